@@ -0,0 +1,171 @@
+#pragma once
+
+// ベンチマーク用のハードウェアパフォーマンスカウンタ
+//
+// Linuxのperf_event_openでサイクル数、命令数、L1/LLCミス、dTLBミス、ページフォルトを計測します。
+// カウンタはinheritを指定して開くため、start()の後に作成したスレッドの値も合算されます
+// （値はスレッドの終了時に加算されるため、stop()の前にスレッドをjoinしてください）。
+// 権限がないなど開けなかったカウンタは使用不可として扱い、計測はそれ以外のカウンタで続けます。
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bench {
+
+class PerfCounters {
+private:
+    // コピー禁止
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+public:
+    enum Counter {
+        CYCLES,
+        INSTRUCTIONS,
+        L1D_MISSES,
+        LLC_MISSES,
+        DTLB_MISSES,
+        PAGE_FAULTS,
+        COUNT,
+    };
+
+    /// カウンタの表示名
+    static constexpr const char* NAMES[COUNT] = {
+        "cycles", "instr", "L1d-miss", "LLC-miss", "dTLB-miss", "faults",
+    };
+
+private:
+    int m_fds[COUNT];
+    double m_values[COUNT] = {};
+
+public:
+    PerfCounters() {
+        for (int i = 0; i < COUNT; ++i) {
+            m_fds[i] = open(static_cast<Counter>(i));
+        }
+    }
+
+    ~PerfCounters() {
+#if defined(__linux__)
+        for (int fd : m_fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+#endif
+    }
+
+    // いずれかのカウンタが使えるかを返します
+    bool any_available() const {
+        for (int i = 0; i < COUNT; ++i) {
+            if (available(static_cast<Counter>(i))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // カウンタが使えるかを返します
+    bool available(Counter counter) const {
+        return m_fds[counter] >= 0;
+    }
+
+    // カウンタをリセットして計測を開始します
+    void start() {
+#if defined(__linux__)
+        for (int fd : m_fds) {
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    // 計測を止めて値を読み取ります。
+    // 多重化でカウンタが一部の時間しか動いていなかった場合は、動作時間の比率で補正します
+    void stop() {
+#if defined(__linux__)
+        for (int i = 0; i < COUNT; ++i) {
+            m_values[i] = 0;
+            if (m_fds[i] < 0) {
+                continue;
+            }
+            ioctl(m_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            std::uint64_t data[3] = {}; // value, time_enabled, time_running
+            if (read(m_fds[i], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data))) {
+                continue;
+            }
+            m_values[i] = data[2] ? static_cast<double>(data[0]) * static_cast<double>(data[1]) /
+                                        static_cast<double>(data[2])
+                                  : 0.0;
+        }
+#endif
+    }
+
+    // 直前のstop()で読み取った値を返します
+    double value(Counter counter) const {
+        return m_values[counter];
+    }
+
+private:
+    static int open(Counter counter) {
+#if defined(__linux__)
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        constexpr auto cache_miss = [](std::uint64_t cache) {
+            return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        };
+        switch (counter) {
+        case CYCLES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case INSTRUCTIONS:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case L1D_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = cache_miss(PERF_COUNT_HW_CACHE_L1D);
+            break;
+        case LLC_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = cache_miss(PERF_COUNT_HW_CACHE_LL);
+            break;
+        case DTLB_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = cache_miss(PERF_COUNT_HW_CACHE_DTLB);
+            break;
+        case PAGE_FAULTS:
+            attr.type = PERF_TYPE_SOFTWARE;
+            attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+            break;
+        default:
+            return -1;
+        }
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+        (void)counter;
+        return -1;
+#endif
+    }
+};
+
+} // namespace bench
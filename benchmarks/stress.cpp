@@ -0,0 +1,485 @@
+// アロケータのストレスベンチマーク
+//
+// マルチスレッドでの典型的な病的パターンを再現する古典的なワークロード
+// （larson, threadtest, cache-thrash, cache-scratch, xmalloc-test）と、
+// サイズの混在したチャーンを任意のIAllocatorに対して実行し、
+// スループットとピークRSSをスレッド数ごとに出力します。
+// ハードウェアカウンタが使える場合は、割り当て1回あたりのカウンタ値も列として出力します
+// （使えないカウンタは"-"になります）。
+//
+// 使い方: w6_mem_stress [--allocator NAME|all] [--workload NAME|all] [--threads 1,2,4] [--scale N]
+
+#include "perf_counters.h"
+
+#include <w6_mem/allocator.h>
+#include <w6_mem/budget_allocator.h>
+#include <w6_mem/cpu_cache_allocator.h>
+#include <w6_mem/size_class_allocator.h>
+#include <w6_mem/unique_ptr.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef PSAPI_VERSION
+#define PSAPI_VERSION 2
+#endif
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+namespace {
+
+constexpr std::size_t ALIGNMENT = alignof(std::max_align_t);
+
+// ---------------------------------------------------------------------------
+// 計測の補助
+
+// スレッドごとの決定的な乱数
+class Random {
+private:
+    std::uint64_t m_state;
+
+public:
+    explicit Random(std::uint64_t seed) : m_state(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+
+    std::uint64_t next() {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+        return m_state;
+    }
+
+    // [min, max]の一様な値
+    std::size_t range(std::size_t min, std::size_t max) {
+        return min + static_cast<std::size_t>(next() % (max - min + 1));
+    }
+};
+
+// ピークRSSの計測をリセットします（Linuxのみ）
+void reset_peak_rss() {
+#if defined(__linux__)
+    if (std::FILE* file = std::fopen("/proc/self/clear_refs", "w")) {
+        std::fputs("5", file);
+        std::fclose(file);
+    }
+#endif
+}
+
+// ピークRSSをバイト数で返します。取得できない場合は0
+std::size_t peak_rss() {
+#if defined(__linux__)
+    std::size_t kib = 0;
+    if (std::FILE* file = std::fopen("/proc/self/status", "r")) {
+        char line[256];
+        while (std::fgets(line, sizeof(line), file)) {
+            if (std::strncmp(line, "VmHWM:", 6) == 0) {
+                kib = std::strtoull(line + 6, nullptr, 10);
+                break;
+            }
+        }
+        std::fclose(file);
+    }
+    return kib * 1024;
+#elif defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    return 0;
+#endif
+}
+
+// 割り当てたメモリに触れて、物理ページを確実に割り当てさせます
+void* touch(void* ptr, std::size_t size) {
+    if (ptr) {
+        auto* bytes = static_cast<unsigned char*>(ptr);
+        bytes[0] = 1;
+        bytes[size - 1] = 1;
+    }
+    return ptr;
+}
+
+template <typename F>
+void run_threads(int threads, F&& body) {
+    std::vector<std::thread> workers;
+    workers.reserve(static_cast<std::size_t>(threads));
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&body, t] { body(t); });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// ワークロード。戻り値は割り当て回数です
+
+// larson: スレッドごとのスロット配列をランダムに解放・再割り当てし、
+// ラウンドごとに配列を別のスレッドへ引き継ぐことで、スレッドをまたいだ解放を発生させます
+std::uint64_t run_larson(w6_mem::IAllocator& allocator, int threads, int scale) {
+    constexpr std::size_t SLOTS = 1000;
+    constexpr int ROUNDS = 8;
+    const std::size_t ops = 100000 * static_cast<std::size_t>(scale);
+
+    std::vector<std::vector<void*>> slots(static_cast<std::size_t>(threads),
+                                          std::vector<void*>(SLOTS, nullptr));
+    for (int round = 0; round < ROUNDS; ++round) {
+        run_threads(threads, [&](int t) {
+            auto& mine = slots[static_cast<std::size_t>((t + round) % threads)];
+            Random random(static_cast<std::uint64_t>(t * ROUNDS + round));
+            for (std::size_t i = 0; i < ops; ++i) {
+                void*& slot = mine[random.range(0, SLOTS - 1)];
+                if (slot) {
+                    allocator.deallocate(slot);
+                }
+                const std::size_t size = random.range(16, 512);
+                slot = touch(allocator.allocate(size, ALIGNMENT), size);
+            }
+        });
+    }
+    for (auto& mine : slots) {
+        for (void* ptr : mine) {
+            if (ptr) {
+                allocator.deallocate(ptr);
+            }
+        }
+    }
+    return static_cast<std::uint64_t>(ROUNDS) * ops * static_cast<std::uint64_t>(threads);
+}
+
+// threadtest: 各スレッドが同じサイズのオブジェクトをまとめて割り当て、まとめて解放します
+std::uint64_t run_threadtest(w6_mem::IAllocator& allocator, int threads, int scale) {
+    constexpr std::size_t OBJECTS = 10000;
+    constexpr std::size_t SIZE = 64;
+    const int iterations = 100 * scale;
+
+    run_threads(threads, [&](int) {
+        std::vector<void*> objects(OBJECTS);
+        for (int i = 0; i < iterations; ++i) {
+            for (auto& object : objects) {
+                object = touch(allocator.allocate(SIZE, ALIGNMENT), SIZE);
+            }
+            for (void* object : objects) {
+                allocator.deallocate(object);
+            }
+        }
+    });
+    return static_cast<std::uint64_t>(iterations) * OBJECTS * static_cast<std::uint64_t>(threads);
+}
+
+// 小さなオブジェクトに繰り返し書き込みます。
+// 別のスレッドのオブジェクトと同じキャッシュラインに置かれると偽共有が起きます
+void scribble(void* ptr, int repetitions) {
+    auto* bytes = static_cast<volatile unsigned char*>(ptr);
+    for (int r = 0; r < repetitions; ++r) {
+        for (int b = 0; b < 8; ++b) {
+            bytes[b] = static_cast<unsigned char>(bytes[b] + 1);
+        }
+    }
+}
+
+// cache-thrash: 各スレッドが小さなオブジェクトの割り当て・書き込み・解放を繰り返します。
+// アロケータが異なるスレッドに同じキャッシュラインを渡すと能動的な偽共有になります
+std::uint64_t run_cache_thrash(w6_mem::IAllocator& allocator, int threads, int scale) {
+    constexpr int REPETITIONS = 100;
+    const int iterations = 200000 * scale;
+
+    run_threads(threads, [&](int) {
+        for (int i = 0; i < iterations; ++i) {
+            void* object = allocator.allocate(8, 8);
+            scribble(object, REPETITIONS);
+            allocator.deallocate(object);
+        }
+    });
+    return static_cast<std::uint64_t>(iterations) * static_cast<std::uint64_t>(threads);
+}
+
+// cache-scratch: メインスレッドが連続して割り当てたオブジェクトを各スレッドが解放してから
+// cache-thrashと同じ処理を行います。解放されたメモリを再利用すると受動的な偽共有になります
+std::uint64_t run_cache_scratch(w6_mem::IAllocator& allocator, int threads, int scale) {
+    constexpr int REPETITIONS = 100;
+    const int iterations = 200000 * scale;
+
+    std::vector<void*> initial(static_cast<std::size_t>(threads));
+    for (auto& object : initial) {
+        object = touch(allocator.allocate(8, 8), 8);
+    }
+    run_threads(threads, [&](int t) {
+        allocator.deallocate(initial[static_cast<std::size_t>(t)]);
+        for (int i = 0; i < iterations; ++i) {
+            void* object = allocator.allocate(8, 8);
+            scribble(object, REPETITIONS);
+            allocator.deallocate(object);
+        }
+    });
+    return static_cast<std::uint64_t>(iterations) * static_cast<std::uint64_t>(threads);
+}
+
+// xmalloc-test: 各スレッドが割り当てたバッチを共有キューに積み、
+// キューから取り出したバッチ（多くは別のスレッドのもの）を解放します
+std::uint64_t run_xmalloc(w6_mem::IAllocator& allocator, int threads, int scale) {
+    constexpr std::size_t BATCH_SIZE = 256;
+    const int batches = 2000 * scale;
+
+    std::mutex mutex;
+    std::vector<std::vector<void*>> queue;
+    run_threads(threads, [&](int t) {
+        Random random(static_cast<std::uint64_t>(t));
+        std::vector<void*> batch;
+        for (int b = 0; b < batches; ++b) {
+            batch.clear();
+            for (std::size_t i = 0; i < BATCH_SIZE; ++i) {
+                const std::size_t size = random.range(16, 256);
+                batch.push_back(touch(allocator.allocate(size, ALIGNMENT), size));
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push_back(std::move(batch));
+                batch = std::move(queue.front());
+                queue.erase(queue.begin());
+            }
+            for (void* ptr : batch) {
+                allocator.deallocate(ptr);
+            }
+        }
+    });
+    for (auto& batch : queue) {
+        for (void* ptr : batch) {
+            allocator.deallocate(ptr);
+        }
+    }
+    return static_cast<std::uint64_t>(batches) * BATCH_SIZE * static_cast<std::uint64_t>(threads);
+}
+
+// mixed: 小さなサイズを中心に大きなサイズが混ざった作業集合をランダムに入れ替えます
+std::uint64_t run_mixed(w6_mem::IAllocator& allocator, int threads, int scale) {
+    constexpr std::size_t LIVE = 4096;
+    const std::size_t ops = 1000000 * static_cast<std::size_t>(scale);
+
+    run_threads(threads, [&](int t) {
+        Random random(static_cast<std::uint64_t>(t) + 100);
+        std::vector<void*> live;
+        live.reserve(LIVE);
+        std::uint64_t allocations = 0;
+        while (allocations < ops) {
+            if (live.empty() || (live.size() < LIVE && (random.next() & 1))) {
+                const std::uint64_t pick = random.next() % 100;
+                const std::size_t size = pick < 90   ? random.range(16, 256)
+                                         : pick < 99 ? random.range(257, 4096)
+                                                     : random.range(4097, 65536);
+                live.push_back(touch(allocator.allocate(size, ALIGNMENT), size));
+                ++allocations;
+            } else {
+                const std::size_t index = random.range(0, live.size() - 1);
+                allocator.deallocate(live[index]);
+                live[index] = live.back();
+                live.pop_back();
+            }
+        }
+        for (void* ptr : live) {
+            allocator.deallocate(ptr);
+        }
+    });
+    return static_cast<std::uint64_t>(ops) * static_cast<std::uint64_t>(threads);
+}
+
+struct Workload {
+    const char* name;
+    std::uint64_t (*run)(w6_mem::IAllocator& allocator, int threads, int scale);
+};
+
+constexpr Workload WORKLOADS[] = {
+    {"larson", &run_larson},
+    {"threadtest", &run_threadtest},
+    {"cache-thrash", &run_cache_thrash},
+    {"cache-scratch", &run_cache_scratch},
+    {"xmalloc", &run_xmalloc},
+    {"mixed", &run_mixed},
+};
+
+// ---------------------------------------------------------------------------
+// 対象のアロケータ。スレッドセーフなものだけを並べます
+
+w6_mem::DefaultAllocator g_default_allocator;
+
+struct AllocatorEntry {
+    const char* name;
+    w6_mem::UniquePtr<w6_mem::IAllocator> (*create)();
+};
+
+constexpr AllocatorEntry ALLOCATORS[] = {
+    {"default",
+     [] { return w6_mem::UniquePtr<w6_mem::IAllocator>(); }},
+    {"cpu_cache",
+     [] {
+         return w6_mem::UniquePtr<w6_mem::IAllocator>(
+             w6_mem::make_unique<w6_mem::CpuCacheAllocator>(&g_default_allocator,
+                                                            &g_default_allocator));
+     }},
+    {"size_class",
+     [] {
+         return w6_mem::UniquePtr<w6_mem::IAllocator>(
+             w6_mem::make_unique<w6_mem::SizeClassAllocator>(&g_default_allocator,
+                                                             &g_default_allocator));
+     }},
+    {"size_class_adaptive",
+     [] {
+         auto allocator = w6_mem::make_unique<w6_mem::SizeClassAllocator>(&g_default_allocator,
+                                                                          &g_default_allocator);
+         if (allocator) {
+             allocator->set_adaptive(true);
+         }
+         return w6_mem::UniquePtr<w6_mem::IAllocator>(std::move(allocator));
+     }},
+    {"budget",
+     [] {
+         return w6_mem::UniquePtr<w6_mem::IAllocator>(w6_mem::make_unique<w6_mem::BudgetAllocator>(
+             &g_default_allocator, &g_default_allocator, ~std::size_t{0}));
+     }},
+};
+
+// ---------------------------------------------------------------------------
+
+void print_header(const bench::PerfCounters& counters) {
+    std::printf("%-14s %-20s %7s %12s %10s %10s", "workload", "allocator", "threads", "seconds",
+                "Mallocs/s", "peakMiB");
+    if (counters.any_available()) {
+        for (const char* name : bench::PerfCounters::NAMES) {
+            std::printf(" %10s", name);
+        }
+    }
+    std::printf("\n");
+}
+
+void run(const AllocatorEntry& entry, const Workload& workload, int threads, int scale,
+         bench::PerfCounters& counters) {
+    auto owned = entry.create();
+    w6_mem::IAllocator& allocator = owned ? *owned : g_default_allocator;
+
+    reset_peak_rss();
+    counters.start();
+    const auto start = std::chrono::steady_clock::now();
+    const std::uint64_t allocations = workload.run(allocator, threads, scale);
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+    counters.stop();
+    const std::size_t rss = peak_rss();
+
+    std::printf("%-14s %-20s %7d %12.3f %10.3f %10.1f", workload.name, entry.name, threads,
+                elapsed.count(), static_cast<double>(allocations) / elapsed.count() / 1e6,
+                static_cast<double>(rss) / (1024.0 * 1024.0));
+    if (counters.any_available()) {
+        // 割り当て1回あたりの値
+        for (int i = 0; i < bench::PerfCounters::COUNT; ++i) {
+            const auto counter = static_cast<bench::PerfCounters::Counter>(i);
+            if (counters.available(counter)) {
+                std::printf(" %10.3f", counters.value(counter) / static_cast<double>(allocations));
+            } else {
+                std::printf(" %10s", "-");
+            }
+        }
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+}
+
+std::vector<int> parse_threads(const char* text) {
+    std::vector<int> threads;
+    while (*text) {
+        char* end = nullptr;
+        const long count = std::strtol(text, &end, 10);
+        if (end == text || count <= 0) {
+            return {};
+        }
+        threads.push_back(static_cast<int>(count));
+        text = *end == ',' ? end + 1 : end;
+    }
+    return threads;
+}
+
+int usage(const char* program) {
+    std::fprintf(stderr,
+                 "usage: %s [--allocator NAME|all] [--workload NAME|all] [--threads 1,2,4] "
+                 "[--scale N]\n",
+                 program);
+    std::fprintf(stderr, "allocators:");
+    for (const auto& entry : ALLOCATORS) {
+        std::fprintf(stderr, " %s", entry.name);
+    }
+    std::fprintf(stderr, "\nworkloads:");
+    for (const auto& workload : WORKLOADS) {
+        std::fprintf(stderr, " %s", workload.name);
+    }
+    std::fprintf(stderr, "\n");
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const char* allocator_name = "all";
+    const char* workload_name = "all";
+    std::vector<int> thread_counts;
+    int scale = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--allocator") == 0 && has_value) {
+            allocator_name = argv[++i];
+        } else if (std::strcmp(argv[i], "--workload") == 0 && has_value) {
+            workload_name = argv[++i];
+        } else if (std::strcmp(argv[i], "--threads") == 0 && has_value) {
+            thread_counts = parse_threads(argv[++i]);
+            if (thread_counts.empty()) {
+                return usage(argv[0]);
+            }
+        } else if (std::strcmp(argv[i], "--scale") == 0 && has_value) {
+            scale = std::atoi(argv[++i]);
+            if (scale <= 0) {
+                return usage(argv[0]);
+            }
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (thread_counts.empty()) {
+        const int hardware = static_cast<int>(std::thread::hardware_concurrency());
+        for (int threads = 1; threads <= (hardware > 1 ? hardware : 1); threads *= 2) {
+            thread_counts.push_back(threads);
+        }
+    }
+
+    const bool all_allocators = std::strcmp(allocator_name, "all") == 0;
+    const bool all_workloads = std::strcmp(workload_name, "all") == 0;
+    bool matched = false;
+
+    bench::PerfCounters counters;
+    print_header(counters);
+    for (const auto& workload : WORKLOADS) {
+        if (!all_workloads && std::strcmp(workload_name, workload.name) != 0) {
+            continue;
+        }
+        for (const auto& entry : ALLOCATORS) {
+            if (!all_allocators && std::strcmp(allocator_name, entry.name) != 0) {
+                continue;
+            }
+            matched = true;
+            for (int threads : thread_counts) {
+                run(entry, workload, threads, scale, counters);
+            }
+        }
+    }
+    return matched ? 0 : usage(argv[0]);
+}
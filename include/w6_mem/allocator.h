@@ -1,10 +1,22 @@
 #pragma once
 
+#include "no_alloc.h"
+#include "probes.h"
 #include <cstddef>
 #include <cstdlib>
 
 namespace w6_mem {
 
+/**
+ * @brief メモリ割り当ての呼び出し元を表す情報
+ *
+ * fileは文字列リテラルを指し、プログラムの終了まで有効です。
+ */
+struct AllocationSite {
+    const char* file = nullptr;
+    int line = 0;
+};
+
 /**
  * @brief メモリアロケーション用のインターフェース
  *
@@ -23,9 +35,27 @@ public:
      * @param size 割り当てるメモリのバイト数
      * @param alignment 必要なアライメント値
      * @return void* 割り当てられたメモリへのポインタ
+     * @note 実装は入口にdetail::NoAllocCheckを置き、NoAllocScopeの中での割り当てを検出します。
      */
     virtual void* allocate(std::size_t size, std::size_t alignment) = 0;
 
+    /**
+     * @brief 呼び出し元の情報を伴ってメモリを割り当てます。
+     *
+     * 既定の実装は呼び出し元を無視してallocate()に委譲します。
+     * 呼び出し元ごとの集計などを行うアロケータはこの関数をオーバーライドします。
+     *
+     * @param size 割り当てるメモリのバイト数
+     * @param alignment 必要なアライメント値
+     * @param site 割り当てを要求した呼び出し元
+     * @return void* 割り当てられたメモリへのポインタ
+     */
+    virtual void* allocate_tagged(std::size_t size, std::size_t alignment,
+                                  const AllocationSite& site) {
+        (void)site;
+        return allocate(size, alignment);
+    }
+
     /**
      * @brief 指定されたメモリを解放します。
      *
@@ -46,17 +76,27 @@ public:
      * @copydoc IAllocator::allocate
      */
     void* allocate(std::size_t size, std::size_t alignment) override {
+        detail::NoAllocCheck no_alloc_check(size, alignment);
+        // 切り上げで桁あふれするサイズと、0のアライメントは割り当てられません
+        if (alignment == 0 || size > ~std::size_t{0} - (alignment - 1)) {
+            W6_MEM_PROBE(allocate, size, alignment, nullptr, this);
+            return nullptr;
+        }
 #if defined(_MSC_VER)
-        return _aligned_malloc(size, alignment);
+        void* ptr = _aligned_malloc(size, alignment);
 #else
-        return std::aligned_alloc(alignment, size);
+        // aligned_allocはサイズがアライメントの倍数であることを要求します
+        void* ptr = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
 #endif
+        W6_MEM_PROBE(allocate, size, alignment, ptr, this);
+        return ptr;
     }
 
     /**
      * @copydoc IAllocator::deallocate
      */
     void deallocate(void* ptr) override {
+        W6_MEM_PROBE(deallocate, 0, 0, ptr, this);
 #if defined(_MSC_VER)
         _aligned_free(ptr);
 #else
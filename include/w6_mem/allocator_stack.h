@@ -0,0 +1,520 @@
+#pragma once
+
+#include "allocator.h"
+#include "budget_allocator.h"
+#include "cpu_cache_allocator.h"
+#include "latency_histogram_allocator.h"
+#include "pinned_allocator.h"
+#include "site_stats_allocator.h"
+#include "size_class_allocator.h"
+#include "unique_ptr.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string_view>
+
+namespace w6_mem {
+
+/**
+ * @brief 構成文字列の解析エラー
+ */
+struct AllocatorSpecError {
+    std::size_t position = 0;     ///< エラーを検出した文字の位置
+    const char* message = nullptr; ///< エラーの内容
+};
+
+/**
+ * @brief 構成文字列から組み立てたアロケータの積み重ね
+ *
+ * 構成文字列は段を'>'で区切って外側から順に並べます。例えば
+ * "percpu(64)>sizeclass(64m)>default"は、CPUキャッシュの内側にサイズクラスアロケータを置き、
+ * 最も内側でDefaultAllocatorを使います。最後の段が土台のアロケータでない場合は、
+ * defaultが補われます。数値には2進接頭辞のk/m/gを付けられます。
+ *
+ * 土台のアロケータ（最後の段にのみ置けます）:
+ * - default : DefaultAllocator
+ * - pinned([region_size[, max_locked_bytes]]) : PinnedAllocator
+ *
+ * 装飾するアロケータ:
+ * - percpu([max_cached_blocks]) : CpuCacheAllocator（別名 cpucache, tcache）
+ * - sizeclass([max_bytes[, mesh][, adaptive]]) : SizeClassAllocator（adaptiveで適応モード）
+ * - budget(bytes) : BudgetAllocator
+ * - latency([slow_threshold_ns]) : LatencyHistogramAllocator
+ * - sites : SiteStatsAllocator
+ *
+ * 各段のアロケータは構築時に渡したアロケータから割り当てられ、外側の段から順に破棄されます。
+ */
+class AllocatorStack : public IAllocator {
+private:
+    // コピー禁止
+    AllocatorStack(const AllocatorStack&) = delete;
+    AllocatorStack& operator=(const AllocatorStack&) = delete;
+
+public:
+    /// 積み重ねられる段の最大数
+    static constexpr std::size_t MAX_LAYERS = 8;
+
+private:
+    static constexpr std::size_t MAX_ARGS = 3;
+
+    enum class Kind {
+        DEFAULT,
+        PINNED,
+        PERCPU,
+        SIZECLASS,
+        BUDGET,
+        LATENCY,
+        SITES,
+    };
+
+    struct KindInfo {
+        const char* name;
+        Kind kind;
+        bool base;               ///< 土台のアロケータかどうか
+        std::size_t min_args;
+        std::size_t max_args;
+    };
+
+    static constexpr KindInfo KINDS[] = {
+        {"default", Kind::DEFAULT, true, 0, 0},      {"pinned", Kind::PINNED, true, 0, 2},
+        {"percpu", Kind::PERCPU, false, 0, 1},       {"cpucache", Kind::PERCPU, false, 0, 1},
+        {"tcache", Kind::PERCPU, false, 0, 1},       {"sizeclass", Kind::SIZECLASS, false, 0, 3},
+        {"budget", Kind::BUDGET, false, 1, 1},       {"latency", Kind::LATENCY, false, 0, 1},
+        {"sites", Kind::SITES, false, 0, 0},
+    };
+
+    struct Arg {
+        std::string_view text;
+        std::size_t value = 0;
+        bool is_number = false;
+    };
+
+    struct Stage {
+        const KindInfo* info = nullptr;
+        std::size_t position = 0; ///< 構成文字列での段の位置
+        Arg args[MAX_ARGS];
+        std::size_t arg_count = 0;
+    };
+
+private:
+    IAllocator* m_allocator = nullptr;
+    DefaultAllocator m_default;
+    UniquePtr<IAllocator> m_owned[MAX_LAYERS]; // 内側から順。破棄は外側の段からになります
+    IAllocator* m_layers[MAX_LAYERS] = {};    // 内側から順
+    const char* m_names[MAX_LAYERS] = {};
+    std::size_t m_layer_count = 0;
+    IAllocator* m_top = &m_default;
+
+public:
+    /**
+     * @brief 構築します。段は空で、DefaultAllocatorに委譲します。
+     * @param allocator 各段のアロケータを割り当てるアロケータ
+     */
+    explicit AllocatorStack(IAllocator* allocator) : m_allocator(allocator) {
+        assert(allocator);
+    }
+
+    /**
+     * @brief 構成文字列から段を組み立てます。
+     *
+     * 割り当てを行う前に一度だけ呼び出します。失敗した場合、段は空のままです。
+     *
+     * @param spec 構成文字列
+     * @param error エラーの格納先。nullptrなら格納しません
+     * @return true 組み立てに成功した場合
+     * @return false 構成文字列が不正か、アロケータの構築に失敗した場合
+     */
+    bool configure(const char* spec, AllocatorSpecError* error = nullptr) {
+        assert(m_layer_count == 0);
+        Stage stages[MAX_LAYERS];
+        std::size_t stage_count = 0;
+        AllocatorSpecError local_error;
+        if (!parse(spec, stages, stage_count, local_error) ||
+            !build(stages, stage_count, local_error)) {
+            if (error) {
+                *error = local_error;
+            }
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @copydoc IAllocator::allocate
+     */
+    void* allocate(std::size_t size, std::size_t alignment) override {
+        detail::NoAllocCheck no_alloc_check(size, alignment);
+        void* ptr = m_top->allocate(size, alignment);
+        W6_MEM_PROBE(allocate, size, alignment, ptr, this);
+        return ptr;
+    }
+
+    /**
+     * @copydoc IAllocator::allocate_tagged
+     */
+    void* allocate_tagged(std::size_t size, std::size_t alignment,
+                          const AllocationSite& site) override {
+        detail::NoAllocCheck no_alloc_check(size, alignment);
+        void* ptr = m_top->allocate_tagged(size, alignment, site);
+        W6_MEM_PROBE(allocate, size, alignment, ptr, this);
+        return ptr;
+    }
+
+    /**
+     * @copydoc IAllocator::deallocate
+     */
+    void deallocate(void* ptr) override {
+        W6_MEM_PROBE(deallocate, 0, 0, ptr, this);
+        m_top->deallocate(ptr);
+    }
+
+    /**
+     * @brief 段の数を返します。
+     * @return std::size_t 段の数
+     */
+    std::size_t layer_count() const {
+        return m_layer_count;
+    }
+
+    /**
+     * @brief 段のアロケータを返します。
+     *
+     * 型はlayer_name()で判別できます（例えば"latency"ならLatencyHistogramAllocator）。
+     *
+     * @param index 段の番号。0が最も外側です
+     * @return IAllocator* 段のアロケータ
+     */
+    IAllocator* layer(std::size_t index) const {
+        assert(index < m_layer_count);
+        return m_layers[m_layer_count - 1 - index];
+    }
+
+    /**
+     * @brief 段の名前を返します。別名で指定した段は正式な名前になります。
+     * @param index 段の番号。0が最も外側です
+     * @return const char* 段の名前
+     */
+    const char* layer_name(std::size_t index) const {
+        assert(index < m_layer_count);
+        return m_names[m_layer_count - 1 - index];
+    }
+
+private:
+    static const KindInfo* find_kind(std::string_view name) {
+        for (const KindInfo& info : KINDS) {
+            if (name == info.name) {
+                return &info;
+            }
+        }
+        return nullptr;
+    }
+
+    static const char* canonical_name(Kind kind) {
+        for (const KindInfo& info : KINDS) {
+            if (info.kind == kind) {
+                return info.name;
+            }
+        }
+        return "";
+    }
+
+    static bool is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    static bool is_name_char(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+               c == '_';
+    }
+
+    // 数値（接頭辞k/m/g付き）として解釈できればvalueに格納します
+    static bool parse_number(std::string_view text, std::size_t& value) {
+        if (text.empty() || text[0] < '0' || text[0] > '9') {
+            return false;
+        }
+        std::size_t result = 0;
+        std::size_t i = 0;
+        for (; i < text.size() && text[i] >= '0' && text[i] <= '9'; ++i) {
+            const auto digit = static_cast<std::size_t>(text[i] - '0');
+            if (result > (SIZE_MAX - digit) / 10) {
+                return false;
+            }
+            result = result * 10 + digit;
+        }
+        unsigned shift = 0;
+        if (i < text.size()) {
+            switch (text[i]) {
+            case 'k':
+            case 'K':
+                shift = 10;
+                break;
+            case 'm':
+            case 'M':
+                shift = 20;
+                break;
+            case 'g':
+            case 'G':
+                shift = 30;
+                break;
+            default:
+                return false;
+            }
+            if (++i != text.size() || result > (SIZE_MAX >> shift)) {
+                return false;
+            }
+        }
+        value = result << shift;
+        return true;
+    }
+
+    static bool fail(AllocatorSpecError& error, std::size_t position, const char* message) {
+        error.position = position;
+        error.message = message;
+        return false;
+    }
+
+    static bool parse(const char* spec, Stage* stages, std::size_t& stage_count,
+                      AllocatorSpecError& error) {
+        const std::string_view text = spec ? spec : "";
+        std::size_t pos = 0;
+        auto skip_space = [&] {
+            while (pos < text.size() && is_space(text[pos])) {
+                ++pos;
+            }
+        };
+
+        while (true) {
+            skip_space();
+            const std::size_t name_begin = pos;
+            while (pos < text.size() && is_name_char(text[pos])) {
+                ++pos;
+            }
+            if (pos == name_begin) {
+                return fail(error, pos, "expected an allocator name");
+            }
+            if (stage_count == MAX_LAYERS) {
+                return fail(error, name_begin, "too many layers");
+            }
+            Stage& stage = stages[stage_count++];
+            stage.position = name_begin;
+            stage.info = find_kind(text.substr(name_begin, pos - name_begin));
+            if (!stage.info) {
+                return fail(error, name_begin, "unknown allocator name");
+            }
+
+            skip_space();
+            if (pos < text.size() && text[pos] == '(') {
+                ++pos;
+                while (true) {
+                    skip_space();
+                    const std::size_t arg_begin = pos;
+                    while (pos < text.size() && is_name_char(text[pos])) {
+                        ++pos;
+                    }
+                    if (pos == arg_begin) {
+                        return fail(error, pos, "expected an argument");
+                    }
+                    if (stage.arg_count == stage.info->max_args) {
+                        return fail(error, arg_begin, "too many arguments");
+                    }
+                    Arg& arg = stage.args[stage.arg_count++];
+                    arg.text = text.substr(arg_begin, pos - arg_begin);
+                    arg.is_number = parse_number(arg.text, arg.value);
+                    skip_space();
+                    if (pos < text.size() && text[pos] == ',') {
+                        ++pos;
+                        continue;
+                    }
+                    if (pos < text.size() && text[pos] == ')') {
+                        ++pos;
+                        break;
+                    }
+                    return fail(error, pos, "expected ',' or ')'");
+                }
+            }
+            if (stage.arg_count < stage.info->min_args) {
+                return fail(error, pos, "missing argument");
+            }
+
+            skip_space();
+            if (pos == text.size()) {
+                break;
+            }
+            if (text[pos] != '>') {
+                return fail(error, pos, "expected '>'");
+            }
+            if (stage.info->base) {
+                return fail(error, pos, "a base allocator must be the last layer");
+            }
+            ++pos;
+        }
+        return true;
+    }
+
+    // 引数を数値として取り出します。省略された場合はfallbackを返します
+    static bool number_arg(const Stage& stage, std::size_t index, std::size_t fallback,
+                           std::size_t& value) {
+        if (index >= stage.arg_count) {
+            value = fallback;
+            return true;
+        }
+        value = stage.args[index].value;
+        return stage.args[index].is_number;
+    }
+
+    bool build(const Stage* stages, std::size_t stage_count, AllocatorSpecError& error) {
+        // 最後の段が土台でなければdefaultを補います
+        const bool implicit_base = !stages[stage_count - 1].info->base;
+        if (implicit_base && stage_count == MAX_LAYERS) {
+            return fail(error, stages[stage_count - 1].position, "too many layers");
+        }
+
+        IAllocator* parent = &m_default;
+        if (implicit_base) {
+            push(nullptr, &m_default, Kind::DEFAULT);
+        }
+        for (std::size_t i = stage_count; i-- > 0;) {
+            const Stage& stage = stages[i];
+            UniquePtr<IAllocator> owned;
+            std::size_t a = 0;
+            std::size_t b = 0;
+            bool valid = true;
+            switch (stage.info->kind) {
+            case Kind::DEFAULT:
+                break;
+            case Kind::PINNED:
+                valid = number_arg(stage, 0, PinnedAllocator::DEFAULT_REGION_SIZE, a) &&
+                        number_arg(stage, 1, 0, b);
+                if (valid) {
+                    owned = make_unique<PinnedAllocator>(m_allocator, a, b);
+                }
+                break;
+            case Kind::PERCPU:
+                valid = number_arg(stage, 0, CpuCacheAllocator::DEFAULT_MAX_CACHED_BLOCKS, a);
+                if (valid) {
+                    owned = make_unique<CpuCacheAllocator>(m_allocator, parent, a);
+                }
+                break;
+            case Kind::SIZECLASS: {
+                valid = number_arg(stage, 0, SizeClassAllocator::DEFAULT_MAX_BYTES, a);
+                bool mesh = false;
+                bool adaptive = false;
+                for (std::size_t arg = 1; arg < stage.arg_count; ++arg) {
+                    bool& flag = stage.args[arg].text == "mesh" ? mesh : adaptive;
+                    valid = valid && !flag &&
+                            (stage.args[arg].text == "mesh" || stage.args[arg].text == "adaptive");
+                    flag = true;
+                }
+                if (valid) {
+                    auto size_class = make_unique<SizeClassAllocator>(m_allocator, parent, a, mesh);
+                    if (size_class) {
+                        size_class->set_adaptive(adaptive);
+                    }
+                    owned = std::move(size_class);
+                }
+                break;
+            }
+            case Kind::BUDGET:
+                valid = number_arg(stage, 0, 0, a);
+                if (valid) {
+                    owned = make_unique<BudgetAllocator>(m_allocator, parent, a);
+                }
+                break;
+            case Kind::LATENCY:
+                valid = number_arg(stage, 0, 0, a);
+                if (valid) {
+                    owned = make_unique<LatencyHistogramAllocator>(m_allocator, parent,
+                                                                   std::uint64_t{a});
+                }
+                break;
+            case Kind::SITES:
+                owned = make_unique<SiteStatsAllocator>(m_allocator, parent);
+                break;
+            }
+            if (!valid) {
+                clear();
+                return fail(error, stage.position, "invalid argument");
+            }
+            if (stage.info->kind == Kind::DEFAULT) {
+                push(nullptr, &m_default, Kind::DEFAULT);
+                continue;
+            }
+            if (!owned) {
+                clear();
+                return fail(error, stage.position, "failed to create a layer");
+            }
+            parent = owned.get();
+            push(std::move(owned), parent, stage.info->kind);
+        }
+        m_top = parent;
+        return true;
+    }
+
+    void push(UniquePtr<IAllocator> owned, IAllocator* layer, Kind kind) {
+        m_owned[m_layer_count] = std::move(owned);
+        m_layers[m_layer_count] = layer;
+        m_names[m_layer_count] = canonical_name(kind);
+        ++m_layer_count;
+    }
+
+    void clear() {
+        while (m_layer_count > 0) {
+            --m_layer_count;
+            m_owned[m_layer_count] = nullptr;
+            m_layers[m_layer_count] = nullptr;
+            m_names[m_layer_count] = nullptr;
+        }
+        m_top = &m_default;
+    }
+};
+
+/**
+ * @brief 構成文字列からアロケータを作成します。
+ * @param allocator AllocatorStackと各段のアロケータを割り当てるアロケータ
+ * @param spec 構成文字列（AllocatorStackを参照）
+ * @param error エラーの格納先。nullptrなら格納しません
+ * @return UniquePtr<AllocatorStack> 作成したアロケータ。失敗した場合はnullptr
+ */
+inline UniquePtr<AllocatorStack> make_allocator_stack(IAllocator* allocator, const char* spec,
+                                                      AllocatorSpecError* error = nullptr) {
+    auto stack = make_unique<AllocatorStack>(allocator, allocator);
+    if (!stack) {
+        if (error) {
+            *error = AllocatorSpecError{0, "failed to allocate the stack"};
+        }
+        return nullptr;
+    }
+    if (!stack->configure(spec, error)) {
+        return nullptr;
+    }
+    return stack;
+}
+
+/**
+ * @brief 環境変数の構成文字列からアロケータを作成します。
+ * @param allocator AllocatorStackと各段のアロケータを割り当てるアロケータ
+ * @param variable 環境変数の名前
+ * @param fallback 環境変数が設定されていない場合の構成文字列
+ * @param error エラーの格納先。nullptrなら格納しません
+ * @return UniquePtr<AllocatorStack> 作成したアロケータ。失敗した場合はnullptr
+ */
+inline UniquePtr<AllocatorStack> make_allocator_stack_from_env(
+    IAllocator* allocator, const char* variable = "W6_MEM_CONFIG", const char* fallback = "default",
+    AllocatorSpecError* error = nullptr) {
+#if defined(_MSC_VER)
+    char* value = nullptr;
+    std::size_t length = 0;
+    if (_dupenv_s(&value, &length, variable) != 0) {
+        value = nullptr;
+    }
+    auto stack = make_allocator_stack(allocator, value ? value : fallback, error);
+    std::free(value);
+    return stack;
+#else
+    const char* value = std::getenv(variable);
+    return make_allocator_stack(allocator, value ? value : fallback, error);
+#endif
+}
+
+} // namespace w6_mem
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "allocator.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+namespace w6_mem {
+
+/**
+ * @brief 連続した1つのバッファから順に切り出すアリーナアロケータ
+ *
+ * 割り当てはポインタを進めるだけで、個別の解放は何もしません。
+ * reset()で全体をまとめて解放します。バッファは連続しているため、
+ * アリーナ先頭からのオフセットでオブジェクトを指すことができます（CompressedPtrを参照）。
+ *
+ * @note スレッドセーフではありません。
+ */
+class Arena : public IAllocator {
+private:
+    // コピー禁止
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+public:
+    /// バッファ先頭のアライメント
+    static constexpr std::size_t BUFFER_ALIGNMENT = 64;
+
+private:
+    IAllocator* m_parent = nullptr;
+    unsigned char* m_begin = nullptr;
+    unsigned char* m_cursor = nullptr;
+    unsigned char* m_end = nullptr;
+
+public:
+    /**
+     * @brief 親アロケータからバッファを割り当てて構築します。
+     * @param parent バッファを割り当てるアロケータ
+     * @param capacity バッファのバイト数
+     */
+    Arena(IAllocator* parent, std::size_t capacity) : m_parent(parent) {
+        assert(parent);
+        m_begin = static_cast<unsigned char*>(parent->allocate(capacity, BUFFER_ALIGNMENT));
+        m_cursor = m_begin;
+        m_end = m_begin ? m_begin + capacity : nullptr;
+    }
+
+    /**
+     * @brief 外部のバッファを借りて構築します。
+     *
+     * バッファの所有権は移りません。
+     *
+     * @param buffer 使用するバッファ
+     * @param capacity バッファのバイト数
+     */
+    Arena(void* buffer, std::size_t capacity)
+        : m_begin(static_cast<unsigned char*>(buffer)), m_cursor(m_begin),
+          m_end(m_begin + capacity) {}
+
+    /**
+     * @brief デストラクタ
+     *
+     * 親アロケータから割り当てたバッファを返却します。
+     */
+    ~Arena() override {
+        if (m_parent && m_begin) {
+            m_parent->deallocate(m_begin);
+        }
+    }
+
+    /**
+     * @copydoc IAllocator::allocate
+     *
+     * 残りの容量が足りない場合はnullptrを返します。
+     */
+    void* allocate(std::size_t size, std::size_t alignment) override {
+        detail::NoAllocCheck no_alloc_check(size, alignment);
+        const auto cursor = reinterpret_cast<std::uintptr_t>(m_cursor);
+        const std::uintptr_t aligned = (cursor + alignment - 1) & ~(alignment - 1);
+        const auto end = reinterpret_cast<std::uintptr_t>(m_end);
+        if (aligned > end || size > end - aligned) {
+            return nullptr;
+        }
+        m_cursor = reinterpret_cast<unsigned char*>(aligned + size);
+        void* ptr = reinterpret_cast<void*>(aligned);
+        W6_MEM_PROBE(allocate, size, alignment, ptr, this);
+        return ptr;
+    }
+
+    /**
+     * @copydoc IAllocator::deallocate
+     *
+     * 個別の解放は何もしません。
+     */
+    void deallocate(void* ptr) override {
+        assert(!ptr || owns(ptr));
+        W6_MEM_PROBE(deallocate, 0, 0, ptr, this);
+        (void)ptr;
+    }
+
+    /**
+     * @brief すべての割り当てをまとめて解放します。
+     */
+    void reset() {
+        W6_MEM_PROBE(arena_reset, used(), 0, m_begin, this);
+        m_cursor = m_begin;
+    }
+
+    /**
+     * @brief 指定されたポインタがこのアリーナのバッファを指しているかを判定します。
+     * @param ptr 判定するポインタ
+     * @return true バッファ内の場合
+     * @return false それ以外の場合
+     */
+    bool owns(const void* ptr) const {
+        const auto* p = static_cast<const unsigned char*>(ptr);
+        return m_begin <= p && p < m_end;
+    }
+
+    /**
+     * @brief バッファの先頭を返します。
+     * @return unsigned char* バッファの先頭
+     */
+    unsigned char* base() const {
+        return m_begin;
+    }
+
+    /**
+     * @brief バッファのバイト数を返します。
+     * @return std::size_t 容量
+     */
+    std::size_t capacity() const {
+        return static_cast<std::size_t>(m_end - m_begin);
+    }
+
+    /**
+     * @brief 使用済みのバイト数を返します。
+     * @return std::size_t 使用量
+     */
+    std::size_t used() const {
+        return static_cast<std::size_t>(m_cursor - m_begin);
+    }
+};
+
+} // namespace w6_mem
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "allocator.h"
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+namespace w6_mem {
+
+/**
+ * @brief 使用量の上限（予算）を持つアロケータ
+ *
+ * 親アロケータへの割り当てをバイト単位で計測し、予算を超える割り当てはnullptrで失敗させます。
+ * 各ブロックの直前にヘッダを置いてサイズを記録するため、解放時にも使用量を正確に減算できます。
+ * 計測するのは親アロケータに要求したバイト数（ヘッダとアライメントの余白を含む）です。
+ *
+ * @note allocate()/deallocate()はスレッドセーフです。
+ */
+class BudgetAllocator : public IAllocator {
+private:
+    // コピー禁止
+    BudgetAllocator(const BudgetAllocator&) = delete;
+    BudgetAllocator& operator=(const BudgetAllocator&) = delete;
+
+private:
+    struct Header {
+        std::size_t charged; ///< 使用量として計上したバイト数
+        std::size_t offset;  ///< 親から割り当てたブロック先頭からのオフセット
+    };
+
+private:
+    IAllocator* m_parent = nullptr;
+    std::size_t m_budget = 0;
+    std::atomic<std::size_t> m_used{0};
+    std::atomic<std::size_t> m_peak{0};
+
+public:
+    /**
+     * @brief 親アロケータと予算を指定して構築します。
+     * @param parent 実際の割り当てを行うアロケータ
+     * @param budget 使用量の上限（バイト）
+     */
+    BudgetAllocator(IAllocator* parent, std::size_t budget) : m_parent(parent), m_budget(budget) {
+        assert(parent);
+    }
+
+    /**
+     * @brief デストラクタ
+     *
+     * 未解放のブロックが残っていないことを確認します。
+     */
+    ~BudgetAllocator() override {
+        assert(m_used.load() == 0);
+    }
+
+    /**
+     * @copydoc IAllocator::allocate
+     *
+     * 予算を超える場合はnullptrを返します。
+     */
+    void* allocate(std::size_t size, std::size_t alignment) override {
+        return allocate_tagged(size, alignment, AllocationSite{});
+    }
+
+    /**
+     * @copydoc IAllocator::allocate_tagged
+     */
+    void* allocate_tagged(std::size_t size, std::size_t alignment,
+                          const AllocationSite& site) override {
+        detail::NoAllocCheck no_alloc_check(size, alignment);
+        if (alignment < alignof(Header)) {
+            alignment = alignof(Header);
+        }
+        const std::size_t offset = (sizeof(Header) + alignment - 1) / alignment * alignment;
+        if (size > m_budget || offset > m_budget - size) {
+            return nullptr;
+        }
+        const std::size_t charged = offset + size;
+        if (!reserve(charged)) {
+            return nullptr;
+        }
+
+        void* block = m_parent->allocate_tagged(charged, alignment, site);
+        if (!block) {
+            m_used.fetch_sub(charged);
+            return nullptr;
+        }
+
+        auto* ptr = static_cast<unsigned char*>(block) + offset;
+        auto* header = reinterpret_cast<Header*>(ptr) - 1;
+        header->charged = charged;
+        header->offset = offset;
+        W6_MEM_PROBE(allocate, size, alignment, ptr, this);
+        return ptr;
+    }
+
+    /**
+     * @copydoc IAllocator::deallocate
+     */
+    void deallocate(void* ptr) override {
+        if (!ptr) {
+            return;
+        }
+        W6_MEM_PROBE(deallocate, 0, 0, ptr, this);
+        const Header* header = static_cast<const Header*>(ptr) - 1;
+        const std::size_t charged = header->charged;
+        void* block = static_cast<unsigned char*>(ptr) - header->offset;
+        m_parent->deallocate(block);
+        m_used.fetch_sub(charged);
+    }
+
+    /**
+     * @brief 現在の使用量を返します。
+     * @return std::size_t 使用中のバイト数
+     */
+    std::size_t used() const {
+        return m_used.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief これまでの最大使用量を返します。
+     * @return std::size_t 最大使用バイト数
+     */
+    std::size_t peak() const {
+        return m_peak.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 予算を返します。
+     * @return std::size_t 使用量の上限（バイト）
+     */
+    std::size_t budget() const {
+        return m_budget;
+    }
+
+private:
+    bool reserve(std::size_t charged) {
+        std::size_t used = m_used.load(std::memory_order_relaxed);
+        do {
+            if (charged > m_budget - used) {
+                return false;
+            }
+        } while (!m_used.compare_exchange_weak(used, used + charged));
+
+        std::size_t peak = m_peak.load(std::memory_order_relaxed);
+        while (peak < used + charged &&
+               !m_peak.compare_exchange_weak(peak, used + charged, std::memory_order_relaxed)) {
+        }
+        return true;
+    }
+};
+
+} // namespace w6_mem
@@ -0,0 +1,453 @@
+#pragma once
+
+#include "allocator.h"
+#include "arena.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace w6_mem {
+
+class ChildArena;
+
+/**
+ * @brief ChildArenaに固定サイズのブロックを貸し出す親
+ *
+ * ブロックは上流のアロケータから割り当て、子が返却したものは空きリストに保持して次の貸し出しに使います。
+ * 入れ子になったサブシステムや順に実行されるフェーズが、それぞれ自分のアリーナに最大使用量分を
+ * 予約する代わりに、同じブロックを順に使い回せます。上流にArenaを指定すれば、1つの大きなアリーナを
+ * 子アリーナで分け合えます（返却されたブロックは空きリストで再利用されます）。
+ *
+ * 子が借りているブロックの数とバイト数（ブロックに収まらない大きな割り当てを含む）を合計し、
+ * そのピークも記録します。max_blocksを指定すると、すべての子が借りられるブロックの数の上限になります。
+ *
+ * @note ブロックの貸し出しと返却はスレッドセーフです。
+ *       プールは、すべての子アリーナが破棄されるまで破棄してはいけません。
+ */
+class BlockPool {
+private:
+    // コピー禁止
+    BlockPool(const BlockPool&) = delete;
+    BlockPool& operator=(const BlockPool&) = delete;
+
+    friend class ChildArena;
+
+public:
+    /// ブロックのバイト数の既定値
+    static constexpr std::size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+    /// ブロックの先頭のアライメント
+    static constexpr std::size_t BLOCK_ALIGNMENT = Arena::BUFFER_ALIGNMENT;
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    IAllocator* m_upstream = nullptr;
+    std::size_t m_block_size = DEFAULT_BLOCK_SIZE;
+    std::size_t m_max_blocks = 0;
+    mutable std::mutex m_mutex;
+    FreeBlock* m_free = nullptr;
+    std::size_t m_cached_blocks = 0;
+    std::size_t m_borrowed_blocks = 0;
+    std::size_t m_peak_borrowed_blocks = 0;
+    std::size_t m_borrowed_bytes = 0;
+    std::size_t m_peak_borrowed_bytes = 0;
+
+public:
+    /**
+     * @brief 構築します。
+     * @param upstream ブロックを割り当てるアロケータ
+     * @param block_size 1つのブロックのバイト数
+     * @param max_blocks 同時に貸し出せるブロックの最大数（0なら無制限）
+     */
+    explicit BlockPool(IAllocator* upstream, std::size_t block_size = DEFAULT_BLOCK_SIZE,
+                       std::size_t max_blocks = 0)
+        : m_upstream(upstream), m_block_size(block_size), m_max_blocks(max_blocks) {
+        assert(upstream);
+        assert(block_size >= 2 * BLOCK_ALIGNMENT);
+    }
+
+    /**
+     * @brief デストラクタ
+     *
+     * 空きリストのブロックを上流に返却します。
+     */
+    ~BlockPool() {
+        assert(m_borrowed_blocks == 0 && m_borrowed_bytes == 0);
+        trim();
+    }
+
+    /**
+     * @brief 空きリストのブロックをすべて上流に返却します。
+     * @return std::size_t 返却したブロックの数
+     */
+    std::size_t trim() {
+        FreeBlock* free = nullptr;
+        std::size_t count = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            free = m_free;
+            count = m_cached_blocks;
+            m_free = nullptr;
+            m_cached_blocks = 0;
+        }
+        while (free) {
+            FreeBlock* next = free->next;
+            m_upstream->deallocate(free);
+            free = next;
+        }
+        return count;
+    }
+
+    /**
+     * @brief 1つのブロックのバイト数を返します。
+     * @return std::size_t ブロックのバイト数
+     */
+    std::size_t block_size() const {
+        return m_block_size;
+    }
+
+    /**
+     * @brief ブロックを割り当てる上流のアロケータを返します。
+     * @return IAllocator* 上流のアロケータ
+     */
+    IAllocator* upstream() const {
+        return m_upstream;
+    }
+
+    /**
+     * @brief 子に貸し出し中のブロックの数を返します。
+     * @return std::size_t ブロックの数
+     */
+    std::size_t borrowed_blocks() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_borrowed_blocks;
+    }
+
+    /**
+     * @brief 貸し出し中のブロックの数のピークを返します。
+     * @return std::size_t ブロックの数
+     */
+    std::size_t peak_borrowed_blocks() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_peak_borrowed_blocks;
+    }
+
+    /**
+     * @brief 子に貸し出し中のバイト数（大きな割り当てを含む）を返します。
+     * @return std::size_t バイト数
+     */
+    std::size_t borrowed_bytes() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_borrowed_bytes;
+    }
+
+    /**
+     * @brief 貸し出し中のバイト数のピークを返します。
+     * @return std::size_t バイト数
+     */
+    std::size_t peak_borrowed_bytes() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_peak_borrowed_bytes;
+    }
+
+    /**
+     * @brief 空きリストに保持しているブロックの数を返します。
+     * @return std::size_t ブロックの数
+     */
+    std::size_t cached_blocks() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_cached_blocks;
+    }
+
+private:
+    // ブロックを1つ貸し出します。上限に達しているか上流の割り当てに失敗した場合はnullptrを返します
+    void* borrow_block() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_max_blocks != 0 && m_borrowed_blocks >= m_max_blocks) {
+                return nullptr;
+            }
+            if (m_free) {
+                FreeBlock* block = m_free;
+                m_free = block->next;
+                --m_cached_blocks;
+                charge(1, m_block_size);
+                return block;
+            }
+            // 上流の割り当て中に他の子が上限を超えないよう、先に計上しておきます
+            charge(1, m_block_size);
+        }
+        void* block = m_upstream->allocate(m_block_size, BLOCK_ALIGNMENT);
+        if (!block) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            --m_borrowed_blocks;
+            m_borrowed_bytes -= m_block_size;
+        }
+        return block;
+    }
+
+    void return_block(void* block) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_borrowed_blocks;
+        m_borrowed_bytes -= m_block_size;
+        auto* free = static_cast<FreeBlock*>(block);
+        free->next = m_free;
+        m_free = free;
+        ++m_cached_blocks;
+    }
+
+    // ブロックに収まらない割り当てを上流から直接行います
+    void* borrow_large(std::size_t bytes) {
+        void* block = m_upstream->allocate(bytes, BLOCK_ALIGNMENT);
+        if (block) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            charge(0, bytes);
+        }
+        return block;
+    }
+
+    void return_large(void* block, std::size_t bytes) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_borrowed_bytes -= bytes;
+        }
+        m_upstream->deallocate(block);
+    }
+
+    // m_mutexを保持した状態で呼び出します
+    void charge(std::size_t blocks, std::size_t bytes) {
+        m_borrowed_blocks += blocks;
+        m_borrowed_bytes += bytes;
+        if (m_borrowed_blocks > m_peak_borrowed_blocks) {
+            m_peak_borrowed_blocks = m_borrowed_blocks;
+        }
+        if (m_borrowed_bytes > m_peak_borrowed_bytes) {
+            m_peak_borrowed_bytes = m_borrowed_bytes;
+        }
+    }
+};
+
+/**
+ * @brief BlockPoolから借りたブロックを順に切り出すアリーナ
+ *
+ * 割り当てはArenaと同じくポインタを進めるだけで、現在のブロックが足りなくなると親から次のブロックを
+ * 借ります。ブロックに収まらない大きな割り当ては、親の上流から専用のブロックを割り当てます。
+ * reset()または破棄で、借りたブロックをすべて親に返却します。
+ * max_bytesを指定すると、このアリーナが借りられるバイト数の上限になります。
+ *
+ * @note スレッドセーフではありません。
+ */
+class ChildArena : public IAllocator {
+private:
+    // コピー禁止
+    ChildArena(const ChildArena&) = delete;
+    ChildArena& operator=(const ChildArena&) = delete;
+
+private:
+    // 借りたブロックの先頭に置く管理情報
+    struct BlockHeader {
+        BlockHeader* next;
+        std::size_t large_bytes; ///< 大きな割り当て用のブロックならそのバイト数、通常のブロックなら0
+    };
+
+    BlockPool* m_pool = nullptr;
+    BlockHeader* m_blocks = nullptr;
+    unsigned char* m_block_begin = nullptr;
+    unsigned char* m_cursor = nullptr;
+    unsigned char* m_end = nullptr;
+    std::size_t m_retired_used = 0;
+    std::size_t m_block_count = 0;
+    std::size_t m_borrowed_bytes = 0;
+    std::size_t m_max_bytes = 0;
+
+public:
+    /**
+     * @brief 親を指定して構築します。ブロックは最初の割り当てで借ります。
+     * @param pool ブロックを借りる親
+     * @param max_bytes 借りられるバイト数の上限（0なら無制限）
+     */
+    explicit ChildArena(BlockPool* pool, std::size_t max_bytes = 0)
+        : m_pool(pool), m_max_bytes(max_bytes) {
+        assert(pool);
+    }
+
+    /**
+     * @brief デストラクタ
+     *
+     * 借りたブロックをすべて親に返却します。
+     */
+    ~ChildArena() override {
+        release_blocks();
+    }
+
+    /**
+     * @copydoc IAllocator::allocate
+     *
+     * 親がブロックを貸し出せない場合はnullptrを返します。
+     */
+    void* allocate(std::size_t size, std::size_t alignment) override {
+        detail::NoAllocCheck no_alloc_check(size, alignment);
+        void* ptr = bump(size, alignment);
+        if (!ptr) {
+            ptr = allocate_slow(size, alignment);
+        }
+        if (ptr) {
+            W6_MEM_PROBE(allocate, size, alignment, ptr, this);
+        }
+        return ptr;
+    }
+
+    /**
+     * @copydoc IAllocator::deallocate
+     *
+     * 個別の解放は何もしません。
+     */
+    void deallocate(void* ptr) override {
+        W6_MEM_PROBE(deallocate, 0, 0, ptr, this);
+        (void)ptr;
+    }
+
+    /**
+     * @brief すべての割り当てをまとめて解放し、借りたブロックを親に返却します。
+     */
+    void reset() {
+        W6_MEM_PROBE(arena_reset, used(), 0, m_block_begin, this);
+        release_blocks();
+    }
+
+    /**
+     * @brief 使用済みのバイト数（アライメントの余白を含む）を返します。
+     * @return std::size_t 使用量
+     */
+    std::size_t used() const {
+        return m_retired_used + static_cast<std::size_t>(m_cursor - m_block_begin);
+    }
+
+    /**
+     * @brief 親から借りているブロックの数（大きな割り当て用のブロックを含む）を返します。
+     * @return std::size_t ブロックの数
+     */
+    std::size_t block_count() const {
+        return m_block_count;
+    }
+
+    /**
+     * @brief 親から借りているバイト数（大きな割り当て用のブロックを含む）を返します。
+     * @return std::size_t バイト数
+     */
+    std::size_t borrowed_bytes() const {
+        return m_borrowed_bytes;
+    }
+
+    /**
+     * @brief 借りられるバイト数の上限を変更します。
+     *
+     * すでに借りているブロックは返却しません。
+     *
+     * @param max_bytes 上限（0なら無制限）
+     */
+    void set_max_bytes(std::size_t max_bytes) {
+        m_max_bytes = max_bytes;
+    }
+
+    /**
+     * @brief ブロックを借りている親を返します。
+     * @return BlockPool* 親
+     */
+    BlockPool* pool() const {
+        return m_pool;
+    }
+
+private:
+    static constexpr std::size_t HEADER_SIZE = sizeof(BlockHeader);
+
+    void* bump(std::size_t size, std::size_t alignment) {
+        const auto cursor = reinterpret_cast<std::uintptr_t>(m_cursor);
+        const std::uintptr_t aligned = (cursor + alignment - 1) & ~(alignment - 1);
+        const auto end = reinterpret_cast<std::uintptr_t>(m_end);
+        if (!m_cursor || aligned > end || size > end - aligned) {
+            return nullptr;
+        }
+        m_cursor = reinterpret_cast<unsigned char*>(aligned + size);
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    void* allocate_slow(std::size_t size, std::size_t alignment) {
+        const std::size_t block_size = m_pool->block_size();
+        // データはブロックの先頭からHEADER_SIZE（16の倍数）ずれた位置から始まるため、
+        // アライメントを満たすための余白は最大でalignment - HEADER_SIZEです
+        const std::size_t padding = alignment > HEADER_SIZE ? alignment - HEADER_SIZE : 0;
+        // ブロックより大きなアライメントでは引き算が桁あふれするため、先に比べます
+        if (padding < block_size - HEADER_SIZE && size <= block_size - HEADER_SIZE - padding) {
+            if (!within_limit(block_size)) {
+                return nullptr;
+            }
+            auto* block = static_cast<unsigned char*>(m_pool->borrow_block());
+            if (!block) {
+                return nullptr;
+            }
+            push_block(block, 0);
+            m_retired_used += static_cast<std::size_t>(m_cursor - m_block_begin);
+            m_block_begin = block + HEADER_SIZE;
+            m_cursor = m_block_begin;
+            m_end = block + block_size;
+            return bump(size, alignment);
+        }
+
+        // 大きな割り当ては専用のブロックに置き、現在のブロックは使い続けます
+        const std::size_t overhead = HEADER_SIZE + alignment;
+        if (size > ~std::size_t{0} - overhead) {
+            return nullptr;
+        }
+        const std::size_t bytes = overhead + size;
+        if (!within_limit(bytes)) {
+            return nullptr;
+        }
+        auto* block = static_cast<unsigned char*>(m_pool->borrow_large(bytes));
+        if (!block) {
+            return nullptr;
+        }
+        push_block(block, bytes);
+        const auto begin = reinterpret_cast<std::uintptr_t>(block + HEADER_SIZE);
+        const std::uintptr_t aligned = (begin + alignment - 1) & ~(alignment - 1);
+        m_retired_used += static_cast<std::size_t>(aligned - begin) + size;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    bool within_limit(std::size_t bytes) const {
+        return m_max_bytes == 0 ||
+               (m_borrowed_bytes <= m_max_bytes && bytes <= m_max_bytes - m_borrowed_bytes);
+    }
+
+    void push_block(unsigned char* block, std::size_t large_bytes) {
+        auto* header = reinterpret_cast<BlockHeader*>(block);
+        header->next = m_blocks;
+        header->large_bytes = large_bytes;
+        m_blocks = header;
+        ++m_block_count;
+        m_borrowed_bytes += large_bytes != 0 ? large_bytes : m_pool->block_size();
+    }
+
+    void release_blocks() {
+        while (m_blocks) {
+            BlockHeader* next = m_blocks->next;
+            if (m_blocks->large_bytes != 0) {
+                m_pool->return_large(m_blocks, m_blocks->large_bytes);
+            } else {
+                m_pool->return_block(m_blocks);
+            }
+            m_blocks = next;
+        }
+        m_block_begin = nullptr;
+        m_cursor = nullptr;
+        m_end = nullptr;
+        m_retired_used = 0;
+        m_block_count = 0;
+        m_borrowed_bytes = 0;
+    }
+};
+
+} // namespace w6_mem
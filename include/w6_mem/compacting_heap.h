@@ -0,0 +1,585 @@
+#pragma once
+
+#include "allocator.h"
+#include "unique_ptr.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace w6_mem {
+
+class CompactingHeap;
+
+/**
+ * @brief CompactingHeap上のオブジェクトを指すハンドル
+ *
+ * ハンドル表の添字と世代を保持します。オブジェクトが移動してもハンドルは変わりません。
+ * 破棄されたオブジェクトを指すハンドルは世代が一致しなくなるため、get()はnullptrを返します。
+ *
+ * @tparam T オブジェクトの型
+ */
+template <typename T>
+class Handle {
+    friend class CompactingHeap;
+
+private:
+    std::uint32_t m_index = 0;
+    std::uint32_t m_generation = 0; // 0は無効なハンドル
+
+    Handle(std::uint32_t index, std::uint32_t generation)
+        : m_index(index), m_generation(generation) {}
+
+public:
+    /**
+     * @brief デフォルトコンストラクタ
+     * 無効なハンドルを構築します。
+     */
+    constexpr Handle() = default;
+
+    /**
+     * @brief 有効なハンドルかどうかを評価します。
+     * @return true 割り当てに成功したハンドルの場合
+     * @return false 無効なハンドルの場合
+     */
+    explicit operator bool() const {
+        return m_generation != 0;
+    }
+
+    /**
+     * @brief 等価性の比較
+     */
+    bool operator==(const Handle& other) const {
+        return m_index == other.m_index && m_generation == other.m_generation;
+    }
+
+    /**
+     * @brief 非等価の比較
+     */
+    bool operator!=(const Handle& other) const {
+        return !(*this == other);
+    }
+};
+
+/**
+ * @brief オブジェクトを固定するスコープガード
+ *
+ * ガードが生存している間、対象のオブジェクトはcompact()で移動されません。
+ * ハンドルが無効な場合は空のガードになります。
+ *
+ * @tparam T オブジェクトの型
+ */
+template <typename T>
+class PinGuard {
+    friend class CompactingHeap;
+
+private:
+    // コピー禁止
+    PinGuard(const PinGuard&) = delete;
+    PinGuard& operator=(const PinGuard&) = delete;
+
+private:
+    CompactingHeap* m_heap = nullptr;
+    std::uint32_t m_index = 0;
+    T* m_ptr = nullptr;
+
+    PinGuard(CompactingHeap* heap, std::uint32_t index, T* ptr)
+        : m_heap(heap), m_index(index), m_ptr(ptr) {}
+
+public:
+    /**
+     * @brief デフォルトコンストラクタ
+     * 空のガードを構築します。
+     */
+    PinGuard() = default;
+
+    /**
+     * @brief ムーブコンストラクタ
+     */
+    PinGuard(PinGuard&& other) noexcept
+        : m_heap(other.m_heap), m_index(other.m_index), m_ptr(other.m_ptr) {
+        other.m_heap = nullptr;
+        other.m_ptr = nullptr;
+    }
+
+    /**
+     * @brief ムーブ代入演算子
+     * @param other ムーブするPinGuard
+     * @return PinGuard& 自身への参照
+     */
+    PinGuard& operator=(PinGuard&& other) noexcept {
+        if (this != &other) {
+            release();
+            m_heap = other.m_heap;
+            m_index = other.m_index;
+            m_ptr = other.m_ptr;
+            other.m_heap = nullptr;
+            other.m_ptr = nullptr;
+        }
+        return *this;
+    }
+
+    /**
+     * @brief デストラクタ
+     * 固定を解除します。
+     */
+    ~PinGuard() {
+        release();
+    }
+
+    /**
+     * @brief 固定を解除します。
+     */
+    void release();
+
+    /**
+     * @brief 固定しているオブジェクトへの参照を返します。
+     * @return T& オブジェクト
+     */
+    T& operator*() const {
+        assert(m_ptr);
+        return *m_ptr;
+    }
+
+    /**
+     * @brief 固定しているオブジェクトへのポインタを返します。
+     * @return T* オブジェクトへのポインタ
+     */
+    T* operator->() const {
+        return m_ptr;
+    }
+
+    /**
+     * @brief 固定しているオブジェクトへのポインタを返します。
+     * @return T* オブジェクトへのポインタ
+     */
+    T* get() const {
+        return m_ptr;
+    }
+
+    /**
+     * @brief オブジェクトを固定しているかどうかを評価します。
+     * @return true 固定している場合
+     * @return false 空の場合
+     */
+    explicit operator bool() const {
+        return !!m_ptr;
+    }
+};
+
+/**
+ * @brief ハンドル経由でオブジェクトを参照し、断片化を解消できるヒープ
+ *
+ * オブジェクトは連続した1つのバッファの末尾に順に配置され、生ポインタの代わりに
+ * ハンドル表を経由するHandle<T>を返します。破棄されたオブジェクトの領域は穴として残り、
+ * compact()が生存オブジェクトを先頭側へ詰めてハンドル表を更新することで回収されます。
+ *
+ * compact()は移動するバイト数の予算を受け取り、予算を使い切ると途中で中断します。
+ * 次の呼び出しは中断した位置から再開するため、フレームごとなどの短い時間枠で少しずつ実行できます。
+ * PinGuardで固定されたオブジェクトは移動されず、その手前に穴が残ります。
+ *
+ * トリビアルにコピーできない型は、ムーブ構築と破棄によって再配置されます。
+ * 移動元と移動先が重なる場合は、末尾の空き領域（足りなければ親アロケータから一時的に
+ * 割り当てた領域）を経由して移動します。一時領域を割り当てられない場合はその位置に残します。
+ *
+ * @note スレッドセーフではありません。get()で取得したポインタはcompact()まで有効です。
+ */
+class CompactingHeap {
+private:
+    // コピー禁止
+    CompactingHeap(const CompactingHeap&) = delete;
+    CompactingHeap& operator=(const CompactingHeap&) = delete;
+
+    template <typename T>
+    friend class PinGuard;
+
+public:
+    /// オブジェクトのアライメントとブロックの粒度
+    static constexpr std::size_t BLOCK_ALIGNMENT = 16;
+
+private:
+    static constexpr std::uint32_t NO_HANDLE = std::numeric_limits<std::uint32_t>::max();
+
+    // 型ごとの操作表。relocateがnullptrならmemmoveで再配置できます
+    struct Ops {
+        void (*relocate)(void* dst, void* src);
+        void (*destroy)(void* object);
+    };
+
+    template <typename T>
+    struct OpsFor {
+        static void relocate(void* dst, void* src) {
+            auto* source = static_cast<T*>(src);
+            new (dst) T(std::move(*source));
+            std::destroy_at(source);
+        }
+
+        static void destroy(void* object) {
+            std::destroy_at(static_cast<T*>(object));
+        }
+
+        static constexpr Ops OPS = {std::is_trivially_copyable_v<T> ? nullptr : &relocate,
+                                    std::is_trivially_destructible_v<T> ? nullptr : &destroy};
+    };
+
+    // ブロックの先頭に置かれるヘッダ。opsがnullptrのブロックは穴です
+    struct alignas(BLOCK_ALIGNMENT) BlockHeader {
+        const Ops* ops;
+        std::uint32_t handle;
+        std::uint32_t size; // ヘッダを含むブロックのバイト数
+    };
+
+    struct Entry {
+        BlockHeader* block;      // 使用中の場合はブロック、未使用の場合はnullptr
+        std::uint32_t generation;
+        std::uint32_t pins;      // 固定の数
+        std::uint32_t next_free; // 未使用エントリのリスト
+    };
+
+private:
+    IAllocator* m_parent = nullptr;
+    unsigned char* m_begin = nullptr;
+    unsigned char* m_top = nullptr; // 次のブロックを配置する位置
+    unsigned char* m_end = nullptr;
+
+    UniquePtr<Entry[]> m_entries;
+    std::uint32_t m_entry_count = 0;
+    std::uint32_t m_free_entry = NO_HANDLE;
+
+    // 進行中のコンパクションの状態。[m_begin, m_dest)は詰め終わった領域、
+    // [m_scan, m_top)は未処理の領域です
+    unsigned char* m_dest = nullptr;
+    unsigned char* m_scan = nullptr;
+
+    std::size_t m_live_bytes = 0;
+    std::size_t m_live_count = 0;
+    std::size_t m_moved_bytes = 0;
+
+public:
+    /**
+     * @brief コンストラクタ
+     * @param parent バッファとハンドル表を割り当てるアロケータ
+     * @param capacity バッファのバイト数（4GiB未満）
+     * @param max_handles 同時に存在できるオブジェクトの最大数
+     */
+    CompactingHeap(IAllocator* parent, std::size_t capacity, std::uint32_t max_handles)
+        : m_parent(parent), m_entries(make_unique<Entry[]>(parent, max_handles)) {
+        assert(parent);
+        assert(capacity <= std::numeric_limits<std::uint32_t>::max());
+        capacity &= ~(BLOCK_ALIGNMENT - 1);
+        m_begin = static_cast<unsigned char*>(parent->allocate(capacity, BLOCK_ALIGNMENT));
+        if (!m_begin || !m_entries) {
+            return;
+        }
+        m_top = m_begin;
+        m_end = m_begin + capacity;
+        m_dest = m_begin;
+        m_scan = m_begin;
+        m_entry_count = max_handles;
+        for (std::uint32_t i = max_handles; i-- > 0;) {
+            m_entries[i] = Entry{nullptr, 1, 0, m_free_entry};
+            m_free_entry = i;
+        }
+    }
+
+    /**
+     * @brief デストラクタ
+     *
+     * 生存しているオブジェクトをすべて破棄し、バッファを返却します。
+     */
+    ~CompactingHeap() {
+        for (std::uint32_t i = 0; i < m_entry_count; ++i) {
+            Entry& entry = m_entries[i];
+            if (entry.block) {
+                assert(entry.pins == 0);
+                destroy_block(entry.block);
+            }
+        }
+        if (m_begin) {
+            m_parent->deallocate(m_begin);
+        }
+    }
+
+    /**
+     * @brief オブジェクトを構築します。
+     *
+     * 末尾に空きがない場合は、進行中のコンパクションを最後まで実行してから再試行します。
+     *
+     * @tparam T 構築する型
+     * @tparam Args コンストラクタ引数の型
+     * @param args コンストラクタ引数
+     * @return Handle<T> オブジェクトのハンドル。容量かハンドルが足りない場合は無効なハンドル
+     */
+    template <typename T, typename... Args>
+    Handle<T> make(Args&&... args) {
+        static_assert(alignof(T) <= BLOCK_ALIGNMENT, "alignment of T exceeds BLOCK_ALIGNMENT");
+        if (m_free_entry == NO_HANDLE) {
+            return {};
+        }
+
+        const std::size_t size = block_size(sizeof(T));
+        detail::NoAllocCheck no_alloc_check(size, BLOCK_ALIGNMENT);
+        if (static_cast<std::size_t>(m_end - m_top) < size) {
+            compact();
+            if (static_cast<std::size_t>(m_end - m_top) < size) {
+                return {};
+            }
+        }
+
+        const std::uint32_t index = m_free_entry;
+        Entry& entry = m_entries[index];
+        m_free_entry = entry.next_free;
+
+        auto* header = reinterpret_cast<BlockHeader*>(m_top);
+        header->ops = &OpsFor<T>::OPS;
+        header->handle = index;
+        header->size = static_cast<std::uint32_t>(size);
+        new (payload(header)) T(std::forward<Args>(args)...);
+        m_top += size;
+
+        entry.block = header;
+        entry.pins = 0;
+        m_live_bytes += size;
+        ++m_live_count;
+        return Handle<T>(index, entry.generation);
+    }
+
+    /**
+     * @brief オブジェクトを破棄します。
+     *
+     * 領域は穴として残り、compact()で回収されます。無効なハンドルの場合は何もしません。
+     *
+     * @tparam T オブジェクトの型
+     * @param handle 破棄するオブジェクトのハンドル
+     */
+    template <typename T>
+    void destroy(Handle<T> handle) {
+        Entry* entry = lookup(handle.m_index, handle.m_generation);
+        if (!entry) {
+            return;
+        }
+        assert(entry->pins == 0);
+
+        BlockHeader* header = entry->block;
+        m_live_bytes -= header->size;
+        --m_live_count;
+        destroy_block(header);
+        header->ops = nullptr;
+        header->handle = NO_HANDLE;
+
+        entry->block = nullptr;
+        entry->generation = entry->generation + 1 ? entry->generation + 1 : 1;
+        entry->next_free = m_free_entry;
+        m_free_entry = handle.m_index;
+    }
+
+    /**
+     * @brief オブジェクトへのポインタを取得します。
+     *
+     * ポインタは次のcompact()まで有効です。それより長く保持する場合はpin()を使用してください。
+     *
+     * @tparam T オブジェクトの型
+     * @param handle オブジェクトのハンドル
+     * @return T* オブジェクトへのポインタ。ハンドルが無効な場合はnullptr
+     */
+    template <typename T>
+    T* get(Handle<T> handle) const {
+        Entry* entry = lookup(handle.m_index, handle.m_generation);
+        return entry ? static_cast<T*>(payload(entry->block)) : nullptr;
+    }
+
+    /**
+     * @brief オブジェクトを固定します。
+     *
+     * 返されたガードが生存している間、オブジェクトは移動されません。
+     *
+     * @tparam T オブジェクトの型
+     * @param handle オブジェクトのハンドル
+     * @return PinGuard<T> 固定ガード。ハンドルが無効な場合は空
+     */
+    template <typename T>
+    PinGuard<T> pin(Handle<T> handle) {
+        Entry* entry = lookup(handle.m_index, handle.m_generation);
+        if (!entry) {
+            return {};
+        }
+        ++entry->pins;
+        return PinGuard<T>(this, handle.m_index, static_cast<T*>(payload(entry->block)));
+    }
+
+    /**
+     * @brief 生存オブジェクトを先頭側へ詰めます。
+     *
+     * 移動したバイト数がbudgetに達すると中断し、次の呼び出しで続きから再開します。
+     * 末尾まで処理し終えると、詰め終わった位置が新しい配置位置になります。
+     *
+     * @param budget 1回の呼び出しで移動する最大バイト数
+     * @return true コンパクションが末尾まで完了した場合
+     * @return false 予算を使い切って中断した場合
+     */
+    bool compact(std::size_t budget = std::numeric_limits<std::size_t>::max()) {
+        std::size_t moved = 0;
+        while (m_scan < m_top) {
+            auto* header = reinterpret_cast<BlockHeader*>(m_scan);
+            const std::size_t size = header->size;
+
+            if (!header->ops) {
+                m_scan += size;
+                continue;
+            }
+
+            Entry& entry = m_entries[header->handle];
+            if (m_dest == m_scan || entry.pins) {
+                skip_block(size);
+                continue;
+            }
+
+            if (moved >= budget) {
+                return false;
+            }
+
+            auto* dest = reinterpret_cast<BlockHeader*>(m_dest);
+            if (!header->ops->relocate) {
+                std::memmove(dest, header, size);
+            } else if (m_dest + size <= m_scan) {
+                *dest = *header;
+                header->ops->relocate(payload(dest), payload(header));
+            } else if (!relocate_overlapping(dest, header)) {
+                skip_block(size);
+                continue;
+            }
+            entry.block = dest;
+            m_dest += size;
+            m_scan += size;
+            moved += size;
+            m_moved_bytes += size;
+        }
+
+        m_top = m_dest;
+        m_dest = m_begin;
+        m_scan = m_begin;
+        return true;
+    }
+
+    /**
+     * @brief バッファのバイト数を返します。
+     * @return std::size_t 容量
+     */
+    std::size_t capacity() const {
+        return static_cast<std::size_t>(m_end - m_begin);
+    }
+
+    /**
+     * @brief 先頭から配置位置までのバイト数を返します。穴を含みます。
+     * @return std::size_t 使用量
+     */
+    std::size_t used_bytes() const {
+        return static_cast<std::size_t>(m_top - m_begin);
+    }
+
+    /**
+     * @brief 生存オブジェクトが占めるバイト数を返します。ヘッダを含みます。
+     * @return std::size_t 生存バイト数
+     */
+    std::size_t live_bytes() const {
+        return m_live_bytes;
+    }
+
+    /**
+     * @brief 生存オブジェクトの数を返します。
+     * @return std::size_t オブジェクト数
+     */
+    std::size_t live_count() const {
+        return m_live_count;
+    }
+
+    /**
+     * @brief これまでにcompact()で移動したバイト数の合計を返します。
+     * @return std::size_t 移動したバイト数
+     */
+    std::size_t moved_bytes() const {
+        return m_moved_bytes;
+    }
+
+private:
+    static std::size_t block_size(std::size_t object_size) {
+        return (sizeof(BlockHeader) + object_size + BLOCK_ALIGNMENT - 1) & ~(BLOCK_ALIGNMENT - 1);
+    }
+
+    static void* payload(BlockHeader* header) {
+        return header + 1;
+    }
+
+    static void destroy_block(BlockHeader* header) {
+        if (header->ops->destroy) {
+            header->ops->destroy(payload(header));
+        }
+    }
+
+    Entry* lookup(std::uint32_t index, std::uint32_t generation) const {
+        if (generation == 0 || index >= m_entry_count) {
+            return nullptr;
+        }
+        Entry& entry = m_entries.get()[index];
+        return entry.block && entry.generation == generation ? &entry : nullptr;
+    }
+
+    // 移動できないブロックを飛ばします。手前の穴は、ヘッダを置いて走査できるようにします
+    void skip_block(std::size_t size) {
+        leave_gap();
+        m_scan += size;
+        m_dest = m_scan;
+    }
+
+    // 移動先と重なるブロックを、一時領域を経由して再配置します
+    bool relocate_overlapping(BlockHeader* dest, BlockHeader* src) {
+        const BlockHeader header = *src;
+        const std::size_t object_size = header.size - sizeof(BlockHeader);
+        void* temporary = m_top;
+        const bool borrowed = static_cast<std::size_t>(m_end - m_top) < object_size;
+        if (borrowed) {
+            temporary = m_parent->allocate(object_size, BLOCK_ALIGNMENT);
+            if (!temporary) {
+                return false;
+            }
+        }
+        header.ops->relocate(temporary, payload(src));
+        *dest = header;
+        header.ops->relocate(payload(dest), temporary);
+        if (borrowed) {
+            m_parent->deallocate(temporary);
+        }
+        return true;
+    }
+
+    void leave_gap() {
+        if (m_dest == m_scan) {
+            return;
+        }
+        auto* gap = reinterpret_cast<BlockHeader*>(m_dest);
+        gap->ops = nullptr;
+        gap->handle = NO_HANDLE;
+        gap->size = static_cast<std::uint32_t>(m_scan - m_dest);
+    }
+
+    void unpin(std::uint32_t index) {
+        assert(index < m_entry_count && m_entries[index].pins > 0);
+        --m_entries[index].pins;
+    }
+};
+
+template <typename T>
+inline void PinGuard<T>::release() {
+    if (m_heap) {
+        m_heap->unpin(m_index);
+        m_heap = nullptr;
+        m_ptr = nullptr;
+    }
+}
+
+} // namespace w6_mem
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "arena.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+namespace w6_mem {
+
+/**
+ * @brief CompressedPtrの基準アドレスを保持するアドレス空間
+ *
+ * タグ型ごとに1つの基準アドレスを持ち、bind()したアリーナのオブジェクトを
+ * 32ビットのオフセットで指せるようにします。
+ * 基準アドレスはアリーナの先頭より8バイト手前に置かれるため、オフセット0をnullに使えます。
+ *
+ * @tparam Tag アドレス空間を区別するための型
+ */
+template <typename Tag>
+class ArenaSpace {
+public:
+    /// CompressedPtrで使える最大のシフト量
+    static constexpr unsigned MAX_SHIFT = 3;
+
+private:
+    static inline std::uintptr_t s_base = 0;
+
+public:
+    /**
+     * @brief アリーナをこのアドレス空間に結び付けます。
+     *
+     * 以前に結び付けたアリーナを指すCompressedPtrは無効になります。
+     *
+     * @param arena 結び付けるアリーナ
+     */
+    static void bind(const Arena& arena) {
+        assert(arena.capacity() < (std::uint64_t{0xFFFFFFFFU} << MAX_SHIFT));
+        s_base = reinterpret_cast<std::uintptr_t>(arena.base()) - (std::uintptr_t{1} << MAX_SHIFT);
+    }
+
+    /**
+     * @brief 基準アドレスを返します。
+     * @return std::uintptr_t 基準アドレス
+     */
+    static std::uintptr_t base() {
+        return s_base;
+    }
+};
+
+/**
+ * @brief アリーナ内のオブジェクトを32ビットで指す圧縮ポインタ
+ *
+ * アドレス空間の基準アドレスからのオフセットをShiftビット右シフトして32ビットに格納します。
+ * Shiftが3なら最大32GiBの範囲を指せます。復元はシフトと加算だけで行えます。
+ * 値はトリビアルにコピーできるため、アリーナ上のノードやコンテナの要素として使えます。
+ *
+ * @tparam T 指す型
+ * @tparam Space 基準アドレスを提供する型（ArenaSpaceなど）
+ * @tparam Shift オフセットのシフト量。Tのアライメントは(1 << Shift)以上である必要があります。
+ *               ノード型が自身を指せるように、不完全型でも使える固定の既定値を持ちます
+ */
+template <typename T, typename Space, unsigned Shift = 3>
+class CompressedPtr {
+    static_assert(Shift <= Space::MAX_SHIFT, "Shift exceeds the address space granularity");
+
+private:
+    std::uint32_t m_offset = 0;
+
+public:
+    using element_type = T;
+    using pointer = T*;
+
+    /**
+     * @brief デフォルトコンストラクタ
+     * nullを指します。
+     */
+    constexpr CompressedPtr() = default;
+
+    /**
+     * @brief nullptrからの構築
+     */
+    constexpr CompressedPtr(std::nullptr_t) {}
+
+    /**
+     * @brief ポインタから構築します。
+     * @param ptr アドレス空間に結び付けたアリーナ内のオブジェクトへのポインタ
+     */
+    explicit CompressedPtr(pointer ptr) : m_offset(encode(ptr)) {}
+
+    /**
+     * @brief 指しているオブジェクトへのポインタを復元します。
+     * @return pointer オブジェクトへのポインタ。nullの場合はnullptr
+     */
+    pointer get() const {
+        if (!m_offset) {
+            return nullptr;
+        }
+        return reinterpret_cast<pointer>(Space::base() + (std::uintptr_t{m_offset} << Shift));
+    }
+
+    /**
+     * @brief 指しているオブジェクトへの参照を返します。
+     * @return T& オブジェクト
+     */
+    T& operator*() const {
+        assert(m_offset);
+        return *get();
+    }
+
+    /**
+     * @brief 指しているオブジェクトへのポインタを返します。
+     * @return pointer オブジェクトへのポインタ
+     */
+    pointer operator->() const {
+        return get();
+    }
+
+    /**
+     * @brief nullでないかどうかを評価します。
+     * @return true オブジェクトを指している場合
+     * @return false nullの場合
+     */
+    explicit operator bool() const {
+        return m_offset != 0;
+    }
+
+    /**
+     * @brief 格納している32ビット値を返します。
+     * @return std::uint32_t 圧縮されたオフセット
+     */
+    std::uint32_t raw() const {
+        return m_offset;
+    }
+
+    /**
+     * @brief 32ビット値から構築します。
+     * @param raw raw()で取得した値
+     * @return CompressedPtr 構築された圧縮ポインタ
+     */
+    static CompressedPtr from_raw(std::uint32_t raw) {
+        CompressedPtr ptr;
+        ptr.m_offset = raw;
+        return ptr;
+    }
+
+    /**
+     * @brief 等価性の比較
+     */
+    bool operator==(const CompressedPtr& other) const {
+        return m_offset == other.m_offset;
+    }
+
+    /**
+     * @brief 非等価の比較
+     */
+    bool operator!=(const CompressedPtr& other) const {
+        return m_offset != other.m_offset;
+    }
+
+private:
+    static std::uint32_t encode(pointer ptr) {
+        static_assert(alignof(T) >= (std::size_t{1} << Shift),
+                      "alignment of T is smaller than the offset granularity");
+        if (!ptr) {
+            return 0;
+        }
+        const auto address = reinterpret_cast<std::uintptr_t>(ptr);
+        assert(Space::base() && address > Space::base());
+        const auto offset = static_cast<std::uint64_t>(address - Space::base());
+        assert(offset % (std::uint64_t{1} << Shift) == 0);
+        assert((offset >> Shift) <= 0xFFFFFFFFU);
+        return static_cast<std::uint32_t>(offset >> Shift);
+    }
+};
+
+} // namespace w6_mem
@@ -0,0 +1,471 @@
+#pragma once
+
+#include "allocator.h"
+#include "epoch.h"
+#include "unique_ptr.h"
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <utility>
+
+namespace w6_mem {
+
+/**
+ * @brief 読み取りがロックフリーな並行ハッシュマップ
+ *
+ * バケットは連結リストで、ノードとバケットの配列はコンストラクタで渡したIAllocatorから割り当てます
+ * （SizeClassAllocatorなどのプールを渡すと、ノードの割り当てがスラブから行われます）。
+ * - 読み取りはロックを取らず、EpochDomain::Guardの中でリストを辿ります。
+ * - 書き込みはハッシュで選んだLOCK_COUNT個のストライプロックの1つを取ります。値の更新はノードを
+ *   差し替える（コピーオンライト）ため、読み取り側は常に一貫した値を見ます。
+ * - 外したノードは内蔵のEpochDomainにretire()し、読み取り中のスレッドがいなくなってから解放します。
+ *
+ * 要素数がバケット数を超えると、2倍のバケット数のテーブルを作って段階的に移行します。
+ * 以降の書き込みがそれぞれMIGRATE_CHUNK個のバケットを新しいテーブルにコピーし、移行したバケットには
+ * 移行済みの印を置きます。読み取りは印を見つけたら新しいテーブルを辿るため、移行中もブロックされません。
+ *
+ * @note すべての操作はスレッドセーフです。
+ * @tparam K キーの型（コピー構築できること）
+ * @tparam V 値の型（コピー構築できること）
+ * @tparam Hash キーのハッシュ関数
+ * @tparam KeyEqual キーの比較関数
+ */
+template <typename K, typename V, typename Hash = std::hash<K>,
+          typename KeyEqual = std::equal_to<K>>
+class ConcurrentHashMap {
+private:
+    // コピー禁止
+    ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+    ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+public:
+    /// 書き込み用のストライプロックの数
+    static constexpr std::size_t LOCK_COUNT = 64;
+    /// バケット数の最小値（ストライプロックがテーブルの移行後も同じバケットを守れるように揃えます）
+    static constexpr std::size_t MIN_BUCKETS = LOCK_COUNT;
+    /// 1回の書き込みで移行するバケットの数
+    static constexpr std::size_t MIGRATE_CHUNK = 16;
+
+private:
+    struct Node : EpochRetired {
+        std::atomic<Node*> next{nullptr};
+        std::size_t hash;
+        K key;
+        V value;
+
+        template <typename KeyArg, typename ValueArg>
+        Node(std::size_t h, KeyArg&& k, ValueArg&& v)
+            : hash(h), key(std::forward<KeyArg>(k)), value(std::forward<ValueArg>(v)) {}
+    };
+
+    struct Table : EpochRetired {
+        std::size_t mask = 0;
+        UniquePtr<std::atomic<Node*>[]> buckets;
+        std::atomic<Table*> next{nullptr}; ///< 移行先のテーブル
+    };
+
+    struct alignas(64) Stripe {
+        std::mutex mutex;
+    };
+
+private:
+    IAllocator* m_allocator = nullptr;
+    mutable EpochDomain m_epoch;
+    std::atomic<Table*> m_table{nullptr};
+    std::atomic<std::size_t> m_size{0};
+    Stripe m_stripes[LOCK_COUNT];
+    std::mutex m_resize_mutex;
+    std::size_t m_migrate_cursor = 0; ///< 次に移行するバケット（m_resize_mutexで保護）
+    Hash m_hash;
+    KeyEqual m_key_equal;
+
+public:
+    /**
+     * @brief 構築します。
+     * @param allocator ノードとバケットの配列を割り当てるアロケータ
+     * @param bucket_count 初期のバケット数（2のべき乗に切り上げ、MIN_BUCKETS以上にします）
+     * @note バケットの配列を割り当てられなかった場合、書き込みは常に失敗します。
+     */
+    explicit ConcurrentHashMap(IAllocator* allocator, std::size_t bucket_count = MIN_BUCKETS)
+        : m_allocator(allocator), m_epoch(this) {
+        assert(allocator);
+        std::size_t size = MIN_BUCKETS;
+        while (size < bucket_count) {
+            size *= 2;
+        }
+        m_table.store(create_table(size), std::memory_order_release);
+    }
+
+    /**
+     * @brief デストラクタ
+     *
+     * すべてのノードとテーブルを解放します。他のスレッドが操作していてはいけません。
+     */
+    ~ConcurrentHashMap() {
+        m_epoch.synchronize();
+        Table* table = m_table.load(std::memory_order_relaxed);
+        while (table) {
+            Table* next = table->next.load(std::memory_order_relaxed);
+            for (std::size_t i = 0; i <= table->mask; ++i) {
+                Node* node = table->buckets[i].load(std::memory_order_relaxed);
+                if (node == moved()) {
+                    continue;
+                }
+                while (node) {
+                    Node* following = node->next.load(std::memory_order_relaxed);
+                    destroy_node(node);
+                    node = following;
+                }
+            }
+            destroy_table(table);
+            table = next;
+        }
+    }
+
+    /**
+     * @brief キーに対応する値をコピーして返します。
+     * @param key キー
+     * @param out 値のコピー先
+     * @return bool キーが見つかった場合はtrue
+     */
+    bool find(const K& key, V& out) const {
+        return visit(key, [&out](const V& value) { out = value; });
+    }
+
+    /**
+     * @brief キーが登録されているかを返します。
+     * @param key キー
+     * @return bool 登録されている場合はtrue
+     */
+    bool contains(const K& key) const {
+        return visit(key, [](const V&) {});
+    }
+
+    /**
+     * @brief キーに対応する値を、ロックを取らずに関数に渡します。
+     *
+     * 関数は読み取りのGuardの中で呼ばれるため、値を参照できるのは関数の中だけです。
+     *
+     * @param key キー
+     * @param f const V&を受け取る関数
+     * @return bool キーが見つかった場合はtrue
+     */
+    template <typename F>
+    bool visit(const K& key, F&& f) const {
+        const std::size_t h = m_hash(key);
+        EpochDomain::Guard guard(m_epoch);
+        Table* table = m_table.load(std::memory_order_acquire);
+        if (!table) {
+            return false;
+        }
+        Node* node = table->buckets[h & table->mask].load(std::memory_order_acquire);
+        while (node == moved()) {
+            table = table->next.load(std::memory_order_acquire);
+            node = table->buckets[h & table->mask].load(std::memory_order_acquire);
+        }
+        for (; node; node = node->next.load(std::memory_order_acquire)) {
+            if (node->hash == h && m_key_equal(node->key, key)) {
+                f(static_cast<const V&>(node->value));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief キーが登録されていなければ追加します。
+     * @param key キー
+     * @param value 値
+     * @return bool 追加した場合はtrue。キーが登録済みか、割り当てに失敗した場合はfalse
+     */
+    bool insert(const K& key, const V& value) {
+        return write(key, value, false);
+    }
+
+    /**
+     * @brief キーを追加するか、登録済みなら値を置き換えます。
+     *
+     * 値の置き換えはノードの差し替えで行い、古いノードは読み取り中のスレッドがいなくなってから解放されます。
+     *
+     * @param key キー
+     * @param value 値
+     * @return bool 成功した場合はtrue。割り当てに失敗した場合はfalse
+     */
+    bool insert_or_assign(const K& key, const V& value) {
+        return write(key, value, true);
+    }
+
+    /**
+     * @brief キーを削除します。
+     * @param key キー
+     * @return bool 削除した場合はtrue。キーが登録されていなければfalse
+     */
+    bool erase(const K& key) {
+        const std::size_t h = m_hash(key);
+        EpochDomain::Guard guard(m_epoch);
+        if (!m_table.load(std::memory_order_acquire)) {
+            return false;
+        }
+        help_migrate();
+        std::lock_guard<std::mutex> lock(stripe(h));
+        Table* table = table_for(h);
+        std::atomic<Node*>* link = &table->buckets[h & table->mask];
+        for (Node* node = link->load(std::memory_order_relaxed); node;
+             node = link->load(std::memory_order_relaxed)) {
+            if (node->hash == h && m_key_equal(node->key, key)) {
+                link->store(node->next.load(std::memory_order_relaxed), std::memory_order_release);
+                m_size.fetch_sub(1, std::memory_order_relaxed);
+                m_epoch.retire(node, &ConcurrentHashMap::reclaim_node);
+                return true;
+            }
+            link = &node->next;
+        }
+        return false;
+    }
+
+    /**
+     * @brief 要素数を返します。
+     * @return std::size_t 要素数
+     */
+    std::size_t size() const {
+        return m_size.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 現在のテーブルのバケット数を返します。移行中は移行元のバケット数です。
+     * @return std::size_t バケット数
+     */
+    std::size_t bucket_count() const {
+        EpochDomain::Guard guard(m_epoch);
+        Table* table = m_table.load(std::memory_order_acquire);
+        return table ? table->mask + 1 : 0;
+    }
+
+    /**
+     * @brief テーブルを移行中かを返します。
+     * @return bool 移行中ならtrue
+     */
+    bool is_resizing() const {
+        EpochDomain::Guard guard(m_epoch);
+        Table* table = m_table.load(std::memory_order_acquire);
+        return table && table->next.load(std::memory_order_acquire) != nullptr;
+    }
+
+    /**
+     * @brief 外したノードのうち、解放できるものを解放します。
+     * @return std::size_t 解放したノードとテーブルの数
+     */
+    std::size_t collect() {
+        return m_epoch.collect();
+    }
+
+    /**
+     * @brief 内蔵のEpochDomainを返します。
+     * @return EpochDomain& ドメイン
+     */
+    EpochDomain& epoch_domain() const {
+        return m_epoch;
+    }
+
+private:
+    // 移行済みのバケットに置く印（参照しないポインタ）
+    static Node* moved() {
+        return reinterpret_cast<Node*>(std::uintptr_t{1});
+    }
+
+    std::mutex& stripe(std::size_t h) {
+        return m_stripes[h & (LOCK_COUNT - 1)].mutex;
+    }
+
+    // ハッシュhのバケットが有効なテーブルを返します。ストライプロックを保持した状態で呼び出します
+    Table* table_for(std::size_t h) const {
+        Table* table = m_table.load(std::memory_order_acquire);
+        while (table->buckets[h & table->mask].load(std::memory_order_acquire) == moved()) {
+            table = table->next.load(std::memory_order_acquire);
+        }
+        return table;
+    }
+
+    bool write(const K& key, const V& value, bool assign) {
+        const std::size_t h = m_hash(key);
+        EpochDomain::Guard guard(m_epoch);
+        if (!m_table.load(std::memory_order_acquire)) {
+            return false;
+        }
+        help_migrate();
+        bool inserted = false;
+        {
+            std::lock_guard<std::mutex> lock(stripe(h));
+            Table* table = table_for(h);
+            std::atomic<Node*>& head = table->buckets[h & table->mask];
+            std::atomic<Node*>* link = &head;
+            Node* node = link->load(std::memory_order_relaxed);
+            for (; node; node = link->load(std::memory_order_relaxed)) {
+                if (node->hash == h && m_key_equal(node->key, key)) {
+                    break;
+                }
+                link = &node->next;
+            }
+            if (node && !assign) {
+                return false;
+            }
+            Node* created = create_node(h, key, value);
+            if (!created) {
+                return false;
+            }
+            if (node) {
+                // 読み取り中のスレッドが古いノードから先に進めるよう、nextは古いノードのものを引き継ぎます
+                created->next.store(node->next.load(std::memory_order_relaxed),
+                                    std::memory_order_relaxed);
+                link->store(created, std::memory_order_release);
+                m_epoch.retire(node, &ConcurrentHashMap::reclaim_node);
+                return true;
+            }
+            created->next.store(head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            head.store(created, std::memory_order_release);
+            inserted = true;
+        }
+        if (inserted) {
+            const std::size_t size = m_size.fetch_add(1, std::memory_order_relaxed) + 1;
+            maybe_start_resize(size);
+        }
+        return true;
+    }
+
+    // 要素数がバケット数を超えたら移行を始めます。読み取りのGuardの中で呼び出します
+    void maybe_start_resize(std::size_t size) {
+        Table* table = m_table.load(std::memory_order_acquire);
+        if (size <= table->mask + 1 || table->next.load(std::memory_order_acquire)) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(m_resize_mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            return;
+        }
+        table = m_table.load(std::memory_order_relaxed);
+        if (size <= table->mask + 1 || table->next.load(std::memory_order_relaxed)) {
+            return;
+        }
+        Table* bigger = create_table((table->mask + 1) * 2);
+        if (!bigger) {
+            return;
+        }
+        m_migrate_cursor = 0;
+        table->next.store(bigger, std::memory_order_release);
+    }
+
+    // 移行中なら、次のMIGRATE_CHUNK個のバケットを移行します。読み取りのGuardの中で呼び出します
+    void help_migrate() {
+        Table* table = m_table.load(std::memory_order_acquire);
+        if (!table->next.load(std::memory_order_acquire)) {
+            return;
+        }
+        // 移行は1度に1つのスレッドだけが行い、他のスレッドは待たずに自分の書き込みに進みます
+        std::unique_lock<std::mutex> lock(m_resize_mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            return;
+        }
+        table = m_table.load(std::memory_order_relaxed);
+        Table* next = table->next.load(std::memory_order_relaxed);
+        if (!next) {
+            return;
+        }
+        const std::size_t count = table->mask + 1;
+        const std::size_t end =
+            m_migrate_cursor + MIGRATE_CHUNK < count ? m_migrate_cursor + MIGRATE_CHUNK : count;
+        while (m_migrate_cursor < end) {
+            std::lock_guard<std::mutex> stripe_lock(stripe(m_migrate_cursor));
+            if (!migrate_bucket(table, next, m_migrate_cursor)) {
+                // 割り当てに失敗した場合は、次の書き込みで同じバケットからやり直します
+                return;
+            }
+            ++m_migrate_cursor;
+        }
+        if (m_migrate_cursor == count) {
+            m_table.store(next, std::memory_order_release);
+            m_migrate_cursor = 0;
+            m_epoch.retire(table, &ConcurrentHashMap::reclaim_table);
+        }
+    }
+
+    // バケットのノードを新しいテーブルにコピーし、移行済みの印を置きます。
+    // 古いノードのリストはそのまま残すため、辿っている途中の読み取りは影響を受けません
+    bool migrate_bucket(Table* table, Table* next, std::size_t index) {
+        std::atomic<Node*>& bucket = table->buckets[index];
+        Node* chain = bucket.load(std::memory_order_relaxed);
+        const std::size_t count = table->mask + 1;
+        Node* heads[2] = {nullptr, nullptr}; // 移行先のindexとindex + count
+        for (Node* node = chain; node; node = node->next.load(std::memory_order_relaxed)) {
+            Node* copy = create_node(node->hash, node->key, node->value);
+            if (!copy) {
+                for (Node* created : heads) {
+                    while (created) {
+                        Node* following = created->next.load(std::memory_order_relaxed);
+                        destroy_node(created);
+                        created = following;
+                    }
+                }
+                return false;
+            }
+            Node*& head = heads[(node->hash & count) != 0 ? 1 : 0];
+            copy->next.store(head, std::memory_order_relaxed);
+            head = copy;
+        }
+        next->buckets[index].store(heads[0], std::memory_order_release);
+        next->buckets[index + count].store(heads[1], std::memory_order_release);
+        bucket.store(moved(), std::memory_order_release);
+        while (chain) {
+            Node* following = chain->next.load(std::memory_order_relaxed);
+            m_epoch.retire(chain, &ConcurrentHashMap::reclaim_node);
+            chain = following;
+        }
+        return true;
+    }
+
+    Node* create_node(std::size_t h, const K& key, const V& value) {
+        void* memory = m_allocator->allocate(sizeof(Node), alignof(Node));
+        if (!memory) {
+            return nullptr;
+        }
+        return new (memory) Node(h, key, value);
+    }
+
+    void destroy_node(Node* node) {
+        node->~Node();
+        m_allocator->deallocate(node);
+    }
+
+    Table* create_table(std::size_t bucket_count) {
+        void* memory = m_allocator->allocate(sizeof(Table), alignof(Table));
+        if (!memory) {
+            return nullptr;
+        }
+        auto* table = new (memory) Table();
+        table->buckets = make_unique<std::atomic<Node*>[]>(m_allocator, bucket_count);
+        if (!table->buckets) {
+            destroy_table(table);
+            return nullptr;
+        }
+        table->mask = bucket_count - 1;
+        return table;
+    }
+
+    void destroy_table(Table* table) {
+        table->~Table();
+        m_allocator->deallocate(table);
+    }
+
+    static void reclaim_node(EpochRetired* object, void* context) {
+        static_cast<ConcurrentHashMap*>(context)->destroy_node(static_cast<Node*>(object));
+    }
+
+    static void reclaim_table(EpochRetired* object, void* context) {
+        static_cast<ConcurrentHashMap*>(context)->destroy_table(static_cast<Table*>(object));
+    }
+};
+
+} // namespace w6_mem
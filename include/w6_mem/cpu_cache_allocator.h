@@ -0,0 +1,316 @@
+#pragma once
+
+#include "allocator.h"
+#include "unique_ptr.h"
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define W6_MEM_HAS_RSEQ 1
+#endif
+#endif
+
+namespace w6_mem {
+
+/**
+ * @brief CPUごとのキャッシュを前段に持つアロケータ
+ *
+ * 小さな割り当て（MAX_CACHED_SIZE以下）を2のべき乗のサイズクラスに丸め、解放されたブロックを
+ * CPUごとの空きリストに保持して再利用します。キャッシュの数はスレッド数ではなくCPU数で決まるため、
+ * 多数のスレッドを動かしてもキャッシュのメモリ量は増えません。
+ *
+ * 実行中のCPUはLinuxのrseq（restartable sequences）領域からシステムコールなしで取得します。
+ * rseqが使えない環境では、スレッドごとに割り振った番号でキャッシュを選択します。
+ * いずれの場合もキャッシュは軽量なスピンロックで保護され、取得したCPUから移動した後でも
+ * 正しく動作します（通常は競合しません）。
+ *
+ * @note 親アロケータはスレッドセーフである必要があります。
+ */
+class CpuCacheAllocator : public IAllocator {
+private:
+    // コピー禁止
+    CpuCacheAllocator(const CpuCacheAllocator&) = delete;
+    CpuCacheAllocator& operator=(const CpuCacheAllocator&) = delete;
+
+public:
+    /// キャッシュする最小のサイズクラス
+    static constexpr std::size_t MIN_CACHED_SIZE = 16;
+    /// キャッシュする最大のサイズクラス
+    static constexpr std::size_t MAX_CACHED_SIZE = 1024;
+    /// 1サイズクラスあたりにキャッシュするブロック数の既定値
+    static constexpr std::size_t DEFAULT_MAX_CACHED_BLOCKS = 64;
+
+private:
+    static constexpr std::size_t CLASS_COUNT = 7; // 16B .. 1KiB
+    static constexpr std::uint32_t UNCACHED = 0xFFFFFFFFU;
+
+    // 払い出したポインタの直前に置くヘッダ
+    struct alignas(16) Header {
+        std::uint32_t class_index; ///< サイズクラス。キャッシュしない場合はUNCACHED
+        std::uint32_t offset;      ///< 親から割り当てたブロック先頭からのオフセット
+    };
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct alignas(64) CpuCache {
+        std::atomic_flag lock = ATOMIC_FLAG_INIT;
+        FreeBlock* free_lists[CLASS_COUNT] = {};
+        std::size_t counts[CLASS_COUNT] = {};
+    };
+
+    class CacheLock {
+    private:
+        std::atomic_flag& m_flag;
+
+    public:
+        explicit CacheLock(std::atomic_flag& flag) : m_flag(flag) {
+            while (m_flag.test_and_set(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+        }
+        CacheLock(const CacheLock&) = delete;
+        CacheLock& operator=(const CacheLock&) = delete;
+        ~CacheLock() {
+            m_flag.clear(std::memory_order_release);
+        }
+    };
+
+private:
+    IAllocator* m_parent = nullptr;
+    std::size_t m_max_cached_blocks = DEFAULT_MAX_CACHED_BLOCKS;
+    std::size_t m_cache_count = 0;
+    UniquePtr<CpuCache[]> m_caches;
+
+public:
+    /**
+     * @brief 親アロケータを指定して構築します。
+     * @param parent キャッシュに無いブロックを割り当てるアロケータ
+     * @param max_cached_blocks 1つのCPUキャッシュが1サイズクラスあたりに保持するブロック数の上限。
+     * 0なら解放したブロックをすぐに親に返却します
+     * @param cache_count CPUキャッシュの数。0ならハードウェアスレッド数
+     */
+    explicit CpuCacheAllocator(IAllocator* parent,
+                               std::size_t max_cached_blocks = DEFAULT_MAX_CACHED_BLOCKS,
+                               std::size_t cache_count = 0)
+        : m_parent(parent), m_max_cached_blocks(max_cached_blocks), m_cache_count(cache_count) {
+        assert(parent);
+        if (m_cache_count == 0) {
+            m_cache_count = std::thread::hardware_concurrency();
+        }
+        if (m_cache_count == 0) {
+            m_cache_count = 1;
+        }
+        m_caches = make_unique<CpuCache[]>(parent, m_cache_count);
+        assert(m_caches);
+    }
+
+    /**
+     * @brief デストラクタ
+     *
+     * キャッシュしているブロックをすべて親アロケータに返却します。
+     */
+    ~CpuCacheAllocator() override {
+        flush();
+    }
+
+    /**
+     * @copydoc IAllocator::allocate
+     */
+    void* allocate(std::size_t size, std::size_t alignment) override {
+        detail::NoAllocCheck no_alloc_check(size, alignment);
+        if (size > MAX_CACHED_SIZE || alignment > alignof(Header)) {
+            void* ptr = allocate_uncached(size, alignment);
+            W6_MEM_PROBE(allocate, size, alignment, ptr, this);
+            return ptr;
+        }
+
+        const std::size_t class_index = size_class(size);
+        void* block = nullptr;
+        {
+            CpuCache& cache = current_cache();
+            CacheLock lock(cache.lock);
+            FreeBlock* head = cache.free_lists[class_index];
+            if (head) {
+                cache.free_lists[class_index] = head->next;
+                --cache.counts[class_index];
+                block = head;
+            }
+        }
+        if (!block) {
+            block = m_parent->allocate(sizeof(Header) + class_size(class_index), alignof(Header));
+            if (!block) {
+                return nullptr;
+            }
+        }
+
+        auto* header = static_cast<Header*>(block);
+        header->class_index = static_cast<std::uint32_t>(class_index);
+        header->offset = sizeof(Header);
+        W6_MEM_PROBE(allocate, size, alignment, header + 1, this);
+        return header + 1;
+    }
+
+    /**
+     * @copydoc IAllocator::deallocate
+     */
+    void deallocate(void* ptr) override {
+        if (!ptr) {
+            return;
+        }
+        W6_MEM_PROBE(deallocate, 0, 0, ptr, this);
+        const Header* header = static_cast<const Header*>(ptr) - 1;
+        void* block = static_cast<unsigned char*>(ptr) - header->offset;
+        if (header->class_index == UNCACHED) {
+            m_parent->deallocate(block);
+            return;
+        }
+
+        const std::size_t class_index = header->class_index;
+        FreeBlock* overflow = nullptr;
+        std::size_t overflow_count = 0;
+        {
+            CpuCache& cache = current_cache();
+            CacheLock lock(cache.lock);
+            auto* free_block = static_cast<FreeBlock*>(block);
+            free_block->next = cache.free_lists[class_index];
+            cache.free_lists[class_index] = free_block;
+            ++cache.counts[class_index];
+            if (cache.counts[class_index] > m_max_cached_blocks) {
+                // 上限を超えたら、まとめて親に返却するために半分（上限が0なら1つ）を切り離します
+                overflow_count = m_max_cached_blocks > 0 ? (m_max_cached_blocks + 1) / 2 : 1;
+                overflow = detach(cache, class_index, overflow_count);
+            }
+        }
+        if (overflow) {
+            W6_MEM_PROBE(cache_flush, overflow_count * class_size(class_index), 0, nullptr, this);
+        }
+        release(overflow);
+    }
+
+    /**
+     * @brief すべてのCPUキャッシュのブロックを親アロケータに返却します。
+     */
+    void flush() {
+        std::size_t released_bytes = 0;
+        for (std::size_t i = 0; i < m_cache_count; ++i) {
+            CpuCache& cache = m_caches[i];
+            for (std::size_t class_index = 0; class_index < CLASS_COUNT; ++class_index) {
+                FreeBlock* blocks = nullptr;
+                {
+                    CacheLock lock(cache.lock);
+                    released_bytes += cache.counts[class_index] * class_size(class_index);
+                    blocks = detach(cache, class_index, cache.counts[class_index]);
+                }
+                release(blocks);
+            }
+        }
+        W6_MEM_PROBE(cache_flush, released_bytes, 0, nullptr, this);
+        (void)released_bytes;
+    }
+
+    /**
+     * @brief CPUキャッシュの数を返します。
+     * @return std::size_t CPUキャッシュの数
+     */
+    std::size_t cache_count() const {
+        return m_cache_count;
+    }
+
+    /**
+     * @brief 呼び出したスレッドでrseqによるCPU番号の取得が使えるかを返します。
+     * @return true rseqでCPU番号を取得できる場合
+     * @return false スレッドごとの番号で代用している場合
+     */
+    static bool uses_rseq() {
+        return rseq_cpu_id() >= 0;
+    }
+
+private:
+    static std::size_t size_class(std::size_t size) {
+        std::size_t class_index = 0;
+        while ((MIN_CACHED_SIZE << class_index) < size) {
+            ++class_index;
+        }
+        return class_index;
+    }
+
+    static std::size_t class_size(std::size_t class_index) {
+        return MIN_CACHED_SIZE << class_index;
+    }
+
+    // rseq領域からCPU番号を取得します。使えない場合は負の値を返します
+    static int rseq_cpu_id() {
+#if defined(W6_MEM_HAS_RSEQ)
+        if (__rseq_size == 0) {
+            return -1;
+        }
+        const auto* area = reinterpret_cast<const volatile struct rseq*>(
+            static_cast<const char*>(__builtin_thread_pointer()) + __rseq_offset);
+        return static_cast<int>(area->cpu_id);
+#else
+        return -1;
+#endif
+    }
+
+    // rseqが使えない場合に、スレッドごとに割り振る番号
+    static std::size_t thread_index() {
+        static std::atomic<std::size_t> s_next_index{0};
+        thread_local const std::size_t t_index = s_next_index.fetch_add(1);
+        return t_index;
+    }
+
+    CpuCache& current_cache() {
+        const int cpu = rseq_cpu_id();
+        const std::size_t index = cpu >= 0 ? static_cast<std::size_t>(cpu) : thread_index();
+        return m_caches[index % m_cache_count];
+    }
+
+    // 空きリストの先頭からcount個のブロックを切り離します。cache.lockを保持した状態で呼び出します
+    static FreeBlock* detach(CpuCache& cache, std::size_t class_index, std::size_t count) {
+        FreeBlock* head = cache.free_lists[class_index];
+        if (count == 0 || !head) {
+            return nullptr;
+        }
+        FreeBlock* tail = head;
+        for (std::size_t i = 1; i < count && tail->next; ++i) {
+            tail = tail->next;
+        }
+        cache.free_lists[class_index] = tail->next;
+        cache.counts[class_index] -= count;
+        tail->next = nullptr;
+        return head;
+    }
+
+    void release(FreeBlock* blocks) {
+        while (blocks) {
+            FreeBlock* next = blocks->next;
+            m_parent->deallocate(blocks);
+            blocks = next;
+        }
+    }
+
+    void* allocate_uncached(std::size_t size, std::size_t alignment) {
+        if (alignment < alignof(Header)) {
+            alignment = alignof(Header);
+        }
+        const std::size_t offset = (sizeof(Header) + alignment - 1) / alignment * alignment;
+        void* block = m_parent->allocate(offset + size, alignment);
+        if (!block) {
+            return nullptr;
+        }
+        auto* ptr = static_cast<unsigned char*>(block) + offset;
+        auto* header = reinterpret_cast<Header*>(ptr) - 1;
+        header->class_index = UNCACHED;
+        header->offset = static_cast<std::uint32_t>(offset);
+        return ptr;
+    }
+};
+
+} // namespace w6_mem
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+namespace w6_mem {
+
+/**
+ * @brief EpochDomainで回収を待つオブジェクトに埋め込む連結情報
+ *
+ * retire()で渡したオブジェクトは、回収できるようになるとreclaimで破棄されます。
+ */
+struct EpochRetired {
+    EpochRetired* next = nullptr;
+    /// オブジェクトを破棄する関数。contextにはEpochDomainの構築時に渡したポインタが渡されます
+    void (*reclaim)(EpochRetired* object, void* context) = nullptr;
+};
+
+namespace detail {
+
+struct EpochState {
+    // スレッドごとの読み取りカウンタの番号（0なら未割り当て）
+    static inline thread_local std::uint32_t s_stripe = 0;
+    static inline std::atomic<std::uint32_t> s_next_stripe{0};
+};
+
+} // namespace detail
+
+/**
+ * @brief エポック方式で、読み取り中のスレッドがいなくなったオブジェクトを回収するドメイン
+ *
+ * 読み取り側はEpochDomain::Guardの生存中、共有データから読んだポインタを安全に参照できます。
+ * 書き込み側はオブジェクトを共有データから外した後にretire()し、ドメインは「外す前から読み取り中
+ * だったスレッド」がすべてGuardを抜けたことを確認してから、オブジェクトを回収します。
+ *
+ * 読み取り側の登録は不要です。Guardはグローバルエポックの偶奇ごとに用意したカウンタを増減するだけで、
+ * カウンタはキャッシュラインごとに分けてスレッドに振り分けるため、読み取り同士はほとんど競合しません。
+ * エポックをeからe+1に進めるのは、エポックe-1で入ったGuardがすべて抜けたときで、
+ * エポックrでretire()したオブジェクトはエポックがr+2に進んだときに回収されます。
+ *
+ * @note retire()/collect()はスレッドセーフです。Guardはネストできます。
+ */
+class EpochDomain {
+private:
+    // コピー禁止
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+public:
+    /// 偶奇ごとの読み取りカウンタの数
+    static constexpr std::size_t STRIPE_COUNT = 16;
+    /// 回収を試みるretire()の回数
+    static constexpr std::size_t COLLECT_INTERVAL = 64;
+
+private:
+    struct alignas(64) Counter {
+        std::atomic<std::size_t> readers{0};
+    };
+
+    // 回収待ちのリストの数（エポック r, r+1 の分と、回収中の分）
+    static constexpr std::size_t LIST_COUNT = 3;
+
+    void* m_context = nullptr;
+    alignas(64) std::atomic<std::uint64_t> m_epoch{0};
+    Counter m_counters[2][STRIPE_COUNT];
+    std::mutex m_mutex;
+    EpochRetired* m_retired[LIST_COUNT] = {};
+    std::size_t m_pending = 0;
+    std::size_t m_collect_countdown = COLLECT_INTERVAL;
+
+public:
+    /**
+     * @brief 読み取り中であることを示すRAIIガード
+     */
+    class Guard {
+    private:
+        // コピー禁止
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+        std::atomic<std::size_t>* m_readers;
+
+    public:
+        /**
+         * @brief ドメインに入ります。
+         * @param domain 入るドメイン
+         */
+        explicit Guard(EpochDomain& domain) : m_readers(domain.enter()) {}
+
+        ~Guard() {
+            m_readers->fetch_sub(1, std::memory_order_release);
+        }
+    };
+
+    /**
+     * @brief 構築します。
+     * @param context EpochRetired::reclaimに渡すポインタ
+     */
+    explicit EpochDomain(void* context = nullptr) : m_context(context) {}
+
+    /**
+     * @brief デストラクタ
+     *
+     * 回収待ちのオブジェクトをすべて回収します。Guardが残っていてはいけません。
+     */
+    ~EpochDomain() {
+        for (EpochRetired*& list : m_retired) {
+            reclaim_list(list);
+        }
+    }
+
+    /**
+     * @brief オブジェクトを回収待ちにします。
+     *
+     * オブジェクトは共有データから外した後に渡します。COLLECT_INTERVAL回ごとにcollect()を行います。
+     *
+     * @param object 回収するオブジェクト
+     * @param reclaim オブジェクトを破棄する関数
+     */
+    void retire(EpochRetired* object, void (*reclaim)(EpochRetired*, void*)) {
+        assert(object && reclaim);
+        object->reclaim = reclaim;
+        // 共有データから外したことが、エポックを読むより前に他のスレッドから見えるようにします
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const std::uint64_t epoch = m_epoch.load(std::memory_order_seq_cst);
+        EpochRetired*& list = m_retired[epoch % LIST_COUNT];
+        object->next = list;
+        list = object;
+        ++m_pending;
+        if (--m_collect_countdown == 0) {
+            m_collect_countdown = COLLECT_INTERVAL;
+            collect_locked();
+        }
+    }
+
+    /**
+     * @brief エポックを進められれば進め、回収できるオブジェクトを回収します。
+     * @return std::size_t 回収したオブジェクトの数
+     */
+    std::size_t collect() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return collect_locked();
+    }
+
+    /**
+     * @brief 回収待ちのオブジェクトがすべて回収されるまで待ちます。
+     * @note Guardの中で呼び出してはいけません（終わらなくなります）。
+     */
+    void synchronize() {
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                collect_locked();
+                if (m_pending == 0) {
+                    return;
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief 現在のエポックを返します。
+     * @return std::uint64_t エポック
+     */
+    std::uint64_t epoch() const {
+        return m_epoch.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 回収待ちのオブジェクトの数を返します。
+     * @return std::size_t オブジェクトの数
+     */
+    std::size_t pending() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_pending;
+    }
+
+private:
+    static std::size_t stripe() {
+        std::uint32_t& stripe = detail::EpochState::s_stripe;
+        if (stripe == 0) {
+            stripe = detail::EpochState::s_next_stripe.fetch_add(1, std::memory_order_relaxed) %
+                         STRIPE_COUNT +
+                     1;
+        }
+        return stripe - 1;
+    }
+
+    std::atomic<std::size_t>* enter() {
+        const std::size_t index = stripe();
+        for (;;) {
+            const std::uint64_t epoch = m_epoch.load(std::memory_order_seq_cst);
+            std::atomic<std::size_t>& readers = m_counters[epoch & 1][index].readers;
+            readers.fetch_add(1, std::memory_order_seq_cst);
+            // カウンタを増やす前にエポックが進んでいた場合、古いエポックで入ったことにはできません
+            if (m_epoch.load(std::memory_order_seq_cst) == epoch) {
+                return &readers;
+            }
+            readers.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    // m_mutexを保持した状態で呼び出します
+    std::size_t collect_locked() {
+        const std::uint64_t epoch = m_epoch.load(std::memory_order_relaxed);
+        // エポックe-1（eと偶奇が異なる）で入ったGuardが残っていれば進められません
+        for (const Counter& counter : m_counters[(epoch + 1) & 1]) {
+            if (counter.readers.load(std::memory_order_acquire) != 0) {
+                return 0;
+            }
+        }
+        m_epoch.store(epoch + 1, std::memory_order_seq_cst);
+        // エポックe-1でretire()したオブジェクトは、もう誰からも参照されていません
+        return reclaim_list(m_retired[(epoch + 2) % LIST_COUNT]);
+    }
+
+    std::size_t reclaim_list(EpochRetired*& list) {
+        std::size_t count = 0;
+        EpochRetired* object = list;
+        list = nullptr;
+        while (object) {
+            EpochRetired* next = object->next;
+            object->reclaim(object, m_context);
+            object = next;
+            ++count;
+        }
+        m_pending -= count;
+        return count;
+    }
+};
+
+} // namespace w6_mem
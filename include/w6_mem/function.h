@@ -0,0 +1,264 @@
+#pragma once
+
+#include "allocator.h"
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace w6_mem {
+
+template <typename Signature, std::size_t InlineSize = 4 * sizeof(void*)>
+class UniqueFunction;
+
+/**
+ * @brief カスタムアロケータ対応のムーブ専用関数ラッパー
+ *
+ * 呼び出し可能オブジェクトがインラインバッファに収まる場合はバッファ内に格納し、
+ * 収まらない場合はIAllocatorから割り当てます。
+ * トリビアルにコピー・破棄できる呼び出し可能オブジェクトは、バッファのコピーだけでムーブされます。
+ *
+ * @tparam R 戻り値の型
+ * @tparam Args 引数の型
+ * @tparam InlineSize インラインバッファのバイト数
+ */
+template <typename R, typename... Args, std::size_t InlineSize>
+class UniqueFunction<R(Args...), InlineSize> {
+private:
+    // コピー禁止
+    UniqueFunction(const UniqueFunction&) = delete;
+    UniqueFunction& operator=(const UniqueFunction&) = delete;
+
+    static constexpr std::size_t INLINE_ALIGNMENT = alignof(std::max_align_t);
+
+public:
+    using result_type = R;
+
+private:
+    // 型ごとの操作表。relocateとdestroyがnullptrならトリビアルに再配置・破棄できます
+    struct Ops {
+        R (*invoke)(void* object, Args&&... args);
+        void (*relocate)(void* dst, void* src);
+        void (*destroy)(void* object);
+        std::size_t size;
+    };
+
+    template <typename F>
+    struct OpsFor {
+        static R invoke(void* object, Args&&... args) {
+            if constexpr (std::is_void_v<R>) {
+                std::invoke(*static_cast<F*>(object), std::forward<Args>(args)...);
+            } else {
+                return std::invoke(*static_cast<F*>(object), std::forward<Args>(args)...);
+            }
+        }
+
+        static void relocate(void* dst, void* src) {
+            auto* source = static_cast<F*>(src);
+            new (dst) F(std::move(*source));
+            std::destroy_at(source);
+        }
+
+        static void destroy(void* object) {
+            std::destroy_at(static_cast<F*>(object));
+        }
+
+        static constexpr bool TRIVIAL =
+            std::is_trivially_copyable_v<F> && std::is_trivially_destructible_v<F>;
+        static constexpr Ops OPS = {&invoke, TRIVIAL ? nullptr : &relocate,
+                                    TRIVIAL ? nullptr : &destroy, sizeof(F)};
+    };
+
+private:
+    alignas(INLINE_ALIGNMENT) unsigned char m_buffer[InlineSize];
+    const Ops* m_ops = nullptr;
+    void* m_object = nullptr;
+    IAllocator* m_allocator = nullptr; // ヒープに割り当てた場合のみ非nullptr
+
+public:
+    /**
+     * @brief 呼び出し可能オブジェクトがインラインに格納されるかを判定します。
+     * @tparam F 判定する型
+     */
+    template <typename F>
+    static constexpr bool fits_inline() {
+        return sizeof(F) <= InlineSize && alignof(F) <= INLINE_ALIGNMENT &&
+               std::is_nothrow_move_constructible_v<F>;
+    }
+
+    /**
+     * @brief デフォルトコンストラクタ
+     * 空の状態で構築します。
+     */
+    UniqueFunction() {}
+
+    /**
+     * @brief nullptrからの構築
+     */
+    UniqueFunction(std::nullptr_t) : UniqueFunction() {}
+
+    /**
+     * @brief インラインに収まる呼び出し可能オブジェクトから構築します。
+     *
+     * インラインに収まらない型は、アロケータを受け取るコンストラクタを使用してください。
+     *
+     * @tparam F 呼び出し可能オブジェクトの型
+     * @param f 呼び出し可能オブジェクト
+     */
+    template <typename F, typename = std::enable_if_t<
+                              !std::is_same_v<std::decay_t<F>, UniqueFunction> &&
+                              std::is_invocable_r_v<R, std::decay_t<F>&, Args...>>>
+    UniqueFunction(F&& f) {
+        static_assert(fits_inline<std::decay_t<F>>(),
+                      "callable does not fit inline; pass an IAllocator");
+        emplace(nullptr, std::forward<F>(f));
+    }
+
+    /**
+     * @brief 呼び出し可能オブジェクトから構築します。
+     *
+     * インラインに収まらない場合はallocatorから割り当てます。割り当てに失敗した場合は空になります。
+     *
+     * @tparam F 呼び出し可能オブジェクトの型
+     * @param allocator インラインに収まらない場合に使用するアロケータ
+     * @param f 呼び出し可能オブジェクト
+     */
+    template <typename F, typename = std::enable_if_t<
+                              std::is_invocable_r_v<R, std::decay_t<F>&, Args...>>>
+    UniqueFunction(IAllocator* allocator, F&& f) {
+        emplace(allocator, std::forward<F>(f));
+    }
+
+    /**
+     * @brief ムーブコンストラクタ
+     */
+    UniqueFunction(UniqueFunction&& other) {
+        take(other);
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    ~UniqueFunction() {
+        reset();
+    }
+
+    /**
+     * @brief ムーブ代入演算子
+     * @param other ムーブするUniqueFunction
+     * @return UniqueFunction& 自身への参照
+     */
+    UniqueFunction& operator=(UniqueFunction&& other) {
+        if (this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+
+    /**
+     * @brief 保持している呼び出し可能オブジェクトを呼び出します。
+     * @param args 引数
+     * @return R 呼び出しの結果
+     */
+    R operator()(Args... args) {
+        assert(m_ops);
+        return m_ops->invoke(m_object, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief 呼び出し可能オブジェクトを保持しているかどうかを評価します。
+     * @return true 保持している場合
+     * @return false 空の場合
+     */
+    explicit operator bool() const {
+        return !!m_ops;
+    }
+
+    /**
+     * @brief 呼び出し可能オブジェクトがインラインバッファに格納されているかを返します。
+     * @return true インラインに格納されている場合
+     * @return false 空、またはヒープに割り当てられている場合
+     */
+    bool is_inline() const {
+        return m_ops && !m_allocator;
+    }
+
+    /**
+     * @brief 保持している呼び出し可能オブジェクトを破棄して空にします。
+     */
+    void reset() {
+        if (!m_ops) {
+            return;
+        }
+        if (m_ops->destroy) {
+            m_ops->destroy(m_object);
+        }
+        if (m_allocator) {
+            m_allocator->deallocate(m_object);
+        }
+        m_ops = nullptr;
+        m_object = nullptr;
+        m_allocator = nullptr;
+    }
+
+private:
+    template <typename F>
+    void emplace(IAllocator* allocator, F&& f) {
+        using Callable = std::decay_t<F>;
+        if constexpr (fits_inline<Callable>()) {
+            m_object = new (m_buffer) Callable(std::forward<F>(f));
+        } else {
+            if (!allocator) {
+                return;
+            }
+            detail::NoAllocCheck no_alloc_check(sizeof(Callable), alignof(Callable));
+            void* memory = allocator->allocate(sizeof(Callable), alignof(Callable));
+            if (!memory) {
+                return;
+            }
+            m_object = new (memory) Callable(std::forward<F>(f));
+            m_allocator = allocator;
+        }
+        m_ops = &OpsFor<Callable>::OPS;
+    }
+
+    // otherの内容を空の自身へ移します
+    void take(UniqueFunction& other) {
+        if (!other.m_ops) {
+            return;
+        }
+        m_ops = other.m_ops;
+        m_allocator = other.m_allocator;
+        if (m_allocator) {
+            m_object = other.m_object;
+        } else {
+            if (m_ops->relocate) {
+                m_ops->relocate(m_buffer, other.m_object);
+            } else {
+                std::memcpy(m_buffer, other.m_buffer, m_ops->size);
+            }
+            m_object = m_buffer;
+        }
+        other.m_ops = nullptr;
+        other.m_object = nullptr;
+        other.m_allocator = nullptr;
+    }
+};
+
+/**
+ * @brief UniqueFunctionの別名
+ *
+ * ムーブ専用である点はUniqueFunctionと同じです。
+ *
+ * @tparam Signature 関数シグネチャ
+ * @tparam InlineSize インラインバッファのバイト数
+ */
+template <typename Signature, std::size_t InlineSize = 4 * sizeof(void*)>
+using Function = UniqueFunction<Signature, InlineSize>;
+
+} // namespace w6_mem
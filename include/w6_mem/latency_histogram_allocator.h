@@ -0,0 +1,457 @@
+#pragma once
+
+#include "allocator.h"
+#include "stack_trace.h"
+#include "unique_ptr.h"
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace w6_mem {
+
+/**
+ * @brief 対数線形バケットのレイテンシヒストグラム（HDRヒストグラム形式）
+ *
+ * 32未満の値は1刻みで、それ以上の値は2のべき乗ごとに16分割したバケットで数えます。
+ * 値の相対誤差は1/16（約6%）以内です。MAX_VALUE以上の値は最後のバケットに数えます。
+ * 値の単位はナノ秒を想定していますが、ヒストグラム自体は単位を持ちません。
+ */
+class LatencyHistogram {
+public:
+    /// 1刻みで数える範囲のビット数
+    static constexpr unsigned SUB_BUCKET_BITS = 5;
+    /// 数えられる値のビット数
+    static constexpr unsigned MAX_VALUE_BITS = 40;
+    /// 正確に数えられる最大値
+    static constexpr std::uint64_t MAX_VALUE = (std::uint64_t{1} << MAX_VALUE_BITS) - 1;
+    /// バケットの数
+    static constexpr std::size_t BUCKET_COUNT =
+        (std::size_t{1} << SUB_BUCKET_BITS) +
+        (MAX_VALUE_BITS - SUB_BUCKET_BITS) * (std::size_t{1} << (SUB_BUCKET_BITS - 1));
+
+private:
+    static constexpr std::uint64_t SUB_BUCKET_COUNT = std::uint64_t{1} << SUB_BUCKET_BITS;
+    static constexpr std::uint64_t HALF_COUNT = SUB_BUCKET_COUNT / 2;
+
+private:
+    std::uint64_t m_counts[BUCKET_COUNT] = {};
+    std::uint64_t m_total = 0;
+    std::uint64_t m_sum = 0;
+    std::uint64_t m_max = 0;
+
+public:
+    /**
+     * @brief 値を記録します。
+     * @param value 記録する値
+     * @param count 記録する回数
+     */
+    void record(std::uint64_t value, std::uint64_t count = 1) {
+        m_counts[bucket_index(value)] += count;
+        m_total += count;
+        m_sum += value * count;
+        if (value > m_max) {
+            m_max = value;
+        }
+    }
+
+    /**
+     * @brief バケットの値を直接加算します。
+     *
+     * 別の場所で数えたバケットを合算するために使います。
+     *
+     * @param index バケットの番号
+     * @param count 加算する回数
+     */
+    void add_bucket(std::size_t index, std::uint64_t count) {
+        assert(index < BUCKET_COUNT);
+        m_counts[index] += count;
+        m_total += count;
+    }
+
+    /**
+     * @brief 合計と最大値を加算します。add_bucket()と組み合わせて使います。
+     * @param sum 値の合計
+     * @param max 値の最大
+     */
+    void add_summary(std::uint64_t sum, std::uint64_t max) {
+        m_sum += sum;
+        if (max > m_max) {
+            m_max = max;
+        }
+    }
+
+    /**
+     * @brief 別のヒストグラムを合算します。
+     * @param other 合算するヒストグラム
+     */
+    void merge(const LatencyHistogram& other) {
+        for (std::size_t i = 0; i < BUCKET_COUNT; ++i) {
+            m_counts[i] += other.m_counts[i];
+        }
+        m_total += other.m_total;
+        add_summary(other.m_sum, other.m_max);
+    }
+
+    /**
+     * @brief 記録した回数を返します。
+     * @return std::uint64_t 回数
+     */
+    std::uint64_t count() const {
+        return m_total;
+    }
+
+    /**
+     * @brief 記録した値の最大を返します。
+     * @return std::uint64_t 最大値
+     */
+    std::uint64_t max() const {
+        return m_max;
+    }
+
+    /**
+     * @brief 記録した値の平均を返します。
+     * @return double 平均値。記録がない場合は0
+     */
+    double mean() const {
+        return m_total ? static_cast<double>(m_sum) / static_cast<double>(m_total) : 0.0;
+    }
+
+    /**
+     * @brief パーセンタイル値を返します。
+     *
+     * 該当するバケットの上限値を返します（最大値を超えることはありません）。
+     *
+     * @param percentile 0から100までのパーセンタイル
+     * @return std::uint64_t パーセンタイル値。記録がない場合は0
+     */
+    std::uint64_t percentile(double percentile) const {
+        if (m_total == 0) {
+            return 0;
+        }
+        const double clamped = percentile < 0.0 ? 0.0 : percentile > 100.0 ? 100.0 : percentile;
+        auto target =
+            static_cast<std::uint64_t>(clamped / 100.0 * static_cast<double>(m_total) + 0.5);
+        if (target == 0) {
+            target = 1;
+        }
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < BUCKET_COUNT; ++i) {
+            seen += m_counts[i];
+            if (seen >= target) {
+                const std::uint64_t upper = bucket_upper(i);
+                return upper < m_max ? upper : m_max;
+            }
+        }
+        return m_max;
+    }
+
+    /**
+     * @brief バケットの回数を返します。
+     * @param index バケットの番号
+     * @return std::uint64_t 回数
+     */
+    std::uint64_t bucket_count(std::size_t index) const {
+        assert(index < BUCKET_COUNT);
+        return m_counts[index];
+    }
+
+    /**
+     * @brief 値が数えられるバケットの番号を返します。
+     * @param value 値
+     * @return std::size_t バケットの番号
+     */
+    static std::size_t bucket_index(std::uint64_t value) {
+        if (value < SUB_BUCKET_COUNT) {
+            return static_cast<std::size_t>(value);
+        }
+        if (value > MAX_VALUE) {
+            value = MAX_VALUE;
+        }
+        const unsigned shift = highest_bit(value) - SUB_BUCKET_BITS + 1;
+        return static_cast<std::size_t>(SUB_BUCKET_COUNT + (shift - 1) * HALF_COUNT +
+                                        ((value >> shift) - HALF_COUNT));
+    }
+
+    /**
+     * @brief バケットに数えられる最小の値を返します。
+     * @param index バケットの番号
+     * @return std::uint64_t 最小値
+     */
+    static std::uint64_t bucket_lower(std::size_t index) {
+        if (index < SUB_BUCKET_COUNT) {
+            return index;
+        }
+        const std::uint64_t offset = index - SUB_BUCKET_COUNT;
+        const std::uint64_t shift = offset / HALF_COUNT + 1;
+        return (offset % HALF_COUNT + HALF_COUNT) << shift;
+    }
+
+    /**
+     * @brief バケットに数えられる最大の値を返します。
+     * @param index バケットの番号
+     * @return std::uint64_t 最大値
+     */
+    static std::uint64_t bucket_upper(std::size_t index) {
+        if (index < SUB_BUCKET_COUNT) {
+            return index;
+        }
+        const std::uint64_t shift = (index - SUB_BUCKET_COUNT) / HALF_COUNT + 1;
+        return bucket_lower(index) + (std::uint64_t{1} << shift) - 1;
+    }
+
+private:
+    static unsigned highest_bit(std::uint64_t value) {
+#if defined(_MSC_VER)
+        unsigned long index = 0;
+        _BitScanReverse64(&index, value);
+        return static_cast<unsigned>(index);
+#else
+        return 63U - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+    }
+};
+
+/**
+ * @brief しきい値を超えて遅かった割り当ての記録
+ */
+struct SlowAllocation {
+    /// 記録するスタックフレームの最大数
+    static constexpr int MAX_FRAMES = 16;
+
+    std::size_t size = 0;
+    std::size_t alignment = 0;
+    std::uint64_t nanoseconds = 0;
+    void* frames[MAX_FRAMES] = {}; ///< 割り当てを呼び出したスタック（取得できない環境では空）
+    int frame_count = 0;
+};
+
+/**
+ * @brief 遅い割り当てを受け取る関数
+ *
+ * 割り当てを行ったスレッドで呼び出されます。
+ *
+ * @param allocation 遅い割り当ての記録
+ * @param context 登録時に渡したポインタ
+ */
+using SlowAllocationHandler = void (*)(const SlowAllocation& allocation, void* context);
+
+/**
+ * @brief 割り当てと解放のレイテンシをヒストグラムに記録するアロケータ
+ *
+ * 親アロケータの呼び出しの前後でsteady_clockを読み、経過時間（ナノ秒）を
+ * LatencyHistogramと同じ対数線形バケットに数えます。記録先はSHARD_COUNT個のシャードのうち、
+ * スレッドの番号で選んだもので、カウンタはアトミックに更新するためロックを取りません。
+ * スレッドがSHARD_COUNTより多い場合は複数のスレッドが1つのシャードを共有します。
+ * パーセンタイルの集計は、allocate_histogram()/deallocate_histogram()を呼び出したときに
+ * シャードを合算して行います。
+ *
+ * slow_thresholdを超えた割り当ては、サイズと呼び出し元のスタックとともにハンドラへ渡されます。
+ * ハンドラを指定しない場合は標準エラー出力に書き出します。
+ *
+ * @note 親アロケータがスレッドセーフなら、このアロケータもスレッドセーフです。
+ */
+class LatencyHistogramAllocator : public IAllocator {
+private:
+    // コピー禁止
+    LatencyHistogramAllocator(const LatencyHistogramAllocator&) = delete;
+    LatencyHistogramAllocator& operator=(const LatencyHistogramAllocator&) = delete;
+
+public:
+    /// シャードの数。スレッドは番号の剰余でシャードに割り振られます
+    static constexpr std::size_t SHARD_COUNT = 16;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Counters {
+        std::atomic<std::uint64_t> buckets[LatencyHistogram::BUCKET_COUNT] = {};
+        std::atomic<std::uint64_t> sum{0};
+        std::atomic<std::uint64_t> max{0};
+    };
+
+    struct alignas(64) Shard {
+        Counters allocate;
+        Counters deallocate;
+    };
+
+private:
+    IAllocator* m_parent = nullptr;
+    UniquePtr<Shard[]> m_shards;
+    std::uint64_t m_slow_threshold = 0;
+    SlowAllocationHandler m_handler = nullptr;
+    void* m_context = nullptr;
+    std::atomic<std::uint64_t> m_slow_count{0};
+
+public:
+    /**
+     * @brief 親アロケータを指定して構築します。
+     *
+     * シャードも親アロケータから割り当てます。
+     *
+     * @param parent 実際の割り当てを行うアロケータ
+     * @param slow_threshold 遅い割り当てとみなすナノ秒数。0なら記録しません
+     * @param handler 遅い割り当てを受け取る関数。nullptrなら標準エラー出力に書き出します
+     * @param context handlerに渡すポインタ
+     */
+    explicit LatencyHistogramAllocator(IAllocator* parent, std::uint64_t slow_threshold = 0,
+                                       SlowAllocationHandler handler = nullptr,
+                                       void* context = nullptr)
+        : m_parent(parent), m_shards(make_unique<Shard[]>(parent, SHARD_COUNT)),
+          m_slow_threshold(slow_threshold), m_handler(handler ? handler : &log_slow_allocation),
+          m_context(context) {
+        assert(parent);
+        assert(m_shards);
+    }
+
+    /**
+     * @copydoc IAllocator::allocate
+     */
+    void* allocate(std::size_t size, std::size_t alignment) override {
+        detail::NoAllocCheck no_alloc_check(size, alignment);
+        const auto start = Clock::now();
+        void* ptr = m_parent->allocate(size, alignment);
+        record_allocate(start, size, alignment);
+        W6_MEM_PROBE(allocate, size, alignment, ptr, this);
+        return ptr;
+    }
+
+    /**
+     * @copydoc IAllocator::allocate_tagged
+     */
+    void* allocate_tagged(std::size_t size, std::size_t alignment,
+                          const AllocationSite& site) override {
+        detail::NoAllocCheck no_alloc_check(size, alignment);
+        const auto start = Clock::now();
+        void* ptr = m_parent->allocate_tagged(size, alignment, site);
+        record_allocate(start, size, alignment);
+        W6_MEM_PROBE(allocate, size, alignment, ptr, this);
+        return ptr;
+    }
+
+    /**
+     * @copydoc IAllocator::deallocate
+     */
+    void deallocate(void* ptr) override {
+        W6_MEM_PROBE(deallocate, 0, 0, ptr, this);
+        const auto start = Clock::now();
+        m_parent->deallocate(ptr);
+        record(current_shard().deallocate, elapsed_since(start));
+    }
+
+    /**
+     * @brief 割り当てのレイテンシを全シャード分合算して返します。
+     * @return LatencyHistogram 合算したヒストグラム（ナノ秒）
+     */
+    LatencyHistogram allocate_histogram() const {
+        return merge(&Shard::allocate);
+    }
+
+    /**
+     * @brief 解放のレイテンシを全シャード分合算して返します。
+     * @return LatencyHistogram 合算したヒストグラム（ナノ秒）
+     */
+    LatencyHistogram deallocate_histogram() const {
+        return merge(&Shard::deallocate);
+    }
+
+    /**
+     * @brief しきい値を超えた割り当ての回数を返します。
+     * @return std::uint64_t 回数
+     */
+    std::uint64_t slow_count() const {
+        return m_slow_count.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 記録をすべて消去します。
+     *
+     * 他のスレッドが同時に記録している場合、その記録は残ることがあります。
+     */
+    void reset() {
+        for (std::size_t i = 0; i < SHARD_COUNT; ++i) {
+            Shard& shard = m_shards[i];
+            for (Counters* counters : {&shard.allocate, &shard.deallocate}) {
+                for (auto& bucket : counters->buckets) {
+                    bucket.store(0, std::memory_order_relaxed);
+                }
+                counters->sum.store(0, std::memory_order_relaxed);
+                counters->max.store(0, std::memory_order_relaxed);
+            }
+        }
+        m_slow_count.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static std::uint64_t elapsed_since(Clock::time_point start) {
+        const auto elapsed = Clock::now() - start;
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+
+    // スレッドごとに割り振る番号
+    static std::size_t thread_index() {
+        static std::atomic<std::size_t> s_next_index{0};
+        thread_local const std::size_t t_index = s_next_index.fetch_add(1);
+        return t_index;
+    }
+
+    Shard& current_shard() {
+        return m_shards[thread_index() % SHARD_COUNT];
+    }
+
+    static void record(Counters& counters, std::uint64_t nanoseconds) {
+        counters.buckets[LatencyHistogram::bucket_index(nanoseconds)].fetch_add(
+            1, std::memory_order_relaxed);
+        counters.sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+        std::uint64_t max = counters.max.load(std::memory_order_relaxed);
+        while (nanoseconds > max &&
+               !counters.max.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) {
+        }
+    }
+
+    void record_allocate(Clock::time_point start, std::size_t size, std::size_t alignment) {
+        const std::uint64_t nanoseconds = elapsed_since(start);
+        record(current_shard().allocate, nanoseconds);
+        if (m_slow_threshold && nanoseconds > m_slow_threshold) {
+            m_slow_count.fetch_add(1, std::memory_order_relaxed);
+            SlowAllocation slow;
+            slow.size = size;
+            slow.alignment = alignment;
+            slow.nanoseconds = nanoseconds;
+            slow.frame_count = detail::capture_stack(slow.frames, SlowAllocation::MAX_FRAMES);
+            m_handler(slow, m_context);
+        }
+    }
+
+    LatencyHistogram merge(Counters Shard::*member) const {
+        LatencyHistogram histogram;
+        for (std::size_t i = 0; i < SHARD_COUNT; ++i) {
+            const Counters& counters = m_shards.get()[i].*member;
+            for (std::size_t b = 0; b < LatencyHistogram::BUCKET_COUNT; ++b) {
+                const std::uint64_t count = counters.buckets[b].load(std::memory_order_relaxed);
+                if (count) {
+                    histogram.add_bucket(b, count);
+                }
+            }
+            histogram.add_summary(counters.sum.load(std::memory_order_relaxed),
+                                  counters.max.load(std::memory_order_relaxed));
+        }
+        return histogram;
+    }
+
+    static void log_slow_allocation(const SlowAllocation& allocation, void*) {
+        std::fprintf(stderr, "w6_mem: slow allocation of %zu bytes (alignment %zu): %llu ns\n",
+                     allocation.size, allocation.alignment,
+                     static_cast<unsigned long long>(allocation.nanoseconds));
+        detail::write_stack(allocation.frames, allocation.frame_count);
+    }
+};
+
+} // namespace w6_mem
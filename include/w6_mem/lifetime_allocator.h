@@ -0,0 +1,299 @@
+#pragma once
+
+#include "allocator.h"
+#include "unique_ptr.h"
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace w6_mem {
+
+/**
+ * @brief 呼び出し元ごとに寿命を学習し、短命なオブジェクトと長命なオブジェクトを別のアロケータに置くアロケータ
+ *
+ * 各割り当ての直前にヘッダを置き、呼び出し元と「割り当て時刻」を記録します。時刻はこのアロケータを
+ * 通った割り当ての回数で数え、解放までに進んだ回数がshort_lifetime未満なら短命とみなします。
+ * 呼び出し元ごとに短命と長命の解放回数を数え、DECISION_WINDOW回ごとに短命が3/4以上なら
+ * 短命と予測して、以降の割り当てをshort_lived側に置きます。予測のない呼び出し元は長命として扱います。
+ *
+ * 短命なオブジェクトは同じページにまとまって一斉に空になり、長命なオブジェクトのページは
+ * 短命なオブジェクトの穴が空かずに密なまま保たれるため、断片化が減ります。
+ * 2つのアロケータには、ページ単位でメモリを返却できるSizeClassAllocatorなどを使います。
+ *
+ * 呼び出し元はallocate_tagged()で渡されたもの（W6_MEM_ENABLE_ALLOCATION_SITEを定義した
+ * make_uniqueなど）を使い、呼び出し元のないallocate()ではallocate()の戻りアドレスを使います。
+ * 戻りアドレスはallocate()を直接呼んだ関数のものなので、make_unique（W6_MEM_ENABLE_ALLOCATION_SITE
+ * 未定義時）やStlAllocator、他のアロケータを経由した割り当てでは、それらの中の同じアドレスになり、
+ * 本来の呼び出し元を区別できません。そのような割り当てを学習させるには呼び出し元を渡します。
+ * 呼び出し元の表は呼び出し元のハッシュで分割され、シャードごとのロックで保護されます。
+ *
+ * @note ヘッダの分だけ、1つの割り当てにつき16バイト（アライメントがそれより大きい場合はアライメント分）を
+ *       余分に使います。
+ */
+class LifetimeAllocator : public IAllocator {
+private:
+    // コピー禁止
+    LifetimeAllocator(const LifetimeAllocator&) = delete;
+    LifetimeAllocator& operator=(const LifetimeAllocator&) = delete;
+
+public:
+    /// 短命とみなす寿命（割り当て回数）の既定値
+    static constexpr std::uint64_t DEFAULT_SHORT_LIFETIME = 4096;
+    /// 予測を更新する解放回数
+    static constexpr std::uint32_t DECISION_WINDOW = 64;
+    /// シャードの数
+    static constexpr std::size_t SHARD_COUNT = 16;
+    /// 1シャードあたりに記録できる呼び出し元の数
+    static constexpr std::size_t SHARD_CAPACITY = 256;
+
+private:
+    static constexpr std::uint32_t NO_SITE = 0xFFFFFFFFU;
+    static constexpr std::size_t HEADER_SIZE = 16;
+
+    struct Header {
+        std::uint64_t birth;      ///< 割り当て時の時刻
+        std::uint32_t site;       ///< 呼び出し元の番号（NO_SITEなら記録していない）
+        std::uint16_t offset;     ///< ブロックの先頭から払い出したポインタまでのバイト数
+        std::uint8_t short_lived; ///< short_lived側から割り当てたなら1
+        std::uint8_t reserved;
+    };
+    static_assert(sizeof(Header) == HEADER_SIZE, "unexpected header size");
+
+    struct Site {
+        const void* id = nullptr; ///< ファイル名、または戻りアドレス
+        int line = 0;
+        bool used = false;
+        bool short_lived = false;
+        std::uint32_t short_deaths = 0;
+        std::uint32_t long_deaths = 0;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        Site entries[SHARD_CAPACITY];
+    };
+
+private:
+    IAllocator* m_short_lived = nullptr;
+    IAllocator* m_long_lived = nullptr;
+    std::uint64_t m_short_lifetime = DEFAULT_SHORT_LIFETIME;
+    UniquePtr<Shard[]> m_shards;
+    std::atomic<std::uint64_t> m_clock{0};
+    std::atomic<std::uint64_t> m_short_count{0};
+    std::atomic<std::uint64_t> m_long_count{0};
+    std::atomic<std::uint64_t> m_dropped{0};
+
+public:
+    /**
+     * @brief 2つのアロケータを指定して構築します。
+     *
+     * 呼び出し元の表はlong_lived側から割り当てます。
+     *
+     * @param short_lived 短命と予測した割り当てを行うアロケータ
+     * @param long_lived それ以外の割り当てを行うアロケータ
+     * @param short_lifetime 短命とみなす寿命（その間にこのアロケータを通った割り当ての回数）
+     */
+    LifetimeAllocator(IAllocator* short_lived, IAllocator* long_lived,
+                      std::uint64_t short_lifetime = DEFAULT_SHORT_LIFETIME)
+        : m_short_lived(short_lived), m_long_lived(long_lived), m_short_lifetime(short_lifetime),
+          m_shards(make_unique<Shard[]>(long_lived, SHARD_COUNT)) {
+        assert(short_lived && long_lived);
+        assert(m_shards);
+    }
+
+    /**
+     * @copydoc IAllocator::allocate
+     *
+     * allocate()の戻りアドレスを呼び出し元とします。他の関数やアロケータを経由して呼ばれた場合は
+     * 経由した関数の中のアドレスになるため、区別したい割り当てにはallocate_tagged()を使います。
+     */
+    void* allocate(std::size_t size, std::size_t alignment) override {
+        detail::NoAllocCheck no_alloc_check(size, alignment);
+#if defined(_MSC_VER)
+        return allocate_from(size, alignment, _ReturnAddress(), 0);
+#else
+        return allocate_from(size, alignment, __builtin_return_address(0), 0);
+#endif
+    }
+
+    /**
+     * @copydoc IAllocator::allocate_tagged
+     *
+     * 呼び出し元のファイル名と行番号で学習します。ファイル名がない場合はallocate()と同じく
+     * 戻りアドレスを使います。
+     */
+    void* allocate_tagged(std::size_t size, std::size_t alignment,
+                          const AllocationSite& site) override {
+        detail::NoAllocCheck no_alloc_check(size, alignment);
+        if (!site.file) {
+#if defined(_MSC_VER)
+            return allocate_from(size, alignment, _ReturnAddress(), 0);
+#else
+            return allocate_from(size, alignment, __builtin_return_address(0), 0);
+#endif
+        }
+        return allocate_from(size, alignment, site.file, site.line);
+    }
+
+    /**
+     * @copydoc IAllocator::deallocate
+     */
+    void deallocate(void* ptr) override {
+        if (!ptr) {
+            return;
+        }
+        W6_MEM_PROBE(deallocate, 0, 0, ptr, this);
+        auto* header = reinterpret_cast<Header*>(static_cast<unsigned char*>(ptr) - HEADER_SIZE);
+        if (header->site != NO_SITE) {
+            const std::uint64_t lifetime =
+                m_clock.load(std::memory_order_relaxed) - header->birth;
+            record_death(header->site, lifetime < m_short_lifetime);
+        }
+        IAllocator* allocator = header->short_lived ? m_short_lived : m_long_lived;
+        allocator->deallocate(static_cast<unsigned char*>(ptr) - header->offset);
+    }
+
+    /**
+     * @brief 呼び出し元が短命と予測されているかを返します。
+     * @param site 呼び出し元
+     * @return true 短命と予測されている場合
+     * @return false 長命と予測されている、または記録がない場合
+     */
+    bool predicts_short_lived(const AllocationSite& site) const {
+        const void* id = site.file;
+        const std::size_t h = hash_site(id, site.line);
+        Shard& shard = m_shards.get()[h % SHARD_COUNT];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const std::uint32_t index = find_site(shard, h, id, site.line, false);
+        return index != NO_SITE && shard.entries[index].short_lived;
+    }
+
+    /**
+     * @brief short_lived側に置いた割り当ての回数を返します。
+     * @return std::uint64_t 割り当ての回数
+     */
+    std::uint64_t short_lived_count() const {
+        return m_short_count.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief long_lived側に置いた割り当ての回数を返します。
+     * @return std::uint64_t 割り当ての回数
+     */
+    std::uint64_t long_lived_count() const {
+        return m_long_count.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 呼び出し元の表が満杯で学習できなかった割り当ての回数を返します。
+     * @return std::uint64_t 学習できなかった回数
+     */
+    std::uint64_t dropped() const {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    static std::size_t hash_site(const void* id, int line) {
+        auto h = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(id));
+        h ^= static_cast<std::uint64_t>(static_cast<std::uint32_t>(line)) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+        h *= 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 32;
+        return static_cast<std::size_t>(h);
+    }
+
+    // 線形探索のオープンアドレス法で、シャード内の呼び出し元の位置を探します。
+    // insertなら見つからないときに登録します。shard.mutexを保持した状態で呼び出します
+    static std::uint32_t find_site(Shard& shard, std::size_t h, const void* id, int line,
+                                   bool insert) {
+        std::size_t index = (h / SHARD_COUNT) % SHARD_CAPACITY;
+        for (std::size_t probe = 0; probe < SHARD_CAPACITY; ++probe) {
+            Site& entry = shard.entries[index];
+            if (!entry.used) {
+                if (!insert) {
+                    return NO_SITE;
+                }
+                entry.used = true;
+                entry.id = id;
+                entry.line = line;
+                return static_cast<std::uint32_t>(index);
+            }
+            if (entry.id == id && entry.line == line) {
+                return static_cast<std::uint32_t>(index);
+            }
+            index = (index + 1) % SHARD_CAPACITY;
+        }
+        return NO_SITE;
+    }
+
+    void* allocate_from(std::size_t size, std::size_t alignment, const void* id, int line) {
+        // 呼び出し元を探し、予測を読みます
+        const std::size_t h = hash_site(id, line);
+        const std::size_t shard_index = h % SHARD_COUNT;
+        std::uint32_t site = NO_SITE;
+        bool short_lived = false;
+        {
+            Shard& shard = m_shards[shard_index];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            const std::uint32_t index = find_site(shard, h, id, line, true);
+            if (index != NO_SITE) {
+                site = static_cast<std::uint32_t>(shard_index * SHARD_CAPACITY + index);
+                short_lived = shard.entries[index].short_lived;
+            }
+        }
+        if (site == NO_SITE) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // アライメントを保ったまま、払い出すポインタの直前にヘッダを置きます
+        if (alignment < HEADER_SIZE) {
+            alignment = HEADER_SIZE;
+        }
+        const std::size_t offset = alignment;
+        if (offset > 0xFFFF || size > ~std::size_t{0} - offset) {
+            return nullptr;
+        }
+        IAllocator* allocator = short_lived ? m_short_lived : m_long_lived;
+        auto* block = static_cast<unsigned char*>(allocator->allocate(size + offset, alignment));
+        if (!block) {
+            return nullptr;
+        }
+        (short_lived ? m_short_count : m_long_count).fetch_add(1, std::memory_order_relaxed);
+
+        unsigned char* ptr = block + offset;
+        auto* header = reinterpret_cast<Header*>(ptr - HEADER_SIZE);
+        header->birth = m_clock.fetch_add(1, std::memory_order_relaxed);
+        header->site = site;
+        header->offset = static_cast<std::uint16_t>(offset);
+        header->short_lived = short_lived ? 1 : 0;
+        header->reserved = 0;
+        W6_MEM_PROBE(allocate, size, alignment, ptr, this);
+        return ptr;
+    }
+
+    void record_death(std::uint32_t site, bool short_death) {
+        Shard& shard = m_shards[site / SHARD_CAPACITY];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Site& entry = shard.entries[site % SHARD_CAPACITY];
+        if (short_death) {
+            ++entry.short_deaths;
+        } else {
+            ++entry.long_deaths;
+        }
+        if (entry.short_deaths + entry.long_deaths >= DECISION_WINDOW) {
+            const std::uint32_t total = entry.short_deaths + entry.long_deaths;
+            entry.short_lived = entry.short_deaths * 4 >= total * 3;
+            // 古い傾向の影響を半分ずつ減らします
+            entry.short_deaths /= 2;
+            entry.long_deaths /= 2;
+        }
+    }
+};
+
+} // namespace w6_mem
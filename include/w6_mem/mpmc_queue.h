@@ -0,0 +1,318 @@
+#pragma once
+
+#include "allocator.h"
+#include "unique_ptr.h"
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace w6_mem {
+
+/**
+ * @brief 容量固定のロックフリーなMPMC（複数生産者・複数消費者）キュー
+ *
+ * スロットごとのシーケンス番号で生産者と消費者を同期する方式（Dmitry Vyukov）です。
+ * スロットの配列は構築時にIAllocatorから一度だけ割り当て、以降の操作では割り当てを行いません。
+ * 書き込み位置と読み出し位置、および各スロットはキャッシュラインに揃え、偽共有を避けます。
+ *
+ * try_push_batch()/try_pop_batch()は、位置の更新（CAS）1回で連続したスロットをまとめて確保します。
+ * 確保するのはシーケンス番号がすでに読み書きできる状態のスロットだけで、相手がまだ使っている
+ * スロットに達したらそこで止めるため、ブロックしません。
+ *
+ * UniquePtrを格納する場合はUniquePtrQueueを使います。ムーブだけで所有権を移すため、
+ * キューへの出し入れでオブジェクトのアロケータは呼ばれません。
+ *
+ * @note すべての操作はスレッドセーフです。
+ * @tparam T 要素の型（ムーブ構築できること）
+ */
+template <typename T>
+class MpmcQueue {
+private:
+    // コピー禁止
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+public:
+    /// 位置とスロットを揃えるキャッシュラインのバイト数
+    static constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Slot {
+        std::atomic<std::size_t> sequence;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T* value() {
+            return std::launder(reinterpret_cast<T*>(storage));
+        }
+    };
+
+    struct alignas(CACHE_LINE_SIZE) Position {
+        std::atomic<std::size_t> value{0};
+    };
+
+private:
+    UniquePtr<Slot[]> m_slots;
+    std::size_t m_mask = 0;
+    Position m_enqueue;
+    Position m_dequeue;
+
+public:
+    /**
+     * @brief 構築します。
+     * @param allocator スロットの配列を割り当てるアロケータ
+     * @param capacity 格納できる要素の最大数（2のべき乗に切り上げます）
+     * @note 割り当てに失敗した場合、capacity()は0になり、try_push()は常に失敗します。
+     */
+    MpmcQueue(IAllocator* allocator, std::size_t capacity) {
+        std::size_t size = 2;
+        while (size < capacity) {
+            size *= 2;
+        }
+        m_slots = make_unique<Slot[]>(allocator, size);
+        if (!m_slots) {
+            return;
+        }
+        for (std::size_t i = 0; i < size; ++i) {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        m_mask = size - 1;
+    }
+
+    /**
+     * @brief デストラクタ
+     *
+     * 残っている要素を破棄します。他のスレッドが操作していてはいけません。
+     */
+    ~MpmcQueue() {
+        if (!m_slots) {
+            return;
+        }
+        const std::size_t end = m_enqueue.value.load(std::memory_order_relaxed);
+        for (std::size_t pos = m_dequeue.value.load(std::memory_order_relaxed); pos != end;
+             ++pos) {
+            m_slots[pos & m_mask].value()->~T();
+        }
+    }
+
+    /**
+     * @brief 要素を構築して末尾に追加します。
+     * @param args 要素のコンストラクタに渡す引数
+     * @return bool 追加できた場合はtrue。キューが満杯ならfalse
+     */
+    template <typename... Args>
+    bool try_emplace(Args&&... args) {
+        if (!m_slots) {
+            return false;
+        }
+        std::size_t pos = m_enqueue.value.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = m_slots[pos & m_mask];
+            const std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            const auto diff =
+                static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (m_enqueue.value.compare_exchange_weak(pos, pos + 1,
+                                                          std::memory_order_relaxed)) {
+                    new (slot.storage) T(std::forward<Args>(args)...);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                // 前の周回の要素がまだ取り出されていません
+                return false;
+            } else {
+                pos = m_enqueue.value.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief 要素を末尾に追加します。
+     * @param value 追加する要素
+     * @return bool 追加できた場合はtrue。キューが満杯ならfalse
+     */
+    bool try_push(T&& value) {
+        return try_emplace(std::move(value));
+    }
+
+    /**
+     * @brief 要素を末尾に追加します。
+     * @param value 追加する要素
+     * @return bool 追加できた場合はtrue。キューが満杯ならfalse
+     */
+    bool try_push(const T& value) {
+        return try_emplace(value);
+    }
+
+    /**
+     * @brief 先頭の要素を取り出します。
+     * @param out 取り出した要素のムーブ先
+     * @return bool 取り出せた場合はtrue。キューが空ならfalse
+     */
+    bool try_pop(T& out) {
+        if (!m_slots) {
+            return false;
+        }
+        std::size_t pos = m_dequeue.value.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = m_slots[pos & m_mask];
+            const std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            const auto diff =
+                static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+            if (diff == 0) {
+                if (m_dequeue.value.compare_exchange_weak(pos, pos + 1,
+                                                          std::memory_order_relaxed)) {
+                    take(slot, pos, out);
+                    return true;
+                }
+            } else if (diff < 0) {
+                // この位置の要素はまだ追加されていません
+                return false;
+            } else {
+                pos = m_dequeue.value.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief 複数の要素をまとめて末尾に追加します。
+     *
+     * 空きが足りない場合や、前の周回の要素がまだ取り出し中のスロットがある場合は、
+     * そこまでの要素だけを追加します。
+     *
+     * @param values 追加する要素の配列。追加した要素はムーブされます
+     * @param count 要素の数
+     * @return std::size_t 追加した要素の数
+     */
+    std::size_t try_push_batch(T* values, std::size_t count) {
+        if (!m_slots || count == 0) {
+            return 0;
+        }
+        std::size_t pos = m_enqueue.value.load(std::memory_order_relaxed);
+        std::size_t n = 0;
+        for (;;) {
+            const std::size_t sequence =
+                m_slots[pos & m_mask].sequence.load(std::memory_order_acquire);
+            const auto diff =
+                static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                n = 1 + ready_count(pos + 1, 0, count - 1);
+                if (m_enqueue.value.compare_exchange_weak(pos, pos + n,
+                                                          std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // 前の周回の要素がまだ取り出されていません
+                return 0;
+            } else {
+                pos = m_enqueue.value.load(std::memory_order_relaxed);
+            }
+        }
+
+        // 確保したスロットのシーケンス番号は、自分が書き込むまで変わりません
+        for (std::size_t i = 0; i < n; ++i) {
+            Slot& slot = m_slots[(pos + i) & m_mask];
+            new (slot.storage) T(std::move(values[i]));
+            slot.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        return n;
+    }
+
+    /**
+     * @brief 複数の要素をまとめて先頭から取り出します。
+     *
+     * 要素が足りない場合や、まだ書き込み中のスロットがある場合は、そこまでの要素だけを取り出します。
+     *
+     * @param out 取り出した要素のムーブ先の配列
+     * @param max_count 取り出す要素の最大数
+     * @return std::size_t 取り出した要素の数
+     */
+    std::size_t try_pop_batch(T* out, std::size_t max_count) {
+        if (!m_slots || max_count == 0) {
+            return 0;
+        }
+        std::size_t pos = m_dequeue.value.load(std::memory_order_relaxed);
+        std::size_t n = 0;
+        for (;;) {
+            const std::size_t sequence =
+                m_slots[pos & m_mask].sequence.load(std::memory_order_acquire);
+            const auto diff =
+                static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+            if (diff == 0) {
+                n = 1 + ready_count(pos + 1, 1, max_count - 1);
+                if (m_dequeue.value.compare_exchange_weak(pos, pos + n,
+                                                          std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // この位置の要素はまだ追加されていません
+                return 0;
+            } else {
+                pos = m_dequeue.value.load(std::memory_order_relaxed);
+            }
+        }
+
+        for (std::size_t i = 0; i < n; ++i) {
+            take(m_slots[(pos + i) & m_mask], pos + i, out[i]);
+        }
+        return n;
+    }
+
+    /**
+     * @brief 格納できる要素の最大数を返します。
+     * @return std::size_t 容量
+     */
+    std::size_t capacity() const {
+        return m_slots ? m_mask + 1 : 0;
+    }
+
+    /**
+     * @brief 格納されている要素のおおよその数を返します。
+     *
+     * 他のスレッドが操作している間は、呼び出し直後に変わっている可能性があります。
+     *
+     * @return std::size_t 要素の数
+     */
+    std::size_t size_approx() const {
+        const std::size_t head = m_dequeue.value.load(std::memory_order_relaxed);
+        const std::size_t tail = m_enqueue.value.load(std::memory_order_relaxed);
+        const auto size = static_cast<std::ptrdiff_t>(tail) - static_cast<std::ptrdiff_t>(head);
+        return size > 0 ? static_cast<std::size_t>(size) : 0;
+    }
+
+private:
+    // posから連続して、シーケンス番号が位置+offsetになっている（読み書きできる）スロットの数を
+    // 最大max_countまで数えます。一周すると確保済みのスロットに当たるため、容量を超えません
+    std::size_t ready_count(std::size_t pos, std::size_t offset, std::size_t max_count) const {
+        std::size_t n = 0;
+        while (n < max_count && m_slots[(pos + n) & m_mask].sequence.load(
+                                    std::memory_order_acquire) == pos + n + offset) {
+            ++n;
+        }
+        return n;
+    }
+
+    // 要素をムーブして破棄し、スロットを次の周回の生産者に渡します
+    void take(Slot& slot, std::size_t pos, T& out) {
+        T* value = slot.value();
+        out = std::move(*value);
+        value->~T();
+        slot.sequence.store(pos + m_mask + 1, std::memory_order_release);
+    }
+};
+
+/**
+ * @brief UniquePtrを受け渡すMPMCキュー
+ *
+ * UniquePtrはムーブでポインタとアロケータを移すだけなので、キューへの出し入れでは
+ * オブジェクトのアロケータは呼ばれません。キューに残ったオブジェクトは、キューの破棄時に
+ * それぞれのアロケータで解放されます。
+ *
+ * @tparam T UniquePtrが管理する型
+ */
+template <typename T>
+using UniquePtrQueue = MpmcQueue<UniquePtr<T>>;
+
+} // namespace w6_mem
@@ -0,0 +1,220 @@
+#pragma once
+
+/**
+ * @file no_alloc.h
+ * @brief 割り当てを禁止する区間（NoAllocScope）
+ *
+ * NoAllocScopeの生存中に、同じスレッドでw6_memのアロケータ、StlAllocator、make_unique()などから
+ * メモリを割り当てると違反として扱います。
+ * - 中断モード（NDEBUGを定義しないビルドの既定）: 違反の内容とスタックを標準エラー出力に書き出して
+ *   std::abort()します。
+ * - 計数モード（NDEBUGを定義したビルドの既定）: 違反の回数を数えます。ハンドラを登録した場合は、
+ *   スタックを取得してハンドラに渡します。
+ *
+ * 違反は最も外側の割り当て呼び出しで1回だけ数えられ、その呼び出しの中（親アロケータへの委譲や
+ * ハンドラ）では割り当てが許可されます。割り当て自体は禁止区間の中でも通常どおり行われます。
+ */
+
+#include "stack_trace.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+namespace w6_mem {
+
+/**
+ * @brief NoAllocScopeの中で行われた割り当ての記録
+ */
+struct NoAllocViolation {
+    /// 記録するスタックフレームの最大数
+    static constexpr int MAX_FRAMES = 16;
+
+    std::size_t size = 0;
+    std::size_t alignment = 0;
+    void* frames[MAX_FRAMES] = {}; ///< 割り当てを呼び出したスタック（取得できない環境では空）
+    int frame_count = 0;
+};
+
+/**
+ * @brief 計数モードで違反を受け取る関数
+ *
+ * 違反したスレッドで呼び出されます。ハンドラの中では割り当てが許可されます。
+ *
+ * @param violation 違反の記録
+ * @param context 登録時に渡したポインタ
+ */
+using NoAllocHandler = void (*)(const NoAllocViolation& violation, void* context);
+
+namespace detail {
+
+struct NoAllocState {
+    // 現在のスレッドで有効なNoAllocScopeの数
+    static inline thread_local unsigned s_depth = 0;
+    static inline std::atomic<std::uint64_t> s_violations{0};
+#if defined(NDEBUG)
+    static inline std::atomic<bool> s_abort{false};
+#else
+    static inline std::atomic<bool> s_abort{true};
+#endif
+    static inline std::atomic<NoAllocHandler> s_handler{nullptr};
+    static inline std::atomic<void*> s_context{nullptr};
+};
+
+} // namespace detail
+
+/**
+ * @brief 生存中、現在のスレッドでの割り当てを禁止するRAIIガード
+ *
+ * 入れ子にできます。禁止は最も外側のNoAllocScopeが破棄されるまで続きます。
+ *
+ * 例:
+ * @code
+ * void handle_request(Request& request) {
+ *     w6_mem::NoAllocScope no_alloc;
+ *     // ここで割り当てると違反になります
+ * }
+ * @endcode
+ */
+class NoAllocScope {
+private:
+    // コピー禁止
+    NoAllocScope(const NoAllocScope&) = delete;
+    NoAllocScope& operator=(const NoAllocScope&) = delete;
+
+public:
+    NoAllocScope() {
+        ++detail::NoAllocState::s_depth;
+    }
+
+    ~NoAllocScope() {
+        --detail::NoAllocState::s_depth;
+    }
+};
+
+/**
+ * @brief 生存中、NoAllocScopeによる禁止を一時的に解除するRAIIガード
+ *
+ * 禁止区間の中で、割り当てを許容する冷たい経路（エラーログの出力など）を囲むために使います。
+ */
+class AllowAllocScope {
+private:
+    // コピー禁止
+    AllowAllocScope(const AllowAllocScope&) = delete;
+    AllowAllocScope& operator=(const AllowAllocScope&) = delete;
+
+    unsigned m_saved_depth;
+
+public:
+    AllowAllocScope() : m_saved_depth(detail::NoAllocState::s_depth) {
+        detail::NoAllocState::s_depth = 0;
+    }
+
+    ~AllowAllocScope() {
+        detail::NoAllocState::s_depth = m_saved_depth;
+    }
+};
+
+/**
+ * @brief 現在のスレッドで割り当てが禁止されているかを返します。
+ * @return bool NoAllocScopeの中ならtrue
+ */
+inline bool is_allocation_forbidden() {
+    return detail::NoAllocState::s_depth != 0;
+}
+
+/**
+ * @brief 違反を検出したときに中断するかを設定します。
+ * @param abort trueなら中断モード、falseなら計数モード
+ */
+inline void set_no_alloc_abort(bool abort) {
+    detail::NoAllocState::s_abort.store(abort, std::memory_order_relaxed);
+}
+
+/**
+ * @brief 計数モードで違反を受け取るハンドラを設定します。
+ *
+ * ハンドラを設定すると、違反ごとにスタックを取得してハンドラに渡します。
+ *
+ * @param handler 違反を受け取る関数。nullptrならスタックを取得せず、回数だけを数えます
+ * @param context handlerに渡すポインタ
+ * @note 違反が起こりうるスレッドの実行中に変更してはいけません。
+ */
+inline void set_no_alloc_handler(NoAllocHandler handler, void* context = nullptr) {
+    detail::NoAllocState::s_context.store(context, std::memory_order_relaxed);
+    detail::NoAllocState::s_handler.store(handler, std::memory_order_release);
+}
+
+/**
+ * @brief プロセス全体でこれまでに検出した違反の回数を返します。
+ * @return std::uint64_t 違反の回数
+ */
+inline std::uint64_t no_alloc_violation_count() {
+    return detail::NoAllocState::s_violations.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief 違反の回数を0に戻します。
+ */
+inline void reset_no_alloc_violation_count() {
+    detail::NoAllocState::s_violations.store(0, std::memory_order_relaxed);
+}
+
+namespace detail {
+
+/**
+ * @brief 割り当ての入口に置き、NoAllocScopeの中での割り当てを検出するガード
+ *
+ * 違反を報告した後は、ガードが破棄されるまで禁止を解除します。これにより、親アロケータへの
+ * 委譲で同じ割り当てが重ねて数えられることはありません。
+ */
+class NoAllocCheck {
+private:
+    // コピー禁止
+    NoAllocCheck(const NoAllocCheck&) = delete;
+    NoAllocCheck& operator=(const NoAllocCheck&) = delete;
+
+    unsigned m_saved_depth;
+
+public:
+    NoAllocCheck(std::size_t size, std::size_t alignment)
+        : m_saved_depth(NoAllocState::s_depth) {
+        if (m_saved_depth != 0) {
+            NoAllocState::s_depth = 0;
+            report(size, alignment);
+        }
+    }
+
+    ~NoAllocCheck() {
+        if (m_saved_depth != 0) {
+            NoAllocState::s_depth = m_saved_depth;
+        }
+    }
+
+private:
+    static void report(std::size_t size, std::size_t alignment) {
+        NoAllocState::s_violations.fetch_add(1, std::memory_order_relaxed);
+        const bool abort = NoAllocState::s_abort.load(std::memory_order_relaxed);
+        const NoAllocHandler handler = NoAllocState::s_handler.load(std::memory_order_acquire);
+        if (!abort && !handler) {
+            return;
+        }
+        NoAllocViolation violation;
+        violation.size = size;
+        violation.alignment = alignment;
+        violation.frame_count = capture_stack(violation.frames, NoAllocViolation::MAX_FRAMES);
+        if (abort) {
+            std::fprintf(stderr,
+                         "w6_mem: allocation of %zu bytes (alignment %zu) inside NoAllocScope\n",
+                         size, alignment);
+            write_stack(violation.frames, violation.frame_count);
+            std::abort();
+        }
+        handler(violation, NoAllocState::s_context.load(std::memory_order_relaxed));
+    }
+};
+
+} // namespace detail
+
+} // namespace w6_mem
@@ -0,0 +1,290 @@
+#pragma once
+
+#include "allocator.h"
+#include "budget_allocator.h"
+#include "unique_ptr.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace w6_mem {
+
+/**
+ * @brief 使用バイト数に上限を持つオブジェクトキャッシュ
+ *
+ * 値は専用のBudgetAllocatorから割り当てられ、予算または登録数の上限に達するとCLOCK方式で
+ * 最近参照されていないエントリを追い出します。エントリは線形探索のオープンアドレス法による
+ * 平坦なテーブルに格納されます。
+ *
+ * 値の内部バッファもvalue_allocator()から割り当てれば、その分も予算に含めて計測されます。
+ *
+ * @note スレッドセーフではありません。
+ * @tparam K キーの型
+ * @tparam V 値の型
+ * @tparam Hash キーのハッシュ関数
+ * @tparam KeyEqual キーの比較関数
+ */
+template <typename K, typename V, typename Hash = std::hash<K>,
+          typename KeyEqual = std::equal_to<K>>
+class ObjectCache {
+private:
+    // コピー禁止
+    ObjectCache(const ObjectCache&) = delete;
+    ObjectCache& operator=(const ObjectCache&) = delete;
+
+private:
+    struct Slot {
+        std::size_t hash = 0;
+        V* value = nullptr; // nullptrなら空きスロット
+        bool referenced = false;
+        alignas(K) unsigned char key_storage[sizeof(K)];
+
+        K& key() {
+            return *std::launder(reinterpret_cast<K*>(key_storage));
+        }
+    };
+
+private:
+    BudgetAllocator m_value_allocator;
+    UniquePtr<Slot[]> m_slots;
+    std::size_t m_mask = 0;
+    std::size_t m_max_entries = 0;
+    std::size_t m_size = 0;
+    std::size_t m_clock_hand = 0;
+    std::size_t m_evictions = 0;
+    Hash m_hash;
+    KeyEqual m_key_equal;
+
+public:
+    /**
+     * @brief キャッシュを構築します。
+     * @param allocator テーブルと値の割り当てに使うアロケータ
+     * @param max_entries 登録できるエントリの最大数
+     * @param budget 値に使えるバイト数の上限
+     */
+    ObjectCache(IAllocator* allocator, std::size_t max_entries, std::size_t budget)
+        : m_value_allocator(allocator, budget), m_max_entries(max_entries) {
+        assert(max_entries > 0);
+        // 負荷率を1/2以下に保つ2のべき乗のテーブルサイズ
+        std::size_t table_size = 1;
+        while (table_size < max_entries * 2) {
+            table_size *= 2;
+        }
+        m_slots = make_unique<Slot[]>(allocator, table_size);
+        assert(m_slots);
+        m_mask = table_size - 1;
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    ~ObjectCache() {
+        clear();
+    }
+
+    /**
+     * @brief キーに対応する値を検索します。
+     *
+     * 見つかったエントリには参照ビットが立ち、追い出されにくくなります。
+     *
+     * @param key 検索するキー
+     * @return V* 値へのポインタ。見つからない場合はnullptr
+     */
+    V* find(const K& key) {
+        const std::size_t index = find_index(key, m_hash(key));
+        if (index == npos()) {
+            return nullptr;
+        }
+        m_slots[index].referenced = true;
+        return m_slots[index].value;
+    }
+
+    /**
+     * @brief 値を構築してキャッシュに登録します。
+     *
+     * 既に同じキーが登録されている場合は値を置き換えます。
+     * 予算が足りない場合は、割り当てが成功するまでエントリを追い出します。
+     *
+     * @param key 登録するキー
+     * @param args 値のコンストラクタ引数
+     * @return V* 登録された値へのポインタ。値が予算に収まらない場合はnullptr
+     */
+    template <typename... Args>
+    V* emplace(const K& key, Args&&... args) {
+        erase(key);
+
+        void* memory = m_value_allocator.allocate(sizeof(V), alignof(V));
+        while (!memory) {
+            if (!evict_one()) {
+                return nullptr;
+            }
+            memory = m_value_allocator.allocate(sizeof(V), alignof(V));
+        }
+        while (m_size >= m_max_entries) {
+            evict_one();
+        }
+
+        V* value = new (memory) V(std::forward<Args>(args)...);
+        const std::size_t hash = m_hash(key);
+        std::size_t index = hash & m_mask;
+        while (m_slots[index].value) {
+            index = (index + 1) & m_mask;
+        }
+        Slot& slot = m_slots[index];
+        new (slot.key_storage) K(key);
+        slot.hash = hash;
+        slot.value = value;
+        slot.referenced = false;
+        ++m_size;
+        return value;
+    }
+
+    /**
+     * @brief キーに対応するエントリを削除します。
+     * @param key 削除するキー
+     * @return true 削除した場合
+     * @return false 見つからなかった場合
+     */
+    bool erase(const K& key) {
+        const std::size_t index = find_index(key, m_hash(key));
+        if (index == npos()) {
+            return false;
+        }
+        remove_at(index);
+        return true;
+    }
+
+    /**
+     * @brief すべてのエントリを削除します。
+     */
+    void clear() {
+        for (std::size_t i = 0; i <= m_mask; ++i) {
+            if (m_slots[i].value) {
+                destroy_slot(m_slots[i]);
+            }
+        }
+        m_size = 0;
+    }
+
+    /**
+     * @brief 登録されているエントリ数を返します。
+     * @return std::size_t エントリ数
+     */
+    std::size_t size() const {
+        return m_size;
+    }
+
+    /**
+     * @brief 値が使用しているバイト数を返します。
+     * @return std::size_t 使用バイト数
+     */
+    std::size_t used_bytes() const {
+        return m_value_allocator.used();
+    }
+
+    /**
+     * @brief 値に使えるバイト数の上限を返します。
+     * @return std::size_t 予算（バイト）
+     */
+    std::size_t budget() const {
+        return m_value_allocator.budget();
+    }
+
+    /**
+     * @brief これまでに追い出したエントリ数を返します。
+     * @return std::size_t 追い出したエントリ数
+     */
+    std::size_t evictions() const {
+        return m_evictions;
+    }
+
+    /**
+     * @brief 値の割り当てに使う予算付きアロケータを返します。
+     *
+     * 値が内部バッファをこのアロケータから割り当てると、その分も予算に含めて計測されます。
+     *
+     * @return IAllocator* 予算付きアロケータ
+     */
+    IAllocator* value_allocator() {
+        return &m_value_allocator;
+    }
+
+private:
+    static constexpr std::size_t npos() {
+        return static_cast<std::size_t>(-1);
+    }
+
+    std::size_t find_index(const K& key, std::size_t hash) {
+        std::size_t index = hash & m_mask;
+        while (m_slots[index].value) {
+            Slot& slot = m_slots[index];
+            if (slot.hash == hash && m_key_equal(slot.key(), key)) {
+                return index;
+            }
+            index = (index + 1) & m_mask;
+        }
+        return npos();
+    }
+
+    void destroy_slot(Slot& slot) {
+        std::destroy_at(slot.value);
+        m_value_allocator.deallocate(slot.value);
+        std::destroy_at(&slot.key());
+        slot.value = nullptr;
+    }
+
+    // 後方シフト削除で、探索列を途切れさせずにスロットを空けます
+    void remove_at(std::size_t index) {
+        destroy_slot(m_slots[index]);
+        --m_size;
+
+        std::size_t hole = index;
+        std::size_t next = (hole + 1) & m_mask;
+        while (m_slots[next].value) {
+            Slot& slot = m_slots[next];
+            const std::size_t home = slot.hash & m_mask;
+            // homeが(hole, next]の外にあるエントリは、穴へ移動しても探索列を保てます
+            const bool movable =
+                hole <= next ? (home <= hole || home > next) : (home <= hole && home > next);
+            if (movable) {
+                Slot& target = m_slots[hole];
+                new (target.key_storage) K(std::move(slot.key()));
+                std::destroy_at(&slot.key());
+                target.hash = slot.hash;
+                target.value = slot.value;
+                target.referenced = slot.referenced;
+                slot.value = nullptr;
+                hole = next;
+            }
+            next = (next + 1) & m_mask;
+        }
+    }
+
+    // CLOCK方式で参照ビットの立っていないエントリを1つ追い出します
+    bool evict_one() {
+        if (m_size == 0) {
+            return false;
+        }
+        for (;;) {
+            Slot& slot = m_slots[m_clock_hand];
+            const std::size_t index = m_clock_hand;
+            m_clock_hand = (m_clock_hand + 1) & m_mask;
+            if (!slot.value) {
+                continue;
+            }
+            if (slot.referenced) {
+                slot.referenced = false;
+                continue;
+            }
+            remove_at(index);
+            ++m_evictions;
+            return true;
+        }
+    }
+};
+
+} // namespace w6_mem
@@ -0,0 +1,364 @@
+#pragma once
+
+#include "allocator.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <mutex>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+namespace w6_mem {
+
+/**
+ * @brief PinnedAllocatorの割り当て失敗の理由
+ */
+enum class PinnedError {
+    NONE,                  ///< 失敗していない
+    LIMIT_EXCEEDED,        ///< ロック可能なバイト数の上限（RLIMIT_MEMLOCKなど）を超える
+    MAPPING_FAILED,        ///< OSからのメモリ確保に失敗した
+    LOCK_FAILED,           ///< メモリのロックに失敗した
+    UNSUPPORTED_ALIGNMENT, ///< アライメントがページサイズを超えている
+};
+
+/**
+ * @brief 物理メモリにロックされた（スワップアウトされない）メモリを払い出すアロケータ
+ *
+ * ロック済みのリージョンをOSから確保し（mlock / VirtualLock）、2のべき乗のサイズクラスに
+ * 切り分けて払い出します。解放されたブロックはロックしたままクラスごとの空きリストに戻り、
+ * 再利用されるため、ロックのコストは最初の1回だけです。
+ * リージョンより大きな割り当ては、専用のロック済みマッピングで行います。
+ *
+ * ロックするバイト数の合計がRLIMIT_MEMLOCKまたはコンストラクタで指定した上限を超える場合、
+ * 割り当てはnullptrを返し、last_error()に理由が記録されます。
+ * IAllocatorを実装しているため、他のアロケータの親として使用できます。
+ *
+ * @note allocate()/deallocate()はスレッドセーフです。
+ */
+class PinnedAllocator : public IAllocator {
+private:
+    // コピー禁止
+    PinnedAllocator(const PinnedAllocator&) = delete;
+    PinnedAllocator& operator=(const PinnedAllocator&) = delete;
+
+public:
+    /// 既定のリージョンサイズ
+    static constexpr std::size_t DEFAULT_REGION_SIZE = 1024 * 1024;
+    /// 最小のサイズクラス
+    static constexpr std::size_t MIN_BLOCK_SIZE = 64;
+    /// 最大のサイズクラス（これを超える割り当ては専用のマッピングで行います）
+    static constexpr std::size_t MAX_BLOCK_SIZE = 64 * 1024;
+
+private:
+    static constexpr std::size_t CLASS_COUNT = 11; // 64B .. 64KiB
+    static constexpr std::size_t SYSTEM_PAGE_SIZE = 4096;
+
+    struct Region {
+        Region* next;
+        std::size_t size;
+    };
+    static constexpr std::size_t REGION_HEADER_SIZE = 64;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    // 払い出したポインタの直前に置くヘッダ
+    struct Header {
+        void* block;            ///< サイズクラスのブロック、または専用マッピングの先頭
+        std::size_t block_size; ///< ブロックのバイト数（MAX_BLOCK_SIZEを超えるなら専用マッピング）
+    };
+
+private:
+    mutable std::mutex m_mutex;
+    std::size_t m_region_size = DEFAULT_REGION_SIZE;
+    std::size_t m_max_locked_bytes = 0;
+    std::size_t m_locked_bytes = 0;
+    Region* m_regions = nullptr;
+    Region* m_spare_regions = nullptr;
+    unsigned char* m_cursor = nullptr;
+    unsigned char* m_cursor_end = nullptr;
+    FreeBlock* m_free_lists[CLASS_COUNT] = {};
+    PinnedError m_last_error = PinnedError::NONE;
+
+public:
+    /**
+     * @brief リージョンサイズとロック量の上限を指定して構築します。
+     * @param region_size OSから一度に確保してロックするバイト数
+     * @param max_locked_bytes ロックするバイト数の上限。0ならOSの上限のみに従います
+     */
+    explicit PinnedAllocator(std::size_t region_size = DEFAULT_REGION_SIZE,
+                             std::size_t max_locked_bytes = 0)
+        : m_region_size(round_up(region_size < MAX_BLOCK_SIZE * 2 ? MAX_BLOCK_SIZE * 2
+                                                                  : region_size,
+                                 SYSTEM_PAGE_SIZE)),
+          m_max_locked_bytes(max_locked_bytes) {}
+
+    /**
+     * @brief デストラクタ
+     *
+     * すべてのリージョンのロックを解除し、OSに返却します。
+     */
+    ~PinnedAllocator() override {
+        for (Region* list : {m_regions, m_spare_regions}) {
+            while (list) {
+                Region* next = list->next;
+                unmap(list, list->size);
+                list = next;
+            }
+        }
+    }
+
+    /**
+     * @copydoc IAllocator::allocate
+     *
+     * 失敗した場合はnullptrを返し、理由をlast_error()に記録します。
+     */
+    void* allocate(std::size_t size, std::size_t alignment) override {
+        detail::NoAllocCheck no_alloc_check(size, alignment);
+        if (alignment < alignof(Header)) {
+            alignment = alignof(Header);
+        }
+        if (alignment > SYSTEM_PAGE_SIZE) {
+            set_error(PinnedError::UNSUPPORTED_ALIGNMENT);
+            return nullptr;
+        }
+
+        // ブロック先頭は16バイト境界なので、ヘッダと余白を含めたサイズを確保します
+        const std::size_t needed = size + sizeof(Header) + alignment - alignof(Header);
+        if (needed > MAX_BLOCK_SIZE) {
+            void* ptr = allocate_large(needed, alignment);
+            W6_MEM_PROBE(allocate, size, alignment, ptr, this);
+            return ptr;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const std::size_t class_index = size_class(needed);
+        const std::size_t block_size = MIN_BLOCK_SIZE << class_index;
+        void* block = m_free_lists[class_index];
+        if (block) {
+            m_free_lists[class_index] = m_free_lists[class_index]->next;
+        } else {
+            block = carve(block_size);
+            if (!block) {
+                return nullptr;
+            }
+        }
+        m_last_error = PinnedError::NONE;
+        void* ptr = place(block, block_size, alignment);
+        W6_MEM_PROBE(allocate, size, alignment, ptr, this);
+        return ptr;
+    }
+
+    /**
+     * @copydoc IAllocator::deallocate
+     *
+     * サイズクラスのブロックはロックしたまま再利用のために保持されます。
+     */
+    void deallocate(void* ptr) override {
+        if (!ptr) {
+            return;
+        }
+        W6_MEM_PROBE(deallocate, 0, 0, ptr, this);
+        const Header* header = static_cast<const Header*>(ptr) - 1;
+        void* block = header->block;
+        const std::size_t block_size = header->block_size;
+        if (block_size > MAX_BLOCK_SIZE) {
+            unmap(block, block_size);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_locked_bytes -= block_size;
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const std::size_t class_index = size_class(block_size);
+        auto* free_block = static_cast<FreeBlock*>(block);
+        free_block->next = m_free_lists[class_index];
+        m_free_lists[class_index] = free_block;
+    }
+
+    /**
+     * @brief リージョンをあらかじめ確保してロックします。
+     *
+     * 起動時に呼び出しておくと、以降の割り当てでロックのコストが発生しません。
+     *
+     * @param bytes ロックしておくバイト数
+     * @return true 確保できた場合
+     * @return false 上限に達した、またはロックに失敗した場合（理由はlast_error()）
+     */
+    bool reserve(std::size_t bytes) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const std::size_t usable = m_region_size - REGION_HEADER_SIZE;
+        for (std::size_t reserved = 0; reserved < bytes; reserved += usable) {
+            void* memory = map_locked(m_region_size);
+            if (!memory) {
+                return false;
+            }
+            auto* region = static_cast<Region*>(memory);
+            region->next = m_spare_regions;
+            region->size = m_region_size;
+            m_spare_regions = region;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 現在ロックしているバイト数を返します。
+     * @return std::size_t ロック済みのバイト数
+     */
+    std::size_t locked_bytes() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_locked_bytes;
+    }
+
+    /**
+     * @brief 直前の割り当て操作の結果を返します。
+     * @return PinnedError 失敗の理由。成功していればPinnedError::NONE
+     */
+    PinnedError last_error() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_last_error;
+    }
+
+private:
+    static constexpr std::size_t round_up(std::size_t value, std::size_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    static std::size_t size_class(std::size_t size) {
+        std::size_t class_index = 0;
+        while ((MIN_BLOCK_SIZE << class_index) < size) {
+            ++class_index;
+        }
+        assert(class_index < CLASS_COUNT);
+        return class_index;
+    }
+
+    static void* place(void* block, std::size_t block_size, std::size_t alignment) {
+        auto address = reinterpret_cast<std::uintptr_t>(block) + sizeof(Header);
+        address = round_up(address, alignment);
+        auto* header = reinterpret_cast<Header*>(address) - 1;
+        header->block = block;
+        header->block_size = block_size;
+        return reinterpret_cast<void*>(address);
+    }
+
+    void set_error(PinnedError error) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_last_error = error;
+    }
+
+    // ロック量の上限を返します。0なら無制限です
+    std::size_t lock_limit() const {
+        std::size_t limit = m_max_locked_bytes;
+#if !defined(_WIN32)
+        rlimit rl{};
+        if (getrlimit(RLIMIT_MEMLOCK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+            const auto os_limit = static_cast<std::size_t>(rl.rlim_cur);
+            if (limit == 0 || os_limit < limit) {
+                limit = os_limit;
+            }
+        }
+#endif
+        return limit;
+    }
+
+    // ロック済みのメモリをOSから確保します。m_mutexを保持した状態で呼び出します
+    void* map_locked(std::size_t size) {
+        const std::size_t limit = lock_limit();
+        if (limit != 0 && (size > limit || m_locked_bytes > limit - size)) {
+            m_last_error = PinnedError::LIMIT_EXCEEDED;
+            return nullptr;
+        }
+#if defined(_WIN32)
+        void* memory = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (!memory) {
+            m_last_error = PinnedError::MAPPING_FAILED;
+            return nullptr;
+        }
+        if (!VirtualLock(memory, size)) {
+            VirtualFree(memory, 0, MEM_RELEASE);
+            m_last_error = PinnedError::LOCK_FAILED;
+            return nullptr;
+        }
+#else
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                            -1, 0);
+        if (memory == MAP_FAILED) {
+            m_last_error = PinnedError::MAPPING_FAILED;
+            return nullptr;
+        }
+        // mlockはページを実際に確保してからロックするため、以降ページフォルトは発生しません
+        if (mlock(memory, size) != 0) {
+            munmap(memory, size);
+            m_last_error = PinnedError::LOCK_FAILED;
+            return nullptr;
+        }
+#endif
+        m_locked_bytes += size;
+        return memory;
+    }
+
+    static void unmap(void* memory, std::size_t size) {
+#if defined(_WIN32)
+        VirtualUnlock(memory, size);
+        VirtualFree(memory, 0, MEM_RELEASE);
+#else
+        munlock(memory, size);
+        munmap(memory, size);
+#endif
+    }
+
+    // 予約済みのリージョンがあればそれを使い、なければ新しく確保します
+    bool add_region() {
+        Region* region = m_spare_regions;
+        if (region) {
+            m_spare_regions = region->next;
+        } else {
+            void* memory = map_locked(m_region_size);
+            if (!memory) {
+                return false;
+            }
+            region = static_cast<Region*>(memory);
+            region->size = m_region_size;
+        }
+        region->next = m_regions;
+        m_regions = region;
+        auto* base = reinterpret_cast<unsigned char*>(region);
+        m_cursor = base + REGION_HEADER_SIZE;
+        m_cursor_end = base + region->size;
+        return true;
+    }
+
+    // 現在のリージョンからブロックを切り出します。m_mutexを保持した状態で呼び出します
+    void* carve(std::size_t block_size) {
+        if (static_cast<std::size_t>(m_cursor_end - m_cursor) < block_size && !add_region()) {
+            return nullptr;
+        }
+        void* block = m_cursor;
+        m_cursor += block_size;
+        return block;
+    }
+
+    void* allocate_large(std::size_t needed, std::size_t alignment) {
+        const std::size_t size = round_up(needed, SYSTEM_PAGE_SIZE);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        void* memory = map_locked(size);
+        if (!memory) {
+            return nullptr;
+        }
+        m_last_error = PinnedError::NONE;
+        return place(memory, size, alignment);
+    }
+};
+
+} // namespace w6_mem
@@ -0,0 +1,255 @@
+#pragma once
+
+#include "allocator.h"
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace w6_mem {
+
+/**
+ * @brief 小さな派生オブジェクトをインラインに格納する多態値型
+ *
+ * 派生オブジェクトがインラインバッファに収まる場合はバッファ内に構築し、収まらない場合は
+ * IAllocatorから割り当てます。インラインに格納したオブジェクトは、型ごとに生成される
+ * 再配置関数（ムーブ構築と破棄）を通してムーブされます。RTTIは使用しません。
+ *
+ * @tparam Base 基底クラス
+ * @tparam InlineSize インラインバッファのバイト数
+ * @tparam InlineAlignment インラインバッファのアライメント
+ */
+template <typename Base, std::size_t InlineSize = 4 * sizeof(void*),
+          std::size_t InlineAlignment = alignof(std::max_align_t)>
+class PolyBox {
+private:
+    // コピー禁止
+    PolyBox(const PolyBox&) = delete;
+    PolyBox& operator=(const PolyBox&) = delete;
+
+public:
+    using element_type = Base;
+    using pointer = Base*;
+
+private:
+    // 型ごとの操作表
+    struct Ops {
+        Base* (*relocate)(void* dst, void* src); ///< srcからdstへムーブし、srcを破棄します
+        void (*destroy)(void* object);           ///< オブジェクトを破棄します
+    };
+
+    template <typename Derived>
+    struct OpsFor {
+        static Base* relocate(void* dst, void* src) {
+            auto* source = static_cast<Derived*>(src);
+            auto* object = new (dst) Derived(std::move(*source));
+            std::destroy_at(source);
+            return object;
+        }
+
+        static void destroy(void* object) {
+            std::destroy_at(static_cast<Derived*>(object));
+        }
+
+        static constexpr Ops OPS = {&relocate, &destroy};
+    };
+
+private:
+    alignas(InlineAlignment) unsigned char m_buffer[InlineSize];
+    const Ops* m_ops = nullptr;
+    void* m_object = nullptr;          // 派生オブジェクトの先頭
+    pointer m_ptr = nullptr;           // 基底クラスへのポインタ
+    IAllocator* m_allocator = nullptr; // ヒープに割り当てた場合のみ非nullptr
+
+public:
+    /**
+     * @brief 派生型がインラインに格納されるかを判定します。
+     * @tparam Derived 判定する型
+     */
+    template <typename Derived>
+    static constexpr bool fits_inline() {
+        return sizeof(Derived) <= InlineSize && alignof(Derived) <= InlineAlignment &&
+               std::is_nothrow_move_constructible_v<Derived>;
+    }
+
+    /**
+     * @brief デフォルトコンストラクタ
+     * 空の状態で構築します。
+     */
+    PolyBox() {}
+
+    /**
+     * @brief nullptrからの構築
+     */
+    PolyBox(std::nullptr_t) : PolyBox() {}
+
+    /**
+     * @brief ムーブコンストラクタ
+     */
+    PolyBox(PolyBox&& other) {
+        take(other);
+    }
+
+    /**
+     * @brief デストラクタ
+     */
+    ~PolyBox() {
+        reset();
+    }
+
+    /**
+     * @brief ムーブ代入演算子
+     * @param other ムーブするPolyBox
+     * @return PolyBox& 自身への参照
+     */
+    PolyBox& operator=(PolyBox&& other) {
+        if (this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+
+    /**
+     * @brief 派生オブジェクトを構築します。
+     *
+     * 既に保持しているオブジェクトは破棄されます。
+     *
+     * @tparam Derived 構築する型
+     * @tparam Args コンストラクタ引数の型
+     * @param allocator インラインに収まらない場合に使用するアロケータ
+     * @param args コンストラクタ引数
+     * @return true 構築できた場合
+     * @return false インラインに収まらず、割り当てにも失敗した場合
+     */
+    template <typename Derived, typename... Args>
+    bool emplace(IAllocator* allocator, Args&&... args) {
+        static_assert(std::is_convertible_v<Derived*, Base*>, "Derived must derive from Base");
+        reset();
+
+        if constexpr (fits_inline<Derived>()) {
+            (void)allocator;
+            auto* object = new (m_buffer) Derived(std::forward<Args>(args)...);
+            m_object = object;
+            m_ptr = object;
+        } else {
+            if (!allocator) {
+                return false;
+            }
+            detail::NoAllocCheck no_alloc_check(sizeof(Derived), alignof(Derived));
+            void* memory = allocator->allocate(sizeof(Derived), alignof(Derived));
+            if (!memory) {
+                return false;
+            }
+            auto* object = new (memory) Derived(std::forward<Args>(args)...);
+            m_object = object;
+            m_ptr = object;
+            m_allocator = allocator;
+        }
+        m_ops = &OpsFor<Derived>::OPS;
+        return true;
+    }
+
+    /**
+     * @brief 保持しているオブジェクトを破棄して空にします。
+     */
+    void reset() {
+        if (!m_ops) {
+            return;
+        }
+        m_ops->destroy(m_object);
+        if (m_allocator) {
+            m_allocator->deallocate(m_object);
+        }
+        m_ops = nullptr;
+        m_object = nullptr;
+        m_ptr = nullptr;
+        m_allocator = nullptr;
+    }
+
+    /**
+     * @brief 管理対象オブジェクトへの参照を返します。
+     * @return Base& 管理対象オブジェクト
+     */
+    Base& operator*() const {
+        assert(m_ptr);
+        return *m_ptr;
+    }
+
+    /**
+     * @brief 管理対象オブジェクトへのポインタを返します。
+     * @return pointer 管理対象オブジェクトへのポインタ
+     */
+    pointer operator->() const {
+        return m_ptr;
+    }
+
+    /**
+     * @brief 管理対象オブジェクトへのポインタを取得します。
+     * @return pointer 管理対象オブジェクトへのポインタ
+     */
+    pointer get() const {
+        return m_ptr;
+    }
+
+    /**
+     * @brief オブジェクトを保持しているかどうかを評価します。
+     * @return true オブジェクトを保持している場合
+     * @return false 空の場合
+     */
+    explicit operator bool() const {
+        return !!m_ptr;
+    }
+
+    /**
+     * @brief オブジェクトがインラインバッファに格納されているかを返します。
+     * @return true インラインに格納されている場合
+     * @return false 空、またはヒープに割り当てられている場合
+     */
+    bool is_inline() const {
+        return m_ops && !m_allocator;
+    }
+
+private:
+    // otherの内容を空の自身へ移します
+    void take(PolyBox& other) {
+        if (!other.m_ops) {
+            return;
+        }
+        m_ops = other.m_ops;
+        m_allocator = other.m_allocator;
+        if (m_allocator) {
+            m_object = other.m_object;
+            m_ptr = other.m_ptr;
+        } else {
+            m_ptr = m_ops->relocate(m_buffer, other.m_object);
+            m_object = m_buffer;
+        }
+        other.m_ops = nullptr;
+        other.m_object = nullptr;
+        other.m_ptr = nullptr;
+        other.m_allocator = nullptr;
+    }
+};
+
+/**
+ * @brief PolyBoxを作成するヘルパー関数
+ * @tparam Base 基底クラス
+ * @tparam Derived 構築する型
+ * @tparam InlineSize インラインバッファのバイト数
+ * @tparam Args コンストラクタ引数の型
+ * @param allocator インラインに収まらない場合に使用するアロケータ
+ * @param args コンストラクタ引数
+ * @return PolyBox<Base, InlineSize> 作成されたPolyBox。失敗した場合は空
+ */
+template <typename Base, typename Derived, std::size_t InlineSize = 4 * sizeof(void*),
+          typename... Args>
+inline PolyBox<Base, InlineSize> make_poly_box(IAllocator* allocator, Args&&... args) {
+    PolyBox<Base, InlineSize> box;
+    box.template emplace<Derived>(allocator, std::forward<Args>(args)...);
+    return box;
+}
+
+} // namespace w6_mem
@@ -0,0 +1,54 @@
+#pragma once
+
+/**
+ * @file probes.h
+ * @brief 割り当てイベントのUSDTプローブ
+ *
+ * W6_MEM_ENABLE_USDTを定義すると、sys/sdt.hのUSDT（静的トレースポイント）としてプローブを埋め込みます。
+ * プローブは未使用時にはnop命令1つだけで、bpftraceやperfから実行中のプロセスに後から接続できます。
+ * 定義しない場合、プローブは何も生成しません。
+ *
+ * プロバイダはw6_memで、すべてのプローブは次の4つの引数を持ちます。
+ * - arg0: サイズ（バイト数）
+ * - arg1: アライメント（意味を持たないイベントでは0）
+ * - arg2: ポインタ
+ * - arg3: アロケータID（アロケータのアドレス）
+ *
+ * | プローブ    | サイズ                   | ポインタ               |
+ * |-------------|--------------------------|------------------------|
+ * | allocate    | 要求サイズ               | 割り当てたメモリ       |
+ * | deallocate  | 0                        | 解放するメモリ         |
+ * | arena_reset | リセット前の使用バイト数 | アリーナの先頭         |
+ * | slab_refill | スロットのサイズ         | 新しく使い始めるページ |
+ * | cache_flush | 親に返却したバイト数     | nullptr                |
+ * | trim        | OSに返却したバイト数     | 領域の先頭             |
+ *
+ * allocateとdeallocateは、IAllocatorを実装するすべてのアロケータが発行します。他のアロケータを
+ * 包むアロケータ（BudgetAllocatorやAllocatorStackなど）では包まれた側でも発行されるため、
+ * 1回の割り当てで複数回発火します。特定の段だけを見るにはarg3で絞り込みます。
+ *
+ * 例: bpftrace -e 'usdt:./app:w6_mem:allocate { @[arg3] = hist(arg0); }'
+ */
+
+#include <cstdint>
+
+#if defined(W6_MEM_ENABLE_USDT)
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define W6_MEM_HAS_USDT 1
+#endif
+#endif
+#if !defined(W6_MEM_HAS_USDT)
+#error "W6_MEM_ENABLE_USDT requires <sys/sdt.h> (systemtap-sdt-dev)"
+#endif
+#endif
+
+#if defined(W6_MEM_HAS_USDT)
+#define W6_MEM_PROBE(name, size, alignment, ptr, allocator)                                       \
+    DTRACE_PROBE4(w6_mem, name, static_cast<std::uint64_t>(size),                                \
+                  static_cast<std::uint64_t>(alignment), static_cast<const void*>(ptr),          \
+                  static_cast<const void*>(allocator))
+#else
+#define W6_MEM_PROBE(name, size, alignment, ptr, allocator) ((void)0)
+#endif
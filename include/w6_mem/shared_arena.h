@@ -0,0 +1,400 @@
+#pragma once
+
+#include "allocator.h"
+#include "arena.h"
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+
+namespace w6_mem {
+
+class ArenaPool;
+class ArenaRef;
+
+/**
+ * @brief 参照カウントで寿命が決まるアリーナ
+ *
+ * ArenaRefが保持する参照の数をアトミックに数え、最後の参照が破棄されたときに、
+ * ArenaPoolから払い出したものならリセットしてプールに戻し、そうでなければ破棄します。
+ * スレッドをまたいで受け渡すリクエストのデータを、コピーせずにアリーナに置いたまま渡せます。
+ *
+ * 管理情報とバッファは親アロケータからの1回の割り当てにまとめて置かれます。
+ * SharedArena::create()で単独で作成するか、ArenaPool::acquire()でプールから払い出します。
+ *
+ * @note 参照カウントの操作はスレッドセーフですが、アリーナからの割り当てはスレッドセーフではありません。
+ *       同時に割り当てを行うスレッドは1つにしてください。
+ */
+class SharedArena {
+private:
+    // コピー禁止
+    SharedArena(const SharedArena&) = delete;
+    SharedArena& operator=(const SharedArena&) = delete;
+
+    friend class ArenaPool;
+    friend class ArenaRef;
+
+private:
+    Arena m_arena;
+    std::atomic<std::uint32_t> m_references{0};
+    IAllocator* m_parent = nullptr;
+    ArenaPool* m_pool = nullptr;
+    SharedArena* m_next = nullptr; ///< プールの空きリストの次のアリーナ
+
+    SharedArena(IAllocator* parent, ArenaPool* pool, void* buffer, std::size_t capacity)
+        : m_arena(buffer, capacity), m_parent(parent), m_pool(pool) {}
+
+    ~SharedArena() = default;
+
+public:
+    /**
+     * @brief 親アロケータから新しいアリーナを作成します。
+     *
+     * 最後の参照が破棄されると、アリーナは親アロケータに返却されます。
+     *
+     * @param parent 管理情報とバッファを割り当てるアロケータ
+     * @param capacity バッファのバイト数
+     * @return ArenaRef アリーナへの参照。割り当てに失敗した場合は空の参照
+     */
+    static ArenaRef create(IAllocator* parent, std::size_t capacity);
+
+    /**
+     * @brief アリーナを返します。
+     * @return Arena& アリーナ
+     */
+    Arena& arena() {
+        return m_arena;
+    }
+
+    /**
+     * @brief 現在の参照の数を返します。
+     * @return std::uint32_t 参照の数
+     */
+    std::uint32_t use_count() const {
+        return m_references.load(std::memory_order_relaxed);
+    }
+
+private:
+    static SharedArena* construct(IAllocator* parent, ArenaPool* pool, std::size_t capacity) {
+        // バッファは管理情報の後ろに、Arena::BUFFER_ALIGNMENTに揃えて置きます
+        constexpr std::size_t header_size =
+            (sizeof(SharedArena) + Arena::BUFFER_ALIGNMENT - 1) & ~(Arena::BUFFER_ALIGNMENT - 1);
+        if (capacity > ~std::size_t{0} - header_size) {
+            return nullptr;
+        }
+        void* block = parent->allocate(header_size + capacity, Arena::BUFFER_ALIGNMENT);
+        if (!block) {
+            return nullptr;
+        }
+        return new (block)
+            SharedArena(parent, pool, static_cast<unsigned char*>(block) + header_size, capacity);
+    }
+
+    static void destroy(SharedArena* shared) {
+        IAllocator* parent = shared->m_parent;
+        shared->~SharedArena();
+        parent->deallocate(shared);
+    }
+
+    void add_reference() {
+        m_references.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 最後の参照ならプールに戻すか破棄します
+    inline void release_reference();
+};
+
+/**
+ * @brief SharedArenaへの参照
+ *
+ * コピーすると参照カウントを1つ増やし（アトミック操作1回）、ムーブではカウントを変えません。
+ * スレッドへの受け渡しはムーブで行えば参照カウントの操作は不要です。
+ * ->でアリーナ（Arena）のメンバにアクセスできます。
+ */
+class ArenaRef {
+private:
+    SharedArena* m_shared = nullptr;
+
+public:
+    /**
+     * @brief 空の参照を構築します。
+     */
+    ArenaRef() = default;
+
+    /**
+     * @brief 参照を受け取って構築します。参照カウントは呼び出し元で増やしておきます。
+     * @param shared 参照するアリーナ
+     */
+    explicit ArenaRef(SharedArena* shared) : m_shared(shared) {}
+
+    /**
+     * @brief コピーコンストラクタ。参照カウントを1つ増やします。
+     * @param other コピー元
+     */
+    ArenaRef(const ArenaRef& other) : m_shared(other.m_shared) {
+        if (m_shared) {
+            m_shared->add_reference();
+        }
+    }
+
+    /**
+     * @brief ムーブコンストラクタ。参照カウントは変わりません。
+     * @param other ムーブ元。空の参照になります
+     */
+    ArenaRef(ArenaRef&& other) noexcept : m_shared(other.m_shared) {
+        other.m_shared = nullptr;
+    }
+
+    /**
+     * @brief デストラクタ。参照を手放します。
+     */
+    ~ArenaRef() {
+        reset();
+    }
+
+    /**
+     * @brief コピー代入演算子
+     * @param other コピー元
+     * @return ArenaRef& 自身への参照
+     */
+    ArenaRef& operator=(const ArenaRef& other) {
+        if (m_shared != other.m_shared) {
+            ArenaRef(other).swap(*this);
+        }
+        return *this;
+    }
+
+    /**
+     * @brief ムーブ代入演算子
+     * @param other ムーブ元。空の参照になります
+     * @return ArenaRef& 自身への参照
+     */
+    ArenaRef& operator=(ArenaRef&& other) noexcept {
+        if (this != &other) {
+            reset();
+            m_shared = other.m_shared;
+            other.m_shared = nullptr;
+        }
+        return *this;
+    }
+
+    /**
+     * @brief 参照を手放して空にします。
+     *
+     * 最後の参照だった場合、アリーナはプールに戻るか破棄されます。
+     */
+    void reset() {
+        if (m_shared) {
+            SharedArena* shared = m_shared;
+            m_shared = nullptr;
+            shared->release_reference();
+        }
+    }
+
+    /**
+     * @brief 参照を交換します。
+     * @param other 交換相手
+     */
+    void swap(ArenaRef& other) noexcept {
+        std::swap(m_shared, other.m_shared);
+    }
+
+    /**
+     * @brief 参照しているアリーナを返します。
+     * @return Arena* アリーナ。空の参照ならnullptr
+     */
+    Arena* get() const {
+        return m_shared ? &m_shared->arena() : nullptr;
+    }
+
+    /**
+     * @brief アリーナのメンバにアクセスします。
+     * @return Arena* アリーナ
+     */
+    Arena* operator->() const {
+        assert(m_shared);
+        return &m_shared->arena();
+    }
+
+    /**
+     * @brief アリーナを返します。
+     * @return Arena& アリーナ
+     */
+    Arena& operator*() const {
+        assert(m_shared);
+        return m_shared->arena();
+    }
+
+    /**
+     * @brief 参照の数を返します。
+     * @return std::uint32_t 参照の数。空の参照なら0
+     */
+    std::uint32_t use_count() const {
+        return m_shared ? m_shared->use_count() : 0;
+    }
+
+    /**
+     * @brief 有効な参照かを返します。
+     */
+    explicit operator bool() const {
+        return m_shared != nullptr;
+    }
+};
+
+/**
+ * @brief 同じ容量のSharedArenaを再利用するプール
+ *
+ * 最後の参照が破棄されたアリーナはリセットしてプールに戻り、次のacquire()で再利用されます。
+ * プールに保持するアリーナの数がmax_cachedを超える場合は、親アロケータに返却します。
+ *
+ * @note acquire()とアリーナの返却はスレッドセーフです。
+ *       プールは、払い出したすべてのアリーナの参照が破棄されるまで破棄してはいけません。
+ */
+class ArenaPool {
+private:
+    // コピー禁止
+    ArenaPool(const ArenaPool&) = delete;
+    ArenaPool& operator=(const ArenaPool&) = delete;
+
+    friend class SharedArena;
+
+public:
+    /// プールに保持するアリーナの数の既定値
+    static constexpr std::size_t DEFAULT_MAX_CACHED = 64;
+
+private:
+    IAllocator* m_parent = nullptr;
+    std::size_t m_arena_capacity = 0;
+    std::size_t m_max_cached = DEFAULT_MAX_CACHED;
+    mutable std::mutex m_mutex;
+    SharedArena* m_free = nullptr;
+    std::size_t m_cached = 0;
+    std::size_t m_outstanding = 0;
+
+public:
+    /**
+     * @brief 構築します。
+     * @param parent アリーナを割り当てるアロケータ
+     * @param arena_capacity 1つのアリーナのバッファのバイト数
+     * @param max_cached プールに保持するアリーナの最大数
+     */
+    ArenaPool(IAllocator* parent, std::size_t arena_capacity,
+              std::size_t max_cached = DEFAULT_MAX_CACHED)
+        : m_parent(parent), m_arena_capacity(arena_capacity), m_max_cached(max_cached) {
+        assert(parent);
+    }
+
+    /**
+     * @brief デストラクタ
+     *
+     * プールに保持しているアリーナを親アロケータに返却します。
+     */
+    ~ArenaPool() {
+        assert(m_outstanding == 0);
+        while (m_free) {
+            SharedArena* next = m_free->m_next;
+            SharedArena::destroy(m_free);
+            m_free = next;
+        }
+    }
+
+    /**
+     * @brief アリーナを払い出します。
+     *
+     * プールに空のアリーナがあれば再利用し、なければ親アロケータから作成します。
+     *
+     * @return ArenaRef アリーナへの参照。割り当てに失敗した場合は空の参照
+     */
+    ArenaRef acquire() {
+        SharedArena* shared = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_free) {
+                shared = m_free;
+                m_free = shared->m_next;
+                --m_cached;
+            }
+            ++m_outstanding;
+        }
+        if (!shared) {
+            shared = SharedArena::construct(m_parent, this, m_arena_capacity);
+            if (!shared) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_outstanding;
+                return ArenaRef();
+            }
+        }
+        shared->m_next = nullptr;
+        shared->m_references.store(1, std::memory_order_relaxed);
+        return ArenaRef(shared);
+    }
+
+    /**
+     * @brief プールに保持しているアリーナの数を返します。
+     * @return std::size_t アリーナの数
+     */
+    std::size_t cached() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_cached;
+    }
+
+    /**
+     * @brief 払い出し中のアリーナの数を返します。
+     * @return std::size_t アリーナの数
+     */
+    std::size_t outstanding() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_outstanding;
+    }
+
+    /**
+     * @brief 1つのアリーナのバッファのバイト数を返します。
+     * @return std::size_t 容量
+     */
+    std::size_t arena_capacity() const {
+        return m_arena_capacity;
+    }
+
+private:
+    void recycle(SharedArena* shared) {
+        shared->m_arena.reset();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            --m_outstanding;
+            if (m_cached < m_max_cached) {
+                shared->m_next = m_free;
+                m_free = shared;
+                ++m_cached;
+                return;
+            }
+        }
+        SharedArena::destroy(shared);
+    }
+};
+
+inline ArenaRef SharedArena::create(IAllocator* parent, std::size_t capacity) {
+    assert(parent);
+    SharedArena* shared = construct(parent, nullptr, capacity);
+    if (!shared) {
+        return ArenaRef();
+    }
+    shared->m_references.store(1, std::memory_order_relaxed);
+    return ArenaRef(shared);
+}
+
+inline void SharedArena::release_reference() {
+    // 最後の参照を手放したスレッドが、他のスレッドによるアリーナへの書き込みを観測できるようにします
+    if (m_references.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+    if (m_pool) {
+        m_pool->recycle(this);
+    } else {
+        destroy(this);
+    }
+}
+
+} // namespace w6_mem
@@ -0,0 +1,222 @@
+#pragma once
+
+#include "allocator.h"
+#include "unique_ptr.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace w6_mem {
+
+/**
+ * @brief 呼び出し元ごとの割り当て統計
+ */
+struct SiteStat {
+    AllocationSite site;
+    std::uint64_t count = 0;
+    std::uint64_t bytes = 0;
+};
+
+/**
+ * @brief 呼び出し元ごとに割り当て回数とバイト数を集計するアロケータ
+ *
+ * allocate_tagged()で渡された呼び出し元をキーに、親アロケータへの割り当てを集計します。
+ * 集計表は呼び出し元のハッシュで分割（シャーディング）され、シャードごとのロックで保護されます。
+ * 呼び出し元を伴わないallocate()は、fileがnullptrの呼び出し元として集計されます。
+ *
+ * make_uniqueで呼び出し元を捕捉するには、W6_MEM_ENABLE_ALLOCATION_SITEを定義します。
+ */
+class SiteStatsAllocator : public IAllocator {
+private:
+    // コピー禁止
+    SiteStatsAllocator(const SiteStatsAllocator&) = delete;
+    SiteStatsAllocator& operator=(const SiteStatsAllocator&) = delete;
+
+public:
+    /// シャードの数
+    static constexpr std::size_t SHARD_COUNT = 16;
+    /// 1シャードあたりに記録できる呼び出し元の数
+    static constexpr std::size_t SHARD_CAPACITY = 256;
+
+private:
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        SiteStat entries[SHARD_CAPACITY];
+        std::uint64_t dropped = 0;
+    };
+
+private:
+    IAllocator* m_parent = nullptr;
+    UniquePtr<Shard[]> m_shards;
+
+public:
+    /**
+     * @brief 親アロケータを指定して構築します。
+     *
+     * 集計表も親アロケータから割り当てます。
+     *
+     * @param parent 実際の割り当てを行うアロケータ
+     */
+    explicit SiteStatsAllocator(IAllocator* parent)
+        : m_parent(parent), m_shards(make_unique<Shard[]>(parent, SHARD_COUNT)) {
+        assert(parent);
+        assert(m_shards);
+    }
+
+    /**
+     * @copydoc IAllocator::allocate
+     */
+    void* allocate(std::size_t size, std::size_t alignment) override {
+        return allocate_tagged(size, alignment, AllocationSite{});
+    }
+
+    /**
+     * @copydoc IAllocator::allocate_tagged
+     */
+    void* allocate_tagged(std::size_t size, std::size_t alignment,
+                          const AllocationSite& site) override {
+        detail::NoAllocCheck no_alloc_check(size, alignment);
+        void* ptr = m_parent->allocate_tagged(size, alignment, site);
+        if (ptr) {
+            record(site, size);
+        }
+        W6_MEM_PROBE(allocate, size, alignment, ptr, this);
+        return ptr;
+    }
+
+    /**
+     * @copydoc IAllocator::deallocate
+     */
+    void deallocate(void* ptr) override {
+        W6_MEM_PROBE(deallocate, 0, 0, ptr, this);
+        m_parent->deallocate(ptr);
+    }
+
+    /**
+     * @brief 全呼び出し元の統計を取得します。
+     *
+     * 翻訳単位ごとに異なるアドレスを持つ同名のファイル名は、1つの呼び出し元にまとめられます。
+     *
+     * @return std::vector<SiteStat> 呼び出し元ごとの統計
+     */
+    std::vector<SiteStat> snapshot() const {
+        std::vector<SiteStat> result;
+        for (std::size_t i = 0; i < SHARD_COUNT; ++i) {
+            Shard& shard = m_shards.get()[i];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (const SiteStat& entry : shard.entries) {
+                if (entry.count == 0) {
+                    continue;
+                }
+                auto it = std::find_if(result.begin(), result.end(), [&](const SiteStat& stat) {
+                    return same_site(stat.site, entry.site);
+                });
+                if (it != result.end()) {
+                    it->count += entry.count;
+                    it->bytes += entry.bytes;
+                } else {
+                    result.push_back(entry);
+                }
+            }
+        }
+        return result;
+    }
+
+    /**
+     * @brief 割り当てバイト数の多い順に呼び出し元を返します。
+     * @param n 返す呼び出し元の最大数
+     * @return std::vector<SiteStat> 上位の呼び出し元
+     */
+    std::vector<SiteStat> top_by_bytes(std::size_t n) const {
+        return top(n, [](const SiteStat& lhs, const SiteStat& rhs) {
+            return lhs.bytes > rhs.bytes;
+        });
+    }
+
+    /**
+     * @brief 割り当て回数の多い順に呼び出し元を返します。
+     * @param n 返す呼び出し元の最大数
+     * @return std::vector<SiteStat> 上位の呼び出し元
+     */
+    std::vector<SiteStat> top_by_count(std::size_t n) const {
+        return top(n, [](const SiteStat& lhs, const SiteStat& rhs) {
+            return lhs.count > rhs.count;
+        });
+    }
+
+    /**
+     * @brief 集計表が満杯で記録できなかった割り当ての回数を返します。
+     * @return std::uint64_t 記録できなかった回数
+     */
+    std::uint64_t dropped() const {
+        std::uint64_t total = 0;
+        for (std::size_t i = 0; i < SHARD_COUNT; ++i) {
+            Shard& shard = m_shards.get()[i];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            total += shard.dropped;
+        }
+        return total;
+    }
+
+private:
+    static bool same_site(const AllocationSite& lhs, const AllocationSite& rhs) {
+        if (lhs.line != rhs.line) {
+            return false;
+        }
+        if (lhs.file == rhs.file) {
+            return true;
+        }
+        return lhs.file && rhs.file && std::strcmp(lhs.file, rhs.file) == 0;
+    }
+
+    static std::size_t hash_site(const AllocationSite& site) {
+        auto h = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(site.file));
+        h ^= static_cast<std::uint64_t>(static_cast<std::uint32_t>(site.line)) *
+             0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+        h *= 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 32;
+        return static_cast<std::size_t>(h);
+    }
+
+    void record(const AllocationSite& site, std::size_t size) {
+        const std::size_t h = hash_site(site);
+        Shard& shard = m_shards[h % SHARD_COUNT];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        // 線形探索のオープンアドレス法。ファイル名はアドレスで比較します。
+        std::size_t index = (h / SHARD_COUNT) % SHARD_CAPACITY;
+        for (std::size_t probe = 0; probe < SHARD_CAPACITY; ++probe) {
+            SiteStat& entry = shard.entries[index];
+            if (entry.count == 0) {
+                entry.site = site;
+                entry.count = 1;
+                entry.bytes = size;
+                return;
+            }
+            if (entry.site.file == site.file && entry.site.line == site.line) {
+                ++entry.count;
+                entry.bytes += size;
+                return;
+            }
+            index = (index + 1) % SHARD_CAPACITY;
+        }
+        ++shard.dropped;
+    }
+
+    template <typename Compare>
+    std::vector<SiteStat> top(std::size_t n, Compare compare) const {
+        std::vector<SiteStat> stats = snapshot();
+        n = std::min(n, stats.size());
+        std::partial_sort(stats.begin(), stats.begin() + static_cast<std::ptrdiff_t>(n),
+                          stats.end(), compare);
+        stats.resize(n);
+        return stats;
+    }
+};
+
+} // namespace w6_mem
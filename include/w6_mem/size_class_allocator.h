@@ -0,0 +1,1054 @@
+#pragma once
+
+#include "allocator.h"
+#include "stl_allocator.h"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <intrin.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace w6_mem {
+
+/**
+ * @brief サイズクラスごとの使用状況
+ *
+ * SizeClassAllocator::save_profile()でファイルに書き出し、次回の起動時に
+ * SizeClassAllocator::warm_start()でページを先に確保するために使います。
+ */
+struct SizeClassUsage {
+    std::size_t slot_size = 0;     ///< スロットのバイト数
+    std::size_t peak_slots = 0;    ///< 同時に使われたスロット数の最大値
+    std::size_t typical_slots = 0; ///< 使われているスロット数の平均的な値
+};
+
+/**
+ * @brief サイズクラス方式のスモールオブジェクトアロケータ
+ *
+ * 予約した仮想アドレス領域を4KiBのページに分け、ページごとに1つのサイズクラスのスロットを
+ * 払い出します。ページの管理情報（スロットのビットマップなど）はページの外に置かれます。
+ * MAX_SMALL_SIZEを超える割り当て、領域を使い切った後の割り当ては親アロケータに委譲します。
+ *
+ * meshableを指定して構築すると、領域をmemfdで裏付けます。この場合compact()で、
+ * 生存スロットが重ならない同じサイズクラスのページ同士を1つの物理ページにまとめ（メッシュ）、
+ * ポインタを変えずに物理メモリを回収できます（Linuxのみ）。
+ *
+ * set_adaptive(true)で適応モードにすると、要求サイズを標本化し、ADAPT_INTERVAL個の標本ごとに
+ * 内部断片化（スロットの余りとページ末尾の余り）が最小になるサイズクラスの組を計算し直します。
+ * 新しいサイズクラスは以降に使い始めるページから適用され、既存のページは新しい組に同じ
+ * スロットサイズがあればそのまま引き継がれ、なければ新たな割り当てに使われずに空になるのを待ちます。
+ *
+ * サイズクラスごとの使用状況（最大と平均的なスロット数）をsave_profile()でファイルに書き出せます。
+ * 起動時にwarm_start()でそのファイルを読むと、必要なページを先に確保して物理メモリを割り当てておくため、
+ * 定常状態に達するまでのページ補充のコストを払わずに済みます。
+ *
+ * @note allocate()/deallocate()はスレッドセーフです。
+ */
+class SizeClassAllocator : public IAllocator {
+private:
+    // コピー禁止
+    SizeClassAllocator(const SizeClassAllocator&) = delete;
+    SizeClassAllocator& operator=(const SizeClassAllocator&) = delete;
+
+public:
+    /// ページのバイト数
+    static constexpr std::size_t SLAB_SIZE = 4096;
+    /// サイズクラスで扱う最大の割り当てサイズ
+    static constexpr std::size_t MAX_SMALL_SIZE = 1024;
+    /// 既定の領域サイズ
+    static constexpr std::size_t DEFAULT_MAX_BYTES = 256 * 1024 * 1024;
+    /// 適応モードで要求サイズを標本化する間隔（この回数の割り当てごとに1回）
+    static constexpr std::uint32_t ADAPT_SAMPLE_PERIOD = 64;
+    /// 適応モードでサイズクラスを計算し直す標本数
+    static constexpr std::uint32_t ADAPT_INTERVAL = 4096;
+    /// 平均的なスロット数を求める指数移動平均の重み（新しい値の比率は1/TYPICAL_WEIGHT）
+    static constexpr std::size_t TYPICAL_WEIGHT = 16;
+
+private:
+    static constexpr std::size_t MIN_SLOT_SIZE = 16;
+    static constexpr std::size_t MAX_CLASS_COUNT = 32;
+    static constexpr std::size_t BITMAP_WORDS = SLAB_SIZE / MIN_SLOT_SIZE / 64;
+    static constexpr std::uint32_t NONE = 0xFFFFFFFFU;
+    static constexpr std::size_t SIZE_UNITS = MAX_SMALL_SIZE / MIN_SLOT_SIZE;
+
+    static constexpr std::size_t DEFAULT_CLASS_SIZES[] = {
+        16,  32,  48,  64,  80,  96,  112, 128, 160, 192,
+        224, 256, 320, 384, 448, 512, 640, 768, 896, 1024,
+    };
+    static constexpr std::size_t DEFAULT_CLASS_COUNT =
+        sizeof(DEFAULT_CLASS_SIZES) / sizeof(DEFAULT_CLASS_SIZES[0]);
+
+    enum class PageState : std::uint8_t {
+        FREE,    ///< 未使用
+        ACTIVE,  ///< スロットを払い出している
+        MESHED,  ///< 別のページの物理メモリを共有している（mesh_ownerが管理）
+        RETIRED, ///< 割り当て直しに失敗したため、二度と使わない
+    };
+
+    struct Page {
+        std::uint64_t bitmap[BITMAP_WORDS];
+        std::uint32_t slot_size;
+        std::uint32_t class_index;
+        std::uint32_t prev;       ///< 部分使用リストの前のページ
+        std::uint32_t next;       ///< 部分使用リスト、または空きページリストの次のページ
+        std::uint32_t mesh_owner; ///< MESHEDの場合、物理メモリを管理するページ
+        std::uint32_t mesh_next;  ///< 同じ物理メモリを共有するページの連結リスト
+        std::uint16_t slot_count;
+        std::uint16_t live;
+        PageState state;
+        bool resident;   ///< 自身のページが物理メモリを持っている
+        bool in_partial; ///< 部分使用リストに入っている
+        bool draining;   ///< 現在のサイズクラスの組にないスロットサイズで、空になるのを待っている
+    };
+
+private:
+    mutable std::mutex m_mutex;
+    IAllocator* m_parent = nullptr;
+    unsigned char* m_base = nullptr;
+    std::size_t m_max_bytes = 0;
+    Page* m_pages = nullptr;
+    std::uint32_t m_page_count = 0;
+    std::uint32_t m_fresh_page = 0;
+    std::uint32_t m_free_pages = NONE;
+    std::size_t m_resident_pages = 0;
+    int m_fd = -1;
+
+    std::size_t m_class_count = 0;
+    std::uint32_t m_class_sizes[MAX_CLASS_COUNT] = {};
+    std::uint32_t m_partial[MAX_CLASS_COUNT] = {};
+    std::uint8_t m_class_lookup[SIZE_UNITS + 1] = {};
+
+    bool m_adaptive = false;
+    std::uint32_t m_sample_countdown = ADAPT_SAMPLE_PERIOD;
+    std::uint32_t m_sample_count = 0;
+    std::uint64_t m_size_samples[SIZE_UNITS + 1] = {}; ///< MIN_SLOT_SIZE単位の要求サイズの度数
+    std::size_t m_class_generation = 0;
+
+    std::size_t m_class_live[MAX_CLASS_COUNT] = {};
+    std::size_t m_class_peak[MAX_CLASS_COUNT] = {};
+    std::size_t m_class_typical[MAX_CLASS_COUNT] = {}; ///< 平均のTYPICAL_WEIGHT倍
+
+public:
+    /**
+     * @brief 構築します。
+     * @param parent 大きな割り当てを委譲するアロケータ
+     * @param max_bytes 予約する領域のバイト数
+     * @param meshable trueならmemfdで領域を裏付け、compact()によるメッシュを可能にします
+     */
+    explicit SizeClassAllocator(IAllocator* parent, std::size_t max_bytes = DEFAULT_MAX_BYTES,
+                                bool meshable = false)
+        : m_parent(parent) {
+        assert(parent);
+        m_page_count = static_cast<std::uint32_t>(max_bytes / SLAB_SIZE);
+        m_max_bytes = static_cast<std::size_t>(m_page_count) * SLAB_SIZE;
+        set_class_sizes(DEFAULT_CLASS_SIZES, DEFAULT_CLASS_COUNT);
+        for (std::uint32_t& head : m_partial) {
+            head = NONE;
+        }
+        map_region(meshable);
+    }
+
+    /**
+     * @brief デストラクタ
+     *
+     * 領域をOSに返却します。親アロケータに委譲した割り当ては解放されません。
+     */
+    ~SizeClassAllocator() override {
+        unmap_region();
+    }
+
+    /**
+     * @copydoc IAllocator::allocate
+     */
+    void* allocate(std::size_t size, std::size_t alignment) override {
+        detail::NoAllocCheck no_alloc_check(size, alignment);
+        if (size <= MAX_SMALL_SIZE && alignment <= SLAB_SIZE) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_adaptive && --m_sample_countdown == 0) {
+                m_sample_countdown = ADAPT_SAMPLE_PERIOD;
+                record_sample(size, alignment);
+            }
+            const std::uint32_t class_index = find_class(size, alignment);
+            void* ptr = class_index != NONE ? allocate_small(class_index) : nullptr;
+            if (ptr) {
+                W6_MEM_PROBE(allocate, size, alignment, ptr, this);
+                return ptr;
+            }
+        }
+        return m_parent->allocate(size, alignment);
+    }
+
+    /**
+     * @copydoc IAllocator::deallocate
+     */
+    void deallocate(void* ptr) override {
+        if (!ptr) {
+            return;
+        }
+        if (!owns(ptr)) {
+            m_parent->deallocate(ptr);
+            return;
+        }
+        W6_MEM_PROBE(deallocate, 0, 0, ptr, this);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        deallocate_small(ptr);
+    }
+
+    /**
+     * @brief 生存スロットが重ならないページ同士をメッシュして物理メモリを回収します。
+     *
+     * 一方のページの生存スロットをもう一方の物理ページにコピーし、両方の仮想ページを
+     * 同じ物理ページに割り当て直します。ポインタは変わりません。
+     * 呼び出し中は、このアロケータから割り当てたオブジェクトへ他のスレッドが書き込まないでください。
+     * 割り当て直し（mmap）に失敗した場合は、そのメッシュを取り消して終了します。
+     *
+     * @return std::size_t 回収した物理ページ数。メッシュできない構成では常に0
+     */
+    std::size_t compact() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_fd < 0) {
+            return 0;
+        }
+
+        constexpr std::size_t MAX_PROBES = 64;
+        std::size_t released = 0;
+        std::vector<std::uint32_t, StlAllocator<std::uint32_t>> candidates(m_parent);
+        for (std::size_t class_index = 0; class_index < m_class_count; ++class_index) {
+            candidates.clear();
+            for (std::uint32_t i = m_partial[class_index]; i != NONE; i = m_pages[i].next) {
+                candidates.push_back(i);
+            }
+            for (std::size_t i = 0; i < candidates.size(); ++i) {
+                const std::uint32_t dst = candidates[i];
+                const std::size_t last = std::min(candidates.size(), i + 1 + MAX_PROBES);
+                for (std::size_t j = i + 1; j < last && m_pages[dst].in_partial; ++j) {
+                    const std::uint32_t src = candidates[j];
+                    // warm_start()で確保した空のページは、物理メモリを保つためにメッシュしません
+                    if (m_pages[src].state == PageState::ACTIVE && m_pages[src].live != 0 &&
+                        can_mesh(dst, src)) {
+                        if (!mesh(dst, src)) {
+                            // マッピング数の上限などで失敗した場合、続けても失敗します
+                            return released;
+                        }
+                        ++released;
+                    }
+                }
+            }
+        }
+        return released;
+    }
+
+    /**
+     * @brief 未使用ページの物理メモリをOSに返却します。
+     * @return std::size_t 返却したページ数
+     */
+    std::size_t trim() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::size_t released = 0;
+        for (std::uint32_t i = m_free_pages; i != NONE; i = m_pages[i].next) {
+            Page& page = m_pages[i];
+            if (page.resident) {
+                release_memory(i);
+                page.resident = false;
+                --m_resident_pages;
+                ++released;
+            }
+        }
+        W6_MEM_PROBE(trim, released * SLAB_SIZE, 0, m_base, this);
+        return released;
+    }
+
+    /**
+     * @brief 指定されたポインタがこのアロケータの領域を指しているかを判定します。
+     * @param ptr 判定するポインタ
+     * @return true 領域内の場合
+     * @return false それ以外の場合
+     */
+    bool owns(const void* ptr) const {
+        const auto* p = static_cast<const unsigned char*>(ptr);
+        return m_base && m_base <= p && p < m_base + m_max_bytes;
+    }
+
+    /**
+     * @brief 物理メモリを持っているページ数を返します。
+     * @return std::size_t ページ数
+     */
+    std::size_t resident_pages() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_resident_pages;
+    }
+
+    /**
+     * @brief compact()によるメッシュが可能かを返します。
+     * @return true memfdで裏付けられている場合
+     * @return false それ以外の場合
+     */
+    bool is_meshable() const {
+        return m_fd >= 0;
+    }
+
+    /**
+     * @brief 適応モードを切り替えます。
+     *
+     * 有効にすると要求サイズの標本化を始めます。無効にしても、それまでに適用した
+     * サイズクラスの組はそのまま使われます。
+     *
+     * @param adaptive trueなら適応モードにします
+     */
+    void set_adaptive(bool adaptive) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_adaptive = adaptive;
+    }
+
+    /**
+     * @brief これまでの標本から、サイズクラスの組をすぐに計算し直します。
+     *
+     * 計算した組による内部断片化の見積もりが、現在の組より1/8以上小さい場合だけ適用します。
+     * 計算の後、標本の度数は半分に減衰します。
+     *
+     * @return true 新しいサイズクラスの組を適用した場合
+     * @return false 標本がない、または現在の組を維持した場合
+     */
+    bool adapt_classes() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return adapt_classes_locked();
+    }
+
+    /**
+     * @brief サイズクラスの組を適用した回数を返します。
+     * @return std::size_t 適用した回数
+     */
+    std::size_t class_generation() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_class_generation;
+    }
+
+    /**
+     * @brief 以前のサイズクラスの組のスロットを払い出したまま、空になるのを待っているページ数を返します。
+     * @return std::size_t ページ数
+     */
+    std::size_t draining_pages() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::size_t count = 0;
+        for (std::uint32_t i = 0; i < m_fresh_page; ++i) {
+            if (m_pages[i].state == PageState::ACTIVE && m_pages[i].draining) {
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * @brief サイズクラスごとの使用状況を取得します。
+     *
+     * 平均的なスロット数は、ページを補充または返却するたびに使用中のスロット数を指数移動平均したものです。
+     *
+     * @param usage 書き込み先
+     * @param capacity usageの要素数
+     * @return std::size_t 書き込んだサイズクラスの数
+     */
+    std::size_t usage(SizeClassUsage* usage, std::size_t capacity) const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const std::size_t count = std::min(capacity, m_class_count);
+        for (std::size_t i = 0; i < count; ++i) {
+            usage[i].slot_size = m_class_sizes[i];
+            usage[i].peak_slots = m_class_peak[i];
+            usage[i].typical_slots = m_class_typical[i] / TYPICAL_WEIGHT;
+        }
+        return count;
+    }
+
+    /**
+     * @brief サイズクラスごとの使用状況をファイルに書き出します。
+     *
+     * 1行に1つのサイズクラスを「スロットのバイト数 最大のスロット数 平均的なスロット数」の形式で書きます。
+     * 一度も使われていないサイズクラスは書きません。
+     *
+     * @param path 書き出すファイルのパス
+     * @return true 書き出せた場合
+     * @return false ファイルを開けない、または書き込みに失敗した場合
+     */
+    bool save_profile(const char* path) const {
+        SizeClassUsage entries[MAX_CLASS_COUNT];
+        const std::size_t count = usage(entries, MAX_CLASS_COUNT);
+        std::FILE* file = open_file(path, "w");
+        if (!file) {
+            return false;
+        }
+        bool ok = std::fprintf(file, "# w6_mem size class profile: slot_size peak typical\n") > 0;
+        for (std::size_t i = 0; i < count && ok; ++i) {
+            if (entries[i].peak_slots != 0) {
+                ok = std::fprintf(file, "%zu %zu %zu\n", entries[i].slot_size,
+                                  entries[i].peak_slots, entries[i].typical_slots) > 0;
+            }
+        }
+        return std::fclose(file) == 0 && ok;
+    }
+
+    /**
+     * @brief save_profile()で書き出したファイルを読み込みます。
+     *
+     * 空行と#で始まる行は無視します。
+     *
+     * @param path 読み込むファイルのパス
+     * @param usage 書き込み先
+     * @param capacity usageの要素数
+     * @return std::size_t 読み込んだサイズクラスの数。ファイルを開けない場合は0
+     */
+    static std::size_t load_profile(const char* path, SizeClassUsage* usage,
+                                    std::size_t capacity) {
+        std::FILE* file = open_file(path, "r");
+        if (!file) {
+            return 0;
+        }
+        std::size_t count = 0;
+        char line[128];
+        while (count < capacity && std::fgets(line, sizeof(line), file)) {
+            char* cursor = line;
+            std::size_t values[3] = {};
+            std::size_t parsed = 0;
+            for (; parsed < 3; ++parsed) {
+                char* end = nullptr;
+                const unsigned long long value = std::strtoull(cursor, &end, 10);
+                if (end == cursor) {
+                    break;
+                }
+                values[parsed] = static_cast<std::size_t>(value);
+                cursor = end;
+            }
+            if (parsed == 3) {
+                usage[count++] = SizeClassUsage{values[0], values[1], values[2]};
+            }
+        }
+        std::fclose(file);
+        return count;
+    }
+
+    /**
+     * @brief 使用状況に合わせてページを先に確保し、物理メモリを割り当てておきます。
+     *
+     * 各サイズクラスについて、空きスロットと使用中のスロットの合計が使用状況のスロット数以上に
+     * なるまでページを確保します。ページ1つごとにロックを取り直すため、
+     * 他のスレッドの割り当てと並行して呼び出せます。
+     *
+     * @param usage 使用状況。スロットのバイト数は、それを収められる最小のサイズクラスに対応させます
+     * @param count usageの要素数
+     * @param use_peak trueなら最大のスロット数、falseなら平均的なスロット数に合わせます
+     * @return std::size_t 確保したページ数
+     */
+    std::size_t warm_start(const SizeClassUsage* usage, std::size_t count, bool use_peak = true) {
+        std::size_t pages = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            const std::size_t target = use_peak ? usage[i].peak_slots : usage[i].typical_slots;
+            while (true) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                const std::uint32_t class_index = find_class(usage[i].slot_size, 1);
+                if (class_index == NONE ||
+                    available_slots(class_index) + m_class_live[class_index] >= target) {
+                    break;
+                }
+                const std::uint32_t index = take_page(class_index);
+                if (index == NONE) {
+                    return pages;
+                }
+                // ページに触れて物理メモリを割り当てます
+                static_cast<volatile unsigned char*>(page_address(index))[0] = 0;
+                ++pages;
+            }
+        }
+        return pages;
+    }
+
+    /**
+     * @brief save_profile()で書き出したファイルを読み込み、ページを先に確保します。
+     * @param path 読み込むファイルのパス
+     * @param use_peak trueなら最大のスロット数、falseなら平均的なスロット数に合わせます
+     * @return std::size_t 確保したページ数
+     */
+    std::size_t warm_start(const char* path, bool use_peak = true) {
+        SizeClassUsage entries[MAX_CLASS_COUNT];
+        const std::size_t count = load_profile(path, entries, MAX_CLASS_COUNT);
+        return warm_start(entries, count, use_peak);
+    }
+
+    /**
+     * @brief ファイルを読み込み、ページの確保をバックグラウンドのスレッドで行います。
+     *
+     * ファイルの読み込みは呼び出したスレッドで行います。返したスレッドは、
+     * このアロケータを破棄する前にjoin()してください。
+     *
+     * @param path 読み込むファイルのパス
+     * @param use_peak trueなら最大のスロット数、falseなら平均的なスロット数に合わせます
+     * @return std::thread ページを確保するスレッド
+     */
+    std::thread warm_start_async(const char* path, bool use_peak = true) {
+        std::array<SizeClassUsage, MAX_CLASS_COUNT> entries;
+        const std::size_t count = load_profile(path, entries.data(), entries.size());
+        return std::thread([this, entries, count, use_peak] {
+            warm_start(entries.data(), count, use_peak);
+        });
+    }
+
+    /**
+     * @brief サイズクラスの数を返します。
+     * @return std::size_t サイズクラスの数
+     */
+    std::size_t class_count() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_class_count;
+    }
+
+    /**
+     * @brief サイズクラスのスロットサイズを返します。
+     * @param class_index サイズクラスの番号
+     * @return std::size_t スロットのバイト数
+     */
+    std::size_t class_size(std::size_t class_index) const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        assert(class_index < m_class_count);
+        return m_class_sizes[class_index];
+    }
+
+private:
+    void set_class_sizes(const std::size_t* sizes, std::size_t count) {
+        assert(count > 0 && count <= MAX_CLASS_COUNT);
+        m_class_count = count;
+        for (std::size_t i = 0; i < count; ++i) {
+            assert(sizes[i] % MIN_SLOT_SIZE == 0 && sizes[i] <= MAX_SMALL_SIZE);
+            assert(i == 0 || sizes[i - 1] < sizes[i]);
+            m_class_sizes[i] = static_cast<std::uint32_t>(sizes[i]);
+        }
+        std::size_t class_index = 0;
+        for (std::size_t i = 0; i <= SIZE_UNITS; ++i) {
+            while (class_index < count && m_class_sizes[class_index] < i * MIN_SLOT_SIZE) {
+                ++class_index;
+            }
+            m_class_lookup[i] = static_cast<std::uint8_t>(class_index);
+        }
+    }
+
+    std::uint32_t find_class(std::size_t size, std::size_t alignment) const {
+        if (size > MAX_SMALL_SIZE || alignment > SLAB_SIZE) {
+            return NONE;
+        }
+        std::size_t class_index = m_class_lookup[(size + MIN_SLOT_SIZE - 1) / MIN_SLOT_SIZE];
+        while (class_index < m_class_count && m_class_sizes[class_index] % alignment != 0) {
+            ++class_index;
+        }
+        return class_index < m_class_count ? static_cast<std::uint32_t>(class_index) : NONE;
+    }
+
+    static std::FILE* open_file(const char* path, const char* mode) {
+#if defined(_MSC_VER)
+        std::FILE* file = nullptr;
+        return fopen_s(&file, path, mode) == 0 ? file : nullptr;
+#else
+        return std::fopen(path, mode);
+#endif
+    }
+
+    // 部分使用リストにあるページの空きスロット数を返します
+    std::size_t available_slots(std::uint32_t class_index) const {
+        std::size_t slots = 0;
+        for (std::uint32_t i = m_partial[class_index]; i != NONE; i = m_pages[i].next) {
+            slots += m_pages[i].slot_count - m_pages[i].live;
+        }
+        return slots;
+    }
+
+    // ページを補充または返却したときに、平均的なスロット数を更新します
+    void update_typical(std::uint32_t class_index) {
+        std::size_t& typical = m_class_typical[class_index];
+        typical = typical - typical / TYPICAL_WEIGHT + m_class_live[class_index];
+    }
+
+    // 要求サイズをアライメントに切り上げて、MIN_SLOT_SIZE単位で数えます
+    void record_sample(std::size_t size, std::size_t alignment) {
+        std::size_t rounded = (size + alignment - 1) / alignment * alignment;
+        rounded = std::min(std::max(rounded, MIN_SLOT_SIZE), MAX_SMALL_SIZE);
+        ++m_size_samples[(rounded + MIN_SLOT_SIZE - 1) / MIN_SLOT_SIZE];
+        if (++m_sample_count >= ADAPT_INTERVAL) {
+            adapt_classes_locked();
+        }
+    }
+
+    // スロットサイズunits * MIN_SLOT_SIZEのクラスが、units - covered + 1 .. unitsの要求を
+    // 受け持つときの内部断片化の見積もり（標本1個あたりのバイト数の合計）
+    std::uint64_t class_waste(std::size_t units, std::size_t covered, const std::uint64_t* counts,
+                              const std::uint64_t* weighted) const {
+        const std::size_t first = units - covered;
+        const std::uint64_t count = counts[units] - counts[first];
+        const std::uint64_t requested = weighted[units] - weighted[first];
+        const std::size_t slot_size = units * MIN_SLOT_SIZE;
+        // ページ末尾の余りは、ページ内のスロットで均等に負担します
+        const std::uint64_t tail = (SLAB_SIZE % slot_size) / (SLAB_SIZE / slot_size);
+        return (count * units - requested) * MIN_SLOT_SIZE + count * tail;
+    }
+
+    bool adapt_classes_locked() {
+        // counts[u], weighted[u]は1..uの度数と、度数 * サイズ（MIN_SLOT_SIZE単位）の累積和
+        std::uint64_t counts[SIZE_UNITS + 1] = {};
+        std::uint64_t weighted[SIZE_UNITS + 1] = {};
+        for (std::size_t u = 1; u <= SIZE_UNITS; ++u) {
+            counts[u] = counts[u - 1] + m_size_samples[u];
+            weighted[u] = weighted[u - 1] + m_size_samples[u] * u;
+        }
+        for (std::uint64_t& samples : m_size_samples) {
+            samples /= 2;
+        }
+        m_sample_count = 0;
+        if (counts[SIZE_UNITS] == 0) {
+            return false;
+        }
+
+        // 現在の組での見積もり
+        std::uint64_t current = 0;
+        for (std::size_t i = 0, first = 0; i < m_class_count; ++i) {
+            const std::size_t units = m_class_sizes[i] / MIN_SLOT_SIZE;
+            current += class_waste(units, units - first, counts, weighted);
+            first = units;
+        }
+
+        // best[k][u]: k個のクラスで1..uを受け持ち、最大のクラスがuのときの最小の見積もり。
+        // 最大のクラスは常にMAX_SMALL_SIZEにして、すべての小さな要求を受け持ちます
+        const std::size_t class_count = std::min(DEFAULT_CLASS_COUNT, SIZE_UNITS);
+        constexpr std::uint64_t INF = ~std::uint64_t{0};
+        std::uint64_t best[DEFAULT_CLASS_COUNT + 1][SIZE_UNITS + 1];
+        std::uint8_t from[DEFAULT_CLASS_COUNT + 1][SIZE_UNITS + 1] = {};
+        for (std::size_t u = 0; u <= SIZE_UNITS; ++u) {
+            best[0][u] = u == 0 ? 0 : INF;
+        }
+        for (std::size_t k = 1; k <= class_count; ++k) {
+            best[k][0] = INF;
+            for (std::size_t u = 1; u <= SIZE_UNITS; ++u) {
+                best[k][u] = INF;
+                for (std::size_t a = k - 1; a < u; ++a) {
+                    if (best[k - 1][a] == INF) {
+                        continue;
+                    }
+                    const std::uint64_t cost =
+                        best[k - 1][a] + class_waste(u, u - a, counts, weighted);
+                    if (cost < best[k][u]) {
+                        best[k][u] = cost;
+                        from[k][u] = static_cast<std::uint8_t>(a);
+                    }
+                }
+            }
+        }
+        if (best[class_count][SIZE_UNITS] * 8 >= current * 7) {
+            return false;
+        }
+
+        std::size_t sizes[DEFAULT_CLASS_COUNT];
+        for (std::size_t k = class_count, u = SIZE_UNITS; k > 0; --k) {
+            sizes[k - 1] = u * MIN_SLOT_SIZE;
+            u = from[k][u];
+        }
+        apply_class_sizes(sizes, class_count);
+        return true;
+    }
+
+    // 新しいサイズクラスの組に切り替え、既存のページを引き継ぐか空になるのを待たせます
+    void apply_class_sizes(const std::size_t* sizes, std::size_t count) {
+        set_class_sizes(sizes, count);
+        ++m_class_generation;
+        for (std::size_t i = 0; i < MAX_CLASS_COUNT; ++i) {
+            m_partial[i] = NONE;
+            m_class_live[i] = 0;
+        }
+        for (std::uint32_t i = 0; i < m_fresh_page; ++i) {
+            Page& page = m_pages[i];
+            if (page.state != PageState::ACTIVE) {
+                continue;
+            }
+            page.in_partial = false;
+            page.draining = true;
+            const std::uint32_t class_index = m_class_lookup[page.slot_size / MIN_SLOT_SIZE];
+            if (class_index < m_class_count && m_class_sizes[class_index] == page.slot_size) {
+                page.class_index = class_index;
+                page.draining = false;
+                m_class_live[class_index] += page.live;
+                if (page.live < page.slot_count) {
+                    push_partial(i);
+                }
+            }
+            // 解放を待つスロットがない（warm_start()で確保しただけなど）ページはここで返します
+            if (page.draining && page.live == 0) {
+                release_page(i);
+            }
+        }
+        // 使用状況は新しい組で数え直します
+        for (std::size_t i = 0; i < MAX_CLASS_COUNT; ++i) {
+            m_class_peak[i] = m_class_live[i];
+            m_class_typical[i] = m_class_live[i] * TYPICAL_WEIGHT;
+        }
+    }
+
+    unsigned char* page_address(std::uint32_t index) const {
+        return m_base + static_cast<std::size_t>(index) * SLAB_SIZE;
+    }
+
+    // 部分使用リストの操作。m_mutexを保持した状態で呼び出します
+    void push_partial(std::uint32_t index) {
+        Page& page = m_pages[index];
+        std::uint32_t& head = m_partial[page.class_index];
+        page.prev = NONE;
+        page.next = head;
+        if (head != NONE) {
+            m_pages[head].prev = index;
+        }
+        head = index;
+        page.in_partial = true;
+    }
+
+    void remove_partial(std::uint32_t index) {
+        Page& page = m_pages[index];
+        if (page.prev != NONE) {
+            m_pages[page.prev].next = page.next;
+        } else {
+            m_partial[page.class_index] = page.next;
+        }
+        if (page.next != NONE) {
+            m_pages[page.next].prev = page.prev;
+        }
+        page.prev = NONE;
+        page.next = NONE;
+        page.in_partial = false;
+    }
+
+    // 空きページを取り出してサイズクラス用に初期化します
+    std::uint32_t take_page(std::uint32_t class_index) {
+        std::uint32_t index = m_free_pages;
+        if (index != NONE) {
+            m_free_pages = m_pages[index].next;
+        } else if (m_fresh_page < m_page_count) {
+            index = m_fresh_page++;
+            m_pages[index].resident = false;
+        } else {
+            return NONE;
+        }
+
+        Page& page = m_pages[index];
+        if (!page.resident) {
+            if (!commit_memory(index)) {
+                page.next = m_free_pages;
+                m_free_pages = index;
+                return NONE;
+            }
+            page.resident = true;
+            ++m_resident_pages;
+        }
+        std::memset(page.bitmap, 0, sizeof(page.bitmap));
+        page.slot_size = m_class_sizes[class_index];
+        page.class_index = class_index;
+        page.slot_count = static_cast<std::uint16_t>(SLAB_SIZE / page.slot_size);
+        page.live = 0;
+        page.state = PageState::ACTIVE;
+        page.draining = false;
+        page.mesh_owner = NONE;
+        page.mesh_next = NONE;
+        push_partial(index);
+        update_typical(class_index);
+        W6_MEM_PROBE(slab_refill, page.slot_size, 0, page_address(index), this);
+        return index;
+    }
+
+    void* allocate_small(std::uint32_t class_index) {
+        std::uint32_t index = m_partial[class_index];
+        if (index == NONE) {
+            index = take_page(class_index);
+            if (index == NONE) {
+                return nullptr;
+            }
+        }
+
+        Page& page = m_pages[index];
+        std::size_t slot = 0;
+        for (std::size_t word = 0; word < BITMAP_WORDS; ++word) {
+            const std::uint64_t free_bits = ~page.bitmap[word];
+            if (free_bits) {
+                slot = word * 64 + count_trailing_zeros(free_bits);
+                break;
+            }
+        }
+        assert(slot < page.slot_count);
+        page.bitmap[slot / 64] |= std::uint64_t{1} << (slot % 64);
+        ++page.live;
+        const std::size_t live = ++m_class_live[class_index];
+        m_class_peak[class_index] = std::max(m_class_peak[class_index], live);
+        if (page.live == page.slot_count) {
+            remove_partial(index);
+        }
+        return page_address(index) + slot * page.slot_size;
+    }
+
+    void deallocate_small(void* ptr) {
+        const auto offset = static_cast<std::size_t>(static_cast<unsigned char*>(ptr) - m_base);
+        const auto virtual_index = static_cast<std::uint32_t>(offset / SLAB_SIZE);
+        std::uint32_t index = virtual_index;
+        if (m_pages[index].state == PageState::MESHED) {
+            index = m_pages[index].mesh_owner;
+        }
+
+        Page& page = m_pages[index];
+        assert(page.state == PageState::ACTIVE);
+        const std::size_t in_page = offset % SLAB_SIZE;
+        assert(in_page % page.slot_size == 0);
+        const std::size_t slot = in_page / page.slot_size;
+        const std::uint64_t bit = std::uint64_t{1} << (slot % 64);
+        assert(page.bitmap[slot / 64] & bit);
+        page.bitmap[slot / 64] &= ~bit;
+
+        const bool was_full = page.live == page.slot_count;
+        --page.live;
+        if (!page.draining) {
+            --m_class_live[page.class_index];
+        }
+        if (page.live == 0) {
+            release_page(index);
+        } else if (was_full && !page.draining) {
+            push_partial(index);
+        }
+    }
+
+    // 空になったページと、その物理メモリを共有するページを空きページリストに戻します
+    void release_page(std::uint32_t index) {
+        Page& page = m_pages[index];
+        if (page.in_partial) {
+            remove_partial(index);
+        }
+        if (!page.draining) {
+            update_typical(page.class_index);
+        }
+        std::uint32_t alias = page.mesh_next;
+        while (alias != NONE) {
+            Page& alias_page = m_pages[alias];
+            const std::uint32_t next = alias_page.mesh_next;
+            alias_page.mesh_owner = NONE;
+            alias_page.mesh_next = NONE;
+            // 自身のファイルページ（メッシュ時に解放済み）に割り当て直します。失敗した場合は
+            // indexの物理メモリを指したままのことがあるため、空きページリストに戻しません
+            if (remap(alias, alias)) {
+                alias_page.state = PageState::FREE;
+                alias_page.next = m_free_pages;
+                m_free_pages = alias;
+            } else {
+                alias_page.state = PageState::RETIRED;
+            }
+            alias = next;
+        }
+        page.state = PageState::FREE;
+        page.mesh_next = NONE;
+        page.next = m_free_pages;
+        m_free_pages = index;
+    }
+
+    bool can_mesh(std::uint32_t dst, std::uint32_t src) const {
+        const Page& a = m_pages[dst];
+        const Page& b = m_pages[src];
+        if (a.slot_size != b.slot_size) {
+            return false;
+        }
+        for (std::size_t word = 0; word < BITMAP_WORDS; ++word) {
+            if (a.bitmap[word] & b.bitmap[word]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // srcの生存スロットをdstの物理ページへコピーし、srcをdstの物理ページに割り当て直します。
+    // 割り当て直しに失敗した場合は元に戻してfalseを返します
+    bool mesh(std::uint32_t dst, std::uint32_t src) {
+        Page& a = m_pages[dst];
+        Page& b = m_pages[src];
+        // コピー先はdstの空きスロットなので、取り消してもdstの生存オブジェクトは壊れません
+        unsigned char* dst_address = page_address(dst);
+        const unsigned char* src_address = page_address(src);
+        for (std::size_t word = 0; word < BITMAP_WORDS; ++word) {
+            std::uint64_t bits = b.bitmap[word];
+            while (bits) {
+                const std::size_t slot = word * 64 + count_trailing_zeros(bits);
+                std::memcpy(dst_address + slot * b.slot_size, src_address + slot * b.slot_size,
+                            b.slot_size);
+                bits &= bits - 1;
+            }
+        }
+
+        // srcと、srcを共有していたページをすべてdstの物理ページへ向けます
+        for (std::uint32_t i = src; i != NONE; i = m_pages[i].mesh_next) {
+            if (!remap(i, dst)) {
+                // 失敗したページも元のマッピングが外れている場合があるため、iまで戻します
+                const std::uint32_t end = m_pages[i].mesh_next;
+                for (std::uint32_t j = src; j != end; j = m_pages[j].mesh_next) {
+                    if (!remap(j, src)) {
+                        // srcの生存オブジェクトに届かなくなるため、続行できません
+                        std::abort();
+                    }
+                }
+                return false;
+            }
+        }
+
+        for (std::size_t word = 0; word < BITMAP_WORDS; ++word) {
+            a.bitmap[word] |= b.bitmap[word];
+        }
+        a.live = static_cast<std::uint16_t>(a.live + b.live);
+        if (b.in_partial) {
+            remove_partial(src);
+        }
+        std::uint32_t tail = src;
+        for (std::uint32_t i = src; i != NONE; i = m_pages[i].mesh_next) {
+            m_pages[i].state = PageState::MESHED;
+            m_pages[i].mesh_owner = dst;
+            tail = i;
+        }
+        m_pages[tail].mesh_next = a.mesh_next;
+        a.mesh_next = src;
+
+        release_memory(src);
+        b.resident = false;
+        --m_resident_pages;
+
+        if (a.live == a.slot_count) {
+            remove_partial(dst);
+        }
+        return true;
+    }
+
+    static std::size_t count_trailing_zeros(std::uint64_t value) {
+#if defined(_MSC_VER)
+        unsigned long index = 0;
+        _BitScanForward64(&index, value);
+        return index;
+#else
+        return static_cast<std::size_t>(__builtin_ctzll(value));
+#endif
+    }
+
+    void map_region(bool meshable) {
+        const std::size_t metadata_bytes = sizeof(Page) * m_page_count;
+#if defined(_WIN32)
+        (void)meshable;
+        m_base = static_cast<unsigned char*>(
+            VirtualAlloc(nullptr, m_max_bytes, MEM_RESERVE, PAGE_READWRITE));
+        m_pages = static_cast<Page*>(
+            VirtualAlloc(nullptr, metadata_bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+#else
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#if defined(__linux__)
+        if (meshable) {
+            m_fd = memfd_create("w6_mem", MFD_CLOEXEC);
+            if (m_fd >= 0 && ftruncate(m_fd, static_cast<off_t>(m_max_bytes)) != 0) {
+                close(m_fd);
+                m_fd = -1;
+            }
+        }
+        if (m_fd >= 0) {
+            flags = MAP_SHARED | MAP_NORESERVE;
+        }
+#else
+        (void)meshable;
+#endif
+        void* base = mmap(nullptr, m_max_bytes, PROT_READ | PROT_WRITE, flags, m_fd, 0);
+        m_base = base == MAP_FAILED ? nullptr : static_cast<unsigned char*>(base);
+        // 管理情報もゼロページのまま遅延確保されます
+        void* pages = mmap(nullptr, metadata_bytes, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        m_pages = pages == MAP_FAILED ? nullptr : static_cast<Page*>(pages);
+#endif
+        if (!m_base || !m_pages) {
+            // 領域を確保できない場合は、すべての割り当てを親に委譲します
+            unmap_region();
+            m_page_count = 0;
+            m_max_bytes = 0;
+        }
+    }
+
+    void unmap_region() {
+#if defined(_WIN32)
+        if (m_base) {
+            VirtualFree(m_base, 0, MEM_RELEASE);
+        }
+        if (m_pages) {
+            VirtualFree(m_pages, 0, MEM_RELEASE);
+        }
+#else
+        if (m_base) {
+            munmap(m_base, m_max_bytes);
+        }
+        if (m_pages) {
+            munmap(m_pages, sizeof(Page) * m_page_count);
+        }
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+#endif
+        m_base = nullptr;
+        m_pages = nullptr;
+        m_fd = -1;
+    }
+
+    bool commit_memory(std::uint32_t index) {
+#if defined(_WIN32)
+        return VirtualAlloc(page_address(index), SLAB_SIZE, MEM_COMMIT, PAGE_READWRITE) !=
+               nullptr;
+#else
+        // POSIXでは最初に触れた時点で物理メモリが割り当てられます
+        (void)index;
+        return true;
+#endif
+    }
+
+    // ページ自身のファイルページ（または匿名ページ）の物理メモリを解放します
+    void release_memory(std::uint32_t index) {
+#if defined(_WIN32)
+        VirtualFree(page_address(index), SLAB_SIZE, MEM_DECOMMIT);
+#else
+#if defined(__linux__)
+        if (m_fd >= 0) {
+            fallocate(m_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      static_cast<off_t>(index) * static_cast<off_t>(SLAB_SIZE),
+                      static_cast<off_t>(SLAB_SIZE));
+            return;
+        }
+#endif
+        madvise(page_address(index), SLAB_SIZE, MADV_DONTNEED);
+#endif
+    }
+
+    // 仮想ページvirtual_indexを、file_indexのファイルページに割り当て直します。
+    // 失敗した場合（マッピング数の上限に達したなど）、仮想ページのマッピングは外れていることがあります
+    bool remap(std::uint32_t virtual_index, std::uint32_t file_index) {
+#if defined(__linux__)
+        void* mapped = mmap(page_address(virtual_index), SLAB_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_FIXED, m_fd,
+                            static_cast<off_t>(file_index) * static_cast<off_t>(SLAB_SIZE));
+        return mapped == page_address(virtual_index);
+#else
+        (void)virtual_index;
+        (void)file_index;
+        return false;
+#endif
+    }
+};
+
+} // namespace w6_mem
@@ -0,0 +1,354 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace w6_mem {
+
+/**
+ * @brief StackPoolが払い出すスタック
+ *
+ * スタックは高位アドレスから低位アドレスへ伸びるため、ファイバの初期スタックポインタにはtop()を使います。
+ * baseの直下にはガードページがあり、オーバーフローすると即座にSIGSEGV（アクセス違反）になります。
+ */
+struct FiberStack {
+    void* base = nullptr;  ///< 使用可能な領域の先頭（最下位アドレス）
+    std::size_t size = 0;  ///< 使用可能なバイト数
+
+    /**
+     * @brief スタックの底（最上位アドレス）を返します。
+     * @return void* 使用可能な領域の終端
+     */
+    void* top() const {
+        return static_cast<unsigned char*>(base) + size;
+    }
+
+    /**
+     * @brief 有効なスタックかを返します。
+     * @return true 領域を指している場合
+     * @return false 空の場合
+     */
+    explicit operator bool() const {
+        return base != nullptr;
+    }
+};
+
+/**
+ * @brief ガードページ付きの固定サイズのスタックを払い出すプール
+ *
+ * 構築時に「ガードページ + スタック」のスロットをmax_stacks個分、PROT_NONEで一度に予約します
+ * （Windowsでは MEM_RESERVE）。スロットは初めて払い出すときにだけ読み書き可能にし、
+ * 以降はガードページを含めてそのまま再利用するため、払い出しは空きリストのpopだけです。
+ * 物理メモリは触れたページにしか割り当てられないため、大きなスタックも実際に使った分しか消費しません。
+ *
+ * 返却されたスタックは、直近のmax_hot個を「ホット」としてそのまま保持し、優先して再利用します
+ * （キャッシュとTLBに残っている可能性が高いため）。それより古いスタックは「コールド」として
+ * MADV_FREE（Windowsでは MEM_RESET）で物理メモリをOSに返却できる状態にします。
+ *
+ * @note acquire()/release()はスレッドセーフです。
+ */
+class StackPool {
+private:
+    // コピー禁止
+    StackPool(const StackPool&) = delete;
+    StackPool& operator=(const StackPool&) = delete;
+
+public:
+    /// ホットとして保持するスタック数の既定値
+    static constexpr std::size_t DEFAULT_MAX_HOT = 16;
+
+private:
+    static constexpr std::uint32_t NONE = ~std::uint32_t{0};
+
+    mutable std::mutex m_mutex;
+    std::size_t m_page_size = 0;
+    std::size_t m_guard_size = 0;
+    std::size_t m_stack_size = 0;
+    std::size_t m_slot_size = 0;
+    std::size_t m_capacity = 0;
+    std::size_t m_max_hot = 0;
+    unsigned char* m_base = nullptr;
+    std::size_t m_region_bytes = 0;
+    std::uint32_t* m_metadata = nullptr;
+    std::size_t m_metadata_bytes = 0;
+    // コールドの空きリスト（スロットごとの次のスロット）
+    std::uint32_t* m_cold_next = nullptr;
+    std::uint32_t m_cold_head = NONE;
+    std::size_t m_cold_count = 0;
+    // ホットのスタック（リングバッファ。末尾が直近に返却されたもの）
+    std::uint32_t* m_hot = nullptr;
+    std::size_t m_hot_begin = 0;
+    std::size_t m_hot_count = 0;
+    // まだ一度も払い出していない最初のスロット
+    std::size_t m_fresh = 0;
+    std::size_t m_in_use = 0;
+
+public:
+    /**
+     * @brief スタックのサイズと最大数を指定して構築します。
+     * @param stack_size 1つのスタックの使用可能なバイト数（ページサイズに切り上げます）
+     * @param max_stacks 同時に払い出せるスタックの最大数
+     * @param max_hot ホットとして保持するスタック数
+     * @param guard_pages スタックの下に置くガードページの数（最低1）
+     * @note 領域を予約できなかった場合、capacity()は0になり、acquire()は常に失敗します。
+     */
+    StackPool(std::size_t stack_size, std::size_t max_stacks,
+              std::size_t max_hot = DEFAULT_MAX_HOT, std::size_t guard_pages = 1)
+        : m_page_size(system_page_size()) {
+        if (guard_pages == 0) {
+            guard_pages = 1;
+        }
+        if (max_hot > max_stacks) {
+            max_hot = max_stacks;
+        }
+        m_guard_size = guard_pages * m_page_size;
+        m_stack_size = round_up(stack_size == 0 ? 1 : stack_size, m_page_size);
+        m_slot_size = m_guard_size + m_stack_size;
+        if (max_stacks == 0 || max_stacks >= NONE || max_stacks > SIZE_MAX / m_slot_size) {
+            return;
+        }
+        m_metadata_bytes = round_up(sizeof(std::uint32_t) * (max_stacks + max_hot), m_page_size);
+        m_region_bytes = m_slot_size * max_stacks;
+        m_base = static_cast<unsigned char*>(reserve(m_region_bytes, false));
+        m_metadata = static_cast<std::uint32_t*>(reserve(m_metadata_bytes, true));
+        if (!m_base || !m_metadata) {
+            release_region();
+            return;
+        }
+        m_capacity = max_stacks;
+        m_max_hot = max_hot;
+        m_cold_next = m_metadata;
+        m_hot = m_metadata + max_stacks;
+    }
+
+    /**
+     * @brief デストラクタ
+     *
+     * 予約した領域をすべてOSに返却します。払い出し中のスタックがあってはいけません。
+     */
+    ~StackPool() {
+        assert(m_in_use == 0);
+        release_region();
+    }
+
+    /**
+     * @brief スタックを払い出します。
+     *
+     * ホット、コールド、未使用のスロットの順に探します。
+     * @return FiberStack 払い出したスタック。空きがなければ無効なスタック
+     */
+    FiberStack acquire() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::uint32_t slot = NONE;
+        if (m_hot_count > 0) {
+            --m_hot_count;
+            slot = m_hot[(m_hot_begin + m_hot_count) % m_max_hot];
+        } else if (m_cold_head != NONE) {
+            slot = m_cold_head;
+            m_cold_head = m_cold_next[slot];
+            --m_cold_count;
+        } else if (m_fresh < m_capacity) {
+            if (!commit(stack_base(static_cast<std::uint32_t>(m_fresh)))) {
+                return {};
+            }
+            slot = static_cast<std::uint32_t>(m_fresh++);
+        } else {
+            return {};
+        }
+        ++m_in_use;
+        return {stack_base(slot), m_stack_size};
+    }
+
+    /**
+     * @brief スタックをプールに返却します。
+     * @param stack acquire()で払い出したスタック。無効なスタックなら何もしません
+     */
+    void release(FiberStack stack) {
+        if (!stack) {
+            return;
+        }
+        assert(owns(stack.base));
+        const auto slot = static_cast<std::uint32_t>(
+            (static_cast<unsigned char*>(stack.base) - m_base) / m_slot_size);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_in_use;
+        if (m_max_hot == 0) {
+            push_cold(slot);
+            return;
+        }
+        if (m_hot_count == m_max_hot) {
+            // 最も古いホットのスタックをコールドに落とします
+            push_cold(m_hot[m_hot_begin]);
+            m_hot_begin = (m_hot_begin + 1) % m_max_hot;
+            --m_hot_count;
+        }
+        m_hot[(m_hot_begin + m_hot_count) % m_max_hot] = slot;
+        ++m_hot_count;
+    }
+
+    /**
+     * @brief アドレスがこのプールのスタック（ガードページを含む）の範囲内かを返します。
+     * @param ptr 調べるアドレス
+     * @return bool プールの領域内ならtrue
+     */
+    bool owns(const void* ptr) const {
+        const auto* p = static_cast<const unsigned char*>(ptr);
+        return m_base && p >= m_base && p < m_base + m_region_bytes;
+    }
+
+    /**
+     * @brief 1つのスタックの使用可能なバイト数を返します。
+     * @return std::size_t バイト数
+     */
+    std::size_t stack_size() const {
+        return m_stack_size;
+    }
+
+    /**
+     * @brief 1つのスタックのガードページのバイト数を返します。
+     * @return std::size_t バイト数
+     */
+    std::size_t guard_size() const {
+        return m_guard_size;
+    }
+
+    /**
+     * @brief 払い出せるスタックの最大数を返します。
+     * @return std::size_t スタック数
+     */
+    std::size_t capacity() const {
+        return m_capacity;
+    }
+
+    /**
+     * @brief 払い出し中のスタック数を返します。
+     * @return std::size_t スタック数
+     */
+    std::size_t in_use() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_in_use;
+    }
+
+    /**
+     * @brief ホットとして保持しているスタック数を返します。
+     * @return std::size_t スタック数
+     */
+    std::size_t hot_count() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_hot_count;
+    }
+
+    /**
+     * @brief コールドとして保持しているスタック数を返します。
+     * @return std::size_t スタック数
+     */
+    std::size_t cold_count() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_cold_count;
+    }
+
+    /**
+     * @brief 一度でも払い出した（読み書き可能にした）スロット数を返します。
+     * @return std::size_t スロット数
+     */
+    std::size_t committed_count() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_fresh;
+    }
+
+private:
+    static std::size_t round_up(std::size_t value, std::size_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    static std::size_t system_page_size() {
+#if defined(_WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return static_cast<std::size_t>(info.dwPageSize);
+#else
+        const long size = sysconf(_SC_PAGESIZE);
+        return size > 0 ? static_cast<std::size_t>(size) : 4096;
+#endif
+    }
+
+    void* stack_base(std::uint32_t slot) const {
+        return m_base + m_slot_size * slot + m_guard_size;
+    }
+
+    // アドレス空間を予約します。accessibleなら読み書き可能な状態で確保します
+    static void* reserve(std::size_t size, bool accessible) {
+#if defined(_WIN32)
+        return VirtualAlloc(nullptr, size, accessible ? MEM_RESERVE | MEM_COMMIT : MEM_RESERVE,
+                            accessible ? PAGE_READWRITE : PAGE_NOACCESS);
+#else
+        void* memory = mmap(nullptr, size, accessible ? PROT_READ | PROT_WRITE : PROT_NONE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        return memory == MAP_FAILED ? nullptr : memory;
+#endif
+    }
+
+    void release_region() {
+#if defined(_WIN32)
+        if (m_base) {
+            VirtualFree(m_base, 0, MEM_RELEASE);
+        }
+        if (m_metadata) {
+            VirtualFree(m_metadata, 0, MEM_RELEASE);
+        }
+#else
+        if (m_base) {
+            munmap(m_base, m_region_bytes);
+        }
+        if (m_metadata) {
+            munmap(m_metadata, m_metadata_bytes);
+        }
+#endif
+        m_base = nullptr;
+        m_metadata = nullptr;
+        m_capacity = 0;
+    }
+
+    // スタック部分だけを読み書き可能にします。ガードページはPROT_NONEのまま残ります
+    bool commit(void* stack) {
+#if defined(_WIN32)
+        return VirtualAlloc(stack, m_stack_size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+        // MAP_NORESERVEで予約しているため、物理メモリは最初に触れたページにだけ割り当てられます
+        return mprotect(stack, m_stack_size, PROT_READ | PROT_WRITE) == 0;
+#endif
+    }
+
+    // スタックの物理メモリを返却可能にして、コールドの空きリストに積みます
+    void push_cold(std::uint32_t slot) {
+        void* stack = stack_base(slot);
+#if defined(_WIN32)
+        VirtualAlloc(stack, m_stack_size, MEM_RESET, PAGE_READWRITE);
+#else
+        // MADV_FREEはメモリが逼迫するまでページを残すため、すぐに再利用すればフォルトしません
+#if defined(MADV_FREE)
+        if (madvise(stack, m_stack_size, MADV_FREE) != 0)
+#endif
+        {
+            madvise(stack, m_stack_size, MADV_DONTNEED);
+        }
+#endif
+        m_cold_next[slot] = m_cold_head;
+        m_cold_head = slot;
+        ++m_cold_count;
+    }
+};
+
+} // namespace w6_mem
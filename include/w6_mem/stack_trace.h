@@ -0,0 +1,69 @@
+#pragma once
+
+/**
+ * @file stack_trace.h
+ * @brief 診断用のスタックトレースの取得と出力
+ *
+ * glibcではbacktrace()、WindowsではRtlCaptureStackBackTrace()を使います。
+ * それ以外の環境ではフレームを取得できず、常に0個を返します。
+ *
+ * allocator.hから（no_alloc.h経由で）すべての利用者に読み込まれるため、<windows.h>や
+ * <execinfo.h>は読み込まず、使う関数だけをここで宣言します。
+ */
+
+#include <cstdio>
+
+namespace w6_mem {
+namespace detail {
+
+#if defined(_WIN32)
+extern "C" __declspec(dllimport) unsigned short __stdcall RtlCaptureStackBackTrace(
+    unsigned long frames_to_skip, unsigned long frames_to_capture, void** back_trace,
+    unsigned long* back_trace_hash);
+#elif defined(__GLIBC__)
+extern "C" int backtrace(void** buffer, int size);
+extern "C" void backtrace_symbols_fd(void* const* buffer, int size, int fd) noexcept;
+#endif
+
+/**
+ * @brief 現在のスレッドのスタックフレームを取得します。
+ * @param frames フレームのアドレスの書き込み先
+ * @param max_frames 取得するフレームの最大数
+ * @return int 取得したフレーム数
+ */
+inline int capture_stack(void** frames, int max_frames) {
+#if defined(_WIN32)
+    return static_cast<int>(
+        RtlCaptureStackBackTrace(0, static_cast<unsigned long>(max_frames), frames, nullptr));
+#elif defined(__GLIBC__)
+    return backtrace(frames, max_frames);
+#else
+    (void)frames;
+    (void)max_frames;
+    return 0;
+#endif
+}
+
+/**
+ * @brief capture_stack()で取得したフレームを標準エラー出力に書き出します。
+ *
+ * glibcではシンボル名を解決して出力します。
+ * この関数はメモリを割り当てません。
+ *
+ * @param frames フレームのアドレス
+ * @param frame_count フレーム数
+ */
+inline void write_stack(void* const* frames, int frame_count) {
+#if defined(__GLIBC__)
+    std::fflush(stderr);
+    // 2は標準エラー出力のファイル記述子です
+    backtrace_symbols_fd(frames, frame_count, 2);
+#else
+    for (int i = 0; i < frame_count; ++i) {
+        std::fprintf(stderr, "  %p\n", frames[i]);
+    }
+#endif
+}
+
+} // namespace detail
+} // namespace w6_mem
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "allocator.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+namespace w6_mem {
+
+/**
+ * @brief StaticPool用の静的ストレージ
+ *
+ * 初期化子を持たない集成体なので、名前空間スコープに置くとゼロ初期化され.bssに配置されます。
+ * 実行時の初期化コストはなく、メモリ使用量はリンク時に確定します。
+ *
+ * @tparam T 格納する型
+ * @tparam Count スロット数
+ */
+template <typename T, std::size_t Count>
+struct StaticPoolStorage {
+    /// 1スロットのアライメント（空きリストのポインタも格納できるようにします）
+    static constexpr std::size_t SLOT_ALIGNMENT =
+        alignof(T) > alignof(void*) ? alignof(T) : alignof(void*);
+    /// 1スロットのバイト数
+    static constexpr std::size_t SLOT_SIZE =
+        (((sizeof(T) > sizeof(void*) ? sizeof(T) : sizeof(void*)) + SLOT_ALIGNMENT - 1) /
+         SLOT_ALIGNMENT) *
+        SLOT_ALIGNMENT;
+
+    static_assert(Count > 0, "Count must be greater than zero");
+
+    alignas(SLOT_ALIGNMENT) unsigned char bytes[SLOT_SIZE * Count];
+};
+
+/**
+ * @brief コンパイル時に容量が決まる固定サイズプール
+ *
+ * StaticPoolStorageを借りて、T型1個分のスロットを払い出します。
+ * 空きリストは最初に触れたスロットから遅延的に構築されるため、構築時にストレージへ触れません。
+ * コンストラクタはconstexprなので、名前空間スコープで定数初期化されます。
+ *
+ * @code
+ * w6_mem::StaticPoolStorage<Node, 1024> g_node_storage;
+ * w6_mem::StaticPool<Node, 1024> g_node_pool(g_node_storage);
+ * @endcode
+ *
+ * @note スレッドセーフではありません。
+ * @tparam T 格納する型
+ * @tparam Count スロット数
+ */
+template <typename T, std::size_t Count>
+class StaticPool : public IAllocator {
+private:
+    // コピー禁止
+    StaticPool(const StaticPool&) = delete;
+    StaticPool& operator=(const StaticPool&) = delete;
+
+public:
+    using Storage = StaticPoolStorage<T, Count>;
+
+private:
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+private:
+    Storage* m_storage = nullptr;
+    FreeSlot* m_free_list = nullptr;
+    std::size_t m_untouched_index = 0;
+    std::size_t m_used = 0;
+
+public:
+    /**
+     * @brief ストレージを指定して構築します。
+     * @param storage スロットを切り出す静的ストレージ
+     */
+    constexpr explicit StaticPool(Storage& storage) : m_storage(&storage) {}
+
+    /**
+     * @copydoc IAllocator::allocate
+     *
+     * スロットに収まらないサイズやアライメントが要求された場合、または空きがない場合はnullptrを返します。
+     */
+    void* allocate(std::size_t size, std::size_t alignment) override {
+        detail::NoAllocCheck no_alloc_check(size, alignment);
+        if (size > Storage::SLOT_SIZE || alignment > Storage::SLOT_ALIGNMENT) {
+            return nullptr;
+        }
+
+        void* slot = nullptr;
+        if (m_free_list) {
+            slot = m_free_list;
+            m_free_list = m_free_list->next;
+        } else if (m_untouched_index < Count) {
+            // まだ一度も払い出していないスロットを先頭から順に使います
+            slot = m_storage->bytes + m_untouched_index * Storage::SLOT_SIZE;
+            ++m_untouched_index;
+        } else {
+            return nullptr;
+        }
+
+        ++m_used;
+        W6_MEM_PROBE(allocate, size, alignment, slot, this);
+        return slot;
+    }
+
+    /**
+     * @copydoc IAllocator::deallocate
+     */
+    void deallocate(void* ptr) override {
+        if (!ptr) {
+            return;
+        }
+        assert(owns(ptr));
+        assert(m_used > 0);
+        W6_MEM_PROBE(deallocate, 0, 0, ptr, this);
+
+        auto* slot = static_cast<FreeSlot*>(ptr);
+        slot->next = m_free_list;
+        m_free_list = slot;
+        --m_used;
+    }
+
+    /**
+     * @brief 指定されたポインタがこのプールのストレージを指しているかを判定します。
+     * @param ptr 判定するポインタ
+     * @return true このプールのスロットを指している場合
+     * @return false それ以外の場合
+     */
+    bool owns(const void* ptr) const {
+        auto address = reinterpret_cast<std::uintptr_t>(ptr);
+        auto begin = reinterpret_cast<std::uintptr_t>(m_storage->bytes);
+        return begin <= address && address < begin + sizeof(m_storage->bytes) &&
+               (address - begin) % Storage::SLOT_SIZE == 0;
+    }
+
+    /**
+     * @brief 使用中のスロット数を返します。
+     * @return std::size_t 使用中のスロット数
+     */
+    std::size_t used() const {
+        return m_used;
+    }
+
+    /**
+     * @brief スロットの総数を返します。
+     * @return std::size_t スロット数
+     */
+    static constexpr std::size_t capacity() {
+        return Count;
+    }
+};
+
+} // namespace w6_mem
@@ -72,6 +72,7 @@ public:
      * @return T* 確保されたメモリへのポインタ。
      */
     T* allocate(size_type n) {
+        detail::NoAllocCheck no_alloc_check(n * sizeof(T), alignof(T));
         void* memory = m_allocator->allocate(n * sizeof(T), alignof(T));
         return static_cast<T*>(memory);
     }
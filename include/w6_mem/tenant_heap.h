@@ -0,0 +1,413 @@
+#pragma once
+
+#include "allocator.h"
+#include "child_arena.h"
+#include "unique_ptr.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace w6_mem {
+
+/**
+ * @brief 1つのテナントのヒープ
+ *
+ * メモリはすべてBlockPoolから借りたブロック（ページ）と、ブロックに収まらない割り当て用に
+ * BlockPoolの上流から直接割り当てたブロックで賄います。
+ * - MAX_POOLED_SIZE以下の割り当ては、2のべき乗のサイズクラスごとの空きリスト（プール）から払い出し、
+ *   空きがなければテナント専用のChildArenaから切り出します。解放されたスロットは空きリストに戻ります。
+ * - それより大きな割り当ては、上流から直接割り当てて連結リストでつなぎます。
+ *
+ * 借りるバイト数（ブロックと大きな割り当ての合計）が割り当て量（quota）を超える割り当てはnullptrを返します。
+ * 破棄するとブロックをまとめてBlockPoolに返却し、大きな割り当てを上流に返却します。
+ * 個々のオブジェクトのdeallocate()は呼ばれず、デストラクタも実行されません。
+ *
+ * 各割り当ての直前に16バイトのヘッダを置き、サイズクラスを記録します。
+ *
+ * @note allocate()/deallocate()はスレッドセーフです。
+ */
+class TenantAllocator : public IAllocator {
+private:
+    // コピー禁止
+    TenantAllocator(const TenantAllocator&) = delete;
+    TenantAllocator& operator=(const TenantAllocator&) = delete;
+
+public:
+    /// プールから払い出す最大のスロットのバイト数（ヘッダを含む）
+    static constexpr std::size_t MAX_POOLED_SIZE = 4096;
+    /// プールから払い出す最大のアライメント
+    static constexpr std::size_t MAX_POOLED_ALIGNMENT = 64;
+
+private:
+    static constexpr std::size_t HEADER_SIZE = 16;
+    static constexpr std::size_t MIN_SLOT_SIZE = 32;
+    static constexpr std::size_t CLASS_COUNT = 8; // 32, 64, ..., 4096
+    static constexpr std::uint32_t LARGE = 0xFFFFFFFFU;
+
+    struct Header {
+        std::uint32_t class_index; ///< サイズクラス（LARGEなら大きな割り当て）
+        std::uint32_t offset;      ///< スロットの先頭から払い出したポインタまでのバイト数
+        std::uint64_t reserved;
+    };
+    static_assert(sizeof(Header) == HEADER_SIZE, "unexpected header size");
+
+    // 大きな割り当てのブロックの先頭に置くリンク
+    struct LargeBlock {
+        LargeBlock* prev;
+        LargeBlock* next;
+        std::size_t bytes;
+    };
+
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+private:
+    mutable std::mutex m_mutex;
+    ChildArena m_arena;
+    IAllocator* m_upstream = nullptr;
+    std::size_t m_quota = 0;
+    FreeSlot* m_free[CLASS_COUNT] = {};
+    LargeBlock* m_large = nullptr;
+    std::size_t m_large_bytes = 0;
+    std::size_t m_live_bytes = 0;
+    std::size_t m_failed_count = 0;
+
+public:
+    /**
+     * @brief 構築します。
+     * @param pool ブロックを借りるプール
+     * @param quota 借りられるバイト数の上限（0なら無制限）
+     */
+    TenantAllocator(BlockPool* pool, std::size_t quota)
+        : m_arena(pool, quota), m_upstream(pool->upstream()), m_quota(quota) {}
+
+    /**
+     * @brief デストラクタ
+     *
+     * 借りたメモリを個々のオブジェクトを辿らずにまとめて返却します。
+     */
+    ~TenantAllocator() override {
+        while (m_large) {
+            LargeBlock* next = m_large->next;
+            m_upstream->deallocate(m_large);
+            m_large = next;
+        }
+        // m_arenaのデストラクタがブロックをBlockPoolに返却します
+    }
+
+    /**
+     * @copydoc IAllocator::allocate
+     *
+     * 割り当て量を超える場合はnullptrを返します。
+     */
+    void* allocate(std::size_t size, std::size_t alignment) override {
+        detail::NoAllocCheck no_alloc_check(size, alignment);
+        if (alignment < HEADER_SIZE) {
+            alignment = HEADER_SIZE;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        void* ptr = nullptr;
+        if (alignment <= MAX_POOLED_ALIGNMENT && size <= MAX_POOLED_SIZE - alignment) {
+            ptr = allocate_pooled(size, alignment);
+        } else {
+            ptr = allocate_large(size, alignment);
+        }
+        if (ptr) {
+            W6_MEM_PROBE(allocate, size, alignment, ptr, this);
+        } else {
+            ++m_failed_count;
+        }
+        return ptr;
+    }
+
+    /**
+     * @copydoc IAllocator::deallocate
+     */
+    void deallocate(void* ptr) override {
+        if (!ptr) {
+            return;
+        }
+        W6_MEM_PROBE(deallocate, 0, 0, ptr, this);
+        auto* bytes = static_cast<unsigned char*>(ptr);
+        const auto* header = reinterpret_cast<const Header*>(bytes - HEADER_SIZE);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (header->class_index == LARGE) {
+            auto* block = reinterpret_cast<LargeBlock*>(bytes - header->offset);
+            (block->prev ? block->prev->next : m_large) = block->next;
+            if (block->next) {
+                block->next->prev = block->prev;
+            }
+            m_large_bytes -= block->bytes;
+            m_live_bytes -= block->bytes;
+            update_arena_limit();
+            m_upstream->deallocate(block);
+            return;
+        }
+        const std::uint32_t class_index = header->class_index;
+        auto* slot = reinterpret_cast<FreeSlot*>(bytes - header->offset);
+        slot->next = m_free[class_index];
+        m_free[class_index] = slot;
+        m_live_bytes -= class_size(class_index);
+    }
+
+    /**
+     * @brief 借りられるバイト数の上限を返します。
+     * @return std::size_t 上限（0なら無制限）
+     */
+    std::size_t quota() const {
+        return m_quota;
+    }
+
+    /**
+     * @brief 借りているバイト数（ブロックと大きな割り当ての合計）を返します。
+     * @return std::size_t バイト数
+     */
+    std::size_t committed_bytes() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_arena.borrowed_bytes() + m_large_bytes;
+    }
+
+    /**
+     * @brief 払い出し中のバイト数（スロットのサイズで数えます）を返します。
+     * @return std::size_t バイト数
+     */
+    std::size_t live_bytes() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_live_bytes;
+    }
+
+    /**
+     * @brief 失敗した割り当て（割り当て量の超過を含む）の回数を返します。
+     * @return std::size_t 回数
+     */
+    std::size_t failed_count() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_failed_count;
+    }
+
+private:
+    static std::size_t class_size(std::uint32_t class_index) {
+        return MIN_SLOT_SIZE << class_index;
+    }
+
+    void* allocate_pooled(std::size_t size, std::size_t alignment) {
+        // ヘッダを置いてもアライメントが保たれるよう、ポインタはスロットの先頭からalignmentバイト後ろに置きます
+        const std::size_t total = alignment + size;
+        std::uint32_t class_index = 0;
+        while (class_size(class_index) < total) {
+            ++class_index;
+        }
+        // スロットはmin(サイズ, MAX_POOLED_ALIGNMENT)に揃えるため、再利用してもアライメントが保たれます
+        const std::size_t slot_size = class_size(class_index);
+        void* slot = m_free[class_index];
+        if (slot) {
+            m_free[class_index] = m_free[class_index]->next;
+        } else {
+            slot = m_arena.allocate(
+                slot_size, slot_size < MAX_POOLED_ALIGNMENT ? slot_size : MAX_POOLED_ALIGNMENT);
+            if (!slot) {
+                return nullptr;
+            }
+        }
+        m_live_bytes += slot_size;
+        return finish(static_cast<unsigned char*>(slot), alignment, class_index);
+    }
+
+    void* allocate_large(std::size_t size, std::size_t alignment) {
+        const std::size_t offset =
+            (sizeof(LargeBlock) + HEADER_SIZE + alignment - 1) / alignment * alignment;
+        if (size > ~std::size_t{0} - offset) {
+            return nullptr;
+        }
+        const std::size_t bytes = offset + size;
+        const std::size_t committed = m_arena.borrowed_bytes() + m_large_bytes;
+        if (m_quota != 0 && (committed > m_quota || bytes > m_quota - committed)) {
+            return nullptr;
+        }
+        auto* block = static_cast<LargeBlock*>(m_upstream->allocate(bytes, alignment));
+        if (!block) {
+            return nullptr;
+        }
+        block->prev = nullptr;
+        block->next = m_large;
+        block->bytes = bytes;
+        if (m_large) {
+            m_large->prev = block;
+        }
+        m_large = block;
+        m_large_bytes += bytes;
+        m_live_bytes += bytes;
+        update_arena_limit();
+        return finish(reinterpret_cast<unsigned char*>(block), offset, LARGE);
+    }
+
+    static void* finish(unsigned char* slot, std::size_t offset, std::uint32_t class_index) {
+        unsigned char* ptr = slot + offset;
+        auto* header = reinterpret_cast<Header*>(ptr - HEADER_SIZE);
+        header->class_index = class_index;
+        header->offset = static_cast<std::uint32_t>(offset);
+        header->reserved = 0;
+        return ptr;
+    }
+
+    // 大きな割り当ての分を差し引いた残りを、アリーナが借りられる上限にします
+    void update_arena_limit() {
+        if (m_quota == 0) {
+            return;
+        }
+        // 0は無制限を意味するため、残りがなければ1バイトにしてブロックを借りられないようにします
+        m_arena.set_max_bytes(m_large_bytes < m_quota ? m_quota - m_large_bytes : 1);
+    }
+};
+
+/**
+ * @brief テナントごとのヒープを管理するレジストリ
+ *
+ * すべてのテナントのヒープ（TenantAllocator）は、1つのBlockPoolからブロックを借ります。
+ * テナントを破棄すると、そのテナントが借りていたブロックはまとめてBlockPoolに戻り、
+ * 他のテナントが再利用します。個々のオブジェクトを辿る必要はありません。
+ *
+ * 例:
+ * @code
+ * w6_mem::TenantHeap heap(&page_allocator);
+ * const auto id = heap.create_tenant(16 * 1024 * 1024);
+ * void* buffer = heap.tenant(id)->allocate(1024, 16);
+ * // ...
+ * heap.destroy_tenant(id); // bufferを含むテナントのメモリをまとめて返却します
+ * @endcode
+ *
+ * @note メンバ関数はスレッドセーフです。破棄したテナントのTenantAllocatorを使ってはいけません。
+ */
+class TenantHeap {
+private:
+    // コピー禁止
+    TenantHeap(const TenantHeap&) = delete;
+    TenantHeap& operator=(const TenantHeap&) = delete;
+
+public:
+    using TenantId = std::uint32_t;
+
+    /// 無効なテナントID
+    static constexpr TenantId INVALID_TENANT = 0xFFFFFFFFU;
+    /// テナントの最大数の既定値
+    static constexpr std::size_t DEFAULT_MAX_TENANTS = 256;
+
+private:
+    IAllocator* m_page_allocator = nullptr;
+    BlockPool m_pool;
+    mutable std::mutex m_mutex;
+    UniquePtr<UniquePtr<TenantAllocator>[]> m_tenants;
+    std::size_t m_max_tenants = 0;
+    std::size_t m_tenant_count = 0;
+
+public:
+    /**
+     * @brief 構築します。
+     * @param page_allocator ブロックと大きな割り当てを行うアロケータ
+     * @param max_tenants 同時に存在できるテナントの最大数
+     * @param block_size テナントが借りるブロックのバイト数
+     */
+    explicit TenantHeap(IAllocator* page_allocator,
+                        std::size_t max_tenants = DEFAULT_MAX_TENANTS,
+                        std::size_t block_size = BlockPool::DEFAULT_BLOCK_SIZE)
+        : m_page_allocator(page_allocator), m_pool(page_allocator, block_size),
+          m_tenants(make_unique<UniquePtr<TenantAllocator>[]>(page_allocator, max_tenants)),
+          m_max_tenants(max_tenants) {
+        assert(m_tenants);
+    }
+
+    /**
+     * @brief デストラクタ
+     *
+     * 残っているテナントをすべて破棄します。
+     */
+    ~TenantHeap() {
+        for (std::size_t i = 0; i < m_max_tenants; ++i) {
+            m_tenants[i] = UniquePtr<TenantAllocator>();
+        }
+    }
+
+    /**
+     * @brief テナントを作成します。
+     * @param quota テナントが借りられるバイト数の上限（0なら無制限）
+     * @return TenantId テナントのID。上限に達しているか割り当てに失敗した場合はINVALID_TENANT
+     */
+    TenantId create_tenant(std::size_t quota) {
+        auto tenant = make_unique<TenantAllocator>(m_page_allocator, &m_pool, quota);
+        if (!tenant) {
+            return INVALID_TENANT;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (std::size_t i = 0; i < m_max_tenants; ++i) {
+            if (!m_tenants[i]) {
+                m_tenants[i] = std::move(tenant);
+                ++m_tenant_count;
+                return static_cast<TenantId>(i);
+            }
+        }
+        return INVALID_TENANT;
+    }
+
+    /**
+     * @brief テナントのヒープを返します。
+     * @param id テナントのID
+     * @return TenantAllocator* ヒープ。存在しない場合はnullptr
+     */
+    TenantAllocator* tenant(TenantId id) const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return id < m_max_tenants ? m_tenants[id].get() : nullptr;
+    }
+
+    /**
+     * @brief テナントを破棄し、そのメモリをまとめて返却します。
+     *
+     * テナントのヒープから割り当てたオブジェクトのデストラクタは実行されません。
+     *
+     * @param id テナントのID
+     * @return bool テナントが存在した場合はtrue
+     */
+    bool destroy_tenant(TenantId id) {
+        UniquePtr<TenantAllocator> tenant;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (id >= m_max_tenants || !m_tenants[id]) {
+                return false;
+            }
+            tenant = std::move(m_tenants[id]);
+            --m_tenant_count;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 存在するテナントの数を返します。
+     * @return std::size_t テナントの数
+     */
+    std::size_t tenant_count() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_tenant_count;
+    }
+
+    /**
+     * @brief ブロックを割り当てるプールを返します。
+     *
+     * すべてのテナントが借りているブロックのバイト数などを参照できます。
+     *
+     * @return BlockPool& プール
+     */
+    BlockPool& pool() {
+        return m_pool;
+    }
+
+    /**
+     * @brief 破棄されたテナントから戻り、再利用されていないブロックをページアロケータに返却します。
+     * @return std::size_t 返却したブロックの数
+     */
+    std::size_t trim() {
+        return m_pool.trim();
+    }
+};
+
+} // namespace w6_mem
@@ -60,7 +60,7 @@ public:
      * @param other ムーブするUniquePtr
      */
     template <typename U, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
-    UniquePtr(UniquePtr<U>&& other)
+    UniquePtr(UniquePtr<U>&& other) noexcept
         : m_allocator(other.m_allocator), m_allocated_memory(other.m_allocated_memory),
           m_ptr(other.m_ptr) {
         other.m_allocator = nullptr;
@@ -71,7 +71,7 @@ public:
     /**
      * @brief ムーブコンストラクタ
      */
-    UniquePtr(UniquePtr&& other)
+    UniquePtr(UniquePtr&& other) noexcept
         : m_allocator(other.m_allocator), m_allocated_memory(other.m_allocated_memory),
           m_ptr(other.m_ptr) {
         other.m_allocator = nullptr;
@@ -129,7 +129,7 @@ public:
      * @param other ムーブするUniquePtr
      * @return UniquePtr& 自身への参照
      */
-    UniquePtr& operator=(UniquePtr&& other) {
+    UniquePtr& operator=(UniquePtr&& other) noexcept {
         UniquePtr(std::move(other)).swap(*this);
         return *this;
     }
@@ -138,7 +138,7 @@ public:
      * @brief 他のUniquePtrと管理内容を交換します。
      * @param other 入れ替える相手のUniquePtr
      */
-    void swap(UniquePtr& other) {
+    void swap(UniquePtr& other) noexcept {
         using std::swap;
         swap(m_allocator, other.m_allocator);
         swap(m_allocated_memory, other.m_allocated_memory);
@@ -194,7 +194,7 @@ public:
      * @brief ムーブコンストラクタ（配列版）
      * 他のUniquePtrからリソースを奪取します。
      */
-    UniquePtr(UniquePtr&& other)
+    UniquePtr(UniquePtr&& other) noexcept
         : m_allocator(other.m_allocator), m_allocated_memory(other.m_allocated_memory),
           m_ptr(other.m_ptr), m_length(other.m_length) {
         other.m_allocator = nullptr;
@@ -209,7 +209,7 @@ public:
      * @param other ムーブするUniquePtr
      * @return UniquePtr& 自身への参照
      */
-    UniquePtr& operator=(UniquePtr&& other) {
+    UniquePtr& operator=(UniquePtr&& other) noexcept {
         UniquePtr(std::move(other)).swap(*this);
         return *this;
     }
@@ -276,7 +276,7 @@ public:
      * @brief 他のUniquePtr（配列版）と管理内容を入れ替えます。
      * @param other 入れ替える相手のUniquePtr
      */
-    void swap(UniquePtr& other) {
+    void swap(UniquePtr& other) noexcept {
         using std::swap;
         swap(m_allocator, other.m_allocator);
         swap(m_allocated_memory, other.m_allocated_memory);
@@ -296,6 +296,47 @@ inline void swap(UniquePtr<T>& lhs, UniquePtr<T>& rhs) {
     lhs.swap(rhs);
 }
 
+/**
+ * @brief 呼び出し元の位置を伴うアロケータ参照
+ *
+ * IAllocator*から暗黙変換され、既定引数で変換が行われた位置（ファイル名と行番号）を捕捉します。
+ * W6_MEM_ENABLE_ALLOCATION_SITEが定義されている場合、make_uniqueの第1引数として使われ、
+ * 割り当てはIAllocator::allocate_tagged()に転送されます。
+ */
+class SiteAllocatorRef {
+private:
+    IAllocator* m_allocator = nullptr;
+    AllocationSite m_site;
+
+public:
+    /**
+     * @brief アロケータから構築し、呼び出し元を捕捉します。
+     * @param allocator 使用するアロケータ
+     * @param file 呼び出し元のファイル名（既定引数で自動的に設定されます）
+     * @param line 呼び出し元の行番号（既定引数で自動的に設定されます）
+     * @note make_unique<T>(&allocator)でIAllocator*から変換されるよう、explicitにしていません。
+     */
+    SiteAllocatorRef( // NOLINT(google-explicit-constructor,hicpp-explicit-conversions)
+        IAllocator* allocator, const char* file = __builtin_FILE(), int line = __builtin_LINE())
+        : m_allocator(allocator), m_site{file, line} {}
+
+    /**
+     * @brief 参照しているアロケータを返します。
+     * @return IAllocator* アロケータへのポインタ
+     */
+    IAllocator* get() const {
+        return m_allocator;
+    }
+
+    /**
+     * @brief 捕捉した呼び出し元を返します。
+     * @return const AllocationSite& 呼び出し元
+     */
+    const AllocationSite& site() const {
+        return m_site;
+    }
+};
+
 template <typename T>
 struct MakeUnique {
     using Single = UniquePtr<T>;
@@ -313,14 +354,28 @@ struct MakeUnique<T[]> {
  * @param allocator 使用するアロケータ
  * @param args コンストラクタ引数
  * @return UniquePtr<T> 作成されたユニークポインタ
+ * @note W6_MEM_ENABLE_ALLOCATION_SITEが定義されている場合、呼び出し元を捕捉して
+ *       IAllocator::allocate_tagged()で割り当てます。
  */
 template <typename T, typename... Args>
+#if defined(W6_MEM_ENABLE_ALLOCATION_SITE)
+inline typename MakeUnique<T>::Single make_unique(SiteAllocatorRef allocator_ref, Args&&... args) {
+    IAllocator* allocator = allocator_ref.get();
+    if (!allocator) {
+        return UniquePtr<T>();
+    }
+
+    detail::NoAllocCheck no_alloc_check(sizeof(T), alignof(T));
+    void* memory = allocator->allocate_tagged(sizeof(T), alignof(T), allocator_ref.site());
+#else
 inline typename MakeUnique<T>::Single make_unique(IAllocator* allocator, Args&&... args) {
     if (!allocator) {
         return UniquePtr<T>();
     }
 
+    detail::NoAllocCheck no_alloc_check(sizeof(T), alignof(T));
     void* memory = allocator->allocate(sizeof(T), alignof(T));
+#endif
     if (!memory) {
         return UniquePtr<T>();
     }
@@ -336,15 +391,30 @@ inline typename MakeUnique<T>::Single make_unique(IAllocator* allocator, Args&&.
  * @param length 配列のサイズ
  * @return UniquePtr<Ts> 作成されたユニークポインタ（配列版）
  * @note 配列型のテンプレート引数を受け取り、その要素型の配列を構築します
+ * @note W6_MEM_ENABLE_ALLOCATION_SITEが定義されている場合、呼び出し元を捕捉して
+ *       IAllocator::allocate_tagged()で割り当てます。
  */
 template <typename Ts>
+#if defined(W6_MEM_ENABLE_ALLOCATION_SITE)
+inline typename MakeUnique<Ts>::Array make_unique(SiteAllocatorRef allocator_ref, size_t length) {
+    IAllocator* allocator = allocator_ref.get();
+    if (!allocator) {
+        return UniquePtr<Ts>();
+    }
+
+    using T = std::remove_extent_t<Ts>;
+    detail::NoAllocCheck no_alloc_check(sizeof(T) * length, alignof(T));
+    void* memory = allocator->allocate_tagged(sizeof(T) * length, alignof(T), allocator_ref.site());
+#else
 inline typename MakeUnique<Ts>::Array make_unique(IAllocator* allocator, size_t length) {
     if (!allocator) {
         return UniquePtr<Ts>();
     }
 
     using T = std::remove_extent_t<Ts>;
+    detail::NoAllocCheck no_alloc_check(sizeof(T) * length, alignof(T));
     void* memory = allocator->allocate(sizeof(T) * length, alignof(T));
+#endif
     if (!memory) {
         return UniquePtr<Ts>();
     }
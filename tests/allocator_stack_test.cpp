@@ -0,0 +1,109 @@
+#include <cstdlib>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <w6_mem/allocator.h>
+#include <w6_mem/allocator_stack.h>
+
+namespace {
+
+TEST(AllocatorStackTest, BuildsLayersOutermostFirst) {
+    w6_mem::DefaultAllocator allocator;
+    auto stack = w6_mem::make_allocator_stack(&allocator, "tcache(32) > sizeclass(16m) > default");
+    ASSERT_TRUE(stack);
+    ASSERT_EQ(stack->layer_count(), 3u);
+    EXPECT_STREQ(stack->layer_name(0), "percpu");
+    EXPECT_STREQ(stack->layer_name(1), "sizeclass");
+    EXPECT_STREQ(stack->layer_name(2), "default");
+
+    void* small = stack->allocate(24, 8);
+    void* large = stack->allocate(8192, 64);
+    ASSERT_NE(small, nullptr);
+    ASSERT_NE(large, nullptr);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(large) % 64, 0u);
+    std::memset(small, 0xAB, 24);
+    std::memset(large, 0xCD, 8192);
+    stack->deallocate(small);
+    stack->deallocate(large);
+}
+
+TEST(AllocatorStackTest, AdaptiveSizeClass) {
+    w6_mem::DefaultAllocator allocator;
+    auto stack = w6_mem::make_allocator_stack(&allocator, "sizeclass(16m, adaptive)");
+    ASSERT_TRUE(stack);
+    auto* size_class = static_cast<w6_mem::SizeClassAllocator*>(stack->layer(0));
+    for (std::size_t i = 0; i < 256 * w6_mem::SizeClassAllocator::ADAPT_SAMPLE_PERIOD; ++i) {
+        stack->deallocate(stack->allocate(260, 16));
+    }
+    EXPECT_TRUE(size_class->adapt_classes());
+}
+
+TEST(AllocatorStackTest, AppendsDefaultBase) {
+    w6_mem::DefaultAllocator allocator;
+    auto stack = w6_mem::make_allocator_stack(&allocator, "latency(1000000)>sites");
+    ASSERT_TRUE(stack);
+    ASSERT_EQ(stack->layer_count(), 3u);
+    EXPECT_STREQ(stack->layer_name(0), "latency");
+    EXPECT_STREQ(stack->layer_name(1), "sites");
+    EXPECT_STREQ(stack->layer_name(2), "default");
+
+    stack->deallocate(stack->allocate(64, 8));
+    auto* latency = static_cast<w6_mem::LatencyHistogramAllocator*>(stack->layer(0));
+    EXPECT_EQ(latency->allocate_histogram().count(), 1u);
+}
+
+TEST(AllocatorStackTest, BudgetIsEnforced) {
+    w6_mem::DefaultAllocator allocator;
+    auto stack = w6_mem::make_allocator_stack(&allocator, "budget(4k)");
+    ASSERT_TRUE(stack);
+    EXPECT_EQ(stack->allocate(8 * 1024, 8), nullptr);
+    void* ptr = stack->allocate(1024, 8);
+    EXPECT_NE(ptr, nullptr);
+    stack->deallocate(ptr);
+}
+
+TEST(AllocatorStackTest, ReportsErrors) {
+    w6_mem::DefaultAllocator allocator;
+    const struct {
+        const char* spec;
+        std::size_t position;
+    } cases[] = {
+        {"", 0},
+        {"unknown", 0},
+        {"budget", 6},
+        {"budget(4x)", 0},
+        {"percpu(1,2)", 9},
+        {"sizeclass(1m, huge)", 0},
+        {"sizeclass(1m, mesh, mesh)", 0},
+        {"default>percpu", 7},
+        {"percpu(", 7},
+        {"percpu)", 6},
+        {"sites>sites>sites>sites>sites>sites>sites>sites", 42},
+        {"sites>sites>sites>sites>sites>sites>sites>sites>sites", 48},
+    };
+    for (const auto& c : cases) {
+        w6_mem::AllocatorSpecError error;
+        EXPECT_FALSE(w6_mem::make_allocator_stack(&allocator, c.spec, &error)) << c.spec;
+        EXPECT_NE(error.message, nullptr) << c.spec;
+        EXPECT_EQ(error.position, c.position) << c.spec;
+    }
+}
+
+TEST(AllocatorStackTest, ReadsEnvironment) {
+#if defined(_WIN32)
+    _putenv_s("W6_MEM_TEST_CONFIG", "sites>default");
+#else
+    setenv("W6_MEM_TEST_CONFIG", "sites>default", 1);
+#endif
+    w6_mem::DefaultAllocator allocator;
+    auto stack = w6_mem::make_allocator_stack_from_env(&allocator, "W6_MEM_TEST_CONFIG");
+    ASSERT_TRUE(stack);
+    ASSERT_EQ(stack->layer_count(), 2u);
+    EXPECT_STREQ(stack->layer_name(0), "sites");
+
+    auto fallback =
+        w6_mem::make_allocator_stack_from_env(&allocator, "W6_MEM_TEST_UNSET", "percpu");
+    ASSERT_TRUE(fallback);
+    EXPECT_STREQ(fallback->layer_name(0), "percpu");
+}
+
+} // namespace
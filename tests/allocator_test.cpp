@@ -69,4 +69,14 @@ TEST(DefaultAllocatorTest, DifferentSizesAndAlignments) {
     }
 }
 
+TEST(DefaultAllocatorTest, RejectsInvalidRequests) {
+    w6_mem::DefaultAllocator allocator;
+    constexpr std::size_t MAX_SIZE = ~std::size_t{0};
+
+    // アライメントの倍数に切り上げると桁あふれするサイズ
+    EXPECT_EQ(allocator.allocate(MAX_SIZE - 7, 16), nullptr);
+    EXPECT_EQ(allocator.allocate(MAX_SIZE, 8), nullptr);
+    EXPECT_EQ(allocator.allocate(16, 0), nullptr);
+}
+
 } // namespace
@@ -0,0 +1,41 @@
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <w6_mem/allocator.h>
+#include <w6_mem/arena.h>
+#include <w6_mem/unique_ptr.h>
+
+namespace {
+
+TEST(ArenaTest, BumpAllocation) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::Arena arena(&parent, 1024);
+    ASSERT_NE(arena.base(), nullptr);
+    EXPECT_EQ(arena.capacity(), 1024u);
+
+    void* a = arena.allocate(10, 1);
+    void* b = arena.allocate(16, 16);
+    ASSERT_NE(a, nullptr);
+    ASSERT_NE(b, nullptr);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(b) % 16, 0u);
+    EXPECT_TRUE(arena.owns(a));
+    EXPECT_TRUE(arena.owns(b));
+    EXPECT_EQ(arena.used(), 32u);
+
+    EXPECT_EQ(arena.allocate(2048, 8), nullptr);
+
+    arena.reset();
+    EXPECT_EQ(arena.used(), 0u);
+    EXPECT_EQ(arena.allocate(10, 1), a);
+}
+
+TEST(ArenaTest, ExternalBuffer) {
+    alignas(16) unsigned char buffer[64];
+    w6_mem::Arena arena(buffer, sizeof(buffer));
+
+    auto values = w6_mem::make_unique<int[]>(&arena, 8);
+    ASSERT_TRUE(values);
+    EXPECT_TRUE(arena.owns(values.get()));
+    EXPECT_EQ(w6_mem::make_unique<int[]>(&arena, 16).get(), nullptr);
+}
+
+} // namespace
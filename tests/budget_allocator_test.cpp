@@ -0,0 +1,40 @@
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <w6_mem/allocator.h>
+#include <w6_mem/budget_allocator.h>
+
+namespace {
+
+TEST(BudgetAllocatorTest, TracksUsage) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::BudgetAllocator allocator(&parent, 1024);
+
+    void* ptr = allocator.allocate(100, 64);
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(ptr) % 64, 0u);
+    EXPECT_GE(allocator.used(), 100u);
+
+    allocator.deallocate(ptr);
+    EXPECT_EQ(allocator.used(), 0u);
+    EXPECT_GE(allocator.peak(), 100u);
+}
+
+TEST(BudgetAllocatorTest, FailsWhenOverBudget) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::BudgetAllocator allocator(&parent, 256);
+
+    EXPECT_EQ(allocator.allocate(512, 8), nullptr);
+
+    void* first = allocator.allocate(128, 8);
+    ASSERT_NE(first, nullptr);
+    EXPECT_EQ(allocator.allocate(128, 8), nullptr);
+
+    // 解放すれば再び割り当てられる
+    allocator.deallocate(first);
+    void* second = allocator.allocate(128, 8);
+    ASSERT_NE(second, nullptr);
+    allocator.deallocate(second);
+    EXPECT_EQ(allocator.used(), 0u);
+}
+
+} // namespace
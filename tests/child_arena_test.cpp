@@ -0,0 +1,135 @@
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <w6_mem/allocator.h>
+#include <w6_mem/arena.h>
+#include <w6_mem/child_arena.h>
+
+namespace {
+
+TEST(ChildArenaTest, BorrowsBlocksFromPool) {
+    w6_mem::DefaultAllocator upstream;
+    w6_mem::BlockPool pool(&upstream, 1024);
+    {
+        w6_mem::ChildArena child(&pool);
+        EXPECT_EQ(child.block_count(), 0u);
+        EXPECT_EQ(pool.borrowed_blocks(), 0u);
+
+        void* a = child.allocate(100, 8);
+        void* b = child.allocate(16, 64);
+        ASSERT_NE(a, nullptr);
+        ASSERT_NE(b, nullptr);
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(b) % 64, 0u);
+        EXPECT_EQ(child.block_count(), 1u);
+        EXPECT_EQ(pool.borrowed_blocks(), 1u);
+
+        // ブロックが足りなくなると次のブロックを借ります
+        for (int i = 0; i < 10; ++i) {
+            ASSERT_NE(child.allocate(200, 8), nullptr);
+        }
+        EXPECT_GE(child.block_count(), 3u);
+        EXPECT_EQ(pool.borrowed_blocks(), child.block_count());
+        EXPECT_EQ(pool.borrowed_bytes(), child.block_count() * 1024);
+        EXPECT_GE(child.used(), 100u + 16u + 2000u);
+
+        child.reset();
+        EXPECT_EQ(child.used(), 0u);
+        EXPECT_EQ(child.block_count(), 0u);
+        EXPECT_EQ(pool.borrowed_blocks(), 0u);
+        EXPECT_GE(pool.cached_blocks(), 3u);
+        ASSERT_NE(child.allocate(8, 8), nullptr);
+    }
+    EXPECT_EQ(pool.borrowed_blocks(), 0u);
+    EXPECT_EQ(pool.trim(), pool.peak_borrowed_blocks());
+    EXPECT_EQ(pool.cached_blocks(), 0u);
+}
+
+TEST(ChildArenaTest, SiblingPhasesShareBlocks) {
+    w6_mem::DefaultAllocator upstream;
+    w6_mem::BlockPool pool(&upstream, 4096);
+    for (int phase = 0; phase < 4; ++phase) {
+        w6_mem::ChildArena child(&pool);
+        for (int i = 0; i < 16; ++i) {
+            ASSERT_NE(child.allocate(1000, 8), nullptr);
+        }
+    }
+    // 順に実行されるフェーズは同じブロックを使い回すため、ピークは1フェーズ分です
+    EXPECT_EQ(pool.peak_borrowed_blocks(), 4u);
+    EXPECT_EQ(pool.cached_blocks(), 4u);
+}
+
+TEST(ChildArenaTest, LargeAllocationsAndLimit) {
+    w6_mem::DefaultAllocator upstream;
+    w6_mem::BlockPool pool(&upstream, 1024, 2);
+    w6_mem::ChildArena a(&pool);
+    w6_mem::ChildArena b(&pool);
+
+    // ブロックに収まらない割り当ては上流から直接行い、ブロック数の上限には数えません
+    void* large = a.allocate(4096, 128);
+    ASSERT_NE(large, nullptr);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(large) % 128, 0u);
+    EXPECT_EQ(pool.borrowed_blocks(), 0u);
+    EXPECT_GT(pool.borrowed_bytes(), 4096u);
+
+    ASSERT_NE(a.allocate(900, 8), nullptr);
+    ASSERT_NE(b.allocate(900, 8), nullptr);
+    EXPECT_EQ(pool.borrowed_blocks(), 2u);
+    // 兄弟で上限を共有します
+    EXPECT_EQ(b.allocate(900, 8), nullptr);
+
+    a.reset();
+    EXPECT_EQ(pool.borrowed_blocks(), 1u);
+    EXPECT_EQ(pool.borrowed_bytes(), 1024u);
+    EXPECT_NE(b.allocate(900, 8), nullptr);
+}
+
+TEST(ChildArenaTest, AlignedAllocationAtBlockBoundary) {
+    w6_mem::DefaultAllocator upstream;
+    w6_mem::BlockPool pool(&upstream, 4096);
+    w6_mem::ChildArena child(&pool);
+
+    // 先頭の16バイトのヘッダとアライメントの余白（48バイト）を引いた分までブロックに収まります
+    void* fits = child.allocate(4096 - 64, 64);
+    ASSERT_NE(fits, nullptr);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(fits) % 64, 0u);
+    EXPECT_EQ(pool.borrowed_blocks(), 1u);
+
+    // それを超えると専用のブロックに置きます
+    child.reset();
+    void* large = child.allocate(4096 - 32, 64);
+    ASSERT_NE(large, nullptr);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(large) % 64, 0u);
+    EXPECT_EQ(child.block_count(), 1u);
+    EXPECT_EQ(pool.borrowed_blocks(), 0u);
+
+    // ブロックより大きなアライメントも専用のブロックに置きます
+    void* over_aligned = child.allocate(64, 8192);
+    ASSERT_NE(over_aligned, nullptr);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(over_aligned) % 8192, 0u);
+    EXPECT_EQ(child.block_count(), 2u);
+    EXPECT_EQ(pool.borrowed_blocks(), 0u);
+}
+
+TEST(ChildArenaTest, NestedUnderArena) {
+    w6_mem::DefaultAllocator upstream;
+    w6_mem::Arena parent(&upstream, 16 * 1024);
+    w6_mem::BlockPool pool(&parent, 1024);
+    {
+        w6_mem::ChildArena child(&pool);
+        for (int i = 0; i < 8; ++i) {
+            void* p = child.allocate(512, 8);
+            ASSERT_NE(p, nullptr);
+            EXPECT_TRUE(parent.owns(p));
+        }
+    }
+    const std::size_t used = parent.used();
+    {
+        // 返却されたブロックを再利用するため、親のアリーナは伸びません
+        w6_mem::ChildArena child(&pool);
+        for (int i = 0; i < 8; ++i) {
+            ASSERT_NE(child.allocate(512, 8), nullptr);
+        }
+    }
+    EXPECT_EQ(parent.used(), used);
+}
+
+} // namespace
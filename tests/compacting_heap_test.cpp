@@ -0,0 +1,200 @@
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <w6_mem/allocator.h>
+#include <w6_mem/compacting_heap.h>
+
+namespace {
+
+struct Payload {
+    std::uint64_t id;
+    unsigned char bytes[40];
+};
+
+// ムーブとデストラクタの呼び出しを数える型
+struct Tracked {
+    static inline int alive = 0;
+    std::string name;
+
+    explicit Tracked(std::string n) : name(std::move(n)) {
+        ++alive;
+    }
+    Tracked(Tracked&& other) noexcept : name(std::move(other.name)) {
+        ++alive;
+    }
+    ~Tracked() {
+        --alive;
+    }
+};
+
+TEST(CompactingHeapTest, MakeGetDestroy) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::CompactingHeap heap(&parent, 4096, 16);
+
+    auto handle = heap.make<Payload>(Payload{7, {}});
+    ASSERT_TRUE(handle);
+    ASSERT_NE(heap.get(handle), nullptr);
+    EXPECT_EQ(heap.get(handle)->id, 7u);
+    EXPECT_EQ(heap.live_count(), 1u);
+
+    heap.destroy(handle);
+    EXPECT_EQ(heap.get(handle), nullptr);
+    EXPECT_EQ(heap.live_count(), 0u);
+
+    // 再利用されたエントリでも古いハンドルは無効のまま
+    auto other = heap.make<Payload>(Payload{8, {}});
+    ASSERT_TRUE(other);
+    EXPECT_EQ(heap.get(handle), nullptr);
+    EXPECT_NE(handle, other);
+}
+
+TEST(CompactingHeapTest, CompactReclaimsHoles) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::CompactingHeap heap(&parent, 64 * 1024, 256);
+
+    std::vector<w6_mem::Handle<Payload>> handles;
+    for (std::uint64_t i = 0; i < 200; ++i) {
+        handles.push_back(heap.make<Payload>(Payload{i, {}}));
+        ASSERT_TRUE(handles.back());
+    }
+    for (std::size_t i = 0; i < handles.size(); i += 2) {
+        heap.destroy(handles[i]);
+    }
+    EXPECT_EQ(heap.used_bytes(), 2 * heap.live_bytes());
+
+    EXPECT_TRUE(heap.compact());
+    EXPECT_EQ(heap.used_bytes(), heap.live_bytes());
+    EXPECT_GT(heap.moved_bytes(), 0u);
+    for (std::size_t i = 1; i < handles.size(); i += 2) {
+        ASSERT_NE(heap.get(handles[i]), nullptr);
+        EXPECT_EQ(heap.get(handles[i])->id, i);
+    }
+}
+
+TEST(CompactingHeapTest, IncrementalBudget) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::CompactingHeap heap(&parent, 64 * 1024, 256);
+
+    std::vector<w6_mem::Handle<Payload>> handles;
+    for (std::uint64_t i = 0; i < 100; ++i) {
+        handles.push_back(heap.make<Payload>(Payload{i, {}}));
+    }
+    heap.destroy(handles[0]);
+
+    int steps = 0;
+    while (!heap.compact(256)) {
+        ++steps;
+        // 途中で割り当てても問題ない
+        handles.push_back(heap.make<Payload>(Payload{1000u + steps, {}}));
+        ASSERT_TRUE(handles.back());
+    }
+    EXPECT_GT(steps, 1);
+    EXPECT_EQ(heap.used_bytes(), heap.live_bytes());
+    for (std::size_t i = 1; i < 100; ++i) {
+        EXPECT_EQ(heap.get(handles[i])->id, i);
+    }
+}
+
+TEST(CompactingHeapTest, PinnedObjectsDoNotMove) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::CompactingHeap heap(&parent, 4096, 16);
+
+    auto a = heap.make<Payload>(Payload{1, {}});
+    auto b = heap.make<Payload>(Payload{2, {}});
+    auto c = heap.make<Payload>(Payload{3, {}});
+    heap.destroy(a);
+
+    {
+        auto pinned = heap.pin(b);
+        ASSERT_TRUE(pinned);
+        Payload* address = pinned.get();
+        EXPECT_TRUE(heap.compact());
+        EXPECT_EQ(heap.get(b), address);
+        EXPECT_EQ(pinned->id, 2u);
+        EXPECT_GT(heap.used_bytes(), heap.live_bytes());
+    }
+
+    EXPECT_TRUE(heap.compact());
+    EXPECT_EQ(heap.used_bytes(), heap.live_bytes());
+    EXPECT_EQ(heap.get(b)->id, 2u);
+    EXPECT_EQ(heap.get(c)->id, 3u);
+}
+
+TEST(CompactingHeapTest, NonTrivialTypesAreRelocated) {
+    {
+        w6_mem::DefaultAllocator parent;
+        w6_mem::CompactingHeap heap(&parent, 4096, 16);
+
+        auto a = heap.make<Tracked>("a long string that does not fit in SSO storage");
+        auto b = heap.make<Tracked>("b long string that does not fit in SSO storage");
+        heap.destroy(a);
+        EXPECT_EQ(Tracked::alive, 1);
+
+        // 穴をブロックより大きくしてから詰めると、移動先に直接ムーブ構築する
+        auto c = heap.make<Tracked>("c");
+        heap.destroy(b);
+        EXPECT_TRUE(heap.compact());
+        EXPECT_EQ(heap.get(c)->name, "c");
+        EXPECT_EQ(Tracked::alive, 1);
+        EXPECT_EQ(heap.used_bytes(), heap.live_bytes());
+    }
+    EXPECT_EQ(Tracked::alive, 0);
+}
+
+// 移動元と移動先が重なる大きさの、トリビアルにコピーできない型
+struct Large {
+    Tracked tracked;
+    std::uint64_t values[16];
+
+    explicit Large(std::string name) : tracked(std::move(name)) {
+        for (std::uint64_t i = 0; i < 16; ++i) {
+            values[i] = i;
+        }
+    }
+};
+
+TEST(CompactingHeapTest, OverlappingNonTrivialTypesAreRelocated) {
+    constexpr const char* NAME = "a long string that does not fit in SSO storage";
+    // 1回目は末尾の空きを経由し、2回目は2つのブロックでちょうど満杯にして、
+    // 親アロケータから一時領域を割り当てます
+    std::size_t capacity = 4096;
+    for (int round = 0; round < 2; ++round) {
+        {
+            w6_mem::DefaultAllocator parent;
+            w6_mem::CompactingHeap heap(&parent, capacity, 16);
+
+            auto small = heap.make<Tracked>("s");
+            auto large = heap.make<Large>(NAME);
+            ASSERT_TRUE(large);
+            capacity = heap.used_bytes();
+            heap.destroy(small);
+
+            EXPECT_TRUE(heap.compact());
+            EXPECT_EQ(heap.used_bytes(), heap.live_bytes());
+            EXPECT_EQ(heap.get(large)->tracked.name, NAME);
+            EXPECT_EQ(heap.get(large)->values[15], 15u);
+            EXPECT_EQ(Tracked::alive, 1);
+        }
+        EXPECT_EQ(Tracked::alive, 0);
+    }
+}
+
+TEST(CompactingHeapTest, MakeCompactsWhenFull) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::CompactingHeap heap(&parent, 1024, 64);
+
+    std::vector<w6_mem::Handle<Payload>> handles;
+    while (auto handle = heap.make<Payload>(Payload{handles.size(), {}})) {
+        handles.push_back(handle);
+    }
+    ASSERT_GE(handles.size(), 2u);
+    heap.destroy(handles.front());
+
+    auto handle = heap.make<Payload>(Payload{99, {}});
+    ASSERT_TRUE(handle);
+    EXPECT_EQ(heap.get(handle)->id, 99u);
+    EXPECT_EQ(heap.get(handles.back())->id, handles.size() - 1);
+}
+
+} // namespace
@@ -0,0 +1,77 @@
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <vector>
+#include <w6_mem/allocator.h>
+#include <w6_mem/arena.h>
+#include <w6_mem/compressed_ptr.h>
+#include <w6_mem/stl_allocator.h>
+
+namespace {
+
+struct GraphTag {};
+using GraphSpace = w6_mem::ArenaSpace<GraphTag>;
+
+struct Node {
+    std::uint64_t value = 0;
+    w6_mem::CompressedPtr<Node, GraphSpace> next;
+};
+
+TEST(CompressedPtrTest, IsFourBytes) {
+    EXPECT_EQ(sizeof(w6_mem::CompressedPtr<Node, GraphSpace>), 4u);
+    EXPECT_EQ(sizeof(Node), 16u);
+}
+
+TEST(CompressedPtrTest, NullByDefault) {
+    w6_mem::CompressedPtr<Node, GraphSpace> ptr;
+    EXPECT_FALSE(ptr);
+    EXPECT_EQ(ptr.get(), nullptr);
+    EXPECT_EQ(ptr.raw(), 0u);
+    EXPECT_EQ(ptr, (w6_mem::CompressedPtr<Node, GraphSpace>(nullptr)));
+}
+
+TEST(CompressedPtrTest, LinkedListInArena) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::Arena arena(&parent, 64 * 1024);
+    GraphSpace::bind(arena);
+
+    w6_mem::CompressedPtr<Node, GraphSpace> head;
+    for (std::uint64_t i = 0; i < 100; ++i) {
+        auto* node = new (arena.allocate(sizeof(Node), alignof(Node))) Node();
+        node->value = i;
+        node->next = head;
+        head = w6_mem::CompressedPtr<Node, GraphSpace>(node);
+        EXPECT_EQ(head.get(), node);
+    }
+
+    // 先頭のオブジェクトもnullと区別できる
+    auto* first = reinterpret_cast<Node*>(arena.base());
+    w6_mem::CompressedPtr<Node, GraphSpace> first_ptr(first);
+    EXPECT_TRUE(first_ptr);
+    EXPECT_EQ(first_ptr.get(), first);
+
+    std::uint64_t expected = 100;
+    for (auto node = head; node; node = node->next) {
+        EXPECT_EQ(node->value, --expected);
+    }
+    EXPECT_EQ(expected, 0u);
+}
+
+TEST(CompressedPtrTest, SmallAlignmentAndContainers) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::Arena arena(&parent, 4096);
+    GraphSpace::bind(arena);
+
+    using IntPtr = w6_mem::CompressedPtr<std::uint32_t, GraphSpace, 2>;
+    std::vector<IntPtr, w6_mem::StlAllocator<IntPtr>> ptrs(&parent);
+    for (std::uint32_t i = 0; i < 16; ++i) {
+        auto* value = static_cast<std::uint32_t*>(arena.allocate(sizeof(std::uint32_t), 4));
+        *value = i;
+        ptrs.emplace_back(value);
+    }
+    for (std::uint32_t i = 0; i < 16; ++i) {
+        EXPECT_EQ(*ptrs[i], i);
+        EXPECT_EQ(IntPtr::from_raw(ptrs[i].raw()), ptrs[i]);
+    }
+}
+
+} // namespace
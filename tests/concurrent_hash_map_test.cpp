@@ -0,0 +1,134 @@
+#include <atomic>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <w6_mem/allocator.h>
+#include <w6_mem/concurrent_hash_map.h>
+#include <w6_mem/size_class_allocator.h>
+
+namespace {
+
+TEST(ConcurrentHashMapTest, InsertFindErase) {
+    w6_mem::DefaultAllocator allocator;
+    w6_mem::ConcurrentHashMap<int, std::string> map(&allocator);
+
+    EXPECT_TRUE(map.insert(1, "one"));
+    EXPECT_TRUE(map.insert(2, "two"));
+    EXPECT_FALSE(map.insert(1, "uno"));
+    EXPECT_EQ(map.size(), 2u);
+
+    std::string value;
+    ASSERT_TRUE(map.find(1, value));
+    EXPECT_EQ(value, "one");
+    EXPECT_FALSE(map.find(3, value));
+
+    EXPECT_TRUE(map.insert_or_assign(1, "uno"));
+    ASSERT_TRUE(map.find(1, value));
+    EXPECT_EQ(value, "uno");
+    EXPECT_EQ(map.size(), 2u);
+
+    std::size_t length = 0;
+    EXPECT_TRUE(map.visit(2, [&length](const std::string& v) { length = v.size(); }));
+    EXPECT_EQ(length, 3u);
+
+    EXPECT_TRUE(map.erase(1));
+    EXPECT_FALSE(map.erase(1));
+    EXPECT_FALSE(map.contains(1));
+    EXPECT_TRUE(map.contains(2));
+    EXPECT_EQ(map.size(), 1u);
+}
+
+TEST(ConcurrentHashMapTest, GrowsIncrementally) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SizeClassAllocator pool(&parent, 16 * 1024 * 1024);
+    w6_mem::ConcurrentHashMap<std::uint64_t, std::uint64_t> map(&pool);
+    const std::size_t initial = map.bucket_count();
+    EXPECT_EQ(initial, decltype(map)::MIN_BUCKETS);
+
+    bool saw_resizing = false;
+    for (std::uint64_t i = 0; i < 5000; ++i) {
+        ASSERT_TRUE(map.insert(i, i * 3));
+        saw_resizing = saw_resizing || map.is_resizing();
+        // 移行中も、すでに登録したキーはすべて見つかります
+        if (i % 97 == 0) {
+            for (std::uint64_t j = 0; j <= i; j += 7) {
+                std::uint64_t value = 0;
+                ASSERT_TRUE(map.find(j, value)) << j;
+                EXPECT_EQ(value, j * 3);
+            }
+        }
+    }
+    EXPECT_TRUE(saw_resizing);
+    EXPECT_GT(map.bucket_count(), initial);
+    EXPECT_EQ(map.size(), 5000u);
+    for (std::uint64_t i = 0; i < 5000; i += 2) {
+        ASSERT_TRUE(map.erase(i));
+    }
+    EXPECT_EQ(map.size(), 2500u);
+    for (std::uint64_t i = 0; i < 5000; ++i) {
+        EXPECT_EQ(map.contains(i), i % 2 == 1);
+    }
+}
+
+TEST(ConcurrentHashMapTest, ConcurrentReadersAndWriters) {
+    w6_mem::DefaultAllocator allocator;
+    w6_mem::ConcurrentHashMap<std::uint64_t, std::uint64_t> map(&allocator);
+    constexpr std::uint64_t KEYS = 4000;
+    constexpr int WRITERS = 4;
+    std::atomic<bool> stop{false};
+    std::atomic<std::uint64_t> mismatches{0};
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&]() {
+            std::uint64_t key = 0;
+            while (!stop.load()) {
+                std::uint64_t value = 0;
+                // 値は常にキーの倍数で書き込まれます
+                if (map.find(key, value) && value % (key + 1) != 0) {
+                    ++mismatches;
+                }
+                key = (key + 13) % KEYS;
+            }
+        });
+    }
+    std::vector<std::thread> writers;
+    for (int t = 0; t < WRITERS; ++t) {
+        writers.emplace_back([&map, t]() {
+            for (std::uint64_t round = 1; round <= 3; ++round) {
+                for (std::uint64_t key = static_cast<std::uint64_t>(t); key < KEYS;
+                     key += WRITERS) {
+                    ASSERT_TRUE(map.insert_or_assign(key, (key + 1) * round));
+                }
+            }
+            for (std::uint64_t key = static_cast<std::uint64_t>(t); key < KEYS; key += WRITERS) {
+                if (key % 3 == 0) {
+                    ASSERT_TRUE(map.erase(key));
+                }
+            }
+        });
+    }
+    for (std::thread& writer : writers) {
+        writer.join();
+    }
+    stop = true;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(mismatches.load(), 0u);
+    for (std::uint64_t key = 0; key < KEYS; ++key) {
+        std::uint64_t value = 0;
+        if (key % 3 == 0) {
+            EXPECT_FALSE(map.find(key, value));
+        } else {
+            ASSERT_TRUE(map.find(key, value));
+            EXPECT_EQ(value, (key + 1) * 3);
+        }
+    }
+    map.epoch_domain().synchronize();
+    EXPECT_EQ(map.epoch_domain().pending(), 0u);
+}
+
+} // namespace
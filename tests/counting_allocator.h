@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <w6_mem/allocator.h>
+
+namespace w6_mem_test {
+
+/**
+ * @brief 割り当てと解放の回数を数えるテスト用のアロケータ
+ *
+ * 実際の割り当てはDefaultAllocatorで行います。nullptrの解放は数えません。
+ * 回数はアトミックなので、複数のスレッドから使えます。
+ */
+class CountingAllocator : public w6_mem::DefaultAllocator {
+public:
+    std::atomic<int> m_allocations{0};
+    std::atomic<int> m_deallocations{0};
+
+    void* allocate(std::size_t size, std::size_t alignment) override {
+        ++m_allocations;
+        return w6_mem::DefaultAllocator::allocate(size, alignment);
+    }
+
+    void deallocate(void* ptr) override {
+        if (ptr) {
+            ++m_deallocations;
+        }
+        w6_mem::DefaultAllocator::deallocate(ptr);
+    }
+};
+
+} // namespace w6_mem_test
@@ -0,0 +1,118 @@
+#include "counting_allocator.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <w6_mem/allocator.h>
+#include <w6_mem/cpu_cache_allocator.h>
+
+namespace {
+
+using w6_mem_test::CountingAllocator;
+
+TEST(CpuCacheAllocatorTest, ReusesCachedBlocks) {
+    CountingAllocator parent;
+    {
+        w6_mem::CpuCacheAllocator allocator(&parent, 8, 1);
+        const int baseline = parent.m_allocations;
+
+        void* first = allocator.allocate(24, 8);
+        ASSERT_NE(first, nullptr);
+        allocator.deallocate(first);
+
+        // 同じサイズクラスはキャッシュから返る
+        void* second = allocator.allocate(32, 16);
+        EXPECT_EQ(second, first);
+        EXPECT_EQ(parent.m_allocations - baseline, 1);
+        allocator.deallocate(second);
+    }
+    EXPECT_EQ(parent.m_allocations, parent.m_deallocations);
+}
+
+TEST(CpuCacheAllocatorTest, UncachedRequests) {
+    CountingAllocator parent;
+    w6_mem::CpuCacheAllocator allocator(&parent, 8, 1);
+
+    void* large = allocator.allocate(4096, 8);
+    ASSERT_NE(large, nullptr);
+    std::memset(large, 0, 4096);
+    void* aligned = allocator.allocate(64, 128);
+    ASSERT_NE(aligned, nullptr);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(aligned) % 128, 0u);
+
+    const int before = parent.m_deallocations;
+    allocator.deallocate(large);
+    allocator.deallocate(aligned);
+    EXPECT_EQ(parent.m_deallocations - before, 2);
+}
+
+TEST(CpuCacheAllocatorTest, OverflowIsReturnedToParent) {
+    CountingAllocator parent;
+    w6_mem::CpuCacheAllocator allocator(&parent, 4, 1);
+
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 16; ++i) {
+        ptrs.push_back(allocator.allocate(64, 8));
+    }
+    const int before = parent.m_deallocations;
+    for (void* ptr : ptrs) {
+        allocator.deallocate(ptr);
+    }
+    // キャッシュに残るのは上限以下
+    EXPECT_GE(parent.m_deallocations - before, 12);
+
+    allocator.flush();
+    EXPECT_EQ(parent.m_deallocations - before, 16);
+}
+
+TEST(CpuCacheAllocatorTest, ZeroLimitCachesNothing) {
+    CountingAllocator parent;
+    w6_mem::CpuCacheAllocator allocator(&parent, 0, 1);
+
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 16; ++i) {
+        ptrs.push_back(allocator.allocate(64, 8));
+    }
+    const int before = parent.m_deallocations;
+    for (void* ptr : ptrs) {
+        allocator.deallocate(ptr);
+    }
+    // 上限が0なら解放のたびに親に返却します
+    EXPECT_EQ(parent.m_deallocations - before, 16);
+}
+
+TEST(CpuCacheAllocatorTest, ManyThreads) {
+    CountingAllocator parent;
+    {
+        w6_mem::CpuCacheAllocator allocator(&parent, 32, 4);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 16; ++t) {
+            threads.emplace_back([&allocator, t] {
+                std::vector<void*> ptrs;
+                for (int round = 0; round < 100; ++round) {
+                    for (int i = 0; i < 16; ++i) {
+                        auto* ptr = static_cast<int*>(allocator.allocate(16 + 16 * (i % 4), 8));
+                        ASSERT_NE(ptr, nullptr);
+                        *ptr = t;
+                        ptrs.push_back(ptr);
+                    }
+                    for (void* ptr : ptrs) {
+                        EXPECT_EQ(*static_cast<int*>(ptr), t);
+                        allocator.deallocate(ptr);
+                    }
+                    ptrs.clear();
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        EXPECT_EQ(allocator.cache_count(), 4u);
+    }
+    EXPECT_EQ(parent.m_allocations, parent.m_deallocations);
+}
+
+} // namespace
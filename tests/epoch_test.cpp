@@ -0,0 +1,99 @@
+#include <atomic>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <w6_mem/epoch.h>
+
+namespace {
+
+struct Object : w6_mem::EpochRetired {
+    int value = 0;
+};
+
+void reclaim_object(w6_mem::EpochRetired* object, void* context) {
+    auto* counter = static_cast<std::atomic<int>*>(context);
+    ++*counter;
+    delete static_cast<Object*>(object);
+}
+
+TEST(EpochTest, WaitsForReaders) {
+    std::atomic<int> reclaimed{0};
+    w6_mem::EpochDomain domain(&reclaimed);
+
+    auto* object = new Object();
+    {
+        w6_mem::EpochDomain::Guard guard(domain);
+        domain.retire(object, &reclaim_object);
+        // 読み取り中のGuardがあるため、エポックは1つしか進められません
+        for (int i = 0; i < 4; ++i) {
+            domain.collect();
+        }
+        EXPECT_EQ(reclaimed.load(), 0);
+        EXPECT_EQ(domain.pending(), 1u);
+    }
+    domain.synchronize();
+    EXPECT_EQ(reclaimed.load(), 1);
+    EXPECT_EQ(domain.pending(), 0u);
+}
+
+TEST(EpochTest, NestedGuards) {
+    std::atomic<int> reclaimed{0};
+    w6_mem::EpochDomain domain(&reclaimed);
+    {
+        w6_mem::EpochDomain::Guard outer(domain);
+        {
+            w6_mem::EpochDomain::Guard inner(domain);
+            domain.retire(new Object(), &reclaim_object);
+        }
+        domain.collect();
+        domain.collect();
+        EXPECT_EQ(reclaimed.load(), 0);
+    }
+    domain.synchronize();
+    EXPECT_EQ(reclaimed.load(), 1);
+}
+
+TEST(EpochTest, DestructorReclaimsPending) {
+    std::atomic<int> reclaimed{0};
+    {
+        w6_mem::EpochDomain domain(&reclaimed);
+        for (int i = 0; i < 10; ++i) {
+            domain.retire(new Object(), &reclaim_object);
+        }
+    }
+    EXPECT_EQ(reclaimed.load(), 10);
+}
+
+TEST(EpochTest, ConcurrentReadersNeverSeeReclaimedObjects) {
+    std::atomic<int> reclaimed{0};
+    w6_mem::EpochDomain domain(&reclaimed);
+    std::atomic<Object*> shared{new Object()};
+    std::atomic<bool> stop{false};
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&]() {
+            while (!stop.load()) {
+                w6_mem::EpochDomain::Guard guard(domain);
+                Object* object = shared.load(std::memory_order_acquire);
+                // 回収済みならASanが検出します
+                EXPECT_GE(object->value, 0);
+            }
+        });
+    }
+    for (int i = 1; i <= 5000; ++i) {
+        auto* object = new Object();
+        object->value = i;
+        Object* old = shared.exchange(object, std::memory_order_acq_rel);
+        domain.retire(old, &reclaim_object);
+    }
+    stop = true;
+    for (std::thread& thread : readers) {
+        thread.join();
+    }
+    domain.synchronize();
+    EXPECT_EQ(reclaimed.load(), 5000);
+    delete shared.load();
+}
+
+} // namespace
@@ -0,0 +1,90 @@
+#include "counting_allocator.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <utility>
+#include <w6_mem/allocator.h>
+#include <w6_mem/function.h>
+#include <w6_mem/unique_ptr.h>
+
+namespace {
+
+using w6_mem_test::CountingAllocator;
+
+int add(int a, int b) {
+    return a + b;
+}
+
+TEST(UniqueFunctionTest, EmptyByDefault) {
+    w6_mem::UniqueFunction<void()> function;
+    EXPECT_FALSE(function);
+    w6_mem::UniqueFunction<void()> null_function(nullptr);
+    EXPECT_FALSE(null_function);
+}
+
+TEST(UniqueFunctionTest, InlineCallables) {
+    w6_mem::UniqueFunction<int(int, int)> from_pointer(&add);
+    ASSERT_TRUE(from_pointer);
+    EXPECT_TRUE(from_pointer.is_inline());
+    EXPECT_EQ(from_pointer(2, 3), 5);
+
+    int base = 10;
+    w6_mem::Function<int(int)> from_lambda([base](int x) { return base + x; });
+    EXPECT_TRUE(from_lambda.is_inline());
+    EXPECT_EQ(from_lambda(5), 15);
+}
+
+TEST(UniqueFunctionTest, MutableStateAndMove) {
+    w6_mem::UniqueFunction<int()> counter([count = 0]() mutable { return ++count; });
+    EXPECT_EQ(counter(), 1);
+    EXPECT_EQ(counter(), 2);
+
+    // トリビアルな呼び出し可能オブジェクトはバッファのコピーでムーブされる
+    w6_mem::UniqueFunction<int()> moved(std::move(counter));
+    EXPECT_FALSE(counter);
+    EXPECT_EQ(moved(), 3);
+}
+
+TEST(UniqueFunctionTest, MoveOnlyCapture) {
+    w6_mem::DefaultAllocator allocator;
+    auto value = w6_mem::make_unique<int>(&allocator, 7);
+    w6_mem::UniqueFunction<int()> function([value = std::move(value)]() { return *value; });
+    ASSERT_TRUE(function.is_inline());
+
+    w6_mem::UniqueFunction<int()> moved;
+    moved = std::move(function);
+    EXPECT_EQ(moved(), 7);
+}
+
+TEST(UniqueFunctionTest, LargeCaptureUsesAllocator) {
+    CountingAllocator allocator;
+    {
+        struct Large {
+            int values[64];
+        };
+        Large large{};
+        large.values[63] = 9;
+
+        w6_mem::UniqueFunction<int()> function(&allocator, [large]() { return large.values[63]; });
+        ASSERT_TRUE(function);
+        EXPECT_FALSE(function.is_inline());
+        EXPECT_EQ(allocator.m_allocations, 1);
+
+        w6_mem::UniqueFunction<int()> moved(std::move(function));
+        EXPECT_EQ(moved(), 9);
+    }
+    EXPECT_EQ(allocator.m_deallocations, 1);
+}
+
+TEST(UniqueFunctionTest, DestroysCapture) {
+    auto shared = std::make_shared<int>(1);
+    {
+        w6_mem::UniqueFunction<void()> function([shared]() {});
+        EXPECT_EQ(shared.use_count(), 2);
+        w6_mem::UniqueFunction<void()> moved(std::move(function));
+        EXPECT_EQ(shared.use_count(), 2);
+    }
+    EXPECT_EQ(shared.use_count(), 1);
+}
+
+} // namespace
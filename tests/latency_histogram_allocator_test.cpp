@@ -0,0 +1,140 @@
+#include <chrono>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <w6_mem/allocator.h>
+#include <w6_mem/latency_histogram_allocator.h>
+
+namespace {
+
+// 指定したサイズの割り当てだけ遅くする親アロケータ
+class SlowAllocator : public w6_mem::IAllocator {
+private:
+    w6_mem::DefaultAllocator m_parent;
+    std::size_t m_slow_size;
+
+public:
+    explicit SlowAllocator(std::size_t slow_size) : m_slow_size(slow_size) {}
+
+    void* allocate(std::size_t size, std::size_t alignment) override {
+        if (size == m_slow_size) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        return m_parent.allocate(size, alignment);
+    }
+
+    void deallocate(void* ptr) override {
+        m_parent.deallocate(ptr);
+    }
+};
+
+TEST(LatencyHistogramTest, BucketBoundaries) {
+    using Histogram = w6_mem::LatencyHistogram;
+    std::size_t previous = 0;
+    for (std::uint64_t value = 0; value < 100000; value += value < 100 ? 1 : 37) {
+        const std::size_t index = Histogram::bucket_index(value);
+        ASSERT_LT(index, Histogram::BUCKET_COUNT);
+        EXPECT_GE(index, previous);
+        EXPECT_LE(Histogram::bucket_lower(index), value);
+        EXPECT_GE(Histogram::bucket_upper(index), value);
+        // 相対誤差は1/16以内
+        EXPECT_LE(Histogram::bucket_upper(index) - Histogram::bucket_lower(index),
+                  Histogram::bucket_lower(index) / 16);
+        previous = index;
+    }
+    EXPECT_EQ(Histogram::bucket_index(Histogram::MAX_VALUE), Histogram::BUCKET_COUNT - 1);
+    EXPECT_EQ(Histogram::bucket_index(~std::uint64_t{0}), Histogram::BUCKET_COUNT - 1);
+    EXPECT_EQ(Histogram::bucket_upper(Histogram::BUCKET_COUNT - 1), Histogram::MAX_VALUE);
+}
+
+TEST(LatencyHistogramTest, Percentiles) {
+    w6_mem::LatencyHistogram histogram;
+    EXPECT_EQ(histogram.percentile(50), 0u);
+
+    for (std::uint64_t value = 1; value <= 1000; ++value) {
+        histogram.record(value);
+    }
+    EXPECT_EQ(histogram.count(), 1000u);
+    EXPECT_EQ(histogram.max(), 1000u);
+    EXPECT_DOUBLE_EQ(histogram.mean(), 500.5);
+    EXPECT_NEAR(static_cast<double>(histogram.percentile(50)), 500.0, 500.0 / 16);
+    EXPECT_NEAR(static_cast<double>(histogram.percentile(99)), 990.0, 990.0 / 16);
+    EXPECT_EQ(histogram.percentile(100), 1000u);
+    EXPECT_EQ(histogram.percentile(0), 1u);
+
+    w6_mem::LatencyHistogram other;
+    other.record(5000);
+    histogram.merge(other);
+    EXPECT_EQ(histogram.count(), 1001u);
+    EXPECT_EQ(histogram.percentile(100), 5000u);
+}
+
+TEST(LatencyHistogramAllocatorTest, RecordsEveryCall) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::LatencyHistogramAllocator allocator(&parent);
+
+    for (int i = 0; i < 100; ++i) {
+        void* ptr = allocator.allocate(64, 8);
+        ASSERT_NE(ptr, nullptr);
+        allocator.deallocate(ptr);
+    }
+    EXPECT_EQ(allocator.allocate_histogram().count(), 100u);
+    EXPECT_EQ(allocator.deallocate_histogram().count(), 100u);
+    EXPECT_EQ(allocator.slow_count(), 0u);
+
+    allocator.reset();
+    EXPECT_EQ(allocator.allocate_histogram().count(), 0u);
+}
+
+TEST(LatencyHistogramAllocatorTest, MergesThreads) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::LatencyHistogramAllocator allocator(&parent);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&allocator] {
+            for (int i = 0; i < 1000; ++i) {
+                allocator.deallocate(allocator.allocate(32, 8));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    const auto histogram = allocator.allocate_histogram();
+    EXPECT_EQ(histogram.count(), 4000u);
+    EXPECT_LE(histogram.percentile(50), histogram.percentile(99.9));
+    EXPECT_LE(histogram.percentile(99.9), histogram.max());
+}
+
+TEST(LatencyHistogramAllocatorTest, ReportsSlowAllocations) {
+    struct Report {
+        int calls = 0;
+        w6_mem::SlowAllocation last;
+    } report;
+    auto handler = [](const w6_mem::SlowAllocation& allocation, void* context) {
+        auto* r = static_cast<Report*>(context);
+        ++r->calls;
+        r->last = allocation;
+    };
+
+    SlowAllocator parent(4096);
+    w6_mem::LatencyHistogramAllocator allocator(&parent, 1000 * 1000, handler, &report);
+
+    allocator.deallocate(allocator.allocate(64, 8));
+    EXPECT_EQ(report.calls, 0);
+
+    allocator.deallocate(allocator.allocate(4096, 16));
+    EXPECT_EQ(report.calls, 1);
+    EXPECT_EQ(allocator.slow_count(), 1u);
+    EXPECT_EQ(report.last.size, 4096u);
+    EXPECT_EQ(report.last.alignment, 16u);
+    EXPECT_GE(report.last.nanoseconds, 1000u * 1000u);
+#if defined(__GLIBC__) || defined(_WIN32)
+    EXPECT_GT(report.last.frame_count, 0);
+#endif
+    EXPECT_GE(allocator.allocate_histogram().max(), 1000u * 1000u);
+}
+
+} // namespace
@@ -0,0 +1,177 @@
+// このファイルはW6_MEM_ENABLE_ALLOCATION_SITEを定義した別の実行ファイルとしてビルドします。
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <vector>
+#include <w6_mem/allocator.h>
+#include <w6_mem/lifetime_allocator.h>
+#include <w6_mem/size_class_allocator.h>
+#include <w6_mem/unique_ptr.h>
+
+namespace {
+
+constexpr std::size_t MAX_BYTES = 16 * 1024 * 1024;
+const w6_mem::AllocationSite SHORT_SITE{"request.cpp", 10};
+const w6_mem::AllocationSite LONG_SITE{"cache.cpp", 20};
+
+// 短命な呼び出し元と長命な呼び出し元の傾向を学習させます
+void train(w6_mem::LifetimeAllocator& allocator) {
+    std::vector<void*> long_lived;
+    for (std::uint32_t i = 0; i < w6_mem::LifetimeAllocator::DECISION_WINDOW; ++i) {
+        long_lived.push_back(allocator.allocate_tagged(64, 16, LONG_SITE));
+    }
+    for (std::uint32_t i = 0; i < w6_mem::LifetimeAllocator::DECISION_WINDOW * 2; ++i) {
+        allocator.deallocate(allocator.allocate_tagged(64, 16, SHORT_SITE));
+    }
+    for (void* ptr : long_lived) {
+        allocator.deallocate(ptr);
+    }
+}
+
+TEST(LifetimeAllocatorTest, LearnsPerSite) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SizeClassAllocator short_lived(&parent, MAX_BYTES);
+    w6_mem::SizeClassAllocator long_lived(&parent, MAX_BYTES);
+    w6_mem::LifetimeAllocator allocator(&short_lived, &long_lived, 100);
+
+    // 学習前はどちらも長命として扱う
+    void* before = allocator.allocate_tagged(64, 16, SHORT_SITE);
+    EXPECT_TRUE(long_lived.owns(before));
+    allocator.deallocate(before);
+
+    train(allocator);
+    EXPECT_TRUE(allocator.predicts_short_lived(SHORT_SITE));
+    EXPECT_FALSE(allocator.predicts_short_lived(LONG_SITE));
+    EXPECT_FALSE(allocator.predicts_short_lived(w6_mem::AllocationSite{"unknown.cpp", 1}));
+
+    void* short_ptr = allocator.allocate_tagged(64, 16, SHORT_SITE);
+    void* long_ptr = allocator.allocate_tagged(64, 16, LONG_SITE);
+    EXPECT_TRUE(short_lived.owns(short_ptr));
+    EXPECT_TRUE(long_lived.owns(long_ptr));
+    EXPECT_GT(allocator.short_lived_count(), 0u);
+    EXPECT_GT(allocator.long_lived_count(), 0u);
+    EXPECT_EQ(allocator.dropped(), 0u);
+    allocator.deallocate(short_ptr);
+    allocator.deallocate(long_ptr);
+}
+
+TEST(LifetimeAllocatorTest, AdaptsWhenBehaviorChanges) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::LifetimeAllocator allocator(&parent, &parent, 100);
+    train(allocator);
+    ASSERT_TRUE(allocator.predicts_short_lived(SHORT_SITE));
+
+    // 同じ呼び出し元のオブジェクトが長く生きるようになると、長命に戻る
+    std::vector<void*> kept;
+    for (int i = 0; i < 400; ++i) {
+        kept.push_back(allocator.allocate_tagged(64, 16, SHORT_SITE));
+    }
+    while (!kept.empty()) {
+        allocator.deallocate(kept.back());
+        kept.pop_back();
+    }
+    EXPECT_FALSE(allocator.predicts_short_lived(SHORT_SITE));
+}
+
+TEST(LifetimeAllocatorTest, UsesReturnAddressWithoutSite) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SizeClassAllocator short_lived(&parent, MAX_BYTES);
+    w6_mem::LifetimeAllocator allocator(&short_lived, &parent, 100);
+
+    void* ptr = nullptr;
+    for (std::uint32_t i = 0; i <= w6_mem::LifetimeAllocator::DECISION_WINDOW; ++i) {
+        allocator.deallocate(ptr);
+        ptr = allocator.allocate(48, 16);
+        ASSERT_NE(ptr, nullptr);
+    }
+    EXPECT_TRUE(short_lived.owns(ptr));
+    allocator.deallocate(ptr);
+}
+
+TEST(LifetimeAllocatorTest, MakeUniqueLearnsPerCallSite) {
+    struct Payload {
+        std::uint64_t values[6] = {};
+    };
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SizeClassAllocator short_lived(&parent, MAX_BYTES);
+    w6_mem::SizeClassAllocator long_lived(&parent, MAX_BYTES);
+    w6_mem::LifetimeAllocator allocator(&short_lived, &long_lived, 100);
+
+    // どちらもmake_uniqueの中からallocate_tagged()が呼ばれるが、呼び出し元の行で区別されます
+    auto make_temporary = [&] { return w6_mem::make_unique<Payload>(&allocator); };
+    auto make_cached = [&] { return w6_mem::make_unique<Payload>(&allocator); };
+
+    std::vector<w6_mem::UniquePtr<Payload>> cached;
+    for (std::uint32_t i = 0; i < w6_mem::LifetimeAllocator::DECISION_WINDOW * 4; ++i) {
+        cached.push_back(make_cached());
+        auto temporary = make_temporary();
+        ASSERT_TRUE(temporary);
+    }
+    cached.clear();
+
+    auto temporary = make_temporary();
+    auto kept = make_cached();
+    EXPECT_TRUE(short_lived.owns(temporary.get()));
+    EXPECT_TRUE(long_lived.owns(kept.get()));
+}
+
+TEST(LifetimeAllocatorTest, Alignment) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::LifetimeAllocator allocator(&parent, &parent);
+    for (std::size_t alignment : {1, 8, 16, 64, 256}) {
+        void* ptr = allocator.allocate_tagged(100, alignment, LONG_SITE);
+        ASSERT_NE(ptr, nullptr);
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(ptr) % alignment, 0u);
+        std::memset(ptr, 0xAB, 100);
+        allocator.deallocate(ptr);
+    }
+    allocator.deallocate(nullptr);
+}
+
+TEST(LifetimeAllocatorTest, SegregationReducesResidentPages) {
+    constexpr int ROUNDS = 1000;
+    w6_mem::DefaultAllocator parent;
+
+    // 長命なオブジェクト1個ごとに、短命なオブジェクト3個をまとめて割り当てて解放する
+    auto run = [](w6_mem::IAllocator& allocator, const w6_mem::AllocationSite& short_site,
+                  const w6_mem::AllocationSite& long_site, std::vector<void*>& long_lived) {
+        std::vector<void*> short_lived;
+        for (int i = 0; i < ROUNDS; ++i) {
+            long_lived.push_back(allocator.allocate_tagged(48, 16, long_site));
+            for (int j = 0; j < 3; ++j) {
+                short_lived.push_back(allocator.allocate_tagged(48, 16, short_site));
+            }
+        }
+        for (void* ptr : short_lived) {
+            allocator.deallocate(ptr);
+        }
+    };
+
+    std::vector<void*> mixed_long;
+    w6_mem::SizeClassAllocator mixed(&parent, MAX_BYTES);
+    run(mixed, SHORT_SITE, LONG_SITE, mixed_long);
+    mixed.trim();
+
+    std::vector<void*> segregated_long;
+    w6_mem::SizeClassAllocator short_lived(&parent, MAX_BYTES);
+    w6_mem::SizeClassAllocator long_lived(&parent, MAX_BYTES);
+    {
+        w6_mem::LifetimeAllocator allocator(&short_lived, &long_lived, 100);
+        train(allocator);
+        run(allocator, SHORT_SITE, LONG_SITE, segregated_long);
+        short_lived.trim();
+        long_lived.trim();
+        const std::size_t segregated = short_lived.resident_pages() + long_lived.resident_pages();
+        // 長命なオブジェクトがページに散らばらず、密に詰まっている
+        EXPECT_LT(segregated * 2, mixed.resident_pages());
+
+        for (void* ptr : segregated_long) {
+            allocator.deallocate(ptr);
+        }
+    }
+    for (void* ptr : mixed_long) {
+        mixed.deallocate(ptr);
+    }
+}
+
+} // namespace
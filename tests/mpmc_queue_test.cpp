@@ -0,0 +1,198 @@
+#include "counting_allocator.h"
+
+#include <atomic>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <w6_mem/allocator.h>
+#include <w6_mem/mpmc_queue.h>
+#include <w6_mem/unique_ptr.h>
+
+namespace {
+
+using w6_mem_test::CountingAllocator;
+
+TEST(MpmcQueueTest, PushAndPop) {
+    w6_mem::DefaultAllocator allocator;
+    w6_mem::MpmcQueue<int> queue(&allocator, 3);
+    EXPECT_EQ(queue.capacity(), 4u);
+
+    int value = 0;
+    EXPECT_FALSE(queue.try_pop(value));
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(queue.try_push(i));
+    }
+    EXPECT_FALSE(queue.try_push(4));
+    EXPECT_EQ(queue.size_approx(), 4u);
+
+    // 周回しても順序が保たれます
+    for (int round = 0; round < 10; ++round) {
+        ASSERT_TRUE(queue.try_pop(value));
+        EXPECT_EQ(value, round);
+        EXPECT_TRUE(queue.try_push(round + 4));
+    }
+    EXPECT_EQ(queue.size_approx(), 4u);
+}
+
+TEST(MpmcQueueTest, Batch) {
+    w6_mem::DefaultAllocator allocator;
+    w6_mem::MpmcQueue<int> queue(&allocator, 8);
+
+    int values[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    EXPECT_EQ(queue.try_push_batch(values, 5), 5u);
+    EXPECT_EQ(queue.try_push_batch(values + 5, 5), 3u);
+    EXPECT_EQ(queue.try_push_batch(values + 8, 2), 0u);
+
+    int out[10] = {};
+    EXPECT_EQ(queue.try_pop_batch(out, 3), 3u);
+    EXPECT_EQ(out[0], 0);
+    EXPECT_EQ(out[2], 2);
+    EXPECT_EQ(queue.try_pop_batch(out, 10), 5u);
+    EXPECT_EQ(out[0], 3);
+    EXPECT_EQ(out[4], 7);
+    EXPECT_EQ(queue.try_pop_batch(out, 10), 0u);
+}
+
+// ムーブの途中で、開かれるまで待つ要素
+struct Gated {
+    static inline std::atomic<bool> s_open{true};
+    static inline std::atomic<bool> s_entered{false};
+    int value = 0;
+
+    Gated() = default;
+    explicit Gated(int v) : value(v) {}
+    Gated(Gated&& other) noexcept : value(other.value) {
+        wait();
+    }
+    Gated& operator=(Gated&& other) noexcept {
+        value = other.value;
+        wait();
+        return *this;
+    }
+
+    static void wait() {
+        s_entered = true;
+        while (!s_open) {
+            std::this_thread::yield();
+        }
+    }
+};
+
+TEST(MpmcQueueTest, BatchDoesNotWaitForInFlightSlots) {
+    w6_mem::DefaultAllocator allocator;
+    w6_mem::MpmcQueue<Gated> queue(&allocator, 2);
+    Gated values[2] = {Gated(1), Gated(2)};
+    Gated out[2];
+
+    // 書き込み中のスロットは取り出さずに戻ります
+    Gated::s_open = false;
+    Gated::s_entered = false;
+    std::thread producer([&] { EXPECT_TRUE(queue.try_push(Gated(0))); });
+    while (!Gated::s_entered) {
+        std::this_thread::yield();
+    }
+    EXPECT_EQ(queue.try_pop_batch(out, 2), 0u);
+    Gated::s_open = true;
+    producer.join();
+    ASSERT_EQ(queue.try_push_batch(values, 1), 1u);
+
+    // 取り出し中のスロットには追加せずに戻ります
+    Gated::s_open = false;
+    Gated::s_entered = false;
+    std::thread consumer([&] {
+        Gated value;
+        EXPECT_TRUE(queue.try_pop(value));
+        EXPECT_EQ(value.value, 0);
+    });
+    while (!Gated::s_entered) {
+        std::this_thread::yield();
+    }
+    EXPECT_EQ(queue.try_push_batch(values + 1, 1), 0u);
+    Gated::s_open = true;
+    consumer.join();
+    EXPECT_EQ(queue.try_push_batch(values + 1, 1), 1u);
+
+    EXPECT_EQ(queue.try_pop_batch(out, 2), 2u);
+    EXPECT_EQ(out[0].value, 1);
+    EXPECT_EQ(out[1].value, 2);
+}
+
+TEST(MpmcQueueTest, ManyProducersAndConsumers) {
+    w6_mem::DefaultAllocator allocator;
+    w6_mem::MpmcQueue<std::uint64_t> queue(&allocator, 64);
+    constexpr int THREADS = 4;
+    constexpr std::uint64_t PER_THREAD = 20000;
+
+    std::atomic<std::uint64_t> sum{0};
+    std::atomic<std::uint64_t> popped{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&queue, t]() {
+            std::uint64_t batch[8];
+            std::uint64_t next = 1;
+            while (next <= PER_THREAD) {
+                if (t % 2 == 0) {
+                    if (queue.try_push(next)) {
+                        ++next;
+                    }
+                    continue;
+                }
+                std::size_t n = 0;
+                while (n < 8 && next + n <= PER_THREAD) {
+                    batch[n] = next + n;
+                    ++n;
+                }
+                next += queue.try_push_batch(batch, n);
+                // 入らなかった分は次の周回で先頭から詰め直します
+            }
+        });
+        threads.emplace_back([&queue, &sum, &popped, t]() {
+            std::uint64_t batch[8];
+            while (popped.load() < THREADS * PER_THREAD) {
+                std::size_t n = 0;
+                if (t % 2 == 0) {
+                    n = queue.try_pop(batch[0]) ? 1 : 0;
+                } else {
+                    n = queue.try_pop_batch(batch, 8);
+                }
+                for (std::size_t i = 0; i < n; ++i) {
+                    sum += batch[i];
+                }
+                popped += n;
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(popped.load(), THREADS * PER_THREAD);
+    EXPECT_EQ(sum.load(), THREADS * PER_THREAD * (PER_THREAD + 1) / 2);
+    EXPECT_EQ(queue.size_approx(), 0u);
+}
+
+TEST(MpmcQueueTest, MovesUniquePtrWithoutAllocator) {
+    CountingAllocator queue_allocator;
+    CountingAllocator object_allocator;
+    {
+        w6_mem::UniquePtrQueue<int> queue(&queue_allocator, 4);
+        EXPECT_EQ(queue_allocator.m_allocations.load(), 1);
+
+        for (int i = 0; i < 3; ++i) {
+            EXPECT_TRUE(queue.try_push(w6_mem::make_unique<int>(&object_allocator, i)));
+        }
+        EXPECT_EQ(object_allocator.m_allocations.load(), 3);
+
+        w6_mem::UniquePtr<int> out;
+        ASSERT_TRUE(queue.try_pop(out));
+        EXPECT_EQ(*out, 0);
+        // キューへの出し入れでオブジェクトのアロケータは呼ばれません
+        EXPECT_EQ(object_allocator.m_allocations.load(), 3);
+        EXPECT_EQ(object_allocator.m_deallocations.load(), 0);
+    }
+    // キューに残った2つと、取り出した1つが解放されます
+    EXPECT_EQ(object_allocator.m_deallocations.load(), 3);
+    EXPECT_EQ(queue_allocator.m_deallocations.load(), 1);
+}
+
+} // namespace
@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <w6_mem/allocator.h>
+#include <w6_mem/budget_allocator.h>
+#include <w6_mem/no_alloc.h>
+#include <w6_mem/stl_allocator.h>
+#include <w6_mem/unique_ptr.h>
+
+namespace {
+
+// 違反を数えるだけのモードで実行するフィクスチャ
+class NoAllocTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        w6_mem::set_no_alloc_abort(false);
+        w6_mem::reset_no_alloc_violation_count();
+    }
+
+    void TearDown() override {
+        w6_mem::set_no_alloc_handler(nullptr);
+        w6_mem::set_no_alloc_abort(true);
+    }
+};
+
+TEST_F(NoAllocTest, ScopesNest) {
+    EXPECT_FALSE(w6_mem::is_allocation_forbidden());
+    {
+        w6_mem::NoAllocScope outer;
+        EXPECT_TRUE(w6_mem::is_allocation_forbidden());
+        {
+            w6_mem::NoAllocScope inner;
+            w6_mem::AllowAllocScope allow;
+            EXPECT_FALSE(w6_mem::is_allocation_forbidden());
+        }
+        EXPECT_TRUE(w6_mem::is_allocation_forbidden());
+    }
+    EXPECT_FALSE(w6_mem::is_allocation_forbidden());
+}
+
+TEST_F(NoAllocTest, CountsViolations) {
+    w6_mem::DefaultAllocator allocator;
+    allocator.deallocate(allocator.allocate(64, 8));
+    EXPECT_EQ(w6_mem::no_alloc_violation_count(), 0u);
+
+    {
+        w6_mem::NoAllocScope no_alloc;
+        // 計数モードでは割り当て自体は成功する
+        void* ptr = allocator.allocate(64, 8);
+        ASSERT_NE(ptr, nullptr);
+        // 解放は違反ではない
+        allocator.deallocate(ptr);
+        {
+            w6_mem::AllowAllocScope allow;
+            allocator.deallocate(allocator.allocate(64, 8));
+        }
+    }
+    EXPECT_EQ(w6_mem::no_alloc_violation_count(), 1u);
+    EXPECT_FALSE(w6_mem::is_allocation_forbidden());
+}
+
+TEST_F(NoAllocTest, CountsOncePerCall) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::BudgetAllocator budget(&parent, 1024 * 1024);
+    {
+        w6_mem::NoAllocScope no_alloc;
+        // make_unique -> BudgetAllocator -> DefaultAllocator で1回だけ数える
+        auto ptr = w6_mem::make_unique<int>(&budget, 42);
+        ASSERT_TRUE(ptr);
+        EXPECT_TRUE(w6_mem::is_allocation_forbidden());
+    }
+    EXPECT_EQ(w6_mem::no_alloc_violation_count(), 1u);
+}
+
+TEST_F(NoAllocTest, ChecksStlAllocator) {
+    w6_mem::DefaultAllocator allocator;
+    std::vector<int, w6_mem::StlAllocator<int>> values{w6_mem::StlAllocator<int>(&allocator)};
+    values.reserve(4);
+    {
+        w6_mem::NoAllocScope no_alloc;
+        values.push_back(1); // 容量内なので割り当てない
+        EXPECT_EQ(w6_mem::no_alloc_violation_count(), 0u);
+        values.resize(100);
+    }
+    EXPECT_EQ(w6_mem::no_alloc_violation_count(), 1u);
+}
+
+TEST_F(NoAllocTest, ScopeIsPerThread) {
+    w6_mem::DefaultAllocator allocator;
+    w6_mem::NoAllocScope no_alloc;
+    std::thread thread([&allocator] {
+        EXPECT_FALSE(w6_mem::is_allocation_forbidden());
+        allocator.deallocate(allocator.allocate(64, 8));
+    });
+    thread.join();
+    EXPECT_EQ(w6_mem::no_alloc_violation_count(), 0u);
+}
+
+TEST_F(NoAllocTest, CallsHandler) {
+    struct Report {
+        int calls = 0;
+        w6_mem::NoAllocViolation last;
+    } report;
+    w6_mem::set_no_alloc_handler(
+        [](const w6_mem::NoAllocViolation& violation, void* context) {
+            auto* r = static_cast<Report*>(context);
+            ++r->calls;
+            r->last = violation;
+            // ハンドラの中では割り当ては許可される
+            EXPECT_FALSE(w6_mem::is_allocation_forbidden());
+        },
+        &report);
+
+    w6_mem::DefaultAllocator allocator;
+    {
+        w6_mem::NoAllocScope no_alloc;
+        allocator.deallocate(allocator.allocate(128, 16));
+    }
+    EXPECT_EQ(report.calls, 1);
+    EXPECT_EQ(report.last.size, 128u);
+    EXPECT_EQ(report.last.alignment, 16u);
+#if defined(__GLIBC__) || defined(_WIN32)
+    EXPECT_GT(report.last.frame_count, 0);
+#endif
+}
+
+TEST(NoAllocDeathTest, AbortsOnViolation) {
+    w6_mem::set_no_alloc_abort(true);
+    w6_mem::DefaultAllocator allocator;
+    EXPECT_DEATH(
+        {
+            w6_mem::NoAllocScope no_alloc;
+            allocator.deallocate(allocator.allocate(64, 8));
+        },
+        "inside NoAllocScope");
+}
+
+} // namespace
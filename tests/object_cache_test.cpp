@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <w6_mem/allocator.h>
+#include <w6_mem/object_cache.h>
+
+namespace {
+
+struct Decoded {
+    static inline int m_live = 0;
+
+    int value = 0;
+    char payload[56] = {};
+
+    explicit Decoded(int v) : value(v) {
+        ++m_live;
+    }
+    Decoded(const Decoded&) = delete;
+    Decoded& operator=(const Decoded&) = delete;
+    ~Decoded() {
+        --m_live;
+    }
+};
+
+TEST(ObjectCacheTest, InsertFindErase) {
+    w6_mem::DefaultAllocator allocator;
+    w6_mem::ObjectCache<std::string, Decoded> cache(&allocator, 16, 4096);
+
+    ASSERT_NE(cache.emplace("a", 1), nullptr);
+    ASSERT_NE(cache.emplace("b", 2), nullptr);
+    EXPECT_EQ(cache.size(), 2u);
+    EXPECT_GT(cache.used_bytes(), 2 * sizeof(Decoded) - 1);
+
+    ASSERT_NE(cache.find("a"), nullptr);
+    EXPECT_EQ(cache.find("a")->value, 1);
+    EXPECT_EQ(cache.find("c"), nullptr);
+
+    // 同じキーの登録は置き換え
+    cache.emplace("a", 10);
+    EXPECT_EQ(cache.size(), 2u);
+    EXPECT_EQ(cache.find("a")->value, 10);
+
+    EXPECT_TRUE(cache.erase("a"));
+    EXPECT_FALSE(cache.erase("a"));
+    EXPECT_EQ(cache.find("a"), nullptr);
+    EXPECT_EQ(cache.find("b")->value, 2);
+}
+
+TEST(ObjectCacheTest, EvictsWithinBudget) {
+    w6_mem::DefaultAllocator allocator;
+    {
+        // 値4個分程度の予算
+        w6_mem::ObjectCache<int, Decoded> cache(&allocator, 64, 4 * (sizeof(Decoded) + 16));
+
+        for (int i = 0; i < 100; ++i) {
+            ASSERT_NE(cache.emplace(i, i), nullptr);
+            EXPECT_LE(cache.used_bytes(), cache.budget());
+        }
+        EXPECT_EQ(cache.size(), 4u);
+        EXPECT_EQ(cache.evictions(), 96u);
+        EXPECT_EQ(Decoded::m_live, 4);
+        EXPECT_EQ(cache.find(99)->value, 99);
+    }
+    EXPECT_EQ(Decoded::m_live, 0);
+}
+
+TEST(ObjectCacheTest, ReferencedEntriesSurvive) {
+    w6_mem::DefaultAllocator allocator;
+    w6_mem::ObjectCache<int, Decoded> cache(&allocator, 4, 1 << 20);
+
+    for (int i = 0; i < 4; ++i) {
+        cache.emplace(i, i);
+    }
+    // 0番を参照しておくと、次の追い出しでは残る
+    ASSERT_NE(cache.find(0), nullptr);
+    cache.emplace(4, 4);
+
+    EXPECT_EQ(cache.size(), 4u);
+    EXPECT_NE(cache.find(0), nullptr);
+    EXPECT_NE(cache.find(4), nullptr);
+}
+
+TEST(ObjectCacheTest, RejectsValueLargerThanBudget) {
+    w6_mem::DefaultAllocator allocator;
+    w6_mem::ObjectCache<int, Decoded> cache(&allocator, 4, sizeof(Decoded) / 2);
+
+    EXPECT_EQ(cache.emplace(1, 1), nullptr);
+    EXPECT_EQ(cache.size(), 0u);
+}
+
+TEST(ObjectCacheTest, ManyKeysKeepProbeChainsIntact) {
+    w6_mem::DefaultAllocator allocator;
+    w6_mem::ObjectCache<int, int> cache(&allocator, 32, 1 << 20);
+
+    for (int i = 0; i < 32; ++i) {
+        cache.emplace(i * 64, i);
+    }
+    for (int i = 0; i < 32; i += 2) {
+        EXPECT_TRUE(cache.erase(i * 64));
+    }
+    for (int i = 1; i < 32; i += 2) {
+        ASSERT_NE(cache.find(i * 64), nullptr);
+        EXPECT_EQ(*cache.find(i * 64), i);
+    }
+}
+
+} // namespace
@@ -0,0 +1,114 @@
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <vector>
+#include <w6_mem/pinned_allocator.h>
+#include <w6_mem/unique_ptr.h>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+constexpr std::size_t REGION_SIZE = 256 * 1024;
+
+// RLIMIT_MEMLOCKがbytes未満の環境（コンテナの既定の64KiBなど）ではリージョンをロックできません
+bool lock_limit_below(std::size_t bytes) {
+#if defined(_WIN32)
+    (void)bytes;
+    return false;
+#else
+    rlimit rl{};
+    return getrlimit(RLIMIT_MEMLOCK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY &&
+           rl.rlim_cur < bytes;
+#endif
+}
+
+TEST(PinnedAllocatorTest, AllocateAndReuse) {
+    if (lock_limit_below(REGION_SIZE)) {
+        GTEST_SKIP() << "RLIMIT_MEMLOCK is below the region size";
+    }
+    w6_mem::PinnedAllocator allocator(REGION_SIZE, REGION_SIZE * 2);
+
+    void* ptr = allocator.allocate(100, 64);
+    if (!ptr && allocator.last_error() == w6_mem::PinnedError::LOCK_FAILED) {
+        GTEST_SKIP() << "mlock is not permitted in this environment";
+    }
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(ptr) % 64, 0u);
+    std::memset(ptr, 0xAB, 100);
+    EXPECT_EQ(allocator.locked_bytes(), REGION_SIZE);
+
+    // 解放したブロックはロックしたまま再利用される
+    allocator.deallocate(ptr);
+    EXPECT_EQ(allocator.allocate(100, 64), ptr);
+    allocator.deallocate(ptr);
+    EXPECT_EQ(allocator.locked_bytes(), REGION_SIZE);
+}
+
+TEST(PinnedAllocatorTest, LargeAllocation) {
+    if (lock_limit_below(REGION_SIZE)) {
+        GTEST_SKIP() << "RLIMIT_MEMLOCK is below the region size";
+    }
+    w6_mem::PinnedAllocator allocator(REGION_SIZE, REGION_SIZE * 4);
+
+    constexpr std::size_t SIZE = 200 * 1024;
+    void* ptr = allocator.allocate(SIZE, 16);
+    if (!ptr && allocator.last_error() == w6_mem::PinnedError::LOCK_FAILED) {
+        GTEST_SKIP() << "mlock is not permitted in this environment";
+    }
+    ASSERT_NE(ptr, nullptr);
+    std::memset(ptr, 0, SIZE);
+    EXPECT_GE(allocator.locked_bytes(), SIZE);
+
+    allocator.deallocate(ptr);
+    EXPECT_EQ(allocator.locked_bytes(), 0u);
+}
+
+TEST(PinnedAllocatorTest, RespectsLockLimit) {
+    if (lock_limit_below(REGION_SIZE)) {
+        GTEST_SKIP() << "RLIMIT_MEMLOCK is below the region size";
+    }
+    w6_mem::PinnedAllocator allocator(REGION_SIZE, REGION_SIZE);
+
+    EXPECT_EQ(allocator.allocate(REGION_SIZE * 2, 16), nullptr);
+    EXPECT_EQ(allocator.last_error(), w6_mem::PinnedError::LIMIT_EXCEEDED);
+
+    // 1リージョン分を使い切ると、次のリージョンは上限を超える
+    std::vector<void*> ptrs;
+    for (;;) {
+        void* ptr = allocator.allocate(w6_mem::PinnedAllocator::MAX_BLOCK_SIZE / 2, 16);
+        if (!ptr) {
+            break;
+        }
+        ptrs.push_back(ptr);
+    }
+    if (ptrs.empty() && allocator.last_error() == w6_mem::PinnedError::LOCK_FAILED) {
+        GTEST_SKIP() << "mlock is not permitted in this environment";
+    }
+    EXPECT_FALSE(ptrs.empty());
+    EXPECT_EQ(allocator.last_error(), w6_mem::PinnedError::LIMIT_EXCEEDED);
+    for (void* ptr : ptrs) {
+        allocator.deallocate(ptr);
+    }
+}
+
+TEST(PinnedAllocatorTest, ReserveAndUseAsParent) {
+    if (lock_limit_below(REGION_SIZE)) {
+        GTEST_SKIP() << "RLIMIT_MEMLOCK is below the region size";
+    }
+    w6_mem::PinnedAllocator allocator(REGION_SIZE, REGION_SIZE * 2);
+    if (!allocator.reserve(REGION_SIZE)) {
+        GTEST_SKIP() << "mlock is not permitted in this environment";
+    }
+    const std::size_t locked = allocator.locked_bytes();
+    EXPECT_GE(locked, REGION_SIZE);
+
+    auto values = w6_mem::make_unique<int[]>(&allocator, 256);
+    ASSERT_TRUE(values);
+    values[255] = 1;
+    EXPECT_EQ(allocator.locked_bytes(), locked);
+}
+
+} // namespace
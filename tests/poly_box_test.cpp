@@ -0,0 +1,132 @@
+#include "counting_allocator.h"
+
+#include <gtest/gtest.h>
+#include <utility>
+#include <w6_mem/allocator.h>
+#include <w6_mem/poly_box.h>
+
+namespace {
+
+class Shape {
+public:
+    static inline int m_live = 0;
+
+    Shape() {
+        ++m_live;
+    }
+    Shape(const Shape&) = delete;
+    Shape& operator=(const Shape&) = delete;
+    Shape(Shape&&) noexcept {
+        ++m_live;
+    }
+    Shape& operator=(Shape&&) = delete;
+    virtual ~Shape() {
+        --m_live;
+    }
+
+    virtual int area() const = 0;
+};
+
+class Square : public Shape {
+public:
+    explicit Square(int side) : m_side(side) {}
+    int area() const override {
+        return m_side * m_side;
+    }
+
+private:
+    int m_side;
+};
+
+class Big : public Shape {
+public:
+    explicit Big(int value) : m_value(value) {}
+    int area() const override {
+        return m_value;
+    }
+
+private:
+    int m_value;
+    char m_padding[256] = {};
+};
+
+// 多重継承で基底クラスのアドレスがずれる型
+class Tagged {
+public:
+    virtual ~Tagged() = default;
+    long m_tag = 7;
+};
+
+class TaggedSquare : public Tagged, public Square {
+public:
+    explicit TaggedSquare(int side) : Square(side) {}
+};
+
+using w6_mem_test::CountingAllocator;
+
+using ShapeBox = w6_mem::PolyBox<Shape, 64>;
+
+TEST(PolyBoxTest, SmallObjectIsInline) {
+    CountingAllocator allocator;
+    {
+        ShapeBox box;
+        EXPECT_FALSE(box);
+        ASSERT_TRUE(box.emplace<Square>(&allocator, 3));
+        EXPECT_TRUE(box.is_inline());
+        EXPECT_EQ(box->area(), 9);
+        EXPECT_EQ(Shape::m_live, 1);
+    }
+    EXPECT_EQ(Shape::m_live, 0);
+    EXPECT_EQ(allocator.m_allocations, 0);
+}
+
+TEST(PolyBoxTest, LargeObjectUsesAllocator) {
+    CountingAllocator allocator;
+    {
+        auto box = w6_mem::make_poly_box<Shape, Big, 64>(&allocator, 42);
+        ASSERT_TRUE(box);
+        EXPECT_FALSE(box.is_inline());
+        EXPECT_EQ(box->area(), 42);
+        EXPECT_EQ(allocator.m_allocations, 1);
+
+        // ヒープのオブジェクトはポインタの移動だけでムーブされる
+        ShapeBox moved(std::move(box));
+        EXPECT_FALSE(box);
+        EXPECT_EQ(moved->area(), 42);
+        EXPECT_EQ(Shape::m_live, 1);
+    }
+    EXPECT_EQ(Shape::m_live, 0);
+    EXPECT_EQ(allocator.m_deallocations, 1);
+}
+
+TEST(PolyBoxTest, LargeObjectWithoutAllocatorFails) {
+    ShapeBox box;
+    EXPECT_FALSE(box.emplace<Big>(nullptr, 1));
+    EXPECT_FALSE(box);
+}
+
+TEST(PolyBoxTest, InlineMoveRelocates) {
+    {
+        ShapeBox box;
+        box.emplace<TaggedSquare>(nullptr, 4);
+        ASSERT_TRUE(box.is_inline());
+
+        ShapeBox moved(std::move(box));
+        EXPECT_FALSE(box);
+        ASSERT_TRUE(moved.is_inline());
+        EXPECT_EQ(moved->area(), 16);
+        EXPECT_EQ(Shape::m_live, 1);
+
+        ShapeBox assigned;
+        assigned.emplace<Square>(nullptr, 1);
+        assigned = std::move(moved);
+        EXPECT_EQ(assigned->area(), 16);
+        EXPECT_EQ(Shape::m_live, 1);
+
+        assigned.reset();
+        EXPECT_FALSE(assigned);
+    }
+    EXPECT_EQ(Shape::m_live, 0);
+}
+
+} // namespace
@@ -0,0 +1,105 @@
+#include "counting_allocator.h"
+
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <thread>
+#include <utility>
+#include <w6_mem/allocator.h>
+#include <w6_mem/shared_arena.h>
+
+namespace {
+
+using w6_mem_test::CountingAllocator;
+
+TEST(SharedArenaTest, LastReferenceDestroysArena) {
+    CountingAllocator parent;
+    w6_mem::ArenaRef ref = w6_mem::SharedArena::create(&parent, 1024);
+    ASSERT_TRUE(ref);
+    EXPECT_EQ(parent.m_allocations, 1);
+    EXPECT_EQ(ref.use_count(), 1u);
+    EXPECT_EQ(ref->capacity(), 1024u);
+
+    void* p = ref->allocate(64, 16);
+    ASSERT_NE(p, nullptr);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(p) % 16, 0u);
+
+    w6_mem::ArenaRef copy = ref;
+    EXPECT_EQ(ref.use_count(), 2u);
+    EXPECT_EQ(copy.get(), ref.get());
+
+    w6_mem::ArenaRef moved = std::move(copy);
+    EXPECT_FALSE(copy);
+    EXPECT_EQ(moved.use_count(), 2u);
+
+    ref.reset();
+    EXPECT_FALSE(ref);
+    EXPECT_EQ(moved.use_count(), 1u);
+    EXPECT_EQ(parent.m_deallocations, 0);
+
+    moved.reset();
+    EXPECT_EQ(parent.m_deallocations, 1);
+}
+
+TEST(SharedArenaTest, PoolRecyclesArenas) {
+    CountingAllocator parent;
+    {
+        w6_mem::ArenaPool pool(&parent, 256, 1);
+        w6_mem::ArenaRef a = pool.acquire();
+        ASSERT_TRUE(a);
+        w6_mem::Arena* first = a.get();
+        ASSERT_NE(a->allocate(100, 8), nullptr);
+        EXPECT_EQ(pool.outstanding(), 1u);
+
+        a.reset();
+        EXPECT_EQ(pool.outstanding(), 0u);
+        EXPECT_EQ(pool.cached(), 1u);
+
+        // 再利用されたアリーナはリセットされています
+        w6_mem::ArenaRef b = pool.acquire();
+        EXPECT_EQ(b.get(), first);
+        EXPECT_EQ(b->used(), 0u);
+        EXPECT_EQ(pool.cached(), 0u);
+        EXPECT_EQ(parent.m_allocations, 1);
+
+        // max_cachedを超えた分は親に返却されます
+        w6_mem::ArenaRef c = pool.acquire();
+        EXPECT_EQ(parent.m_allocations, 2);
+        b.reset();
+        c.reset();
+        EXPECT_EQ(pool.cached(), 1u);
+        EXPECT_EQ(parent.m_deallocations, 1);
+    }
+    EXPECT_EQ(parent.m_deallocations, 2);
+}
+
+TEST(SharedArenaTest, HandsOffAcrossThreads) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::ArenaPool pool(&parent, 4096);
+    constexpr int ROUNDS = 100;
+    for (int round = 0; round < ROUNDS; ++round) {
+        w6_mem::ArenaRef ref = pool.acquire();
+        ASSERT_TRUE(ref);
+        auto* data = static_cast<int*>(ref->allocate(sizeof(int) * 64, alignof(int)));
+        ASSERT_NE(data, nullptr);
+        for (int i = 0; i < 64; ++i) {
+            data[i] = round + i;
+        }
+
+        // 片方はコピーして手元に残し、もう片方はムーブで渡します
+        w6_mem::ArenaRef kept = ref;
+        int sum = 0;
+        std::thread consumer([ref = std::move(ref), data, &sum]() mutable {
+            for (int i = 0; i < 64; ++i) {
+                sum += data[i];
+            }
+            ref.reset();
+        });
+        kept.reset();
+        consumer.join();
+        EXPECT_EQ(sum, round * 64 + 63 * 64 / 2);
+    }
+    EXPECT_EQ(pool.outstanding(), 0u);
+    EXPECT_EQ(pool.cached(), 1u);
+}
+
+} // namespace
@@ -0,0 +1,80 @@
+// このファイルはW6_MEM_ENABLE_ALLOCATION_SITEを定義した別の実行ファイルとしてビルドします。
+#include <cstring>
+#include <gtest/gtest.h>
+#include <w6_mem/allocator.h>
+#include <w6_mem/site_stats_allocator.h>
+#include <w6_mem/unique_ptr.h>
+
+namespace {
+
+TEST(SiteStatsAllocatorTest, MakeUniqueCapturesCallSite) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SiteStatsAllocator allocator(&parent);
+
+    const int line = __LINE__ + 1;
+    auto value = w6_mem::make_unique<int>(&allocator, 42);
+    ASSERT_TRUE(value);
+    EXPECT_EQ(*value, 42);
+
+    auto stats = allocator.snapshot();
+    ASSERT_EQ(stats.size(), 1u);
+    EXPECT_EQ(stats[0].site.line, line);
+    ASSERT_NE(stats[0].site.file, nullptr);
+    EXPECT_NE(std::strstr(stats[0].site.file, "site_stats_allocator_test.cpp"), nullptr);
+    EXPECT_EQ(stats[0].count, 1u);
+    EXPECT_EQ(stats[0].bytes, sizeof(int));
+}
+
+TEST(SiteStatsAllocatorTest, ArrayMakeUniqueCapturesCallSite) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SiteStatsAllocator allocator(&parent);
+
+    const int line = __LINE__ + 2;
+    for (int i = 0; i < 3; ++i) {
+        auto values = w6_mem::make_unique<int[]>(&allocator, 8);
+        ASSERT_TRUE(values);
+    }
+
+    auto stats = allocator.snapshot();
+    ASSERT_EQ(stats.size(), 1u);
+    EXPECT_EQ(stats[0].site.line, line);
+    EXPECT_EQ(stats[0].count, 3u);
+    EXPECT_EQ(stats[0].bytes, 3 * 8 * sizeof(int));
+}
+
+TEST(SiteStatsAllocatorTest, TopSites) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SiteStatsAllocator allocator(&parent);
+
+    const w6_mem::AllocationSite many_small{"small.cpp", 1};
+    const w6_mem::AllocationSite few_large{"large.cpp", 2};
+    for (int i = 0; i < 10; ++i) {
+        allocator.deallocate(allocator.allocate_tagged(8, 8, many_small));
+    }
+    allocator.deallocate(allocator.allocate_tagged(4096, 8, few_large));
+
+    auto by_count = allocator.top_by_count(1);
+    ASSERT_EQ(by_count.size(), 1u);
+    EXPECT_STREQ(by_count[0].site.file, "small.cpp");
+    EXPECT_EQ(by_count[0].count, 10u);
+
+    auto by_bytes = allocator.top_by_bytes(5);
+    ASSERT_EQ(by_bytes.size(), 2u);
+    EXPECT_STREQ(by_bytes[0].site.file, "large.cpp");
+    EXPECT_EQ(by_bytes[0].bytes, 4096u);
+    EXPECT_EQ(allocator.dropped(), 0u);
+}
+
+TEST(SiteStatsAllocatorTest, UntaggedAllocationsAreRecordedAsUnknown) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SiteStatsAllocator allocator(&parent);
+
+    allocator.deallocate(allocator.allocate(16, 8));
+
+    auto stats = allocator.snapshot();
+    ASSERT_EQ(stats.size(), 1u);
+    EXPECT_EQ(stats[0].site.file, nullptr);
+    EXPECT_EQ(stats[0].count, 1u);
+}
+
+} // namespace
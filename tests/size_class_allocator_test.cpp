@@ -0,0 +1,373 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <w6_mem/allocator.h>
+#include <w6_mem/size_class_allocator.h>
+
+namespace {
+
+constexpr std::size_t MAX_BYTES = 16 * 1024 * 1024;
+
+TEST(SizeClassAllocatorTest, AllocateAndDeallocate) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SizeClassAllocator allocator(&parent, MAX_BYTES);
+
+    std::vector<std::pair<unsigned char*, std::size_t>> blocks;
+    for (std::size_t size = 1; size <= 1024; size += 7) {
+        auto* ptr = static_cast<unsigned char*>(allocator.allocate(size, 8));
+        ASSERT_NE(ptr, nullptr);
+        EXPECT_TRUE(allocator.owns(ptr));
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(ptr) % 8, 0u);
+        std::memset(ptr, static_cast<int>(size & 0xFF), size);
+        blocks.emplace_back(ptr, size);
+    }
+    for (const auto& [ptr, size] : blocks) {
+        for (std::size_t i = 0; i < size; ++i) {
+            ASSERT_EQ(ptr[i], static_cast<unsigned char>(size & 0xFF));
+        }
+        allocator.deallocate(ptr);
+    }
+}
+
+TEST(SizeClassAllocatorTest, AlignmentAndLargeRequests) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SizeClassAllocator allocator(&parent, MAX_BYTES);
+
+    void* aligned = allocator.allocate(40, 64);
+    ASSERT_NE(aligned, nullptr);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(aligned) % 64, 0u);
+
+    void* large = allocator.allocate(8192, 16);
+    ASSERT_NE(large, nullptr);
+    EXPECT_FALSE(allocator.owns(large));
+
+    allocator.deallocate(aligned);
+    allocator.deallocate(large);
+}
+
+TEST(SizeClassAllocatorTest, ReusesFreedSlotsAndTrims) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SizeClassAllocator allocator(&parent, MAX_BYTES);
+
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 1000; ++i) {
+        ptrs.push_back(allocator.allocate(64, 16));
+    }
+    const std::size_t resident = allocator.resident_pages();
+    EXPECT_GE(resident, 1000 * 64 / w6_mem::SizeClassAllocator::SLAB_SIZE);
+
+    for (void* ptr : ptrs) {
+        allocator.deallocate(ptr);
+    }
+    EXPECT_EQ(allocator.trim(), resident);
+    EXPECT_EQ(allocator.resident_pages(), 0u);
+
+    // 返却後も再び割り当てられる
+    void* ptr = allocator.allocate(64, 16);
+    ASSERT_NE(ptr, nullptr);
+    std::memset(ptr, 0, 64);
+    EXPECT_EQ(allocator.resident_pages(), 1u);
+    allocator.deallocate(ptr);
+}
+
+TEST(SizeClassAllocatorTest, FallsBackToParentWhenExhausted) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SizeClassAllocator allocator(&parent, w6_mem::SizeClassAllocator::SLAB_SIZE);
+
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 20; ++i) {
+        ptrs.push_back(allocator.allocate(256, 16));
+        ASSERT_NE(ptrs.back(), nullptr);
+    }
+    EXPECT_TRUE(allocator.owns(ptrs.front()));
+    EXPECT_FALSE(allocator.owns(ptrs.back()));
+    for (void* ptr : ptrs) {
+        allocator.deallocate(ptr);
+    }
+}
+
+TEST(SizeClassAllocatorTest, CompactMeshesDisjointPages) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SizeClassAllocator allocator(&parent, MAX_BYTES, true);
+    if (!allocator.is_meshable()) {
+        GTEST_SKIP() << "memfd is not available";
+    }
+
+    // 256バイトのスロットは1ページに16個。2ページ分を埋める
+    constexpr std::size_t SLOTS = w6_mem::SizeClassAllocator::SLAB_SIZE / 256;
+    std::vector<std::uint32_t*> ptrs;
+    for (std::size_t i = 0; i < SLOTS * 2; ++i) {
+        auto* ptr = static_cast<std::uint32_t*>(allocator.allocate(256, 16));
+        ASSERT_NE(ptr, nullptr);
+        *ptr = static_cast<std::uint32_t>(i);
+        ptrs.push_back(ptr);
+    }
+    EXPECT_EQ(allocator.resident_pages(), 2u);
+
+    // 1ページ目は奇数スロット、2ページ目は偶数スロットを解放して生存スロットを重ならなくする
+    std::vector<std::uint32_t*> live;
+    for (std::size_t i = 0; i < ptrs.size(); ++i) {
+        const bool first_page = i < SLOTS;
+        if ((i % 2 == 1) == first_page) {
+            allocator.deallocate(ptrs[i]);
+        } else {
+            live.push_back(ptrs[i]);
+        }
+    }
+
+    EXPECT_EQ(allocator.compact(), 1u);
+    EXPECT_EQ(allocator.resident_pages(), 1u);
+
+    // ポインタは変わらず、内容も保たれている
+    for (std::uint32_t* ptr : live) {
+        const auto index = static_cast<std::size_t>(ptr - ptrs[0]) * sizeof(std::uint32_t) / 256;
+        EXPECT_EQ(*ptr, index);
+    }
+    // 2つの仮想ページは同じ物理ページを共有している
+    ptrs[1 + SLOTS][0] = 12345;
+    EXPECT_EQ(ptrs[1][0], 12345u);
+
+    for (std::uint32_t* ptr : live) {
+        allocator.deallocate(ptr);
+    }
+    // 解放後、両ページとも再利用できる
+    std::vector<void*> again;
+    for (std::size_t i = 0; i < SLOTS * 2; ++i) {
+        auto* ptr = static_cast<std::uint32_t*>(allocator.allocate(256, 16));
+        *ptr = static_cast<std::uint32_t>(i);
+        again.push_back(ptr);
+    }
+    for (std::size_t i = 0; i < again.size(); ++i) {
+        EXPECT_EQ(*static_cast<std::uint32_t*>(again[i]), i);
+        allocator.deallocate(again[i]);
+    }
+}
+
+// 要求サイズを標本化させるため、割り当てと解放を繰り返します
+void sample_size(w6_mem::SizeClassAllocator& allocator, std::size_t size, std::size_t samples) {
+    for (std::size_t i = 0; i < samples * w6_mem::SizeClassAllocator::ADAPT_SAMPLE_PERIOD; ++i) {
+        allocator.deallocate(allocator.allocate(size, 16));
+    }
+}
+
+bool has_class(const w6_mem::SizeClassAllocator& allocator, std::size_t size) {
+    for (std::size_t i = 0; i < allocator.class_count(); ++i) {
+        if (allocator.class_size(i) == size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+TEST(SizeClassAllocatorTest, AdaptiveClassesReduceResidentPages) {
+    constexpr std::size_t SIZE = 260; // 既定の組では320バイトのクラスに入る
+    constexpr std::size_t COUNT = 15000;
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SizeClassAllocator fixed(&parent, MAX_BYTES);
+    w6_mem::SizeClassAllocator adaptive(&parent, MAX_BYTES);
+
+    adaptive.set_adaptive(true);
+    sample_size(adaptive, SIZE, 256);
+    EXPECT_TRUE(adaptive.adapt_classes());
+    EXPECT_EQ(adaptive.class_generation(), 1u);
+    EXPECT_TRUE(has_class(adaptive, 272));
+    EXPECT_EQ(adaptive.class_size(adaptive.class_count() - 1),
+              w6_mem::SizeClassAllocator::MAX_SMALL_SIZE);
+
+    std::vector<void*> fixed_ptrs;
+    std::vector<void*> adaptive_ptrs;
+    for (std::size_t i = 0; i < COUNT; ++i) {
+        fixed_ptrs.push_back(fixed.allocate(SIZE, 16));
+        adaptive_ptrs.push_back(adaptive.allocate(SIZE, 16));
+        ASSERT_TRUE(adaptive.owns(adaptive_ptrs.back()));
+        std::memset(adaptive_ptrs.back(), 0x5A, SIZE);
+    }
+    // 1ページに12個（320バイト）ではなく15個（272バイト）入る
+    EXPECT_LE(adaptive.resident_pages() * 100, fixed.resident_pages() * 85);
+
+    for (std::size_t i = 0; i < COUNT; ++i) {
+        fixed.deallocate(fixed_ptrs[i]);
+        adaptive.deallocate(adaptive_ptrs[i]);
+    }
+}
+
+TEST(SizeClassAllocatorTest, OldPagesDrainAfterAdapting) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SizeClassAllocator allocator(&parent, MAX_BYTES);
+
+    // 標本化を始める前に、既定の組（320バイト）で割り当てておく
+    std::vector<std::uint32_t*> old_ptrs;
+    for (std::uint32_t i = 0; i < 100; ++i) {
+        auto* ptr = static_cast<std::uint32_t*>(allocator.allocate(300, 16));
+        *ptr = i;
+        old_ptrs.push_back(ptr);
+    }
+    allocator.set_adaptive(true);
+    sample_size(allocator, 260, 256);
+    ASSERT_TRUE(allocator.adapt_classes());
+
+    const bool kept = has_class(allocator, 320);
+    EXPECT_EQ(allocator.draining_pages() > 0, !kept);
+
+    // 以前のスロットも読み書きでき、解放すると空になったページが戻る
+    for (std::uint32_t i = 0; i < old_ptrs.size(); ++i) {
+        EXPECT_EQ(*old_ptrs[i], i);
+    }
+    for (std::uint32_t* ptr : old_ptrs) {
+        allocator.deallocate(ptr);
+    }
+    EXPECT_EQ(allocator.draining_pages(), 0u);
+    allocator.trim();
+    EXPECT_EQ(allocator.resident_pages(), 0u);
+}
+
+TEST(SizeClassAllocatorTest, AdaptingReleasesWarmPages) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SizeClassAllocator allocator(&parent, MAX_BYTES);
+
+    // 既定の組（320バイト）でページを確保しておくが、使わないまま組が変わる
+    const w6_mem::SizeClassUsage usage[] = {{320, 100, 100}};
+    const std::size_t pages = allocator.warm_start(usage, 1);
+    EXPECT_EQ(pages, (100u + 11) / 12); // 4096 / 320 = 12
+    allocator.set_adaptive(true);
+    sample_size(allocator, 260, 256);
+    ASSERT_TRUE(allocator.adapt_classes());
+    ASSERT_FALSE(has_class(allocator, 320));
+
+    // 空のまま待たせず、その場で空きページに戻る
+    EXPECT_EQ(allocator.draining_pages(), 0u);
+    EXPECT_EQ(allocator.resident_pages(), pages);
+    EXPECT_EQ(allocator.trim(), pages);
+    EXPECT_EQ(allocator.resident_pages(), 0u);
+}
+
+TEST(SizeClassAllocatorTest, AdaptiveKeepsGoodClasses) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SizeClassAllocator allocator(&parent, MAX_BYTES);
+    EXPECT_FALSE(allocator.adapt_classes());
+
+    // 既定のクラスにちょうど収まる要求だけなら組を変えない
+    allocator.set_adaptive(true);
+    sample_size(allocator, 64, 64);
+    sample_size(allocator, 256, 64);
+    EXPECT_FALSE(allocator.adapt_classes());
+    EXPECT_EQ(allocator.class_generation(), 0u);
+}
+
+TEST(SizeClassAllocatorTest, AdaptsPeriodically) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SizeClassAllocator allocator(&parent, MAX_BYTES);
+    allocator.set_adaptive(true);
+    sample_size(allocator, 260, w6_mem::SizeClassAllocator::ADAPT_INTERVAL);
+    EXPECT_EQ(allocator.class_generation(), 1u);
+    EXPECT_TRUE(has_class(allocator, 272));
+}
+
+TEST(SizeClassAllocatorTest, TracksUsage) {
+    w6_mem::DefaultAllocator parent;
+    w6_mem::SizeClassAllocator allocator(&parent, MAX_BYTES);
+
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 300; ++i) {
+        ptrs.push_back(allocator.allocate(64, 16));
+    }
+    for (int i = 0; i < 200; ++i) {
+        allocator.deallocate(ptrs.back());
+        ptrs.pop_back();
+    }
+
+    w6_mem::SizeClassUsage usage[32];
+    const std::size_t count = allocator.usage(usage, 32);
+    ASSERT_EQ(count, allocator.class_count());
+    for (std::size_t i = 0; i < count; ++i) {
+        EXPECT_EQ(usage[i].slot_size, allocator.class_size(i));
+        if (usage[i].slot_size == 64) {
+            EXPECT_EQ(usage[i].peak_slots, 300u);
+            EXPECT_GT(usage[i].typical_slots, 0u);
+            EXPECT_LE(usage[i].typical_slots, 300u);
+        } else {
+            EXPECT_EQ(usage[i].peak_slots, 0u);
+        }
+    }
+    for (void* ptr : ptrs) {
+        allocator.deallocate(ptr);
+    }
+}
+
+TEST(SizeClassAllocatorTest, WarmStartFromProfile) {
+    const std::string path = ::testing::TempDir() + "w6_mem_size_class_profile.txt";
+    w6_mem::DefaultAllocator parent;
+    {
+        w6_mem::SizeClassAllocator allocator(&parent, MAX_BYTES);
+        std::vector<void*> ptrs;
+        for (int i = 0; i < 500; ++i) {
+            ptrs.push_back(allocator.allocate(64, 16));
+            ptrs.push_back(allocator.allocate(200, 16));
+        }
+        for (void* ptr : ptrs) {
+            allocator.deallocate(ptr);
+        }
+        ASSERT_TRUE(allocator.save_profile(path.c_str()));
+    }
+
+    w6_mem::SizeClassUsage usage[32];
+    ASSERT_EQ(w6_mem::SizeClassAllocator::load_profile(path.c_str(), usage, 32), 2u);
+    EXPECT_EQ(usage[0].slot_size, 64u);
+    EXPECT_EQ(usage[0].peak_slots, 500u);
+    EXPECT_EQ(usage[1].slot_size, 224u);
+    EXPECT_EQ(usage[1].peak_slots, 500u);
+
+    w6_mem::SizeClassAllocator allocator(&parent, MAX_BYTES);
+    const std::size_t pages = allocator.warm_start(path.c_str());
+    const std::size_t expected = (500 + 63) / 64 + (500 + 17) / 18; // 4096 / 224 = 18
+    EXPECT_EQ(pages, expected);
+    EXPECT_EQ(allocator.resident_pages(), expected);
+    // 2回目は足りているので確保しない
+    EXPECT_EQ(allocator.warm_start(path.c_str()), 0u);
+
+    // 定常状態の割り当てではページを補充しない
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 500; ++i) {
+        ptrs.push_back(allocator.allocate(64, 16));
+        ptrs.push_back(allocator.allocate(200, 16));
+    }
+    EXPECT_EQ(allocator.resident_pages(), expected);
+    for (void* ptr : ptrs) {
+        allocator.deallocate(ptr);
+    }
+    std::remove(path.c_str());
+}
+
+TEST(SizeClassAllocatorTest, WarmStartInBackground) {
+    const std::string path = ::testing::TempDir() + "w6_mem_size_class_profile_async.txt";
+    w6_mem::DefaultAllocator parent;
+    {
+        w6_mem::SizeClassAllocator allocator(&parent, MAX_BYTES);
+        std::vector<void*> ptrs;
+        for (int i = 0; i < 1000; ++i) {
+            ptrs.push_back(allocator.allocate(32, 16));
+        }
+        for (void* ptr : ptrs) {
+            allocator.deallocate(ptr);
+        }
+        ASSERT_TRUE(allocator.save_profile(path.c_str()));
+    }
+
+    w6_mem::SizeClassAllocator allocator(&parent, MAX_BYTES);
+    std::thread warm = allocator.warm_start_async(path.c_str());
+    // 確保と並行して割り当てられる
+    void* ptr = allocator.allocate(32, 16);
+    ASSERT_NE(ptr, nullptr);
+    warm.join();
+    EXPECT_GE(allocator.resident_pages(), (1000u + 127) / 128);
+    allocator.deallocate(ptr);
+    std::remove(path.c_str());
+
+    EXPECT_EQ(allocator.warm_start("/nonexistent/w6_mem_profile.txt"), 0u);
+}
+
+} // namespace
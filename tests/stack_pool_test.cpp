@@ -0,0 +1,142 @@
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <w6_mem/stack_pool.h>
+
+namespace {
+
+TEST(StackPoolTest, AcquireAndRelease) {
+    w6_mem::StackPool pool(64 * 1024, 4);
+    ASSERT_EQ(pool.capacity(), 4u);
+    EXPECT_EQ(pool.stack_size(), 64u * 1024u);
+    EXPECT_GT(pool.guard_size(), 0u);
+    EXPECT_EQ(pool.committed_count(), 0u);
+
+    w6_mem::FiberStack stack = pool.acquire();
+    ASSERT_TRUE(stack);
+    EXPECT_EQ(stack.size, pool.stack_size());
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(stack.top()) % 16, 0u);
+    EXPECT_TRUE(pool.owns(stack.base));
+    EXPECT_EQ(pool.in_use(), 1u);
+
+    // スタック全体が読み書き可能
+    std::memset(stack.base, 0xAB, stack.size);
+    EXPECT_EQ(static_cast<unsigned char*>(stack.top())[-1], 0xAB);
+
+    pool.release(stack);
+    EXPECT_EQ(pool.in_use(), 0u);
+    EXPECT_EQ(pool.hot_count(), 1u);
+}
+
+TEST(StackPoolTest, RoundsUpToPageSize) {
+    w6_mem::StackPool pool(1000, 1);
+    EXPECT_EQ(pool.stack_size() % pool.guard_size(), 0u);
+    EXPECT_GE(pool.stack_size(), 1000u);
+}
+
+TEST(StackPoolTest, Exhaustion) {
+    w6_mem::StackPool pool(16 * 1024, 3);
+    std::vector<w6_mem::FiberStack> stacks;
+    for (int i = 0; i < 3; ++i) {
+        stacks.push_back(pool.acquire());
+        ASSERT_TRUE(stacks.back());
+    }
+    EXPECT_FALSE(pool.acquire());
+
+    // スタック同士はガードページで隔てられている
+    for (std::size_t i = 1; i < stacks.size(); ++i) {
+        const auto distance = static_cast<unsigned char*>(stacks[i].base) -
+                              static_cast<unsigned char*>(stacks[i - 1].base);
+        EXPECT_GE(static_cast<std::size_t>(distance < 0 ? -distance : distance),
+                  pool.stack_size() + pool.guard_size());
+    }
+    for (auto& stack : stacks) {
+        pool.release(stack);
+    }
+    w6_mem::FiberStack again = pool.acquire();
+    EXPECT_TRUE(again);
+    pool.release(again);
+}
+
+TEST(StackPoolTest, RecyclesHotStacksFirst) {
+    w6_mem::StackPool pool(16 * 1024, 8, 2);
+    w6_mem::FiberStack a = pool.acquire();
+    w6_mem::FiberStack b = pool.acquire();
+    w6_mem::FiberStack c = pool.acquire();
+    EXPECT_EQ(pool.committed_count(), 3u);
+
+    pool.release(a);
+    pool.release(b);
+    pool.release(c);
+    // 上限を超えた最も古いスタックaがコールドになる
+    EXPECT_EQ(pool.hot_count(), 2u);
+    EXPECT_EQ(pool.cold_count(), 1u);
+
+    // 直近に返却したものから再利用する
+    EXPECT_EQ(pool.acquire().base, c.base);
+    EXPECT_EQ(pool.acquire().base, b.base);
+    w6_mem::FiberStack cold = pool.acquire();
+    EXPECT_EQ(cold.base, a.base);
+    EXPECT_EQ(pool.committed_count(), 3u);
+
+    // コールドになったスタックも読み書きできる
+    std::memset(cold.base, 0x5A, cold.size);
+    EXPECT_EQ(static_cast<unsigned char*>(cold.base)[0], 0x5A);
+
+    pool.release(a);
+    pool.release(b);
+    pool.release(c);
+}
+
+TEST(StackPoolTest, WithoutHotStacks) {
+    w6_mem::StackPool pool(16 * 1024, 2, 0);
+    pool.release(pool.acquire());
+    EXPECT_EQ(pool.hot_count(), 0u);
+    EXPECT_EQ(pool.cold_count(), 1u);
+    pool.release(pool.acquire());
+    EXPECT_EQ(pool.committed_count(), 1u);
+}
+
+TEST(StackPoolTest, LargeStacksAreReservedLazily) {
+    // 1GiB x 16 のスタックを予約しても、触れなければ物理メモリは消費しない
+    w6_mem::StackPool pool(std::size_t{1} << 30, 16);
+    ASSERT_EQ(pool.capacity(), 16u);
+    w6_mem::FiberStack stack = pool.acquire();
+    ASSERT_TRUE(stack);
+    static_cast<unsigned char*>(stack.top())[-1] = 1;
+    pool.release(stack);
+}
+
+TEST(StackPoolTest, ConcurrentAcquire) {
+    w6_mem::StackPool pool(16 * 1024, 16, 4);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&pool] {
+            for (int i = 0; i < 1000; ++i) {
+                w6_mem::FiberStack stack = pool.acquire();
+                ASSERT_TRUE(stack);
+                static_cast<unsigned char*>(stack.top())[-1] = static_cast<unsigned char>(i);
+                pool.release(stack);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(pool.in_use(), 0u);
+    EXPECT_LE(pool.committed_count(), 4u);
+}
+
+#if !defined(_WIN32)
+TEST(StackPoolDeathTest, GuardPageFaults) {
+    w6_mem::StackPool pool(16 * 1024, 1);
+    w6_mem::FiberStack stack = pool.acquire();
+    ASSERT_TRUE(stack);
+    EXPECT_DEATH(static_cast<volatile unsigned char*>(stack.base)[-1] = 1, "");
+    pool.release(stack);
+}
+#endif
+
+} // namespace
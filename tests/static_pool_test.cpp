@@ -0,0 +1,67 @@
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <vector>
+#include <w6_mem/static_pool.h>
+#include <w6_mem/unique_ptr.h>
+
+namespace {
+
+struct Node {
+    Node* next = nullptr;
+    int value = 0;
+
+    Node() = default;
+    explicit Node(int v) : value(v) {}
+};
+
+// 名前空間スコープに置いたストレージとプール
+w6_mem::StaticPoolStorage<Node, 4> g_node_storage;
+w6_mem::StaticPool<Node, 4> g_node_pool(g_node_storage);
+
+TEST(StaticPoolTest, NamespaceScopePool) {
+    EXPECT_EQ(g_node_pool.used(), 0u);
+
+    auto node = w6_mem::make_unique<Node>(&g_node_pool, 42);
+    ASSERT_TRUE(node);
+    EXPECT_EQ(node->value, 42);
+    EXPECT_TRUE(g_node_pool.owns(node.get()));
+    EXPECT_EQ(g_node_pool.used(), 1u);
+
+    node = nullptr;
+    EXPECT_EQ(g_node_pool.used(), 0u);
+}
+
+TEST(StaticPoolTest, ExhaustionAndReuse) {
+    static w6_mem::StaticPoolStorage<Node, 3> storage;
+    w6_mem::StaticPool<Node, 3> pool(storage);
+
+    std::vector<void*> ptrs;
+    for (std::size_t i = 0; i < pool.capacity(); ++i) {
+        void* ptr = pool.allocate(sizeof(Node), alignof(Node));
+        ASSERT_NE(ptr, nullptr);
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(ptr) % alignof(Node), 0u);
+        ptrs.push_back(ptr);
+    }
+    EXPECT_EQ(pool.allocate(sizeof(Node), alignof(Node)), nullptr);
+
+    // 解放したスロットが再利用されることを確認
+    pool.deallocate(ptrs[1]);
+    EXPECT_EQ(pool.allocate(sizeof(Node), alignof(Node)), ptrs[1]);
+
+    for (void* ptr : ptrs) {
+        pool.deallocate(ptr);
+    }
+    EXPECT_EQ(pool.used(), 0u);
+}
+
+TEST(StaticPoolTest, RejectsOversizedRequests) {
+    static w6_mem::StaticPoolStorage<std::uint32_t, 2> storage;
+    w6_mem::StaticPool<std::uint32_t, 2> pool(storage);
+
+    EXPECT_EQ(pool.allocate(1024, 4), nullptr);
+    EXPECT_EQ(pool.allocate(4, 1024), nullptr);
+    EXPECT_FALSE(pool.owns(&pool));
+    EXPECT_FALSE(pool.owns(storage.bytes + 1));
+}
+
+} // namespace
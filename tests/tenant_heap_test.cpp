@@ -0,0 +1,127 @@
+#include "counting_allocator.h"
+
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <w6_mem/allocator.h>
+#include <w6_mem/tenant_heap.h>
+
+namespace {
+
+using w6_mem_test::CountingAllocator;
+
+TEST(TenantHeapTest, PooledAllocation) {
+    w6_mem::DefaultAllocator upstream;
+    w6_mem::BlockPool pool(&upstream, 64 * 1024);
+    w6_mem::TenantAllocator tenant(&pool, 0);
+
+    void* a = tenant.allocate(24, 8);
+    void* b = tenant.allocate(100, 64);
+    ASSERT_NE(a, nullptr);
+    ASSERT_NE(b, nullptr);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(a) % 16, 0u);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(b) % 64, 0u);
+    std::memset(a, 0xAA, 24);
+    std::memset(b, 0xBB, 100);
+    EXPECT_EQ(tenant.committed_bytes(), 64u * 1024);
+
+    // 解放したスロットは同じサイズクラスで再利用されます
+    tenant.deallocate(a);
+    EXPECT_EQ(tenant.allocate(30, 16), a);
+    tenant.deallocate(b);
+    void* c = tenant.allocate(16, 16);
+    EXPECT_NE(c, b);
+    EXPECT_EQ(tenant.allocate(120, 64), b);
+}
+
+TEST(TenantHeapTest, LargeAllocation) {
+    w6_mem::DefaultAllocator upstream;
+    w6_mem::BlockPool pool(&upstream, 64 * 1024);
+    w6_mem::TenantAllocator tenant(&pool, 0);
+
+    void* large = tenant.allocate(100000, 256);
+    ASSERT_NE(large, nullptr);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(large) % 256, 0u);
+    std::memset(large, 0xCC, 100000);
+    EXPECT_GT(tenant.committed_bytes(), 100000u);
+    EXPECT_EQ(pool.borrowed_blocks(), 0u);
+
+    tenant.deallocate(large);
+    EXPECT_EQ(tenant.committed_bytes(), 0u);
+    EXPECT_EQ(tenant.live_bytes(), 0u);
+}
+
+TEST(TenantHeapTest, EnforcesQuota) {
+    w6_mem::DefaultAllocator upstream;
+    w6_mem::BlockPool pool(&upstream, 4096);
+    w6_mem::TenantAllocator tenant(&pool, 3 * 4096);
+
+    // 大きな割り当てとブロックの合計が割り当て量を超えないようにします
+    void* large = tenant.allocate(6000, 16);
+    ASSERT_NE(large, nullptr);
+    EXPECT_EQ(tenant.allocate(8000, 16), nullptr);
+    int count = 0;
+    while (tenant.allocate(1000, 8)) {
+        ++count;
+    }
+    EXPECT_GT(count, 0);
+    EXPECT_LE(tenant.committed_bytes(), 3u * 4096);
+    EXPECT_EQ(tenant.failed_count(), 2u);
+
+    tenant.deallocate(large);
+    EXPECT_NE(tenant.allocate(1000, 8), nullptr);
+}
+
+TEST(TenantHeapTest, DestroyReleasesEverythingInBulk) {
+    CountingAllocator pages;
+    w6_mem::TenantHeap heap(&pages, 4, 16 * 1024);
+    const auto a = heap.create_tenant(0);
+    const auto b = heap.create_tenant(1024 * 1024);
+    ASSERT_NE(a, w6_mem::TenantHeap::INVALID_TENANT);
+    ASSERT_NE(b, w6_mem::TenantHeap::INVALID_TENANT);
+    EXPECT_NE(a, b);
+    EXPECT_EQ(heap.tenant_count(), 2u);
+
+    w6_mem::TenantAllocator* tenant = heap.tenant(a);
+    ASSERT_NE(tenant, nullptr);
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_NE(tenant->allocate(static_cast<std::size_t>(16 + i % 200), 8), nullptr);
+    }
+    ASSERT_NE(tenant->allocate(50000, 16), nullptr);
+    ASSERT_NE(heap.tenant(b)->allocate(64, 8), nullptr);
+    const std::size_t blocks = heap.pool().borrowed_blocks();
+    EXPECT_GT(blocks, 2u);
+
+    // 解放されていないオブジェクトがあっても、ブロックごとにまとめて返却されます
+    const int deallocations = pages.m_deallocations;
+    EXPECT_TRUE(heap.destroy_tenant(a));
+    EXPECT_FALSE(heap.destroy_tenant(a));
+    EXPECT_EQ(heap.tenant(a), nullptr);
+    EXPECT_EQ(heap.tenant_count(), 1u);
+    EXPECT_EQ(heap.pool().borrowed_blocks(), 1u);
+    EXPECT_EQ(heap.pool().cached_blocks(), blocks - 1);
+    // 上流に返却したのは、大きな割り当てとテナント自身だけです
+    EXPECT_EQ(pages.m_deallocations - deallocations, 2);
+
+    // 返却されたブロックは他のテナントが再利用します
+    const int allocations = pages.m_allocations;
+    const auto c = heap.create_tenant(0);
+    ASSERT_NE(c, w6_mem::TenantHeap::INVALID_TENANT);
+    ASSERT_NE(heap.tenant(c)->allocate(64, 8), nullptr);
+    EXPECT_EQ(pages.m_allocations - allocations, 1);
+
+    EXPECT_EQ(heap.trim(), blocks - 2);
+}
+
+TEST(TenantHeapTest, TenantLimit) {
+    w6_mem::DefaultAllocator pages;
+    w6_mem::TenantHeap heap(&pages, 2);
+    EXPECT_NE(heap.create_tenant(0), w6_mem::TenantHeap::INVALID_TENANT);
+    const auto id = heap.create_tenant(0);
+    EXPECT_NE(id, w6_mem::TenantHeap::INVALID_TENANT);
+    EXPECT_EQ(heap.create_tenant(0), w6_mem::TenantHeap::INVALID_TENANT);
+    EXPECT_TRUE(heap.destroy_tenant(id));
+    EXPECT_EQ(heap.create_tenant(0), id);
+}
+
+} // namespace